@@ -0,0 +1,174 @@
+// Cost of the address allow and deny list (addr_filter.h).
+//
+// Builds lists of 1k, 10k and 50k entries (one in 16 an OUI prefix) and times the
+// check of every advertisement report against them: unlisted addresses, which the
+// Bloom filter answers on its own most of the time, and listed ones, which always
+// take the binary search as well. Half of the reports carry public addresses, whose
+// prefix is looked up too. The sorted array searched without the Bloom filter is the
+// baseline. Also reported: the Bloom filter false positive rate, memory per entry and
+// a save and load round trip through the filter region of the stub backend.
+
+#include "addr_filter.h"
+#include "hal_stub.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ENTRIES 50000
+#define REPORTS 8192
+#define MIN_RUN_NS 200000000ull
+
+static const int list_sizes[] = { 1000, 10000, 50000 };
+
+static uint64_t keys[MAX_ENTRIES];
+static uint64_t list[MAX_ENTRIES];
+static uint64_t bloom[ADDR_FILTER_BLOOM_WORDS(MAX_ENTRIES)];
+static uint8_t listed[REPORTS][6];
+static uint8_t unlisted[REPORTS][6];
+
+static volatile int sink;
+
+static uint64_t random_address(void) {
+    return ((uint64_t) rand() << 24 ^ (uint64_t) rand()) & 0xffffffffffffULL;
+}
+
+static void key_to_bda(uint64_t key, uint8_t *bda) {
+    for (int i = 5; i >= 0; i--) {
+        bda[i] = key;
+        key >>= 8;
+    }
+}
+
+static int compare_keys(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+// Nanoseconds per report through the filter, counting reports accepted by an allow list
+static double time_filter(struct AddrFilter *filter, uint8_t (*reports)[6], int *accepted) {
+    uint64_t elapsed = 0;
+    uint64_t checks = 0;
+
+    *accepted = 0;
+    while (elapsed < MIN_RUN_NS) {
+        uint64_t start = histogram_now_ns();
+        int passed = 0;
+
+        for (int i = 0; i < REPORTS; i++) {
+            passed += addr_filter_accepts(filter, reports[i], i & 1);
+        }
+        elapsed += histogram_now_ns() - start;
+        checks += REPORTS;
+        *accepted = passed;
+    }
+
+    return (double) elapsed / checks;
+}
+
+// Same lookups by binary search alone
+static double time_search(const struct AddrFilter *filter, uint8_t (*reports)[6]) {
+    uint64_t elapsed = 0;
+    uint64_t checks = 0;
+
+    while (elapsed < MIN_RUN_NS) {
+        uint64_t start = histogram_now_ns();
+
+        for (int i = 0; i < REPORTS; i++) {
+            uint64_t key = addr_filter_address_key(reports[i]);
+            bool found = bsearch(&key, filter->keys, filter->count, sizeof(uint64_t), compare_keys) != NULL;
+
+            if (!found && (i & 1) == 0) {
+                key = ADDR_FILTER_PREFIX_FLAG | (key & 0xffffff000000ULL);
+                found = bsearch(&key, filter->keys, filter->count, sizeof(uint64_t), compare_keys) != NULL;
+            }
+            sink += found;
+        }
+        elapsed += histogram_now_ns() - start;
+        checks += REPORTS;
+    }
+
+    return (double) elapsed / checks;
+}
+
+int main(int argc, char **argv) {
+    struct AddrFilter filter;
+    int errors = 0;
+
+    printf("%-8s %10s %10s %10s %10s %9s %9s\n", "entries", "unlisted", "search", "listed", "search", "false pos",
+           "bytes/ent");
+
+    for (size_t s = 0; s < sizeof(list_sizes) / sizeof(list_sizes[0]); s++) {
+        int count = list_sizes[s];
+        int accepted;
+
+        srand(count);
+        for (int i = 0; i < count; i++) {
+            list[i] = i % 16 == 15 ? ADDR_FILTER_PREFIX_FLAG | (random_address() & 0xffffff000000ULL) : random_address();
+        }
+
+        addr_filter_init(&filter, keys, count, bloom);
+        if (!addr_filter_set(&filter, list, count)) {
+            errors++;
+            continue;
+        }
+        filter.mode = ADDR_FILTER_ALLOW;
+
+        for (int i = 0; i < REPORTS; i++) {
+            uint64_t key = list[rand() % count];
+
+            // Listed prefixes only match public addresses (even reports), any device of the vendor
+            while ((i & 1) && (key & ADDR_FILTER_PREFIX_FLAG)) {
+                key = list[rand() % count];
+            }
+            if (key & ADDR_FILTER_PREFIX_FLAG) {
+                key = (key & 0xffffff000000ULL) | (rand() & 0xffffff);
+            }
+            key_to_bda(key, listed[i]);
+            key_to_bda(random_address(), unlisted[i]);
+        }
+
+        memset(&filter.counters, 0, sizeof(filter.counters));
+        double unlisted_ns = time_filter(&filter, unlisted, &accepted);
+        double false_positive = filter.counters.checked > 0
+                ? 100.0 * filter.counters.false_positives / filter.counters.checked : 0;
+
+        // A few random addresses fall under a listed prefix
+        if (accepted > REPORTS / 100) {
+            errors++;
+        }
+
+        double unlisted_search_ns = time_search(&filter, unlisted);
+        double listed_ns = time_filter(&filter, listed, &accepted);
+        double listed_search_ns = time_search(&filter, listed);
+
+        if (accepted != REPORTS) {
+            errors++;
+        }
+
+        printf("%-8d %10.1f %10.1f %10.1f %10.1f %8.2f%% %9.1f\n", filter.count, unlisted_ns, unlisted_search_ns,
+               listed_ns, listed_search_ns, false_positive, (double) addr_filter_memory(&filter) / filter.count);
+
+        // Round trip through flash
+        int kept = filter.count;
+
+        hal_stub_set_filter_size(ADDR_FILTER_HEADER_SIZE + kept * sizeof(uint64_t));
+        filter.mode = ADDR_FILTER_DENY;
+        if (!addr_filter_save(&filter)) {
+            errors++;
+        }
+        addr_filter_clear(&filter);
+        if (!addr_filter_load(&filter) || filter.count != kept || filter.mode != ADDR_FILTER_DENY
+                || addr_filter_accepts(&filter, listed[0], 0)) {
+            errors++;
+        }
+    }
+
+    printf("\nColumns in ns per report, search is the sorted array without the Bloom filter\n");
+    printf("Errors: %d\n", errors);
+
+    return errors > 0;
+}
@@ -0,0 +1,181 @@
+// Throughput of the beacon and manufacturer data decoders (adv_decoder.h).
+//
+// A sample advertisement of every recognised kind plus two that are not (a
+// plain named device and unknown manufacturer data) is decoded over and over,
+// alone on a parsed report and together with the parse the scanner core does
+// anyway. Every sample is first checked for its expected kind, then formatted
+// for the text uplink and sent through the binary encoder and decoder.
+//
+// Connections avoided on a recorded trace are printed by the replay tool.
+
+#include "adv_parser.h"
+#include "adv_decoder.h"
+#include "device_table.h"
+#include "wire_encoder.h"
+#include "wire_decoder.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ITERATIONS 2000000
+#define MAX_SAMPLES 16
+
+struct Sample {
+    const char *label;
+    uint8_t kind;
+    uint8_t data[31];
+    int len;
+};
+
+static struct Sample samples[MAX_SAMPLES];
+static int samples_count = 0;
+static struct AdvReport reports[MAX_SAMPLES];
+
+static volatile uint32_t sink;
+
+// Sample with flags followed by one AD structure
+static void add_sample(const char *label, uint8_t kind, uint8_t type, const uint8_t *value, int len) {
+    struct Sample *sample = &samples[samples_count++];
+    uint8_t *p = sample->data;
+
+    sample->label = label;
+    sample->kind = kind;
+
+    *p++ = 2;
+    *p++ = AD_TYPE_FLAGS;
+    *p++ = 0x06;
+    *p++ = len + 1;
+    *p++ = type;
+    memcpy(p, value, len);
+    sample->len = 5 + len;
+}
+
+static void build_samples(void) {
+    static const uint8_t ibeacon[] = {
+        0x4c, 0x00, 0x02, 0x15, 0xfd, 0xa5, 0x06, 0x93, 0xa4, 0xe2, 0x4f, 0xb1, 0xaf, 0xcf,
+        0xc6, 0xeb, 0x07, 0x64, 0x78, 0x25, 0x27, 0x11, 0x00, 0x07, 0xc5,
+    };
+    static const uint8_t altbeacon[] = {
+        0x18, 0x01, 0xbe, 0xac, 0x2f, 0x23, 0x44, 0x54, 0xcf, 0x6d, 0x4a, 0x0f, 0xad, 0xf2,
+        0xf4, 0x91, 0x1b, 0xa9, 0xff, 0xa6, 0x00, 0x01, 0x00, 0x02, 0xc5, 0x00,
+    };
+    static const uint8_t eddystone_uid[] = {
+        0xaa, 0xfe, 0x00, 0xe7, 0xed, 0xd5, 0x76, 0xc1, 0x7c, 0x2d, 0x7c, 0xe7, 0x0a, 0x5c,
+        0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x00, 0x00,
+    };
+    static const uint8_t eddystone_url[] = { 0xaa, 0xfe, 0x10, 0xeb, 0x03, 'e', 'x', 'a', 'm', 'p', 'l', 'e', 0x00 };
+    static const uint8_t eddystone_tlm[] = {
+        0xaa, 0xfe, 0x20, 0x00, 0x0b, 0xb8, 0x15, 0x80, 0x00, 0x00, 0x12, 0x34, 0x00, 0x01, 0x86, 0xa0,
+    };
+    static const uint8_t eddystone_eid[] = { 0xaa, 0xfe, 0x30, 0xe7, 0x8a, 0x2f, 0x11, 0x5e, 0x73, 0x01, 0x9b, 0x44 };
+    static const uint8_t apple_nearby[] = { 0x4c, 0x00, 0x10, 0x05, 0x0b, 0x1c, 0x5a, 0x3e, 0x21 };
+    static const uint8_t microsoft_cdp[] = {
+        0x06, 0x00, 0x01, 0x09, 0x20, 0x02, 0x8b, 0x3e, 0x5a, 0x11, 0x62, 0x44, 0x1a, 0x70, 0xbe, 0x0c,
+        0xf4, 0x2a, 0x6d, 0x48, 0x10, 0x3f, 0x01, 0x00, 0x00,
+    };
+    static const uint8_t fast_pair[] = { 0x2c, 0xfe, 0x00, 0x00, 0x47 };
+    static const uint8_t exposure[] = {
+        0x6f, 0xfd, 0x1a, 0x44, 0x9c, 0x07, 0x33, 0xe1, 0x5b, 0x0a, 0x6f, 0x30, 0x12, 0xe8, 0x9d, 0x4c,
+        0x02, 0x71, 0x40, 0x00, 0x8c, 0x11,
+    };
+    static const uint8_t name[] = { 's', 'e', 'n', 's', 'o', 'r', '-', '4', '2' };
+    static const uint8_t vendor[] = { 0x59, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06 };
+
+    add_sample("iBeacon", ADV_KIND_IBEACON, AD_TYPE_MANUFACTURER, ibeacon, sizeof(ibeacon));
+    add_sample("AltBeacon", ADV_KIND_ALTBEACON, AD_TYPE_MANUFACTURER, altbeacon, sizeof(altbeacon));
+    add_sample("Eddystone UID", ADV_KIND_EDDYSTONE_UID, AD_TYPE_SERVICE_DATA16, eddystone_uid, sizeof(eddystone_uid));
+    add_sample("Eddystone URL", ADV_KIND_EDDYSTONE_URL, AD_TYPE_SERVICE_DATA16, eddystone_url, sizeof(eddystone_url));
+    add_sample("Eddystone TLM", ADV_KIND_EDDYSTONE_TLM, AD_TYPE_SERVICE_DATA16, eddystone_tlm, sizeof(eddystone_tlm));
+    add_sample("Eddystone EID", ADV_KIND_EDDYSTONE_EID, AD_TYPE_SERVICE_DATA16, eddystone_eid, sizeof(eddystone_eid));
+    add_sample("Apple nearby", ADV_KIND_APPLE, AD_TYPE_MANUFACTURER, apple_nearby, sizeof(apple_nearby));
+    add_sample("Microsoft CDP", ADV_KIND_MICROSOFT, AD_TYPE_MANUFACTURER, microsoft_cdp, sizeof(microsoft_cdp));
+    add_sample("Fast Pair", ADV_KIND_FAST_PAIR, AD_TYPE_SERVICE_DATA16, fast_pair, sizeof(fast_pair));
+    add_sample("Exposure", ADV_KIND_EXPOSURE, AD_TYPE_SERVICE_DATA16, exposure, sizeof(exposure));
+    add_sample("Name only", ADV_KIND_NONE, AD_TYPE_NAME_COMPLETE, name, sizeof(name));
+    add_sample("Unknown vendor", ADV_KIND_NONE, AD_TYPE_MANUFACTURER, vendor, sizeof(vendor));
+}
+
+// Beacon of a device survives the binary encoder and decoder
+static void check_wire(const struct WireDevice *decoded, void *arg) {
+    const struct Device *device = arg;
+
+    if (decoded->beacon_kind != device->beacon_kind || decoded->beacon_subtype != device->beacon_subtype
+            || decoded->beacon_len != device->beacon_len || memcmp(decoded->beacon, device->beacon, device->beacon_len) != 0) {
+        printf("  binary round trip of kind %d FAILED\n", device->beacon_kind);
+    }
+}
+
+int main(int argc, char **argv) {
+    static struct Device device;
+    uint8_t batch[256];
+    char text[ADV_DECODED_STRING_MAX];
+    int errors = 0;
+
+    build_samples();
+
+    printf("%-15s %-14s %s\n", "sample", "kind", "text report");
+    for (int i = 0; i < samples_count; i++) {
+        struct AdvDecoded decoded;
+        struct WireEncoder encoder;
+
+        adv_parse(samples[i].data, samples[i].len, NULL, 0, &reports[i]);
+        adv_decode(&reports[i], &decoded);
+
+        if (decoded.kind != samples[i].kind) {
+            errors++;
+        }
+
+        adv_decoded_format(decoded.kind, decoded.subtype, decoded.frame.data, decoded.frame.len, text, sizeof(text));
+        printf("%-15s %-14s %s\n", samples[i].label, adv_kind_name(decoded.kind), decoded.kind != ADV_KIND_NONE ? text : "-");
+
+        memset(&device, 0, sizeof(device));
+        device.beacon_kind = decoded.kind;
+        device.beacon_subtype = decoded.subtype;
+        device.beacon_len = decoded.frame.len < ADV_DECODED_MAX ? decoded.frame.len : ADV_DECODED_MAX;
+        memcpy(device.beacon, decoded.frame.data, device.beacon_len);
+        strcpy(device.name, "-");
+
+        wire_encoder_init(&encoder, batch, sizeof(batch));
+        wire_encoder_add_device(&encoder, &device, NULL, 0, false, false);
+        if (wire_decode(batch, encoder.length, check_wire, &device) != 1) {
+            errors++;
+        }
+    }
+
+    struct AdvDecoded decoded;
+    struct AdvReport report;
+    uint64_t start;
+
+    start = histogram_now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        adv_decode(&reports[n % samples_count], &decoded);
+        sink += decoded.kind;
+    }
+    double decode_ns = (double) (histogram_now_ns() - start) / ITERATIONS;
+
+    start = histogram_now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        const struct Sample *sample = &samples[n % samples_count];
+
+        adv_parse(sample->data, sample->len, NULL, 0, &report);
+        adv_decode(&report, &decoded);
+        sink += decoded.kind;
+    }
+    double parse_decode_ns = (double) (histogram_now_ns() - start) / ITERATIONS;
+
+    start = histogram_now_ns();
+    for (int n = 0; n < ITERATIONS; n++) {
+        adv_decode(&reports[n % samples_count], &decoded);
+        sink += adv_decoded_format(decoded.kind, decoded.subtype, decoded.frame.data, decoded.frame.len, text, sizeof(text));
+    }
+    double format_ns = (double) (histogram_now_ns() - start) / ITERATIONS - decode_ns;
+
+    printf("\nDecode:         %6.1f ns, %.1f M decodes/s\n", decode_ns, 1000.0 / decode_ns);
+    printf("Parse + decode: %6.1f ns, %.1f M advertisements/s\n", parse_decode_ns, 1000.0 / parse_decode_ns);
+    printf("Text format:    %6.1f ns\n", format_ns);
+    printf("Errors: %d\n", errors);
+
+    return errors > 0;
+}
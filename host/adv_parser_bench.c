@@ -0,0 +1,164 @@
+// Parse rate of the advertisement parser (adv_parser.h) in reports per second.
+//
+// Every sample is an advertisement and scan response as the scanner core receives
+// them, parsed over and over: the usual legacy shapes, an extended advertisement of 244
+// bytes with many structures, and two malformed ones the parser has to stop in. The
+// last row cycles through all samples, which keeps the branch predictor from learning
+// a single layout.
+
+#include "adv_parser.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MIN_RUN_NS 200000000ull
+#define BATCH 1000
+#define MAX_SAMPLES 8
+
+struct Sample {
+    const char *label;
+    uint8_t adv[254];
+    int adv_len;
+    uint8_t scan_rsp[31];
+    int scan_rsp_len;
+    int structures;
+    bool malformed;
+};
+
+static struct Sample samples[MAX_SAMPLES];
+static int samples_count = 0;
+
+static volatile int sink;
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+static int add_structure(uint8_t *payload, int len, uint8_t type, const void *value, int value_len) {
+    payload[len] = value_len + 1;
+    payload[len + 1] = type;
+    memcpy(payload + len + 2, value, value_len);
+    return len + 2 + value_len;
+}
+
+static void build_samples(void) {
+    static const uint8_t flags[] = { 0x06 };
+    static const uint8_t tx_power[] = { 0xf4 };
+    static const uint8_t uuid16[] = { 0x0f, 0x18, 0x0a, 0x18, 0x1a, 0x18 };
+    static const uint8_t uuid128[] = {
+        0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x01, 0x00, 0x40, 0x6e,
+    };
+    static const uint8_t ibeacon[] = {
+        0x4c, 0x00, 0x02, 0x15, 0xfd, 0xa5, 0x06, 0x93, 0xa4, 0xe2, 0x4f, 0xb1, 0xaf, 0xcf,
+        0xc6, 0xeb, 0x07, 0x64, 0x78, 0x25, 0x27, 0x11, 0x00, 0x07, 0xc5,
+    };
+    static const uint8_t service_data[] = { 0x1a, 0x18, 0x3c, 0x0a, 0x64, 0x00, 0x12, 0x34, 0x56 };
+    static const uint8_t appearance[] = { 0xc1, 0x03 };
+    struct Sample *s;
+
+    s = &samples[samples_count++];
+    s->label = "name only";
+    s->adv_len = add_structure(s->adv, 0, AD_TYPE_FLAGS, flags, 1);
+    s->adv_len = add_structure(s->adv, s->adv_len, AD_TYPE_NAME_COMPLETE, "thermometer-kitchen-2", 21);
+
+    s = &samples[samples_count++];
+    s->label = "iBeacon";
+    s->adv_len = add_structure(s->adv, 0, AD_TYPE_FLAGS, flags, 1);
+    s->adv_len = add_structure(s->adv, s->adv_len, AD_TYPE_MANUFACTURER, ibeacon, sizeof(ibeacon));
+
+    s = &samples[samples_count++];
+    s->label = "adv + scan rsp";
+    s->adv_len = add_structure(s->adv, 0, AD_TYPE_FLAGS, flags, 1);
+    s->adv_len = add_structure(s->adv, s->adv_len, AD_TYPE_UUID16_COMPLETE, uuid16, sizeof(uuid16));
+    s->adv_len = add_structure(s->adv, s->adv_len, AD_TYPE_APPEARANCE, appearance, sizeof(appearance));
+    s->adv_len = add_structure(s->adv, s->adv_len, AD_TYPE_SERVICE_DATA16, service_data, sizeof(service_data));
+    s->scan_rsp_len = add_structure(s->scan_rsp, 0, AD_TYPE_NAME_COMPLETE, "sensor-42", 9);
+    s->scan_rsp_len = add_structure(s->scan_rsp, s->scan_rsp_len, AD_TYPE_TX_POWER, tx_power, 1);
+    s->scan_rsp_len = add_structure(s->scan_rsp, s->scan_rsp_len, AD_TYPE_UUID128_COMPLETE, uuid128, sizeof(uuid128));
+
+    s = &samples[samples_count++];
+    s->label = "extended";
+    s->adv_len = add_structure(s->adv, 0, AD_TYPE_FLAGS, flags, 1);
+    s->adv_len = add_structure(s->adv, s->adv_len, AD_TYPE_UUID128_COMPLETE, uuid128, sizeof(uuid128));
+    while (s->adv_len + 2 + (int) sizeof(service_data) <= (int) sizeof(s->adv) - 3) {
+        s->adv_len = add_structure(s->adv, s->adv_len, AD_TYPE_SERVICE_DATA16, service_data, sizeof(service_data));
+    }
+    s->adv_len = add_structure(s->adv, s->adv_len, AD_TYPE_TX_POWER, tx_power, 1);
+
+    // Last length runs 10 bytes past the advertisement
+    s = &samples[samples_count++];
+    s->label = "oversized length";
+    s->adv_len = add_structure(s->adv, 0, AD_TYPE_FLAGS, flags, 1);
+    s->adv_len = add_structure(s->adv, s->adv_len, AD_TYPE_MANUFACTURER, ibeacon, sizeof(ibeacon));
+    s->adv[3] += 10;
+
+    // Cut in the middle of the name
+    s = &samples[samples_count++];
+    s->label = "truncated";
+    s->adv_len = add_structure(s->adv, 0, AD_TYPE_FLAGS, flags, 1);
+    s->adv_len = add_structure(s->adv, s->adv_len, AD_TYPE_UUID16_COMPLETE, uuid16, sizeof(uuid16));
+    s->adv_len = add_structure(s->adv, s->adv_len, AD_TYPE_NAME_COMPLETE, "thermometer", 11) - 4;
+
+    for (int i = 0; i < samples_count; i++) {
+        struct AdvReport report;
+
+        s = &samples[i];
+        s->structures = adv_parse(s->adv, s->adv_len, s->scan_rsp_len > 0 ? s->scan_rsp : NULL, s->scan_rsp_len,
+                                  &report);
+        s->malformed = report.malformed;
+    }
+}
+
+// Nanoseconds per report, samples first to last in turn
+static double time_parse(int first, int last) {
+    struct AdvReport report;
+    uint64_t elapsed = 0;
+    uint64_t reports = 0;
+    int n = first;
+
+    while (elapsed < MIN_RUN_NS) {
+        uint64_t start = histogram_now_ns();
+        int structures = 0;
+
+        for (int i = 0; i < BATCH; i++) {
+            const struct Sample *s = &samples[n];
+
+            structures += adv_parse(s->adv, s->adv_len, s->scan_rsp_len > 0 ? s->scan_rsp : NULL, s->scan_rsp_len,
+                                    &report);
+            n = n == last ? first : n + 1;
+        }
+
+        elapsed += histogram_now_ns() - start;
+        reports += BATCH;
+        sink = structures;
+    }
+
+    return (double) elapsed / reports;
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+int main(void) {
+    int total_bytes = 0;
+    int total_structures = 0;
+
+    build_samples();
+
+    printf("%-18s %6s %11s %10s %10s %14s\n", "sample", "bytes", "structures", "malformed", "ns/report",
+           "M reports/s");
+
+    for (int i = 0; i < samples_count; i++) {
+        const struct Sample *s = &samples[i];
+        double ns = time_parse(i, i);
+
+        total_bytes += s->adv_len + s->scan_rsp_len;
+        total_structures += s->structures;
+        printf("%-18s %6d %11d %10s %10.1f %14.1f\n", s->label, s->adv_len + s->scan_rsp_len, s->structures,
+               s->malformed ? "yes" : "no", ns, 1e3 / ns);
+    }
+
+    double ns = time_parse(0, samples_count - 1);
+
+    printf("%-18s %6.0f %11.1f %10s %10.1f %14.1f\n", "all in turn", (double) total_bytes / samples_count,
+           (double) total_structures / samples_count, "", ns, 1e3 / ns);
+    return 0;
+}
@@ -0,0 +1,282 @@
+// Fuzz harness of the advertisement parser (adv_parser.h) and the decoders fed by it
+// (adv_decoder.h), built with AddressSanitizer and UndefinedBehaviorSanitizer.
+//
+// Inputs are random advertisement and scan response payloads of up to 255 bytes (legacy
+// payloads are 31 bytes, extended ones longer), a quarter of them random bytes and the rest
+// well formed AD structures of every type the parser handles, which are then broken: cut
+// short in the middle of a structure, given a length running past the payload, or bit
+// flipped. Every payload is copied to a heap block of its exact size so a read past it is
+// caught. Checked for every input:
+//   - the structure count and malformed flag match a reference walk of the payloads
+//   - every field points inside the payload it came from
+//   - the decoded frame points inside a payload, and formatting it (cut to ADV_DECODED_MAX
+//     like the device table does) stays inside the frame and the output buffer
+//
+// Usage: adv_parser_fuzz [seed] [iterations], exits nonzero on the first failed input
+// after printing it.
+
+#include "adv_parser.h"
+#include "adv_decoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PAYLOAD 255
+
+static const uint8_t ad_types[] = {
+    AD_TYPE_FLAGS, AD_TYPE_UUID16_INCOMPLETE, AD_TYPE_UUID16_COMPLETE, AD_TYPE_UUID32_INCOMPLETE,
+    AD_TYPE_UUID32_COMPLETE, AD_TYPE_UUID128_INCOMPLETE, AD_TYPE_UUID128_COMPLETE, AD_TYPE_NAME_SHORT,
+    AD_TYPE_NAME_COMPLETE, AD_TYPE_TX_POWER, AD_TYPE_SERVICE_DATA16, AD_TYPE_APPEARANCE,
+    AD_TYPE_SERVICE_DATA32, AD_TYPE_SERVICE_DATA128, AD_TYPE_MANUFACTURER,
+};
+#define AD_TYPES (int) (sizeof(ad_types) / sizeof(ad_types[0]))
+
+// Company identifiers and service UUIDs the decoders look for, little endian
+static const uint8_t known_ids[][2] = {
+    { 0x4c, 0x00 }, { 0x06, 0x00 }, { 0x18, 0x01 }, { 0xaa, 0xfe }, { 0x2c, 0xfe }, { 0x6f, 0xfd },
+};
+#define KNOWN_IDS (int) (sizeof(known_ids) / sizeof(known_ids[0]))
+
+static uint64_t state;
+
+struct Payload {
+    uint8_t data[MAX_PAYLOAD];
+    int len;
+};
+
+struct Walk {
+    int structures;
+    bool malformed;
+};
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+static uint32_t next_random(void) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (uint32_t) (state >> 11);
+}
+
+static int random_below(int n) {
+    return (int) (next_random() % (uint32_t) n);
+}
+
+// Well formed structures up to the size, then broken one way or another
+static void generate(struct Payload *payload, int size) {
+    payload->len = 0;
+
+    if (random_below(4) == 0) {
+        payload->len = random_below(size + 1);
+        for (int i = 0; i < payload->len; i++) {
+            payload->data[i] = next_random();
+        }
+        return;
+    }
+
+    int last_start = -1;
+
+    while (payload->len + 2 <= size && random_below(8) != 0) {
+        uint8_t *p = payload->data + payload->len;
+        int room = size - payload->len - 2;
+        int value_len = random_below(4) == 0 ? random_below(room + 1) : random_below((room < 27 ? room : 27) + 1);
+
+        p[0] = value_len + 1;
+        p[1] = random_below(8) == 0 ? next_random() : ad_types[random_below(AD_TYPES)];
+        for (int i = 0; i < value_len; i++) {
+            p[2 + i] = next_random();
+        }
+
+        // Company or service UUID of a decoder, followed by its usual frame type
+        if (value_len >= 2 && (p[1] == AD_TYPE_MANUFACTURER || p[1] == AD_TYPE_SERVICE_DATA16) && random_below(2)) {
+            memcpy(p + 2, known_ids[random_below(KNOWN_IDS)], 2);
+            if (value_len >= 3) {
+                p[4] = random_below(2) ? 0x02 : random_below(0x40);
+            }
+        }
+
+        last_start = payload->len;
+        payload->len += 2 + value_len;
+    }
+
+    switch (random_below(5)) {
+    case 0:
+        // Cut short, possibly in the middle of a structure
+        payload->len = random_below(payload->len + 1);
+        break;
+    case 1:
+        // Length of the last structure runs past the payload
+        if (last_start >= 0) {
+            int over = payload->len - last_start + random_below(8);
+
+            payload->data[last_start] = over > 255 ? 255 : over;
+        }
+        break;
+    case 2:
+        // Length byte of any structure anywhere up to 255
+        if (last_start >= 0) {
+            payload->data[random_below(last_start + 1)] = next_random();
+        }
+        break;
+    case 3:
+        for (int flips = 1 + random_below(4); flips > 0 && payload->len > 0; flips--) {
+            payload->data[random_below(payload->len)] ^= 1 << random_below(8);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// What the parser has to find, walked the simple way
+static void reference_walk(const uint8_t *data, int len, struct Walk *walk) {
+    int offset = 0;
+
+    while (offset < len && data[offset] != 0) {
+        if (offset + data[offset] >= len) {
+            walk->malformed = true;
+            return;
+        }
+        walk->structures++;
+        offset += data[offset] + 1;
+    }
+}
+
+static bool field_inside(const struct AdvField *field, const uint8_t *adv, int adv_len, const uint8_t *scan_rsp,
+                         int scan_rsp_len) {
+    if (field->data == NULL) {
+        return field->len == 0;
+    }
+    if (adv != NULL && field->data >= adv && field->data + field->len <= adv + adv_len) {
+        return true;
+    }
+    return scan_rsp != NULL && field->data >= scan_rsp && field->data + field->len <= scan_rsp + scan_rsp_len;
+}
+
+static const char *check_report(const struct AdvReport *report, int structures, const uint8_t *adv, int adv_len,
+                                const uint8_t *scan_rsp, int scan_rsp_len) {
+    struct Walk walk = { 0 };
+
+    reference_walk(adv, adv_len, &walk);
+    reference_walk(scan_rsp, scan_rsp_len, &walk);
+
+    if (structures != walk.structures) {
+        return "structure count";
+    }
+    if (report->malformed != walk.malformed) {
+        return "malformed flag";
+    }
+    if (report->service_data_count < 0 || report->service_data_count > ADV_MAX_SERVICE_DATA
+            || report->manufacturer_data_count < 0 || report->manufacturer_data_count > ADV_MAX_MANUFACTURER_DATA) {
+        return "field count";
+    }
+
+    const struct AdvField *fields[] = {
+        &report->flags, &report->name, &report->appearance, &report->uuid16, &report->uuid32, &report->uuid128,
+    };
+
+    for (int i = 0; i < (int) (sizeof(fields) / sizeof(fields[0])); i++) {
+        if (!field_inside(fields[i], adv, adv_len, scan_rsp, scan_rsp_len)) {
+            return "field outside the payload";
+        }
+    }
+    for (int i = 0; i < report->service_data_count; i++) {
+        if (!field_inside(&report->service_data[i], adv, adv_len, scan_rsp, scan_rsp_len)) {
+            return "service data outside the payload";
+        }
+    }
+    for (int i = 0; i < report->manufacturer_data_count; i++) {
+        if (!field_inside(&report->manufacturer_data[i], adv, adv_len, scan_rsp, scan_rsp_len)) {
+            return "manufacturer data outside the payload";
+        }
+    }
+
+    return NULL;
+}
+
+// Exact size copy, NULL for an empty payload half the time like a missing scan response
+static uint8_t *heap_copy(const struct Payload *payload) {
+    if (payload->len == 0 && random_below(2)) {
+        return NULL;
+    }
+
+    uint8_t *copy = malloc(payload->len > 0 ? payload->len : 1);
+
+    memcpy(copy, payload->data, payload->len);
+    return copy;
+}
+
+static void print_payload(const char *label, const struct Payload *payload) {
+    printf("%-9s", label);
+    for (int i = 0; i < payload->len; i++) {
+        printf(" %02x", payload->data[i]);
+    }
+    printf("\n");
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+    uint64_t seed = argc > 1 ? strtoull(argv[1], NULL, 0) : 1;
+    long iterations = argc > 2 ? strtol(argv[2], NULL, 0) : 2000000;
+    uint64_t malformed = 0;
+    uint64_t decoded = 0;
+
+    state = seed * 0x9e3779b97f4a7c15ull + 1;
+
+    for (long n = 0; n < iterations; n++) {
+        struct Payload adv_payload;
+        struct Payload scan_rsp_payload;
+        struct AdvReport report;
+        struct AdvDecoded decoded_frame;
+
+        generate(&adv_payload, random_below(2) ? 31 : MAX_PAYLOAD);
+        generate(&scan_rsp_payload, random_below(2) ? 31 : MAX_PAYLOAD);
+
+        uint8_t *adv = heap_copy(&adv_payload);
+        uint8_t *scan_rsp = heap_copy(&scan_rsp_payload);
+        int adv_len = adv != NULL ? adv_payload.len : 0;
+        int scan_rsp_len = scan_rsp != NULL ? scan_rsp_payload.len : 0;
+
+        int structures = adv_parse(adv, adv_len, scan_rsp, scan_rsp_len, &report);
+        const char *failure = check_report(&report, structures, adv, adv_len, scan_rsp, scan_rsp_len);
+
+        if (failure == NULL && adv_decode(&report, &decoded_frame)) {
+            if (!field_inside(&decoded_frame.frame, adv, adv_len, scan_rsp, scan_rsp_len)) {
+                failure = "decoded frame outside the payload";
+            } else {
+                // Formatted from the copy kept in the device table
+                size_t len = decoded_frame.frame.len < ADV_DECODED_MAX ? decoded_frame.frame.len : ADV_DECODED_MAX;
+                uint8_t *beacon = malloc(len > 0 ? len : 1);
+                char *text = malloc(ADV_DECODED_STRING_MAX);
+
+                memcpy(beacon, decoded_frame.frame.data, len);
+                int text_len = adv_decoded_format(decoded_frame.kind, decoded_frame.subtype, beacon, len, text,
+                                                  ADV_DECODED_STRING_MAX);
+
+                if (text_len < 0 || text_len >= ADV_DECODED_STRING_MAX || strlen(text) != (size_t) text_len) {
+                    failure = "formatted length";
+                }
+                free(beacon);
+                free(text);
+            }
+            decoded++;
+        }
+
+        malformed += report.malformed;
+        free(adv);
+        free(scan_rsp);
+
+        if (failure != NULL) {
+            printf("FAILED at input %ld (seed %llu): %s\n", n, (unsigned long long) seed, failure);
+            print_payload("adv", &adv_payload);
+            print_payload("scan rsp", &scan_rsp_payload);
+            return 1;
+        }
+    }
+
+    printf("%ld inputs ok (seed %llu): %llu malformed, %llu decoded\n", iterations, (unsigned long long) seed,
+           (unsigned long long) malformed, (unsigned long long) decoded);
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include "alloc_count.h"
+
+#include <stddef.h>
+#include <string.h>
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static __thread struct AllocCount *counting = NULL;
+
+void alloc_count_start(struct AllocCount *count) {
+    memset(count, 0, sizeof(*count));
+    counting = count;
+}
+
+void alloc_count_stop(void) {
+    counting = NULL;
+}
+
+void *__wrap_malloc(size_t size) {
+    if (counting != NULL) {
+        counting->allocations++;
+        counting->bytes += size;
+    }
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    if (counting != NULL) {
+        counting->allocations++;
+        counting->bytes += count * size;
+    }
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (counting != NULL) {
+        counting->allocations++;
+        counting->bytes += size;
+    }
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+    if (counting != NULL && ptr != NULL) {
+        counting->frees++;
+    }
+    __real_free(ptr);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// Heap calls of the current thread, counted between alloc_count_start and
+// alloc_count_stop. Programs using it are linked with ALLOC_COUNT_WRAP (CMakeLists.txt),
+// which routes malloc, calloc, realloc and free of every object through the counter.
+
+struct AllocCount {
+    uint64_t allocations;   // malloc, calloc and realloc calls
+    uint64_t bytes;         // Bytes asked for by them
+    uint64_t frees;
+};
+
+// Reset count and start counting on the calling thread
+void alloc_count_start(struct AllocCount *count);
+
+void alloc_count_stop(void);
@@ -0,0 +1,1098 @@
+// Reference collector: a fast local stand-in for the RESTServerScanner endpoint.
+//
+// Accepts everything the scanner sends to SERVER_URL: single device reports as a GET
+// query, batches POSTed as text (one query per line) or in the binary format of
+// wire_format.h, batches sent again from the spool (spooled=1), metrics records and
+// the long-poll command channel. Reported devices go into an in-memory index split
+// into shards by address, each behind its own lock, so workers rarely wait on each
+// other.
+//
+// Every worker thread runs its own epoll loop on its own listening socket
+// (SO_REUSEPORT, the kernel spreads connections over them) and serves any number of
+// keep-alive connections. A scanner is told apart by its IPv4 address. With -d the
+// collector asks for the discovery of every device it has no services of, once: as a
+// discover command to the poll of the command channel when the scanner that saw it
+// has one waiting, otherwise in the body of the next answer to a device report, which
+// is what handle_http_events passes to scanner_core_on_http_data.
+//
+// Ingest, index and connection statistics are printed periodically. host/collector_load.c
+// simulates scanners against it.
+
+#define _GNU_SOURCE
+
+#include "wire_decoder.h"
+#include "histogram.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define API_PATH "/RESTServerScanner-1.0-SNAPSHOT/api/scanner"
+
+#define MAX_WORKERS 64
+#define MAX_EVENTS 256
+
+#define HEADER_MAX 8192
+#define BODY_MAX (4 * 1024 * 1024)
+#define READ_CHUNK 16384
+
+// Parked command polls are checked this often for new commands and their deadline
+#define POLL_CHECK_MS 100
+#define POLL_WAIT_MAX_S 60
+
+#define MAX_SCANNERS 4096
+#define PENDING_DISCOVERIES 64
+
+#define DEVICE_NAME_SIZE 32
+#define SHARD_INITIAL_CAPACITY 1024
+
+// Index key: address, address type above it, KEY_USED marks a taken slot
+#define KEY_USED (1ULL << 63)
+
+#define ENTRY_DISCOVERED 0x01       // Services reported, or discovery failed
+#define ENTRY_ASKED      0x02       // Discovery requested
+#define ENTRY_LOST       0x04
+
+struct Options {
+    int port;
+    int workers;
+    int shards;
+    bool discover;
+    int stats_s;
+    bool verbose;
+};
+
+// Device as reported, from a query or a binary device item
+struct Report {
+    uint8_t bda[6];
+    uint8_t addr_type;
+    int8_t rssi;
+    bool lost;
+    bool discovery;
+    char name[DEVICE_NAME_SIZE];
+};
+
+struct IndexEntry {
+    uint64_t key;
+    uint64_t seen_ns;
+    uint32_t reports;
+    uint16_t scanner;           // Index of the scanner that reported it last
+    int8_t rssi;
+    uint8_t flags;              // ENTRY_*
+    char name[DEVICE_NAME_SIZE];
+};
+
+struct Shard {
+    pthread_mutex_t lock;
+    struct IndexEntry *entries;
+    uint32_t capacity;          // Power of two
+    uint32_t count;
+} __attribute__((aligned(64)));
+
+struct Scanner {
+    uint32_t ip;
+    pthread_mutex_t lock;
+    uint8_t pending[PENDING_DISCOVERIES][6];
+    int pending_count;
+    uint32_t next_command_id;
+    _Atomic int polling;        // Command polls parked
+    _Atomic uint64_t devices;
+};
+
+struct Connection {
+    int fd;
+    struct Scanner *scanner;
+    char *in;
+    size_t in_len;
+    size_t in_size;
+    char *out;
+    size_t out_len;
+    size_t out_sent;
+    size_t out_size;
+    bool writing;               // Registered for EPOLLOUT
+    bool close_after;           // Close once the output is sent
+    bool parked;                // Command poll waiting for a command
+    uint64_t deadline_ns;
+    struct Connection *next_parked;
+};
+
+struct WorkerStats {
+    _Atomic uint64_t requests;
+    _Atomic uint64_t devices;
+    _Atomic uint64_t bytes;
+    _Atomic uint64_t errors;
+    _Atomic uint64_t spooled;
+    _Atomic uint64_t metrics;
+    _Atomic uint64_t polls;
+    _Atomic uint64_t commands;
+    _Atomic uint64_t busy_ns;
+    _Atomic uint64_t connections;
+};
+
+struct Worker {
+    pthread_t thread;
+    int epoll_fd;
+    int listen_fd;
+    struct Connection *parked;
+    struct WorkerStats stats;
+} __attribute__((aligned(64)));
+
+static struct Options options = { .port = 8080, .workers = 0, .shards = 64, .discover = false, .stats_s = 10 };
+
+static struct Shard *shards;
+static uint32_t shard_mask;
+
+static struct Scanner scanners[MAX_SCANNERS];
+static int scanners_count = 0;
+static pthread_mutex_t scanners_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct Worker workers[MAX_WORKERS];
+static _Atomic uint64_t discoveries_asked;
+
+static volatile sig_atomic_t stop = 0;
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+static uint64_t hash_key(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+static void count(_Atomic uint64_t *counter, uint64_t value) {
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+static uint64_t read_counter(_Atomic uint64_t *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static bool parse_address(const char *str, uint8_t *bda) {
+    unsigned b[6];
+    int n = 0;
+
+    if (sscanf(str, "%2x:%2x:%2x:%2x:%2x:%2x%n", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &n) != 6 || str[n] != '\0') {
+        return false;
+    }
+    for (int i = 0; i < 6; i++) {
+        bda[i] = b[i];
+    }
+    return true;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Percent decode at most size - 1 bytes, the rest of a long value is cut
+static void decode_value(const char *value, size_t len, char *out, size_t size) {
+    size_t n = 0;
+
+    for (size_t i = 0; i < len && n + 1 < size; i++) {
+        if (value[i] == '%' && i + 2 < len && hex_value(value[i + 1]) >= 0 && hex_value(value[i + 2]) >= 0) {
+            out[n++] = hex_value(value[i + 1]) << 4 | hex_value(value[i + 2]);
+            i += 2;
+        } else {
+            out[n++] = value[i] == '+' ? ' ' : value[i];
+        }
+    }
+    out[n] = '\0';
+}
+
+// Calls handler with every key and percent decoded value of a query string
+static void for_each_parameter(const char *query, size_t len,
+                               void (*handler)(const char *key, size_t key_len, const char *value, void *arg), void *arg) {
+    const char *end = query + len;
+
+    while (query < end) {
+        const char *pair_end = memchr(query, '&', end - query);
+        const char *equals;
+        char value[256];
+
+        if (pair_end == NULL) {
+            pair_end = end;
+        }
+        equals = memchr(query, '=', pair_end - query);
+        if (equals != NULL) {
+            decode_value(equals + 1, pair_end - equals - 1, value, sizeof(value));
+            handler(query, equals - query, value, arg);
+        }
+        query = pair_end + 1;
+    }
+}
+
+static bool key_is(const char *key, size_t key_len, const char *name) {
+    return strlen(name) == key_len && memcmp(key, name, key_len) == 0;
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+// DEVICE INDEX -----------------------------------------------------------------------------------
+
+static void index_init(void) {
+    shards = aligned_alloc(64, options.shards * sizeof(struct Shard));
+    shard_mask = options.shards - 1;
+
+    for (int i = 0; i < options.shards; i++) {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        shards[i].capacity = SHARD_INITIAL_CAPACITY;
+        shards[i].count = 0;
+        shards[i].entries = calloc(SHARD_INITIAL_CAPACITY, sizeof(struct IndexEntry));
+    }
+}
+
+// Slot of the key or the free slot it goes into, linear probing. Shard bits of the hash are not reused.
+static struct IndexEntry *shard_slot(struct Shard *shard, uint64_t key, uint64_t hash) {
+    uint32_t mask = shard->capacity - 1;
+
+    for (uint32_t i = (hash >> 32) & mask;; i = (i + 1) & mask) {
+        if (shard->entries[i].key == key || shard->entries[i].key == 0) {
+            return &shard->entries[i];
+        }
+    }
+}
+
+// Double the table at 3/4 load
+static void shard_grow(struct Shard *shard) {
+    struct IndexEntry *old = shard->entries;
+    uint32_t old_capacity = shard->capacity;
+
+    shard->capacity *= 2;
+    shard->entries = calloc(shard->capacity, sizeof(struct IndexEntry));
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old[i].key != 0) {
+            *shard_slot(shard, old[i].key, hash_key(old[i].key)) = old[i];
+        }
+    }
+    free(old);
+}
+
+// Record a report. Returns true when the scanner should be asked to discover the device.
+static bool index_update(const struct Report *report, int scanner, uint64_t now_ns) {
+    uint64_t key = KEY_USED | (uint64_t) report->addr_type << 48;
+    bool ask = false;
+
+    for (int i = 0; i < 6; i++) {
+        key |= (uint64_t) report->bda[i] << (40 - 8 * i);
+    }
+
+    uint64_t hash = hash_key(key);
+    struct Shard *shard = &shards[hash & shard_mask];
+
+    pthread_mutex_lock(&shard->lock);
+
+    if ((shard->count + 1) * 4 > shard->capacity * 3) {
+        shard_grow(shard);
+    }
+
+    struct IndexEntry *entry = shard_slot(shard, key, hash);
+
+    if (entry->key == 0) {
+        memset(entry, 0, sizeof(*entry));
+        entry->key = key;
+        shard->count++;
+    }
+
+    entry->seen_ns = now_ns;
+    entry->reports++;
+    entry->scanner = scanner;
+    entry->rssi = report->rssi;
+    if (report->name[0] != '\0') {
+        memcpy(entry->name, report->name, sizeof(entry->name));
+    }
+    entry->flags = report->lost ? entry->flags | ENTRY_LOST : entry->flags & ~ENTRY_LOST;
+    if (report->discovery) {
+        entry->flags |= ENTRY_DISCOVERED;
+    }
+
+    if (options.discover && !report->lost && !(entry->flags & (ENTRY_DISCOVERED | ENTRY_ASKED))) {
+        entry->flags |= ENTRY_ASKED;
+        ask = true;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return ask;
+}
+
+static uint64_t index_count(uint32_t *largest) {
+    uint64_t total = 0;
+
+    *largest = 0;
+    for (int i = 0; i < options.shards; i++) {
+        pthread_mutex_lock(&shards[i].lock);
+        total += shards[i].count;
+        if (shards[i].count > *largest) {
+            *largest = shards[i].count;
+        }
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+    return total;
+}
+
+// END DEVICE INDEX -------------------------------------------------------------------------------
+
+// SCANNERS ---------------------------------------------------------------------------------------
+
+// Scanner of a peer address, looked up once per connection
+static struct Scanner *find_scanner(uint32_t ip) {
+    struct Scanner *scanner = NULL;
+
+    pthread_mutex_lock(&scanners_lock);
+    for (int i = 0; i < scanners_count; i++) {
+        if (scanners[i].ip == ip) {
+            scanner = &scanners[i];
+            break;
+        }
+    }
+    if (scanner == NULL && scanners_count < MAX_SCANNERS) {
+        scanner = &scanners[scanners_count++];
+        scanner->ip = ip;
+        pthread_mutex_init(&scanner->lock, NULL);
+    }
+    pthread_mutex_unlock(&scanners_lock);
+
+    return scanner;
+}
+
+static void queue_discovery(struct Scanner *scanner, const uint8_t *bda) {
+    pthread_mutex_lock(&scanner->lock);
+    if (scanner->pending_count < PENDING_DISCOVERIES) {
+        memcpy(scanner->pending[scanner->pending_count++], bda, 6);
+        count(&discoveries_asked, 1);
+    }
+    pthread_mutex_unlock(&scanner->lock);
+}
+
+// Pending discoveries as lines, "<address>" for device report answers or "<id> discover <address>"
+// for command polls. Returns the length written.
+static size_t take_discoveries(struct Scanner *scanner, bool as_commands, char *out, size_t size) {
+    size_t len = 0;
+
+    if (scanner == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&scanner->lock);
+    for (int i = 0; i < scanner->pending_count && len + 48 < size; i++) {
+        const uint8_t *b = scanner->pending[i];
+
+        if (as_commands) {
+            len += snprintf(out + len, size - len, "%u discover ", (unsigned) ++scanner->next_command_id);
+        }
+        len += snprintf(out + len, size - len, "%02x:%02x:%02x:%02x:%02x:%02x\n", b[0], b[1], b[2], b[3], b[4], b[5]);
+    }
+    scanner->pending_count = 0;
+    pthread_mutex_unlock(&scanner->lock);
+
+    return len;
+}
+
+// END SCANNERS -----------------------------------------------------------------------------------
+
+// REQUESTS ---------------------------------------------------------------------------------------
+
+struct Request {
+    bool post;
+    const char *path;
+    size_t path_len;
+    const char *query;
+    size_t query_len;
+    const char *body;
+    size_t body_len;
+    bool binary;
+};
+
+struct IngestContext {
+    struct Worker *worker;
+    struct Connection *connection;
+    struct Report report;
+    bool has_address;
+    uint64_t now_ns;
+    int devices;
+};
+
+static void ingest_report(struct IngestContext *context) {
+    struct Scanner *scanner = context->connection->scanner;
+    int scanner_index = scanner != NULL ? scanner - scanners : 0;
+
+    if (index_update(&context->report, scanner_index, context->now_ns) && scanner != NULL) {
+        queue_discovery(scanner, context->report.bda);
+    }
+    context->devices++;
+}
+
+static void query_parameter(const char *key, size_t key_len, const char *value, void *arg) {
+    struct Report *report = &((struct IngestContext *) arg)->report;
+
+    if (key_is(key, key_len, "address")) {
+        ((struct IngestContext *) arg)->has_address = parse_address(value, report->bda);
+    } else if (key_is(key, key_len, "device")) {
+        snprintf(report->name, sizeof(report->name), "%.*s", (int) sizeof(report->name) - 1, value);
+    } else if (key_is(key, key_len, "rssi")) {
+        report->rssi = atoi(value);
+    } else if (key_is(key, key_len, "services") || key_is(key, key_len, "chars")) {
+        report->discovery = true;
+    } else if (key_is(key, key_len, "lost")) {
+        report->lost = value[0] == '1';
+    }
+}
+
+// One device query (text format), false when it names no device
+static bool ingest_query(struct IngestContext *context, const char *query, size_t len) {
+    memset(&context->report, 0, sizeof(context->report));
+    context->has_address = false;
+
+    for_each_parameter(query, len, query_parameter, context);
+
+    if (!context->has_address) {
+        return false;
+    }
+    ingest_report(context);
+    return true;
+}
+
+static void ingest_wire_device(const struct WireDevice *device, void *arg) {
+    struct IngestContext *context = arg;
+    struct Report *report = &context->report;
+
+    memcpy(report->bda, device->bda, 6);
+    report->addr_type = device->addr_type;
+    report->rssi = device->rssi;
+    report->lost = device->lost;
+    report->discovery = device->discovery;
+    snprintf(report->name, sizeof(report->name), "%.*s", (int) sizeof(report->name) - 1, device->name);
+
+    ingest_report(context);
+}
+
+// Batch of device queries, one per line
+static bool ingest_lines(struct IngestContext *context, const char *body, size_t len) {
+    const char *end = body + len;
+    bool valid = true;
+
+    while (body < end) {
+        const char *line_end = memchr(body, '\n', end - body);
+        size_t line_len;
+
+        if (line_end == NULL) {
+            line_end = end;
+        }
+        line_len = line_end - body;
+        if (line_len > 0 && body[line_len - 1] == '\r') {
+            line_len--;
+        }
+        if (line_len > 0) {
+            valid &= ingest_query(context, body, line_len);
+        }
+        body = line_end + 1;
+    }
+    return valid;
+}
+
+static const char *status_text(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    default: return "Error";
+    }
+}
+
+static void reserve(char **buffer, size_t *size, size_t needed) {
+    if (needed > *size) {
+        while (*size < needed) {
+            *size = *size > 0 ? *size * 2 : 4096;
+        }
+        *buffer = realloc(*buffer, *size);
+    }
+}
+
+static void respond(struct Connection *connection, int status, const char *body, size_t len) {
+    reserve(&connection->out, &connection->out_size, connection->out_len + 128 + len);
+
+    connection->out_len += snprintf(connection->out + connection->out_len, 128,
+                                    "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\n%s\r\n",
+                                    status, status_text(status), len, connection->close_after ? "Connection: close\r\n" : "");
+    memcpy(connection->out + connection->out_len, body, len);
+    connection->out_len += len;
+}
+
+// Device reports, answered with the discoveries waiting for the scanner
+static void handle_devices(struct Worker *worker, struct Connection *connection, const struct Request *request) {
+    struct IngestContext context = { .worker = worker, .connection = connection, .now_ns = histogram_now_ns() };
+    char answer[PENDING_DISCOVERIES * 48];
+    bool valid;
+
+    if (!request->post) {
+        valid = ingest_query(&context, request->query, request->query_len);
+    } else if (request->binary) {
+        valid = wire_decode((const uint8_t *) request->body, request->body_len, ingest_wire_device, &context) >= 0;
+    } else {
+        valid = ingest_lines(&context, request->body, request->body_len);
+    }
+
+    if (request->post && request->query_len >= 9 && memmem(request->query, request->query_len, "spooled=1", 9) != NULL) {
+        count(&worker->stats.spooled, 1);
+    }
+    count(&worker->stats.devices, context.devices);
+    if (connection->scanner != NULL) {
+        count(&connection->scanner->devices, context.devices);
+    }
+
+    if (!valid) {
+        count(&worker->stats.errors, 1);
+        respond(connection, 400, "", 0);
+        return;
+    }
+
+    // Scanners polling for commands get discoveries as commands, which they acknowledge
+    struct Scanner *scanner = connection->scanner;
+    bool polling = scanner != NULL && atomic_load_explicit(&scanner->polling, memory_order_relaxed) > 0;
+
+    respond(connection, 200, answer, polling ? 0 : take_discoveries(scanner, false, answer, sizeof(answer)));
+}
+
+struct PollArguments {
+    int wait_s;
+};
+
+static void poll_parameter(const char *key, size_t key_len, const char *value, void *arg) {
+    if (key_is(key, key_len, "wait")) {
+        ((struct PollArguments *) arg)->wait_s = atoi(value);
+    }
+}
+
+// Answer a command poll with the commands waiting, false when there are none
+static bool answer_poll(struct Connection *connection) {
+    char answer[PENDING_DISCOVERIES * 64];
+    size_t len = take_discoveries(connection->scanner, true, answer, sizeof(answer));
+
+    if (len == 0) {
+        return false;
+    }
+    respond(connection, 200, answer, len);
+    return true;
+}
+
+// Command poll, parked until a command is due or the wait runs out
+static void handle_poll(struct Worker *worker, struct Connection *connection, const struct Request *request) {
+    struct PollArguments arguments = { .wait_s = 0 };
+
+    count(&worker->stats.polls, 1);
+    for_each_parameter(request->query, request->query_len, poll_parameter, &arguments);
+
+    if (answer_poll(connection)) {
+        count(&worker->stats.commands, 1);
+        return;
+    }
+    if (arguments.wait_s <= 0) {
+        respond(connection, 204, "", 0);
+        return;
+    }
+
+    if (arguments.wait_s > POLL_WAIT_MAX_S) {
+        arguments.wait_s = POLL_WAIT_MAX_S;
+    }
+    connection->parked = true;
+    if (connection->scanner != NULL) {
+        atomic_fetch_add_explicit(&connection->scanner->polling, 1, memory_order_relaxed);
+    }
+    connection->deadline_ns = histogram_now_ns() + arguments.wait_s * 1000000000ULL;
+    connection->next_parked = worker->parked;
+    worker->parked = connection;
+}
+
+static void handle_metrics(struct Worker *worker, struct Connection *connection, const struct Request *request) {
+    static _Thread_local struct WireMetrics metrics;
+    int found = wire_decode_metrics((const uint8_t *) request->body, request->body_len, &metrics);
+
+    if (found <= 0) {
+        count(&worker->stats.errors, 1);
+        respond(connection, 400, "", 0);
+        return;
+    }
+
+    count(&worker->stats.metrics, 1);
+    if (options.verbose) {
+        printf("Metrics: uptime %u ms, heap %u free, %u min, %u advertisements dropped\n", (unsigned) metrics.uptime_ms,
+               (unsigned) metrics.heap_free, (unsigned) metrics.heap_min_free, (unsigned) metrics.adv_dropped);
+    }
+    respond(connection, 200, "", 0);
+}
+
+static bool path_is(const struct Request *request, const char *path) {
+    return strlen(path) == request->path_len && memcmp(request->path, path, request->path_len) == 0;
+}
+
+static void handle_request(struct Worker *worker, struct Connection *connection, const struct Request *request) {
+    uint64_t start_ns = histogram_now_ns();
+
+    count(&worker->stats.requests, 1);
+    count(&worker->stats.bytes, request->body_len + request->query_len);
+
+    if (path_is(request, API_PATH)) {
+        handle_devices(worker, connection, request);
+    } else if (path_is(request, API_PATH "/commands") && !request->post) {
+        handle_poll(worker, connection, request);
+    } else if (path_is(request, API_PATH "/metrics") && request->post) {
+        handle_metrics(worker, connection, request);
+    } else {
+        count(&worker->stats.errors, 1);
+        respond(connection, 404, "", 0);
+    }
+
+    count(&worker->stats.busy_ns, histogram_now_ns() - start_ns);
+}
+
+// Request at the start of data. Returns its length, 0 when incomplete, -400 or -413 when malformed.
+static long parse_request(char *data, size_t len, struct Request *request, bool *close) {
+    char *header_end = memmem(data, len, "\r\n\r\n", 4);
+
+    if (header_end == NULL) {
+        return len > HEADER_MAX ? -400 : 0;
+    }
+    *header_end = '\0';
+
+    char *target = strchr(data, ' ');
+    char *version = target != NULL ? strchr(target + 1, ' ') : NULL;
+
+    if (version == NULL) {
+        return -400;
+    }
+
+    memset(request, 0, sizeof(*request));
+    if (target - data == 4 && memcmp(data, "POST", 4) == 0) {
+        request->post = true;
+    } else if (target - data != 3 || memcmp(data, "GET", 3) != 0) {
+        return -400;
+    }
+
+    request->path = target + 1;
+    request->path_len = version - request->path;
+    char *question = memchr(request->path, '?', request->path_len);
+    if (question != NULL) {
+        request->query = question + 1;
+        request->query_len = version - request->query;
+        request->path_len = question - request->path;
+    }
+
+    *close = strncmp(version + 1, "HTTP/1.0", 8) == 0;
+
+    size_t content_length = 0;
+
+    for (char *line = strstr(version, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            content_length = strtoul(line + 15, NULL, 10);
+        } else if (strncasecmp(line, "Content-Type:", 13) == 0) {
+            request->binary = strncmp(line + 13 + strspn(line + 13, " "), WIRE_CONTENT_TYPE, strlen(WIRE_CONTENT_TYPE)) == 0;
+        } else if (strncasecmp(line, "Connection:", 11) == 0) {
+            *close = strncasecmp(line + 11 + strspn(line + 11, " "), "close", 5) == 0;
+        } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+            return -400;
+        }
+    }
+
+    if (content_length > BODY_MAX) {
+        return -413;
+    }
+
+    size_t header_len = header_end + 4 - data;
+
+    if (len < header_len + content_length) {
+        *header_end = '\r';
+        return 0;
+    }
+
+    request->body = header_end + 4;
+    request->body_len = content_length;
+    return header_len + content_length;
+}
+
+// END REQUESTS -----------------------------------------------------------------------------------
+
+// CONNECTIONS ------------------------------------------------------------------------------------
+
+static void unpark(struct Worker *worker, struct Connection *connection) {
+    for (struct Connection **link = &worker->parked; *link != NULL; link = &(*link)->next_parked) {
+        if (*link == connection) {
+            *link = connection->next_parked;
+            break;
+        }
+    }
+    connection->parked = false;
+    if (connection->scanner != NULL) {
+        atomic_fetch_sub_explicit(&connection->scanner->polling, 1, memory_order_relaxed);
+    }
+}
+
+static void close_connection(struct Worker *worker, struct Connection *connection) {
+    if (connection->parked) {
+        unpark(worker, connection);
+    }
+    close(connection->fd);
+    free(connection->in);
+    free(connection->out);
+    free(connection);
+}
+
+// Requests complete in the input, stopping at a parked poll
+static void process_input(struct Worker *worker, struct Connection *connection) {
+    size_t pos = 0;
+
+    while (!connection->parked && !connection->close_after && pos < connection->in_len) {
+        struct Request request;
+        bool close = false;
+        long used = parse_request(connection->in + pos, connection->in_len - pos, &request, &close);
+
+        if (used == 0) {
+            break;
+        }
+        if (used < 0) {
+            count(&worker->stats.errors, 1);
+            connection->close_after = true;
+            respond(connection, -used, "", 0);
+            break;
+        }
+
+        connection->close_after = close;
+        handle_request(worker, connection, &request);
+        pos += used;
+    }
+
+    memmove(connection->in, connection->in + pos, connection->in_len - pos);
+    connection->in_len -= pos;
+}
+
+// Send what the socket takes. Returns false when the connection is to be closed.
+static bool flush_output(struct Worker *worker, struct Connection *connection) {
+    while (connection->out_sent < connection->out_len) {
+        ssize_t sent = send(connection->fd, connection->out + connection->out_sent,
+                            connection->out_len - connection->out_sent, MSG_NOSIGNAL);
+
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        connection->out_sent += sent;
+    }
+
+    if (connection->out_sent == connection->out_len) {
+        connection->out_sent = connection->out_len = 0;
+        if (connection->close_after) {
+            return false;
+        }
+    }
+
+    bool writing = connection->out_len > 0;
+
+    if (writing != connection->writing) {
+        struct epoll_event event = { .events = EPOLLIN | (writing ? EPOLLOUT : 0), .data.ptr = connection };
+
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->writing = writing;
+    }
+    return true;
+}
+
+// Read until the socket is drained. Returns false on end of stream or error.
+static bool read_input(struct Connection *connection) {
+    for (;;) {
+        if (connection->in_size - connection->in_len < READ_CHUNK) {
+            if (connection->in_size >= HEADER_MAX + BODY_MAX + READ_CHUNK) {
+                return false;
+            }
+            reserve(&connection->in, &connection->in_size, connection->in_len + READ_CHUNK);
+        }
+
+        ssize_t received = recv(connection->fd, connection->in + connection->in_len,
+                                connection->in_size - connection->in_len, 0);
+
+        if (received > 0) {
+            connection->in_len += received;
+        } else if (received == 0) {
+            return false;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        } else if (errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+static void accept_connections(struct Worker *worker) {
+    for (;;) {
+        struct sockaddr_in peer;
+        socklen_t peer_len = sizeof(peer);
+        int fd = accept4(worker->listen_fd, (struct sockaddr *) &peer, &peer_len, SOCK_NONBLOCK);
+
+        if (fd < 0) {
+            return;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        struct Connection *connection = calloc(1, sizeof(*connection));
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = connection };
+
+        connection->fd = fd;
+        connection->scanner = find_scanner(peer.sin_addr.s_addr);
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        count(&worker->stats.connections, 1);
+    }
+}
+
+// Parked polls with a command waiting or past their deadline are answered
+static void check_parked(struct Worker *worker) {
+    uint64_t now_ns = histogram_now_ns();
+    struct Connection *connection = worker->parked;
+
+    while (connection != NULL) {
+        struct Connection *next = connection->next_parked;
+
+        if (answer_poll(connection)) {
+            count(&worker->stats.commands, 1);
+        } else if (now_ns >= connection->deadline_ns) {
+            respond(connection, 204, "", 0);
+        } else {
+            connection = next;
+            continue;
+        }
+
+        unpark(worker, connection);
+        process_input(worker, connection);
+        if (!flush_output(worker, connection)) {
+            close_connection(worker, connection);
+        }
+        connection = next;
+    }
+}
+
+static void *worker_main(void *arg) {
+    struct Worker *worker = arg;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (!stop) {
+        int n = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, POLL_CHECK_MS);
+
+        for (int i = 0; i < n; i++) {
+            struct Connection *connection = events[i].data.ptr;
+
+            if (connection == NULL) {
+                accept_connections(worker);
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                close_connection(worker, connection);
+                continue;
+            }
+
+            bool open = true;
+
+            if (events[i].events & EPOLLIN) {
+                open = read_input(connection);
+                process_input(worker, connection);
+            }
+            if (!flush_output(worker, connection) || (!open && connection->out_len == 0)) {
+                close_connection(worker, connection);
+            }
+        }
+
+        if (worker->parked != NULL) {
+            check_parked(worker);
+        }
+    }
+    return NULL;
+}
+
+static bool start_worker(struct Worker *worker) {
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_port = htons(options.port), .sin_addr.s_addr = INADDR_ANY };
+    int one = 1;
+
+    worker->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    setsockopt(worker->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(worker->listen_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    if (bind(worker->listen_fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(worker->listen_fd, 1024) < 0) {
+        perror("listen");
+        return false;
+    }
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+
+    worker->epoll_fd = epoll_create1(0);
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->listen_fd, &event);
+
+    return pthread_create(&worker->thread, NULL, worker_main, worker) == 0;
+}
+
+// END CONNECTIONS --------------------------------------------------------------------------------
+
+struct Totals {
+    uint64_t requests;
+    uint64_t devices;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t spooled;
+    uint64_t metrics;
+    uint64_t polls;
+    uint64_t commands;
+    uint64_t busy_ns;
+    uint64_t connections;
+};
+
+static void sum_stats(struct Totals *totals) {
+    memset(totals, 0, sizeof(*totals));
+
+    for (int i = 0; i < options.workers; i++) {
+        struct WorkerStats *stats = &workers[i].stats;
+
+        totals->requests += read_counter(&stats->requests);
+        totals->devices += read_counter(&stats->devices);
+        totals->bytes += read_counter(&stats->bytes);
+        totals->errors += read_counter(&stats->errors);
+        totals->spooled += read_counter(&stats->spooled);
+        totals->metrics += read_counter(&stats->metrics);
+        totals->polls += read_counter(&stats->polls);
+        totals->commands += read_counter(&stats->commands);
+        totals->busy_ns += read_counter(&stats->busy_ns);
+        totals->connections += read_counter(&stats->connections);
+    }
+}
+
+static void print_stats(const struct Totals *now, const struct Totals *before, double seconds) {
+    uint32_t largest_shard;
+    uint64_t indexed = index_count(&largest_shard);
+    uint64_t requests = now->requests - before->requests;
+
+    printf("%.0f requests/s, %.0f devices/s, %.1f MB/s, %.1f us per request | index %llu devices, largest shard %u, "
+           "%d scanners | %llu connections, %llu polls, %llu commands, %llu discoveries asked, %llu spooled, "
+           "%llu metrics, %llu errors\n",
+           requests / seconds, (now->devices - before->devices) / seconds, (now->bytes - before->bytes) / seconds / 1e6,
+           requests > 0 ? (now->busy_ns - before->busy_ns) / 1e3 / requests : 0.0, (unsigned long long) indexed,
+           (unsigned) largest_shard, scanners_count, (unsigned long long) now->connections,
+           (unsigned long long) now->polls, (unsigned long long) now->commands,
+           (unsigned long long) read_counter(&discoveries_asked), (unsigned long long) now->spooled,
+           (unsigned long long) now->metrics, (unsigned long long) now->errors);
+    fflush(stdout);
+}
+
+static void on_signal(int signal) {
+    stop = 1;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-p port] [-j worker threads] [-s shards] [-i stats interval s] [-d] [-v]\n", program);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0) {
+            options.discover = true;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            options.verbose = true;
+        } else if (i + 1 < argc && strcmp(argv[i], "-p") == 0) {
+            options.port = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-j") == 0) {
+            options.workers = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+            options.shards = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-i") == 0) {
+            options.stats_s = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (options.workers <= 0) {
+        options.workers = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (options.workers > MAX_WORKERS) {
+        options.workers = MAX_WORKERS;
+    }
+
+    // Shards are selected by the low bits of the address hash
+    if (options.shards <= 0 || (options.shards & (options.shards - 1)) != 0 || options.stats_s <= 0) {
+        usage(argv[0]);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    index_init();
+    for (int i = 0; i < options.workers; i++) {
+        if (!start_worker(&workers[i])) {
+            return 1;
+        }
+    }
+
+    printf("Listening on port %d, API at %s, %d workers, %d shards%s\n", options.port, API_PATH, options.workers,
+           options.shards, options.discover ? ", asking for discoveries" : "");
+    fflush(stdout);
+
+    struct Totals before;
+    struct Totals now;
+    uint64_t start_ns = histogram_now_ns();
+    uint64_t last_ns = start_ns;
+
+    sum_stats(&before);
+    while (!stop) {
+        for (int i = 0; i < options.stats_s * 10 && !stop; i++) {
+            usleep(100000);
+        }
+
+        uint64_t now_ns = histogram_now_ns();
+
+        sum_stats(&now);
+        print_stats(&now, &before, (now_ns - last_ns) / 1e9);
+        before = now;
+        last_ns = now_ns;
+    }
+
+    struct Totals zero = { 0 };
+
+    printf("Total over %.1f s: ", (histogram_now_ns() - start_ns) / 1e9);
+    print_stats(&now, &zero, (histogram_now_ns() - start_ns) / 1e9);
+
+    for (int i = 0; i < options.workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    return 0;
+}
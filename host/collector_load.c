@@ -0,0 +1,456 @@
+// Load generator for the reference collector (collector.c), or any server of the
+// RESTServerScanner API.
+//
+// Simulates scanners, each a thread on its own keep-alive connection, reporting its
+// own devices in requests like the firmware sends them: one device per GET query,
+// or batches POSTed as text or in the binary format. Against a loopback address every
+// scanner connects from its own address (127.1.x.y) so the collector tells them apart.
+// Discovery requests in the answers are followed by a report of the device with
+// services, as a scanner does once it has read them.
+//
+// With a request rate every scanner sends on a fixed schedule and latency counts from
+// the time a request was due, so a server falling behind shows in the percentiles.
+// Without one every scanner sends as fast as it gets answers. Reports sustained
+// requests and devices per second and latency percentiles.
+
+#define _GNU_SOURCE
+
+#include "histogram.h"
+#include "wire_format.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define API_PATH "/RESTServerScanner-1.0-SNAPSHOT/api/scanner"
+
+#define MAX_SCANNERS 1024
+#define MAX_DEVICES 65536
+#define REQUEST_MAX (1024 * 1024)
+#define RESPONSE_MAX 65536
+#define THREAD_STACK_SIZE (256 * 1024)
+
+enum Format { FORMAT_QUERY, FORMAT_TEXT, FORMAT_BINARY };
+
+struct Options {
+    const char *host;
+    int port;
+    int scanners;
+    int devices;
+    int batch;
+    int rate;
+    int seconds;
+    int format;
+};
+
+struct ScannerThread {
+    pthread_t thread;
+    int index;
+    int fd;
+    uint8_t *discovered;        // Devices to report with services, 1 waiting, 2 reported
+    uint32_t *latencies_us;
+    size_t latencies_count;
+    size_t latencies_size;
+    uint64_t requests;
+    uint64_t devices;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t discoveries;
+    char *request;
+    char response[RESPONSE_MAX];
+};
+
+static struct Options options = {
+    .host = "127.0.0.1", .port = 8080, .scanners = 10, .devices = 200, .batch = 50, .rate = 0, .seconds = 10,
+    .format = FORMAT_TEXT,
+};
+
+static struct ScannerThread threads[MAX_SCANNERS];
+static uint64_t end_ns;
+
+static const char *format_names[] = { "query", "text", "binary" };
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+// Address of a device of a scanner, random static
+static void device_address(int scanner, int device, uint8_t *bda) {
+    bda[0] = 0xc0 | (scanner >> 8);
+    bda[1] = scanner;
+    bda[2] = device >> 16;
+    bda[3] = device >> 8;
+    bda[4] = device;
+    bda[5] = 0x5a;
+}
+
+static int device_rssi(int device) {
+    return -40 - device % 50 - rand() % 4;
+}
+
+static size_t append_query(char *out, int scanner, int device, bool with_services) {
+    uint8_t b[6];
+
+    device_address(scanner, device, b);
+    return sprintf(out, "address=%02x%%3A%02x%%3A%02x%%3A%02x%%3A%02x%%3A%02x&device=dev-%d-%d%s&rssi=%d",
+                   b[0], b[1], b[2], b[3], b[4], b[5], scanner, device,
+                   with_services ? "&chars=2a00,2a01&services=1800,180f" : "", device_rssi(device));
+}
+
+static void put_u16(uint8_t *p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+// Device item of wire_format.h, 16-bit UUIDs only
+static size_t append_wire_device(uint8_t *out, int scanner, int device, bool with_services) {
+    static const uint16_t services[] = { 0x1800, 0x180f };
+    static const uint16_t chars[] = { 0x2a00, 0x2a01 };
+    uint8_t *p = out + WIRE_ITEM_HEADER_SIZE;
+    int name_len;
+
+    *p++ = WIRE_DEVICE_NAME | (with_services ? WIRE_DEVICE_DISCOVERY : 0) | 1 << WIRE_DEVICE_ADDR_TYPE_SHIFT;
+    device_address(scanner, device, p);
+    p += 6;
+    *p++ = (uint8_t) device_rssi(device);
+
+    name_len = sprintf((char *) p + 1, "dev-%d-%d", scanner, device);
+    *p = name_len;
+    p += 1 + name_len;
+
+    if (with_services) {
+        put_u16(p, 4);
+        p += 2;
+        for (int i = 0; i < 2; i++) {
+            *p++ = WIRE_UUID_16;
+            put_u16(p, services[i]);
+            p += 2;
+            *p++ = WIRE_UUID_CHAR | WIRE_UUID_16;
+            put_u16(p, chars[i]);
+            p += 2;
+        }
+    }
+
+    out[0] = WIRE_ITEM_DEVICE;
+    put_u16(out + 1, p - out - WIRE_ITEM_HEADER_SIZE);
+    return p - out;
+}
+
+// Next request of the scanner into its buffer, devices taken in turn starting at *next_device
+static size_t build_request(struct ScannerThread *scanner, int *next_device, int *devices) {
+    char *body = scanner->request + 512;
+    size_t body_len = 0;
+    int count = options.format == FORMAT_QUERY ? 1 : options.batch;
+
+    if (options.format == FORMAT_BINARY) {
+        memcpy(body, WIRE_MAGIC, 3);
+        body[3] = WIRE_VERSION;
+        body_len = WIRE_HEADER_SIZE;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int device = *next_device;
+        bool with_services = scanner->discovered[device] == 1;
+
+        *next_device = (device + 1) % options.devices;
+        if (with_services) {
+            scanner->discovered[device] = 2;
+        }
+
+        if (options.format == FORMAT_BINARY) {
+            body_len += append_wire_device((uint8_t *) body + body_len, scanner->index, device, with_services);
+        } else {
+            body_len += append_query(body + body_len, scanner->index, device, with_services);
+            if (options.format == FORMAT_TEXT) {
+                body[body_len++] = '\n';
+            }
+        }
+    }
+    *devices = count;
+
+    // Request line and headers in front of the body
+    char head[256];
+    int head_len = options.format == FORMAT_QUERY
+            ? snprintf(head, sizeof(head), "GET %s?", API_PATH)
+            : snprintf(head, sizeof(head), "POST %s HTTP/1.1\r\nHost: collector\r\nContent-Type: %s\r\n"
+                       "Content-Length: %zu\r\n\r\n", API_PATH,
+                       options.format == FORMAT_BINARY ? WIRE_CONTENT_TYPE : "text/plain", body_len);
+
+    memmove(scanner->request + head_len, body, body_len);
+    memcpy(scanner->request, head, head_len);
+
+    if (options.format == FORMAT_QUERY) {
+        return head_len + body_len + sprintf(scanner->request + head_len + body_len, " HTTP/1.1\r\nHost: collector\r\n\r\n");
+    }
+    return head_len + body_len;
+}
+
+static bool send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+
+        if (sent <= 0) {
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+// Read one response, returns its status and sets the body. 0 when the connection failed.
+static int read_response(struct ScannerThread *scanner, const char **body, size_t *body_len) {
+    size_t len = 0;
+    char *header_end = NULL;
+
+    for (;;) {
+        if (header_end != NULL) {
+            size_t header_len = header_end + 4 - scanner->response;
+            const char *length = strcasestr(scanner->response, "\r\nContent-Length:");
+            size_t content_length = length != NULL && length < header_end ? strtoul(length + 17, NULL, 10) : 0;
+
+            if (header_len + content_length > sizeof(scanner->response)) {
+                return 0;
+            }
+            if (len >= header_len + content_length) {
+                *body = header_end + 4;
+                *body_len = content_length;
+                return atoi(scanner->response + 9);
+            }
+        }
+
+        ssize_t received = recv(scanner->fd, scanner->response + len, sizeof(scanner->response) - 1 - len, 0);
+
+        if (received <= 0) {
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        len += received;
+        scanner->response[len] = '\0';
+        if (header_end == NULL) {
+            header_end = strstr(scanner->response, "\r\n\r\n");
+        }
+    }
+}
+
+// Discovery requests are addresses separated by anything else
+static void take_discoveries(struct ScannerThread *scanner, const char *body, size_t len) {
+    for (size_t i = 0; i + 17 <= len; i++) {
+        unsigned b[6];
+        int n = 0;
+
+        if (sscanf(body + i, "%2x:%2x:%2x:%2x:%2x:%2x%n", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &n) == 6 && n == 17) {
+            int device = b[2] << 16 | b[3] << 8 | b[4];
+
+            if (device < options.devices && scanner->discovered[device] == 0) {
+                scanner->discovered[device] = 1;
+            }
+            scanner->discoveries++;
+            i += 16;
+        }
+    }
+}
+
+static void add_latency(struct ScannerThread *scanner, uint64_t ns) {
+    if (scanner->latencies_count == scanner->latencies_size) {
+        scanner->latencies_size = scanner->latencies_size > 0 ? scanner->latencies_size * 2 : 4096;
+        scanner->latencies_us = realloc(scanner->latencies_us, scanner->latencies_size * sizeof(uint32_t));
+    }
+    scanner->latencies_us[scanner->latencies_count++] = ns / 1000;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+static int connect_scanner(int index) {
+    struct sockaddr_in server = { .sin_family = AF_INET, .sin_port = htons(options.port) };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+
+    inet_pton(AF_INET, options.host, &server.sin_addr);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Own source address per scanner on loopback
+    if ((ntohl(server.sin_addr.s_addr) >> 24) == 127) {
+        struct sockaddr_in local = { .sin_family = AF_INET };
+
+        local.sin_addr.s_addr = htonl(0x7f010000 | (index + 1));
+        bind(fd, (struct sockaddr *) &local, sizeof(local));
+    }
+
+    if (connect(fd, (struct sockaddr *) &server, sizeof(server)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void *scanner_main(void *arg) {
+    struct ScannerThread *scanner = arg;
+    uint64_t period_ns = options.rate > 0 ? 1000000000ULL / options.rate : 0;
+    uint64_t due_ns = histogram_now_ns() + (period_ns > 0 ? (uint64_t) rand() % period_ns : 0);
+    int next_device = 0;
+
+    scanner->request = malloc(REQUEST_MAX);
+    scanner->discovered = calloc(options.devices, 1);
+    scanner->fd = connect_scanner(scanner->index);
+
+    while (scanner->fd >= 0 && histogram_now_ns() < end_ns) {
+        int devices;
+        size_t len = build_request(scanner, &next_device, &devices);
+
+        if (period_ns > 0) {
+            uint64_t now_ns = histogram_now_ns();
+
+            if (due_ns > now_ns) {
+                struct timespec wait = { .tv_sec = (due_ns - now_ns) / 1000000000, .tv_nsec = (due_ns - now_ns) % 1000000000 };
+
+                nanosleep(&wait, NULL);
+            }
+        } else {
+            due_ns = histogram_now_ns();
+        }
+
+        const char *body;
+        size_t body_len;
+        int status = send_all(scanner->fd, scanner->request, len) ? read_response(scanner, &body, &body_len) : 0;
+
+        if (status == 0) {
+            scanner->errors++;
+            close(scanner->fd);
+            scanner->fd = connect_scanner(scanner->index);
+            continue;
+        }
+
+        add_latency(scanner, histogram_now_ns() - due_ns);
+        scanner->requests++;
+        scanner->bytes += len;
+        if (status == 200) {
+            scanner->devices += devices;
+            take_discoveries(scanner, body, body_len);
+        } else {
+            scanner->errors++;
+        }
+        due_ns += period_ns;
+    }
+
+    if (scanner->fd >= 0) {
+        close(scanner->fd);
+    }
+    return NULL;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-h host] [-p port] [-n scanners] [-d devices per scanner] [-b devices per request] "
+            "[-r requests/s per scanner] [-t seconds] [-f query|text|binary]\n", program);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+        } else if (strcmp(argv[i], "-h") == 0) {
+            options.host = argv[++i];
+        } else if (strcmp(argv[i], "-p") == 0) {
+            options.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0) {
+            options.scanners = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0) {
+            options.devices = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0) {
+            options.batch = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0) {
+            options.rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-t") == 0) {
+            options.seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0) {
+            i++;
+            options.format = strcmp(argv[i], "query") == 0 ? FORMAT_QUERY : strcmp(argv[i], "binary") == 0 ? FORMAT_BINARY
+                    : strcmp(argv[i], "text") == 0 ? FORMAT_TEXT : -1;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    struct in_addr host;
+
+    // A batch of the largest devices must fit the request buffer
+    if (options.scanners <= 0 || options.scanners > MAX_SCANNERS || options.devices <= 0 || options.devices > MAX_DEVICES
+            || options.batch <= 0 || options.batch > REQUEST_MAX / 256 || options.rate < 0 || options.seconds <= 0
+            || options.format < 0 || inet_pton(AF_INET, options.host, &host) != 1) {
+        usage(argv[0]);
+    }
+
+    pthread_attr_t attributes;
+
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, THREAD_STACK_SIZE);
+
+    uint64_t start_ns = histogram_now_ns();
+
+    end_ns = start_ns + options.seconds * 1000000000ULL;
+    for (int i = 0; i < options.scanners; i++) {
+        threads[i].index = i;
+        pthread_create(&threads[i].thread, &attributes, scanner_main, &threads[i]);
+    }
+
+    struct ScannerThread total = { 0 };
+    size_t samples = 0;
+
+    for (int i = 0; i < options.scanners; i++) {
+        pthread_join(threads[i].thread, NULL);
+        total.requests += threads[i].requests;
+        total.devices += threads[i].devices;
+        total.bytes += threads[i].bytes;
+        total.errors += threads[i].errors;
+        total.discoveries += threads[i].discoveries;
+        samples += threads[i].latencies_count;
+    }
+
+    double wall_s = (histogram_now_ns() - start_ns) / 1e9;
+    uint32_t *latencies = malloc((samples + 1) * sizeof(uint32_t));
+    size_t filled = 0;
+
+    for (int i = 0; i < options.scanners; i++) {
+        memcpy(latencies + filled, threads[i].latencies_us, threads[i].latencies_count * sizeof(uint32_t));
+        filled += threads[i].latencies_count;
+    }
+    qsort(latencies, samples, sizeof(uint32_t), compare_latencies);
+
+    printf("Load: %d scanners, %d devices each, %s, %d devices per request, %s\n", options.scanners, options.devices,
+           format_names[options.format], options.format == FORMAT_QUERY ? 1 : options.batch,
+           options.rate > 0 ? "fixed rate" : "as fast as answered");
+    if (options.rate > 0) {
+        printf("Offered %d requests/s per scanner, %d in total\n", options.rate, options.rate * options.scanners);
+    }
+    printf("Sustained %.0f requests/s, %.0f devices/s, %.1f MB/s over %.1f s\n", total.requests / wall_s,
+           total.devices / wall_s, total.bytes / wall_s / 1e6, wall_s);
+    printf("Requests: %llu, %llu errors, %llu discovery requests answered\n", (unsigned long long) total.requests,
+           (unsigned long long) total.errors, (unsigned long long) total.discoveries);
+    if (samples > 0) {
+        printf("Latency ms: p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n", latencies[samples / 2] / 1e3,
+               latencies[samples * 90 / 100] / 1e3, latencies[samples * 99 / 100] / 1e3,
+               latencies[samples * 999 / 1000] / 1e3, latencies[samples - 1] / 1e3);
+    }
+
+    return total.errors > 0;
+}
@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+"""Local stand-in for the scanner server, used to measure command-to-action latency.
+
+Accepts device reports (GET with query, batched POST as text or binary) and
+metrics records, and serves the long-poll command channel. Commands are issued
+at a fixed rate, cycling through the enabled kinds, and delivered to the
+waiting poll immediately. The scanner acknowledges a command on its next poll
+once the command was applied; the time from issuing to acknowledgement is the
+latency reported per command kind.
+Commands not acknowledged within --redeliver seconds are sent again.
+
+Point CONFIG_ESP_IP_ADDRESS at the machine running it (e.g. 192.168.0.10:8080).
+"""
+
+import argparse
+import itertools
+import random
+import struct
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+API_PATH = "/RESTServerScanner-1.0-SNAPSHOT/api/scanner"
+
+# Binary batches and metrics records, see main/wire_format.h
+WIRE_CONTENT_TYPE = "application/x-ble-scanner-batch"
+WIRE_ITEM_DEVICE = 0x02
+WIRE_ITEM_METRICS = 0x03
+
+# Scan parameter sets alternated by scan commands (interval, window in 0.625 ms units)
+SCAN_PARAMETERS = [(0x50, 0x30), (0xa0, 0x50)]
+
+
+class Commands:
+    def __init__(self, redeliver_s):
+        self.condition = threading.Condition()
+        self.ids = itertools.count(1)
+        self.pending = {}       # id -> (kind, line, issued, last delivery or None)
+        self.latencies = {}     # kind -> [seconds]
+        self.redeliveries = 0
+        self.redeliver_s = redeliver_s
+        self.addresses = set()
+
+    def issue(self, kind, arguments=""):
+        with self.condition:
+            command_id = next(self.ids)
+            line = f"{command_id} {kind} {arguments}".strip()
+            self.pending[command_id] = (kind, line, time.monotonic(), None)
+            self.condition.notify_all()
+
+    def acknowledge(self, ids):
+        now = time.monotonic()
+        with self.condition:
+            for command_id in ids:
+                entry = self.pending.pop(command_id, None)
+                if entry is not None:
+                    self.latencies.setdefault(entry[0], []).append(now - entry[2])
+
+    def _due(self, now):
+        return [command_id for command_id, (_, _, _, delivered) in self.pending.items()
+                if delivered is None or now - delivered > self.redeliver_s]
+
+    def take(self, wait_s):
+        """Lines to deliver, waiting up to wait_s for the first one."""
+        deadline = time.monotonic() + wait_s
+        with self.condition:
+            while True:
+                now = time.monotonic()
+                due = self._due(now)
+                if due or now >= deadline:
+                    break
+                self.condition.wait(min(deadline - now, 1.0))
+
+            lines = []
+            for command_id in sorted(due):
+                kind, line, issued, delivered = self.pending[command_id]
+                if delivered is not None:
+                    self.redeliveries += 1
+                self.pending[command_id] = (kind, line, issued, now)
+                lines.append(line)
+            return lines
+
+    def report(self):
+        with self.condition:
+            print(f"{'kind':10} {'count':>6} {'p50 ms':>8} {'p90 ms':>8} {'p99 ms':>8} {'max ms':>8}")
+            for kind, values in sorted(self.latencies.items()):
+                values = sorted(values)
+
+                def percentile(p):
+                    return values[min(len(values) - 1, int(p * len(values)))] * 1000
+
+                print(f"{kind:10} {len(values):6} {percentile(0.5):8.1f} {percentile(0.9):8.1f} "
+                      f"{percentile(0.99):8.1f} {values[-1] * 1000:8.1f}")
+            print(f"unacknowledged {len(self.pending)}, redelivered {self.redeliveries}, "
+                  f"known devices {len(self.addresses)}", flush=True)
+
+
+def wire_items(body):
+    """(type, value) of every item of a binary batch."""
+    if body[:3] != b"SCN" or len(body) < 4:
+        return
+    pos = 4
+    while pos + 3 <= len(body):
+        item_type, length = struct.unpack_from("<BH", body, pos)
+        yield item_type, body[pos + 3:pos + 3 + length]
+        pos += 3 + length
+
+
+def wire_addresses(body):
+    for item_type, value in wire_items(body):
+        if item_type == WIRE_ITEM_DEVICE and len(value) >= 7:
+            yield ":".join("%02x" % b for b in value[1:7])
+
+
+def make_handler(commands, verbose):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+
+        def log_message(self, format, *args):
+            if verbose:
+                super().log_message(format, *args)
+
+        def reply(self, status, body=b""):
+            self.send_response(status)
+            self.send_header("Content-Type", "text/plain")
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def remember_devices(self, queries):
+            for query in queries:
+                for address in parse_qs(query).get("address", []):
+                    commands.addresses.add(address)
+
+        def do_GET(self):
+            url = urlparse(self.path)
+
+            if url.path == API_PATH + "/commands":
+                query = parse_qs(url.query)
+                ids = [int(i) for value in query.get("ack", []) for i in value.split(",") if i.isdigit()]
+                commands.acknowledge(ids)
+
+                lines = commands.take(float(query.get("wait", ["25"])[0]))
+                if lines:
+                    self.reply(200, ("\n".join(lines) + "\n").encode())
+                else:
+                    self.reply(204)
+
+            elif url.path == API_PATH:
+                self.remember_devices([url.query])
+                self.reply(200)
+            else:
+                self.reply(404)
+
+        def do_POST(self):
+            url = urlparse(self.path)
+            body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+            binary = self.headers.get("Content-Type") == WIRE_CONTENT_TYPE
+
+            if url.path == API_PATH and binary:
+                commands.addresses.update(wire_addresses(body))
+                self.reply(200)
+            elif url.path == API_PATH:
+                self.remember_devices(body.decode(errors="replace").splitlines())
+                self.reply(200)
+            elif url.path == API_PATH + "/metrics" and binary:
+                # Decoded by host/wire_decoder.c, here only acknowledged
+                if verbose:
+                    print(f"metrics record of {len(body)} bytes", flush=True)
+                self.reply(200)
+            else:
+                self.reply(404)
+
+    return Handler
+
+
+def issue_commands(commands, kinds, interval_s):
+    scan_parameters = itertools.cycle(SCAN_PARAMETERS)
+
+    for kind in itertools.cycle(kinds):
+        time.sleep(interval_s)
+
+        if kind == "discover":
+            if not commands.addresses:
+                continue
+            commands.issue("discover", random.choice(sorted(commands.addresses)))
+        elif kind == "scan":
+            commands.issue("scan", "%d %d" % next(scan_parameters))
+        else:
+            commands.issue(kind)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-p", "--port", type=int, default=8080)
+    parser.add_argument("-i", "--interval", type=float, default=2.0, help="seconds between commands")
+    parser.add_argument("-k", "--kinds", default="discover,scan,flush", help="command kinds to cycle through (also metrics)")
+    parser.add_argument("-r", "--redeliver", type=float, default=10.0, help="seconds before an unacknowledged command is sent again")
+    parser.add_argument("-s", "--stats", type=float, default=30.0, help="seconds between latency reports")
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    commands = Commands(args.redeliver)
+    server = ThreadingHTTPServer(("", args.port), make_handler(commands, args.verbose))
+    server.daemon_threads = True
+
+    threading.Thread(target=issue_commands, args=(commands, args.kinds.split(","), args.interval), daemon=True).start()
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+
+    print(f"Listening on port {args.port}, API at {API_PATH}", flush=True)
+    try:
+        while True:
+            time.sleep(args.stats)
+            commands.report()
+    except KeyboardInterrupt:
+        commands.report()
+    finally:
+        server.shutdown()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,145 @@
+// Lookup rate and probe lengths of the hash-indexed device table (device_table.h).
+//
+// The table is built here with 10,000 slots (20,000 buckets) instead of the firmware
+// setting, and filled with 100 to 10,000 devices: half random addresses, half public
+// addresses of a few vendors, which share the first three bytes. Timed per population
+// are lookups of known devices and of unknown ones, in random order. Probe lengths are
+// the longest insert probe, which bounds every hit, and the longest run of occupied
+// buckets, the probe of the worst miss. The last row keeps the table full while new
+// devices keep coming, each insert evicting the least recently seen one.
+
+#include "device_table.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_DEVICES DEVICE_TABLE_CAPACITY
+#define LOOKUPS 8192
+#define MIN_RUN_NS 200000000ull
+
+static const int populations[] = { 100, 1000, 2500, 5000, 10000 };
+#define POPULATIONS (int) (sizeof(populations) / sizeof(populations[0]))
+
+static const uint8_t vendors[][3] = {
+    { 0x00, 0x1a, 0x7d }, { 0xac, 0x23, 0x3f }, { 0xf0, 0x08, 0xd1 }, { 0x3c, 0x71, 0xbf },
+};
+
+struct Address {
+    uint8_t bda[DEVICE_ADDR_LEN];
+    uint8_t addr_type;
+};
+
+static struct Address known[MAX_DEVICES];
+static struct Address unknown[LOOKUPS];
+static int order[LOOKUPS];
+
+static volatile int sink;
+
+static void random_address(struct Address *address) {
+    for (int i = 0; i < DEVICE_ADDR_LEN; i++) {
+        address->bda[i] = rand();
+    }
+
+    // Public address of a known vendor, or random static
+    if (rand() & 1) {
+        memcpy(address->bda, vendors[rand() % 4], 3);
+        address->addr_type = 0;
+    } else {
+        address->bda[0] |= 0xc0;
+        address->addr_type = 1;
+    }
+}
+
+// Nanoseconds per lookup of given addresses, in the order of the order array
+static double time_lookups(const struct Address *addresses) {
+    uint64_t elapsed = 0;
+    uint64_t lookups = 0;
+
+    while (elapsed < MIN_RUN_NS) {
+        uint64_t start = histogram_now_ns();
+        int found = 0;
+
+        for (int i = 0; i < LOOKUPS; i++) {
+            const struct Address *address = &addresses[order[i]];
+
+            found += device_table_find(address->bda, address->addr_type) >= 0;
+        }
+
+        elapsed += histogram_now_ns() - start;
+        lookups += LOOKUPS;
+        sink = found;
+    }
+
+    return (double) elapsed / lookups;
+}
+
+int main(void) {
+    srand(1);
+
+    for (int i = 0; i < LOOKUPS; i++) {
+        random_address(&unknown[i]);
+    }
+
+    printf("%d slots, %d buckets\n\n", DEVICE_TABLE_CAPACITY, DEVICE_TABLE_BUCKETS);
+    printf("%8s %6s %12s %12s %10s %10s %10s\n", "devices", "load", "hit Mops/s", "miss Mops/s", "max probe",
+           "worst miss", "insert ns");
+
+    for (int p = 0; p < POPULATIONS; p++) {
+        int count = populations[p];
+
+        device_table_init();
+
+        uint64_t start = histogram_now_ns();
+
+        for (int i = 0; i < count; i++) {
+            random_address(&known[i]);
+            if (device_table_find(known[i].bda, known[i].addr_type) >= 0) {
+                i--;
+                continue;
+            }
+            device_table_insert(known[i].bda, known[i].addr_type, i);
+        }
+
+        double insert_ns = (double) (histogram_now_ns() - start) / count;
+
+        for (int i = 0; i < LOOKUPS; i++) {
+            order[i] = rand() % count;
+        }
+        double hit_ns = time_lookups(known);
+
+        // Unknown addresses were drawn before the table was filled, a few may collide
+        for (int i = 0; i < LOOKUPS; i++) {
+            order[i] = i;
+        }
+        double miss_ns = time_lookups(unknown);
+
+        printf("%8d %6.2f %12.1f %12.1f %10d %10d %10.1f\n", count, (double) count / DEVICE_TABLE_BUCKETS,
+               1e3 / hit_ns, 1e3 / miss_ns, device_table_max_probe(), device_table_longest_run(), insert_ns);
+    }
+
+    // Full table with newcomers evicting the least recently seen device
+    uint64_t start = histogram_now_ns();
+    int inserts = 4 * MAX_DEVICES;
+
+    for (int i = 0; i < inserts; i++) {
+        struct Address address;
+
+        random_address(&address);
+        if (device_table_find(address.bda, address.addr_type) < 0) {
+            device_table_insert(address.bda, address.addr_type, MAX_DEVICES + i);
+        }
+    }
+
+    double insert_ns = (double) (histogram_now_ns() - start) / inserts;
+
+    printf("%8s %6.2f %12s %12s %10d %10d %10.1f  (%u evictions)\n", "churn",
+           (double) device_table_count() / DEVICE_TABLE_BUCKETS, "", "", device_table_max_probe(),
+           device_table_longest_run(), insert_ns, (unsigned) device_table_evictions());
+
+    printf("\nmax probe: longest insert probe since the table was cleared, bounds every hit\n");
+    printf("worst miss: longest run of occupied buckets in the index now\n");
+    printf("insert ns: address generation and the lookup before the insert included\n");
+    return 0;
+}
@@ -0,0 +1,150 @@
+// Throughput of extended advertising report reassembly (ext_adv.h).
+//
+// Advertisers send payloads split into 229 byte fragments, the most one HCI LE
+// Extended Advertising Report carries, and their fragments are interleaved
+// round robin like a controller may deliver them. Every completed report is
+// checked against the payload that was sent. The last part times compaction of
+// a full 1650 byte report into an observation record.
+
+#include "ext_adv.h"
+#include "adv_parser.h"
+#include "obs_ring.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAGMENT_SIZE 229
+#define MAX_ADVERTISERS 8
+#define TARGET_BYTES (256u * 1024 * 1024)
+
+struct Scenario {
+    int payload;
+    int advertisers;
+};
+
+static const struct Scenario scenarios[] = {
+    { 31, 1 }, { 254, 1 }, { 1650, 1 }, { 1650, 4 }, { 254, 8 }, { 1650, 8 },
+};
+
+static struct ExtAdvAssembler assembler;
+static uint8_t payloads[MAX_ADVERTISERS][EXT_ADV_MAX_DATA];
+
+// Name, 16-bit UUID list, a short and then long manufacturer data structures filling len bytes
+static void build_payload(uint8_t *p, int len, int advertiser) {
+    int i = 0;
+    int name_len = snprintf((char *) p + 2, 20, "ext-%d", advertiser);
+
+    p[i++] = name_len + 1;
+    p[i++] = AD_TYPE_NAME_COMPLETE;
+    i += name_len;
+
+    p[i++] = 5;
+    p[i++] = AD_TYPE_UUID16_COMPLETE;
+    p[i++] = 0x0f;
+    p[i++] = 0x18;
+    p[i++] = 0x0a;
+    p[i++] = 0x18;
+
+    p[i++] = 5;
+    p[i++] = AD_TYPE_MANUFACTURER;
+    p[i++] = 0xe5;
+    p[i++] = 0x02;
+    p[i++] = advertiser;
+    p[i++] = 0;
+
+    while (i < len) {
+        int field_len = len - i - 1 > 254 ? 254 : len - i - 1;
+
+        if (field_len < 1) {
+            p[i++] = 0;
+            break;
+        }
+        p[i++] = field_len;
+        p[i++] = AD_TYPE_MANUFACTURER;
+        for (int j = 1; j < field_len; j++, i++) {
+            p[i] = (uint8_t) (advertiser * 31 + i);
+        }
+    }
+}
+
+// One round: every advertiser sends its payload once. Returns completed reports, mismatches counted in errors.
+static int run_round(const struct Scenario *scenario, uint32_t now_ms, bool verify, int *errors) {
+    int fragments = (scenario->payload + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE;
+    int completed = 0;
+
+    for (int f = 0; f < fragments; f++) {
+        for (int a = 0; a < scenario->advertisers; a++) {
+            uint8_t bda[6] = { 0xc0, 0, 0, 0, 0, (uint8_t) a };
+            int offset = f * FRAGMENT_SIZE;
+            int len = scenario->payload - offset > FRAGMENT_SIZE ? FRAGMENT_SIZE : scenario->payload - offset;
+            uint8_t status = f == fragments - 1 ? EXT_ADV_DATA_COMPLETE : EXT_ADV_DATA_INCOMPLETE;
+            struct ExtAdvData report;
+
+            if (ext_adv_add(&assembler, bda, 1, 0, status, payloads[a] + offset, len, now_ms, &report)) {
+                completed++;
+                if (verify && (report.truncated || report.len != scenario->payload
+                        || memcmp(report.data, payloads[a], report.len) != 0)) {
+                    (*errors)++;
+                }
+            }
+        }
+    }
+
+    return completed;
+}
+
+int main(int argc, char **argv) {
+    printf("%-8s %-11s %10s %10s %12s %10s %8s %7s\n",
+           "payload", "advertisers", "fragments", "reports", "ns/fragment", "MB/s", "evicted", "errors");
+
+    for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+        const struct Scenario *scenario = &scenarios[s];
+        int rounds = TARGET_BYTES / (scenario->payload * scenario->advertisers);
+        int errors = 0;
+
+        for (int a = 0; a < scenario->advertisers; a++) {
+            build_payload(payloads[a], scenario->payload, a);
+        }
+
+        // Checked round first, then the timed ones
+        ext_adv_init(&assembler);
+        run_round(scenario, 0, true, &errors);
+
+        ext_adv_init(&assembler);
+        int reports = 0;
+        uint64_t start = histogram_now_ns();
+        for (int r = 0; r < rounds; r++) {
+            reports += run_round(scenario, r, false, &errors);
+        }
+        uint64_t elapsed = histogram_now_ns() - start;
+
+        uint32_t fragments = assembler.counters.fragments;
+
+        printf("%-8d %-11d %10u %10d %12.1f %10.0f %8u %7d\n", scenario->payload, scenario->advertisers,
+               (unsigned) fragments, reports, (double) elapsed / fragments,
+               (double) rounds * scenario->payload * scenario->advertisers * 1000.0 / elapsed,
+               (unsigned) assembler.counters.evicted, errors);
+    }
+
+    // Compaction keeps the identity fields of a long report within one observation
+    uint8_t out[OBS_DATA_LEN];
+    struct AdvReport parsed;
+    size_t len = 0;
+    int iterations = 10000000;
+
+    build_payload(payloads[0], EXT_ADV_MAX_DATA, 0);
+
+    uint64_t start = histogram_now_ns();
+    for (int i = 0; i < iterations; i++) {
+        len = ext_adv_compact(payloads[0], EXT_ADV_MAX_DATA, out, sizeof(out));
+    }
+    double compact_ns = (double) (histogram_now_ns() - start) / iterations;
+
+    adv_parse(out, len, NULL, 0, &parsed);
+    printf("Compaction of %d bytes into %zu: %.1f ns, name %s, %d manufacturer fields kept\n", EXT_ADV_MAX_DATA, len,
+           compact_ns, parsed.name.data != NULL ? "kept" : "LOST", parsed.manufacturer_data_count);
+
+    return 0;
+}
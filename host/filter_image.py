@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Builds an image of the "filter" partition from a list of addresses and OUI prefixes.
+
+The list has one entry per line, "aa:bb:cc:dd:ee:ff" for a device address or
+"aa:bb:cc" for every public address of a vendor; text after '#' is ignored. The
+image holds the header and the sorted keys described in main/addr_filter.h and is
+written with parttool.py:
+
+    python3 host/filter_image.py -m deny list.txt filter.bin
+    parttool.py -p <PORT_NUMBER> write_partition --partition-name filter --input filter.bin
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x544C4641
+VERSION = 1
+PREFIX_FLAG = 1 << 48
+MODES = {"off": 0, "allow": 1, "deny": 2}
+
+# Size of the partition in partitions.csv
+PARTITION_SIZE = 0x10000
+
+
+def parse_entry(text):
+    parts = text.split(":")
+    if len(parts) not in (3, 6) or any(len(part) != 2 for part in parts):
+        raise ValueError(f"not an address or OUI prefix: {text}")
+
+    value = int("".join(parts), 16)
+    return value if len(parts) == 6 else PREFIX_FLAG | value << 24
+
+
+def fnv1a(data):
+    value = 2166136261
+    for byte in data:
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-m", "--mode", choices=MODES, default="allow", help="filter mode stored with the list")
+    parser.add_argument("-s", "--size", type=lambda text: int(text, 0), default=PARTITION_SIZE, help="partition size")
+    parser.add_argument("list", help="addresses and prefixes, one per line")
+    parser.add_argument("image", help="partition image to write")
+    args = parser.parse_args()
+
+    keys = set()
+    with open(args.list) as lines:
+        for number, line in enumerate(lines, 1):
+            entry = line.split("#", 1)[0].strip()
+            if not entry:
+                continue
+            try:
+                keys.add(parse_entry(entry))
+            except ValueError as error:
+                sys.exit(f"{args.list}:{number}: {error}")
+
+    body = b"".join(struct.pack("<Q", key) for key in sorted(keys))
+    header = struct.pack("<IBBHII", MAGIC, VERSION, MODES[args.mode], 0, len(keys), fnv1a(body))
+
+    if len(header) + len(body) > args.size:
+        sys.exit(f"{len(keys)} entries do not fit in {args.size} bytes")
+
+    # Erased flash after the list
+    image = header + body
+    with open(args.image, "wb") as output:
+        output.write(image + b"\xff" * (args.size - len(image)))
+
+    print(f"{len(keys)} entries, mode {args.mode}, {len(image)} of {args.size} bytes")
+
+
+if __name__ == "__main__":
+    main()
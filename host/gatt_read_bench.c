@@ -0,0 +1,283 @@
+// Round trips and connection dwell of characteristic value reads (gatt_reader.h).
+//
+// Every discovery target is a simulated GATT server holding the characteristics of the
+// configured UUID set. Its values are read four ways: one single read per value and the
+// Read Multiple batches of the planner, each at the default ATT MTU of 23 and after an
+// MTU exchange to CONFIG_ESP_GATT_MTU. A single read answers MTU - 1 bytes, longer
+// values take Read Blob requests; a Read Multiple answer is the concatenation of the
+// values cut at MTU - 1. Every request is one round trip, which costs a connection
+// interval on the link: the central sends in one connection event and the answer comes
+// in the next. Dwell adds the connection setup and the service discovery, the same for
+// every way of reading. Also checked: every value comes back whole and a values item
+// survives a round trip through the binary uplink format.
+
+#include "gatt_reader.h"
+#include "device_table.h"
+#include "uuid_list.h"
+#include "wire_encoder.h"
+#include "wire_decoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Connection event intervals of the dwell columns, in units of 1.25 ms
+static const int intervals[] = { 6, 24, 40 };
+#define INTERVALS (int) (sizeof(intervals) / sizeof(intervals[0]))
+
+// Round trips before the values: connection setup, primary services and the characteristics
+// of the three services by Read By Type, the last answer of each empty
+#define DISCOVERY_ROUND_TRIPS 9
+
+#define MAX_VALUE 64
+
+struct SimChar {
+    uint16_t uuid16;
+    const char *value;      // Strings are sent without terminator
+    uint8_t len;            // Set for binary values
+};
+
+struct Profile {
+    const char *name;
+    int count;
+    struct SimChar chars[GATT_READER_MAX_CHARS];
+};
+
+static const struct Profile profiles[] = {
+    { "heart rate strap", 11, {
+        { 0x2a00, "Polar H10 8C4F2A1D" },
+        { 0x2a01, "\x41\x03", 2 },
+        { 0x2a19, "\x57", 1 },
+        { 0x2a24, "H10" },
+        { 0x2a25, "8C4F2A1D" },
+        { 0x2a26, "5.0.0" },
+        { 0x2a27, "39044024.10" },
+        { 0x2a28, "3.1.1" },
+        { 0x2a29, "Polar Electro Oy" },
+        { 0x2a23, "\x1d\x2a\x4f\xfe\xff\x8c\xa0\x00", 8 },
+        { 0x2a50, "\x01\x6b\x00\x0d\x00\x01\x00", 7 },
+    } },
+    { "sensor, long strings", 9, {
+        { 0x2a00, "Environmental Sensor Tag 4E21" },
+        { 0x2a01, "\x40\x05", 2 },
+        { 0x2a19, "\x64", 1 },
+        { 0x2a24, "ENV-TAG-2 (rev C)" },
+        { 0x2a26, "v2.14.3-rc1+build.20240511" },
+        { 0x2a27, "PCA10059 1.0.0" },
+        { 0x2a29, "Nordic Semiconductor ASA" },
+        { 0x2a23, "\x21\x4e\x3a\xfe\xff\x12\x34\x56", 8 },
+        { 0x2a50, "\x01\x59\x00\x01\x00\x03\x02", 7 },
+    } },
+    { "beacon, GAP only", 3, {
+        { 0x2a00, "iTag" },
+        { 0x2a01, "\x00\x02", 2 },
+        { 0x2a19, "\x3c", 1 },
+    } },
+    // Appearance answered with 4 bytes, the Read Multiple answer does not split
+    { "non-conforming", 3, {
+        { 0x2a01, "\x00\x00\x01\x00", 4 },
+        { 0x2a19, "\x10", 1 },
+        { 0x2a50, "\x02\x34\x12\x01\x00\x01\x00", 7 },
+    } },
+};
+
+#define PROFILES (int) (sizeof(profiles) / sizeof(profiles[0]))
+
+struct Received {
+    const struct Profile *profile;
+    int count;
+    int errors;
+};
+
+static size_t value_len(const struct SimChar *sim_char) {
+    return sim_char->len > 0 ? sim_char->len : strlen(sim_char->value);
+}
+
+// Characteristics are at handles 3, 6, 9... (declaration, value, descriptor)
+static const struct SimChar *char_at(const struct Profile *profile, uint16_t handle) {
+    return &profile->chars[handle / 3 - 1];
+}
+
+// Single read with the Read Blob requests of a long value, returns round trips
+static int single_read(const struct SimChar *sim_char, int mtu) {
+    size_t len = value_len(sim_char);
+    int round_trips = 1;
+
+    // Stack goes on with Read Blob while answers fill the MTU
+    for (size_t offset = mtu - 1; offset <= len; offset += mtu - 1) {
+        round_trips++;
+    }
+    return round_trips;
+}
+
+static void check_value(uint16_t uuid16, const uint8_t *value, size_t len, void *arg) {
+    struct Received *received = arg;
+    const struct SimChar *sim_char = NULL;
+
+    for (int i = 0; i < received->profile->count; i++) {
+        if (received->profile->chars[i].uuid16 == uuid16) {
+            sim_char = &received->profile->chars[i];
+        }
+    }
+
+    if (sim_char == NULL || value_len(sim_char) != len || memcmp(sim_char->value, value, len) != 0) {
+        printf("  value %04x of %s read wrong\n", uuid16, received->profile->name);
+        received->errors++;
+    }
+    received->count++;
+}
+
+// Every value on its own
+static int read_single(const struct Profile *profile, int mtu) {
+    int round_trips = 0;
+
+    for (int i = 0; i < profile->count; i++) {
+        round_trips += single_read(&profile->chars[i], mtu);
+    }
+    return round_trips;
+}
+
+// Planner batches, answered like a server would. Returns round trips.
+static int read_multiple(const struct Profile *profile, int mtu, struct Received *received, int *retries) {
+    struct GattReadPlan plan;
+    uint16_t handles[GATT_READER_MAX_BATCH];
+    uint8_t answer[GATT_READER_MAX_BATCH * MAX_VALUE];
+    int round_trips = 0;
+    int count;
+
+    gatt_reader_init(&plan);
+    gatt_reader_set_mtu(&plan, mtu);
+    for (int i = 0; i < profile->count; i++) {
+        gatt_reader_add(&plan, 3 * (i + 1), profile->chars[i].uuid16);
+    }
+
+    while ((count = gatt_reader_next(&plan, handles)) > 0) {
+        size_t len = 0;
+
+        if (count == 1) {
+            const struct SimChar *sim_char = char_at(profile, handles[0]);
+
+            // Whole value, after the Read Blob requests
+            round_trips += single_read(sim_char, mtu);
+            len = value_len(sim_char);
+            memcpy(answer, sim_char->value, len);
+        } else {
+            round_trips++;
+            for (int i = 0; i < count; i++) {
+                const struct SimChar *sim_char = char_at(profile, handles[i]);
+
+                memcpy(answer + len, sim_char->value, value_len(sim_char));
+                len += value_len(sim_char);
+            }
+            if (len > (size_t) mtu - 1) {
+                len = mtu - 1;
+            }
+        }
+
+        gatt_reader_complete(&plan, answer, len, check_value, received);
+    }
+
+    *retries = plan.retries;
+    return round_trips;
+}
+
+static void check_wire_device(const struct WireDevice *decoded, void *arg) {
+    for (int i = 0; i < decoded->values_count; i++) {
+        check_value(decoded->values[i].uuid16, decoded->values[i].bytes, decoded->values[i].len, arg);
+    }
+}
+
+// Values item through the binary uplink format
+static int check_wire(const struct Profile *profile) {
+    static struct Device device;
+    static uint8_t batch[1024];
+    uint8_t values[512];
+    size_t values_len = 0;
+    struct WireEncoder encoder;
+    int errors = 0;
+
+    for (int i = 0; i < profile->count; i++) {
+        size_t len = value_len(&profile->chars[i]);
+
+        values[values_len] = profile->chars[i].uuid16 & 0xff;
+        values[values_len + 1] = profile->chars[i].uuid16 >> 8;
+        values[values_len + 2] = len;
+        memcpy(values + values_len + 3, profile->chars[i].value, len);
+        values_len += 3 + len;
+    }
+
+    memset(&device, 0, sizeof(device));
+    uuid_list_init(&device.uuids);
+    strcpy(device.name, profile->name);
+
+    wire_encoder_init(&encoder, batch, sizeof(batch));
+    if (!wire_encoder_add_device(&encoder, &device, values, values_len, true, false)) {
+        return 1;
+    }
+
+    struct Received received = { .profile = profile };
+
+    if (wire_decode(batch, encoder.length, check_wire_device, &received) != 1 || received.count != profile->count) {
+        errors++;
+    }
+    return errors + received.errors;
+}
+
+int main(int argc, char **argv) {
+    static const char *ways[] = { "single, MTU 23", "single, MTU exchange", "multiple, MTU 23", "multiple, MTU exchange" };
+    int totals[4] = { 0 };
+    int errors = 0;
+
+    uuid_pool_init();
+
+    printf("MTU exchange to %d, dwell adds %d round trips of connection setup and service discovery\n\n",
+           CONFIG_ESP_GATT_MTU, DISCOVERY_ROUND_TRIPS);
+    printf("%-22s %-24s %6s %7s", "device", "reads", "values", "round");
+    for (int i = 0; i < INTERVALS; i++) {
+        printf("  dwell %4.1f", intervals[i] * 1.25);
+    }
+    printf("\n%-22s %-24s %6s %7s", "", "", "", "trips");
+    for (int i = 0; i < INTERVALS; i++) {
+        printf("  %10s", "ms");
+    }
+    printf("\n");
+
+    for (int p = 0; p < PROFILES; p++) {
+        const struct Profile *profile = &profiles[p];
+        int round_trips[4];
+        int retries[4] = { 0 };
+
+        round_trips[0] = read_single(profile, GATT_READER_DEFAULT_MTU);
+        round_trips[1] = 1 + read_single(profile, CONFIG_ESP_GATT_MTU);
+
+        for (int way = 2; way < 4; way++) {
+            struct Received received = { .profile = profile };
+            int mtu = way == 2 ? GATT_READER_DEFAULT_MTU : CONFIG_ESP_GATT_MTU;
+
+            round_trips[way] = (way == 3 ? 1 : 0) + read_multiple(profile, mtu, &received, &retries[way]);
+            errors += received.errors + (received.count != profile->count);
+        }
+
+        for (int way = 0; way < 4; way++) {
+            totals[way] += round_trips[way];
+            printf("%-22s %-24s %6d %7d", way == 0 ? profile->name : "", ways[way], profile->count, round_trips[way]);
+            for (int i = 0; i < INTERVALS; i++) {
+                printf("  %10.1f", (DISCOVERY_ROUND_TRIPS + round_trips[way]) * intervals[i] * 1.25);
+            }
+            if (retries[way] > 0) {
+                printf("  (%d read again)", retries[way]);
+            }
+            printf("\n");
+        }
+
+        errors += check_wire(profile);
+    }
+
+    printf("\nRound trips for the %d devices:", PROFILES);
+    for (int way = 0; way < 4; way++) {
+        printf(" %s %d%s", ways[way], totals[way], way < 3 ? "," : "\n");
+    }
+    printf("Errors: %d\n", errors);
+
+    return errors > 0;
+}
@@ -0,0 +1,371 @@
+#include "hal_stub.h"
+#include "scanner_hal.h"
+#include "scanner_core.h"
+#include "http_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if HAL_STUB_MBEDTLS
+#include "mbedtls/aes.h"
+#else
+#define OPENSSL_API_COMPAT 0x10100000L
+#include <openssl/aes.h>
+#endif
+
+bool hal_log_enabled = false;
+
+struct HalStubStats hal_stub_stats;
+
+static uint32_t stub_now_ms = 0;
+static bool stub_wifi_connected = true;
+
+#define STUB_MAX_OPENS 16
+
+// In memory replacement of the NVS namespace, survives scanner_core_init like flash survives a reboot
+#define STUB_STORE_KEYS 256
+#define STUB_STORE_BLOB_SIZE 2048
+
+static char stub_response[512];
+static bool stub_response_pending = false;
+
+// POSTs answered with another status than 200
+static char stub_post_type[64];
+static bool stub_post_any = false;
+static int stub_post_status = 200;
+
+// Connections requested and not yet taken by the host tool
+static uint8_t stub_open_bda[STUB_MAX_OPENS][6];
+static uint8_t stub_open_addr_type[STUB_MAX_OPENS];
+static int stub_open_count = 0;
+
+struct StubStoreEntry {
+    char key[16];
+    size_t len;
+    uint8_t data[STUB_STORE_BLOB_SIZE];
+};
+
+static struct StubStoreEntry stub_store[STUB_STORE_KEYS];
+static int stub_store_count = 0;
+
+// In memory replacement of the spool partition, erased flash reads as 0xff
+#define STUB_SPOOL_SECTOR_SIZE 4096
+
+static uint8_t *stub_spool = NULL;
+static size_t stub_spool_size = 0;
+
+// Same for the address filter partition
+static uint8_t *stub_filter = NULL;
+static size_t stub_filter_size = 0;
+
+void hal_stub_set_time_ms(uint32_t now_ms) {
+    stub_now_ms = now_ms;
+}
+
+void hal_stub_set_wifi(bool connected) {
+    stub_wifi_connected = connected;
+}
+
+void hal_stub_set_http_response(const char *body) {
+    if (body == NULL) {
+        stub_response_pending = false;
+        return;
+    }
+
+    strncpy(stub_response, body, sizeof(stub_response) - 1);
+    stub_response[sizeof(stub_response) - 1] = '\0';
+    stub_response_pending = true;
+}
+
+void hal_stub_set_post_status(const char *content_type, int status) {
+    stub_post_status = status;
+    stub_post_any = content_type == NULL;
+    snprintf(stub_post_type, sizeof(stub_post_type), "%s", content_type != NULL ? content_type : "");
+}
+
+void hal_stub_set_spool_size(size_t size) {
+    free(stub_spool);
+    stub_spool = NULL;
+    stub_spool_size = 0;
+
+    if (size > 0 && (stub_spool = malloc(size)) != NULL) {
+        memset(stub_spool, 0xff, size);
+        stub_spool_size = size;
+    }
+}
+
+void hal_stub_set_filter_size(size_t size) {
+    free(stub_filter);
+    stub_filter = NULL;
+    stub_filter_size = 0;
+
+    if (size > 0 && (stub_filter = malloc(size)) != NULL) {
+        memset(stub_filter, 0xff, size);
+        stub_filter_size = size;
+    }
+}
+
+void hal_stub_clear_store(void) {
+    stub_store_count = 0;
+}
+
+static struct StubStoreEntry *find_store_entry(const char *key) {
+    for (int i = 0; i < stub_store_count; i++) {
+        if (strcmp(stub_store[i].key, key) == 0) {
+            return &stub_store[i];
+        }
+    }
+    return NULL;
+}
+
+bool hal_stub_take_gattc_open(uint8_t *bda, uint8_t *addr_type) {
+    if (stub_open_count == 0) {
+        return false;
+    }
+
+    stub_open_count--;
+    memcpy(bda, stub_open_bda[stub_open_count], 6);
+    *addr_type = stub_open_addr_type[stub_open_count];
+
+    return true;
+}
+
+uint32_t hal_now_ms(void) {
+    return stub_now_ms;
+}
+
+// Host has no cycle counter, durations are measured in nanoseconds of the monotonic clock
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint32_t hal_cycle_count(void) {
+    return (uint32_t) monotonic_ns();
+}
+
+uint32_t hal_cycles_per_us(void) {
+    return 1000;
+}
+
+uint32_t hal_timer_us(void) {
+    return (uint32_t) (monotonic_ns() / 1000);
+}
+
+void hal_gap_start_scanning(uint32_t duration_s) {
+    hal_stub_stats.scan_starts++;
+}
+
+void hal_gap_stop_scanning(void) {
+    hal_stub_stats.scan_stops++;
+}
+
+void hal_gattc_open(const uint8_t *bda, uint8_t addr_type) {
+    if (stub_open_count < STUB_MAX_OPENS) {
+        memcpy(stub_open_bda[stub_open_count], bda, 6);
+        stub_open_addr_type[stub_open_count] = addr_type;
+        stub_open_count++;
+    }
+
+    hal_stub_stats.gattc_opens++;
+}
+
+void hal_gattc_close(const uint8_t *bda) {
+    hal_stub_stats.gattc_closes++;
+}
+
+int hal_http_request(const char *url, const char *content_type, const char *body, int body_len) {
+    // Transport error, like a request without network on the ESP32
+    if (!stub_wifi_connected) {
+        return -1;
+    }
+
+    struct HttpUrl parsed;
+    char head[2304];
+
+    hal_stub_stats.http_requests++;
+    hal_stub_stats.http_bytes += strlen(url) + (body != NULL ? body_len : 0);
+
+    if (http_parse_url(url, &parsed)) {
+        hal_stub_stats.http_wire_bytes += http_format_request(head, sizeof(head), &parsed,
+                                                              body != NULL ? content_type : NULL, body_len);
+    }
+    hal_stub_stats.http_wire_bytes += body != NULL ? body_len : 0;
+
+    if (body != NULL) {
+        hal_stub_stats.http_posts++;
+
+        if (stub_post_status != 200 && (stub_post_any || strcmp(content_type, stub_post_type) == 0)) {
+            return stub_post_status;
+        }
+    }
+
+    if (stub_response_pending) {
+        stub_response_pending = false;
+        scanner_core_on_http_data(stub_response, strlen(stub_response));
+    }
+
+    return 200;
+}
+
+bool hal_wifi_connected(void) {
+    return stub_wifi_connected;
+}
+
+bool hal_store_read(const char *key, void *data, size_t *len) {
+    struct StubStoreEntry *entry = find_store_entry(key);
+
+    hal_stub_stats.store_reads++;
+
+    if (entry == NULL || entry->len > *len) {
+        return false;
+    }
+
+    memcpy(data, entry->data, entry->len);
+    *len = entry->len;
+
+    return true;
+}
+
+bool hal_store_write(const char *key, const void *data, size_t len) {
+    struct StubStoreEntry *entry = find_store_entry(key);
+
+    hal_stub_stats.store_writes++;
+
+    if (len > STUB_STORE_BLOB_SIZE) {
+        return false;
+    }
+
+    if (entry == NULL) {
+        if (stub_store_count == STUB_STORE_KEYS || strlen(key) >= sizeof(entry->key)) {
+            return false;
+        }
+        entry = &stub_store[stub_store_count++];
+        strcpy(entry->key, key);
+    }
+
+    memcpy(entry->data, data, len);
+    entry->len = len;
+
+    return true;
+}
+
+void hal_store_erase(const char *key) {
+    struct StubStoreEntry *entry = find_store_entry(key);
+
+    // Moving last entry into the hole
+    if (entry != NULL) {
+        *entry = stub_store[--stub_store_count];
+    }
+}
+
+void hal_store_erase_prefix(const char *prefix) {
+    size_t prefix_len = strlen(prefix);
+
+    for (int i = 0; i < stub_store_count;) {
+        if (strncmp(stub_store[i].key, prefix, prefix_len) == 0) {
+            stub_store[i] = stub_store[--stub_store_count];
+        } else {
+            i++;
+        }
+    }
+}
+
+size_t hal_spool_size(void) {
+    return stub_spool_size;
+}
+
+bool hal_spool_read(size_t offset, void *data, size_t len) {
+    if (offset > stub_spool_size || len > stub_spool_size - offset) {
+        return false;
+    }
+
+    memcpy(data, stub_spool + offset, len);
+    return true;
+}
+
+// Programming flash only clears bits
+bool hal_spool_write(size_t offset, const void *data, size_t len) {
+    if (offset > stub_spool_size || len > stub_spool_size - offset) {
+        return false;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        stub_spool[offset + i] &= ((const uint8_t *) data)[i];
+    }
+    hal_stub_stats.spool_written += len;
+
+    return true;
+}
+
+bool hal_spool_erase_sector(size_t offset) {
+    if (offset % STUB_SPOOL_SECTOR_SIZE != 0 || offset + STUB_SPOOL_SECTOR_SIZE > stub_spool_size) {
+        return false;
+    }
+
+    memset(stub_spool + offset, 0xff, STUB_SPOOL_SECTOR_SIZE);
+    hal_stub_stats.spool_erases++;
+
+    return true;
+}
+
+size_t hal_filter_size(void) {
+    return stub_filter_size;
+}
+
+bool hal_filter_read(size_t offset, void *data, size_t len) {
+    if (offset > stub_filter_size || len > stub_filter_size - offset) {
+        return false;
+    }
+
+    memcpy(data, stub_filter + offset, len);
+    return true;
+}
+
+bool hal_filter_write(size_t offset, const void *data, size_t len) {
+    if (offset > stub_filter_size || len > stub_filter_size - offset) {
+        return false;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        stub_filter[offset + i] &= ((const uint8_t *) data)[i];
+    }
+    return true;
+}
+
+bool hal_filter_erase(size_t len) {
+    size_t sectors_len = (len + STUB_SPOOL_SECTOR_SIZE - 1) / STUB_SPOOL_SECTOR_SIZE * STUB_SPOOL_SECTOR_SIZE;
+
+    if (len > stub_filter_size) {
+        return false;
+    }
+    if (sectors_len > stub_filter_size) {
+        sectors_len = stub_filter_size;
+    }
+
+    memset(stub_filter, 0xff, sectors_len);
+    return true;
+}
+
+// mbedtls like on the ESP32 (in software there), OpenSSL when mbedtls is not installed
+void hal_aes128_encrypt(const uint8_t *key, const uint8_t *in, uint8_t *out) {
+#if HAL_STUB_MBEDTLS
+    mbedtls_aes_context context;
+
+    mbedtls_aes_init(&context);
+    mbedtls_aes_setkey_enc(&context, key, 128);
+    mbedtls_aes_crypt_ecb(&context, MBEDTLS_AES_ENCRYPT, in, out);
+    mbedtls_aes_free(&context);
+#else
+    AES_KEY aes_key;
+
+    AES_set_encrypt_key(key, 128, &aes_key);
+    AES_encrypt(in, out, &aes_key);
+#endif
+}
+
+void hal_log_stats(void) {
+}
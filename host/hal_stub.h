@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Controls and counters of the stub hardware backend used by host tools
+
+struct HalStubStats {
+    uint32_t scan_starts;
+    uint32_t scan_stops;
+    uint32_t gattc_opens;
+    uint32_t gattc_closes;
+    uint32_t http_requests;
+    uint32_t http_posts;
+    uint64_t http_bytes;
+    uint64_t http_wire_bytes;   // Body and request line and headers as http_stream.h formats them
+    uint32_t store_reads;
+    uint32_t store_writes;
+    uint32_t spool_erases;
+    uint64_t spool_written;
+};
+
+extern struct HalStubStats hal_stub_stats;
+
+// Virtual clock returned by hal_now_ms
+void hal_stub_set_time_ms(uint32_t now_ms);
+
+void hal_stub_set_wifi(bool connected);
+
+// Body returned with the next HTTP response (addresses of devices to discover), NULL for none
+void hal_stub_set_http_response(const char *body);
+
+// Status answered to POSTs of given content type, every POST when NULL. Status 200 answers all requests again.
+void hal_stub_set_post_status(const char *content_type, int status);
+
+// Size of the in memory spool region, 0 removes it. Contents survive scanner_core_init.
+void hal_stub_set_spool_size(size_t size);
+
+// Size of the in memory address filter region, 0 removes it. Contents survive scanner_core_init.
+void hal_stub_set_filter_size(size_t size);
+
+// Forget everything written through hal_store_write, like erasing the NVS partition
+void hal_stub_clear_store(void);
+
+// Take one pending hal_gattc_open request, returns false when there is none
+bool hal_stub_take_gattc_open(uint8_t *bda, uint8_t *addr_type);
@@ -0,0 +1,50 @@
+#include "histogram.h"
+
+#include <stdio.h>
+#include <time.h>
+
+uint64_t histogram_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void histogram_add(struct Histogram *h, uint64_t ns) {
+    int bucket = 0;
+
+    while (bucket < HISTOGRAM_BUCKETS - 1 && (1ull << (bucket + 1)) <= ns) {
+        bucket++;
+    }
+
+    h->count++;
+    h->total_ns += ns;
+    h->buckets[bucket]++;
+    if (ns > h->max_ns) {
+        h->max_ns = ns;
+    }
+}
+
+uint64_t histogram_percentile(const struct Histogram *h, double percentile) {
+    uint64_t target = (uint64_t) (h->count * percentile);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > target) {
+            return 1ull << (i + 1);
+        }
+    }
+    return h->max_ns;
+}
+
+void histogram_print(const char *name, const struct Histogram *h) {
+    if (h->count == 0) {
+        printf("%-10s no events\n", name);
+        return;
+    }
+
+    printf("%-10s %10llu events, mean %6llu ns, p50 < %6llu ns, p99 < %7llu ns, max %8llu ns\n", name,
+           (unsigned long long) h->count, (unsigned long long) (h->total_ns / h->count),
+           (unsigned long long) histogram_percentile(h, 0.50), (unsigned long long) histogram_percentile(h, 0.99),
+           (unsigned long long) h->max_ns);
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+
+#define HISTOGRAM_BUCKETS 32
+
+// Log2 histogram of durations in nanoseconds
+struct Histogram {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+uint64_t histogram_now_ns(void);
+
+void histogram_add(struct Histogram *h, uint64_t ns);
+
+// Upper bound of the bucket holding given percentile
+uint64_t histogram_percentile(const struct Histogram *h, double percentile);
+
+void histogram_print(const char *name, const struct Histogram *h);
@@ -0,0 +1,243 @@
+// Request rate and heap churn of the uplink with a connection per request against one
+// kept alive connection, measured against a local stand-in HTTP server.
+//
+// The server thread answers every request with an empty 200 over HTTP/1.1 keep-alive,
+// optionally closing the connection every few requests like a server enforcing a
+// request limit. The client sends device reports as GET requests formatted by
+// http_stream.h:
+//   - connection per request, what the uplink did before: every request allocates a
+//     client with the 1 KB receive and transmit buffers of its configuration, connects,
+//     and frees it all again (esp_http_client_init allocates more than these, so its
+//     churn is higher still)
+//   - one client kept for every request, reconnecting only once the server closed
+// Heap calls of the client thread are counted with the malloc wrapper of alloc_count.h.
+
+#define _GNU_SOURCE
+
+#include "http_stream.h"
+#include "alloc_count.h"
+#include "histogram.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Connections per request leave sockets in TIME_WAIT, the run stays well below the port range
+#define REQUESTS 4000
+#define CLIENT_BUFFER_SIZE 1024
+
+#define REPORT_URL "http://127.0.0.1:%d/RESTServerScanner-1.0-SNAPSHOT/api/scanner?address=c0:11:22:00:2a:5a" \
+                   "&type=1&name=sensor-42&tx_power=-4&rssi=-67"
+
+struct Scenario {
+    const char *name;
+    bool keep_alive;
+    int server_close_every;     // Server closes after this many requests, 0 for never
+};
+
+static const struct Scenario scenarios[] = {
+    { "connection per request", false, 0 },
+    { "kept alive", true, 0 },
+    { "kept alive, server closes every 100", true, 100 },
+};
+#define SCENARIOS (int) (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static int listen_fd;
+static _Atomic int server_close_every;
+
+// Client state, what esp_http_client_init allocated for the uplink
+struct Client {
+    int fd;
+    char *rx_buffer;
+    char *tx_buffer;
+};
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+static int listen_local(int *port) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0
+            || getsockname(fd, (struct sockaddr *) &addr, &addr_len) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static int connect_local(int port) {
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Requests of one connection until the client goes away or the request limit is reached
+static void serve_requests(int fd) {
+    static const char answer[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+    static const char last_answer[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    char buffer[4096];
+    size_t used = 0;
+    int served = 0;
+
+    for (;;) {
+        char *end = memmem(buffer, used, "\r\n\r\n", 4);
+
+        if (end == NULL) {
+            ssize_t len = used < sizeof(buffer) ? read(fd, buffer + used, sizeof(buffer) - used) : 0;
+
+            if (len <= 0) {
+                return;
+            }
+            used += len;
+            continue;
+        }
+
+        // Reports are GET requests without a body
+        size_t head_len = end + 4 - buffer;
+        int close_every = atomic_load(&server_close_every);
+        bool last = close_every > 0 && ++served == close_every;
+
+        memmove(buffer, buffer + head_len, used - head_len);
+        used -= head_len;
+
+        if (last) {
+            write(fd, last_answer, sizeof(last_answer) - 1);
+            return;
+        }
+        if (write(fd, answer, sizeof(answer) - 1) < 0) {
+            return;
+        }
+    }
+}
+
+static void *server_thread(void *arg) {
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+
+        if (fd >= 0) {
+            serve_requests(fd);
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+static void client_open(struct Client *client, int port) {
+    client->rx_buffer = malloc(CLIENT_BUFFER_SIZE);
+    client->tx_buffer = malloc(CLIENT_BUFFER_SIZE);
+    client->fd = connect_local(port);
+}
+
+static void client_close(struct Client *client) {
+    close(client->fd);
+    free(client->rx_buffer);
+    free(client->tx_buffer);
+    client->fd = -1;
+}
+
+// One request, returns true when the server closes the connection after it
+static bool client_request(struct Client *client, const struct HttpUrl *url) {
+    struct HttpResponse response;
+    size_t head_len = http_format_request(client->tx_buffer, CLIENT_BUFFER_SIZE, url, NULL, 0);
+
+    if (head_len == 0 || write(client->fd, client->tx_buffer, head_len) != (ssize_t) head_len) {
+        fprintf(stderr, "Request failed\n");
+        exit(1);
+    }
+
+    http_response_init(&response);
+    while (!http_response_done(&response)) {
+        ssize_t len = read(client->fd, client->rx_buffer, CLIENT_BUFFER_SIZE);
+
+        if (len <= 0 || http_response_feed(&response, client->rx_buffer, len, NULL, NULL) < 0) {
+            fprintf(stderr, "Response failed\n");
+            exit(1);
+        }
+    }
+
+    return response.close;
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+int main(void) {
+    pthread_t server;
+    int port;
+    char url[256];
+    struct HttpUrl parsed;
+
+    listen_fd = listen_local(&port);
+    pthread_create(&server, NULL, server_thread, NULL);
+
+    snprintf(url, sizeof(url), REPORT_URL, port);
+    if (!http_parse_url(url, &parsed)) {
+        return 1;
+    }
+
+    printf("%d device reports per scenario, %d byte client buffers\n\n", REQUESTS, CLIENT_BUFFER_SIZE);
+    printf("%-38s %12s %9s %10s %10s %13s %13s\n", "scenario", "requests/s", "connects", "mean us", "p99 us",
+           "allocs/req", "bytes/req");
+
+    for (int s = 0; s < SCENARIOS; s++) {
+        const struct Scenario *scenario = &scenarios[s];
+        struct Histogram latency = { 0 };
+        struct AllocCount count;
+        struct Client client = { .fd = -1 };
+        int connects = 0;
+
+        atomic_store(&server_close_every, scenario->server_close_every);
+
+        uint64_t started = histogram_now_ns();
+
+        alloc_count_start(&count);
+        for (int i = 0; i < REQUESTS; i++) {
+            uint64_t request_started = histogram_now_ns();
+
+            // Connection is opened lazily, like get_uplink_client does
+            if (client.fd < 0) {
+                client_open(&client, port);
+                connects++;
+            }
+
+            bool closed = client_request(&client, &parsed);
+
+            if (!scenario->keep_alive || closed) {
+                client_close(&client);
+            }
+            histogram_add(&latency, histogram_now_ns() - request_started);
+        }
+        alloc_count_stop();
+
+        double elapsed_s = (histogram_now_ns() - started) / 1e9;
+
+        if (client.fd >= 0) {
+            client_close(&client);
+        }
+
+        printf("%-38s %12.0f %9d %10.1f %10llu %13.2f %13.1f\n", scenario->name, REQUESTS / elapsed_s, connects,
+               latency.total_ns / 1e3 / latency.count, (unsigned long long) (histogram_percentile(&latency, 0.99) / 1000),
+               (double) count.allocations / REQUESTS, (double) count.bytes / REQUESTS);
+    }
+
+    printf("\np99 us: upper bound of the log2 bucket\n");
+    return 0;
+}
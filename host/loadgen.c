@@ -0,0 +1,360 @@
+// Synthetic load generator for the host build of the scanner core.
+//
+// Feeds advertisement observations (what handle_gap_events pushes for every
+// ESP_GAP_SEARCH_INQ_RES_EVT) through the observation ring into the scanner
+// core on a virtual clock, and reports per-event CPU time and memory use.
+
+#include "hal_stub.h"
+#include "scanner_hal.h"
+#include "scanner_core.h"
+#include "device_table.h"
+#include "obs_ring.h"
+#include "histogram.h"
+#include "discovery_queue.h"
+#include "gatt_cache.h"
+#include "metrics.h"
+#include "spool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+struct Options {
+    int devices;
+    int rate;
+    int seconds;
+    int window_s;
+    int discoveries;
+    int offline_start_s;
+    int offline_s;
+};
+
+// Same size as the spool partition
+#define SPOOL_SIZE 0x58000
+
+// Uplink task wake up period of the ESP32 build
+#define POLL_MS 100
+
+#define MAX_SIMULATED_CONNECTIONS 16
+
+// Connection of the simulated discovery
+struct SimulatedConnection {
+    bool used;
+    uint8_t bda[6];
+    uint32_t done_ms;
+};
+
+static struct ObsRing ring;
+static struct SimulatedConnection connections[MAX_SIMULATED_CONNECTIONS];
+
+static void simulate_discovery(const uint8_t *bda, uint32_t now_ms);
+
+// Synthetic advertiser address
+static void device_address(int device, uint8_t *bda) {
+    bda[0] = 0xc0 | ((device >> 24) & 0x3f);
+    bda[1] = (device >> 16) & 0xff;
+    bda[2] = (device >> 8) & 0xff;
+    bda[3] = device & 0xff;
+    bda[4] = 0x5a;
+    bda[5] = 0xa5;
+}
+
+// Advertisement with flags, complete name and manufacturer data, scan response with TX power
+static void build_advertisement(int device, struct Observation *obs) {
+    uint8_t *p = obs->data;
+    int name_len = snprintf((char *) p + 5, 20, "dev-%d", device);
+
+    p[0] = 2; p[1] = 0x01; p[2] = 0x06;
+    p[3] = name_len + 1; p[4] = 0x09;
+    p += 5 + name_len;
+
+    p[0] = 5; p[1] = 0xff; p[2] = 0x59; p[3] = 0x00; p[4] = device & 0xff; p[5] = (device >> 8) & 0xff;
+    p += 6;
+
+    obs->adv_len = p - obs->data;
+
+    p[0] = 2; p[1] = 0x0a; p[2] = (uint8_t) -4;
+    obs->scan_rsp_len = 3;
+}
+
+// Accept connection requests, reading services and characteristics takes 0.5 to 2 s of virtual time
+static void accept_connections(uint32_t now_ms) {
+    uint8_t bda[6];
+    uint8_t addr_type;
+
+    while (hal_stub_take_gattc_open(bda, &addr_type)) {
+        for (int i = 0; i < MAX_SIMULATED_CONNECTIONS; i++) {
+            if (!connections[i].used) {
+                connections[i].used = true;
+                connections[i].done_ms = now_ms + 500 + rand() % 1500;
+                memcpy(connections[i].bda, bda, sizeof(bda));
+
+                struct Observation obs = { .timestamp_ms = now_ms, .kind = OBS_CONNECTED };
+                memcpy(obs.bda, bda, sizeof(bda));
+                obs_ring_push(&ring, &obs, NULL);
+                break;
+            }
+        }
+    }
+}
+
+// Answer finished connections like a device with a few services and characteristics
+static void finish_connections(uint32_t now_ms) {
+    for (int c = 0; c < MAX_SIMULATED_CONNECTIONS; c++) {
+        if (connections[c].used && now_ms >= connections[c].done_ms) {
+            connections[c].used = false;
+            simulate_discovery(connections[c].bda, now_ms);
+        }
+    }
+}
+
+// Vendor base of the 128-bit service, little endian (6e40xxxx-b5a3-f393-e0a9-e50e24dcca9e)
+static const uint8_t vendor_base[16] = {
+    0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x00, 0x00, 0x40, 0x6e,
+};
+
+// Two standard services and a vendor one, each with two characteristics, and two values
+static void simulate_discovery(const uint8_t *bda, uint32_t now_ms) {
+    struct Observation obs = { .timestamp_ms = now_ms };
+
+    memcpy(obs.bda, bda, sizeof(obs.bda));
+
+    for (int i = 0; i < 3; i++) {
+        bool vendor = i == 2;
+
+        obs.kind = OBS_SERVICE;
+        if (vendor) {
+            obs.adv_len = 16;
+            memcpy(obs.data, vendor_base, sizeof(vendor_base));
+            obs.data[12] = 0x01;
+        } else {
+            obs.adv_len = 2;
+            obs.data[0] = 0x00 + i;
+            obs.data[1] = 0x18;
+        }
+        obs_ring_push(&ring, &obs, NULL);
+
+        for (int j = 0; j < 2; j++) {
+            obs.kind = OBS_CHAR;
+            if (vendor) {
+                obs.data[12] = 0x02 + j;
+            } else {
+                obs.data[0] = 0x00 + i * 2 + j;
+                obs.data[1] = 0x2a;
+            }
+            obs_ring_push(&ring, &obs, NULL);
+        }
+    }
+
+    // Battery level and device name read after the services
+    obs.kind = OBS_VALUE;
+    obs.data[0] = 0x19;
+    obs.data[1] = 0x2a;
+    obs.data[2] = 87;
+    obs.adv_len = 1;
+    obs_ring_push(&ring, &obs, NULL);
+
+    obs.data[0] = 0x00;
+    obs.adv_len = snprintf((char *) obs.data + 2, OBS_DATA_LEN - 2, "Sensor %02X%02X", bda[4], bda[5]);
+    obs_ring_push(&ring, &obs, NULL);
+
+    obs.kind = OBS_DISCONNECTED;
+    obs_ring_push(&ring, &obs, NULL);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-n devices] [-r adv/s] [-t seconds] [-w window s] [-d discoveries/window] [-o offline start s:duration s] [-v]\n", program);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    struct Options options = { .devices = 100, .rate = 10000, .seconds = 60, .window_s = SCANNING_DURATION, .discoveries = 0 };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            hal_log_enabled = true;
+        } else if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+            options.devices = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-r") == 0) {
+            options.rate = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-t") == 0) {
+            options.seconds = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-w") == 0) {
+            options.window_s = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-d") == 0) {
+            options.discoveries = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+            if (sscanf(argv[++i], "%d:%d", &options.offline_start_s, &options.offline_s) != 2) {
+                usage(argv[0]);
+            }
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (options.devices <= 0 || options.rate <= 0 || options.seconds <= 0 || options.window_s <= 0) {
+        usage(argv[0]);
+    }
+
+    hal_stub_set_spool_size(SPOOL_SIZE);
+    scanner_core_init();
+    obs_ring_init(&ring);
+
+    struct Histogram adv_histogram = { 0 };
+    struct Histogram window_histogram = { 0 };
+    struct Histogram other_histogram = { 0 };
+
+    uint64_t total_events = (uint64_t) options.rate * options.seconds;
+    uint32_t next_window_ms = options.window_s * 1000;
+    uint64_t start_ns = histogram_now_ns();
+
+    // WiFi outage, and how long the backlog took to drain once it was over
+    uint32_t offline_start_ms = options.offline_start_s * 1000;
+    uint32_t offline_end_ms = offline_start_ms + options.offline_s * 1000;
+    uint32_t next_poll_ms = POLL_MS;
+    uint32_t max_backlog = 0;
+    uint32_t drained_ms = 0;
+
+    srand(1);
+
+    for (uint64_t event = 0; event <= total_events; event++) {
+        uint32_t now_ms = (uint32_t) (event * 1000 / options.rate);
+        struct Observation obs = { .timestamp_ms = now_ms };
+
+        hal_stub_set_time_ms(now_ms);
+
+        if (options.offline_s > 0) {
+            hal_stub_set_wifi(now_ms < offline_start_ms || now_ms >= offline_end_ms);
+        }
+
+        if (now_ms >= next_poll_ms) {
+            next_poll_ms += POLL_MS;
+            scanner_core_poll(now_ms);
+
+            if (spool_pending() > max_backlog) {
+                max_backlog = spool_pending();
+            }
+            if (drained_ms == 0 && options.offline_s > 0 && now_ms >= offline_end_ms && spool_pending() == 0) {
+                drained_ms = now_ms - offline_end_ms;
+            }
+        }
+
+        // Inquiry window boundary
+        if (now_ms >= next_window_ms || event == total_events) {
+            obs.kind = OBS_WINDOW_END;
+            next_window_ms += options.window_s * 1000;
+
+            // Server asks for discovery of some of the reported devices in its response
+            if (options.discoveries > 0) {
+                char response[512] = "";
+                int start = rand() % DEVICE_TABLE_CAPACITY;
+                int requested = 0;
+
+                for (int i = 0; i < DEVICE_TABLE_CAPACITY && requested < options.discoveries; i++) {
+                    int slot = (start + i) % DEVICE_TABLE_CAPACITY;
+                    if (devices[slot].used && strlen(response) + 19 < sizeof(response)) {
+                        strcat(response, devices[slot].address);
+                        strcat(response, "\n");
+                        requested++;
+                    }
+                }
+                hal_stub_set_http_response(response);
+            }
+        } else {
+            int device = rand() % options.devices;
+
+            obs.kind = OBS_ADV;
+            obs.addr_type = device & 1;
+            // Stationary devices, RSSI jitters around a fixed level
+            obs.rssi = -40 - (device % 50) - (rand() % 4);
+            device_address(device, obs.bda);
+            build_advertisement(device, &obs);
+        }
+
+        obs_ring_push(&ring, &obs, NULL);
+
+        // Draining ring like the uplink task does
+        while (obs_ring_pop(&ring, &obs)) {
+            uint64_t begin = histogram_now_ns();
+            scanner_core_process(&obs);
+            uint64_t elapsed = histogram_now_ns() - begin;
+
+            if (obs.kind == OBS_ADV) {
+                histogram_add(&adv_histogram, elapsed);
+            } else if (obs.kind == OBS_WINDOW_END) {
+                histogram_add(&window_histogram, elapsed);
+            } else {
+                histogram_add(&other_histogram, elapsed);
+            }
+
+            accept_connections(now_ms);
+        }
+
+        finish_connections(now_ms);
+    }
+
+    double wall_s = (histogram_now_ns() - start_ns) / 1e9;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("Load: %d devices, %d adv/s, %d s virtual time, %d s windows\n",
+           options.devices, options.rate, options.seconds, options.window_s);
+    printf("Wall time %.3f s, %.0f events/s sustained\n", wall_s, total_events / wall_s);
+    histogram_print("adv", &adv_histogram);
+    histogram_print("window", &window_histogram);
+    histogram_print("discovery", &other_histogram);
+    printf("Device table: %d/%d used, max probe %d, %u evictions\n",
+           device_table_count(), DEVICE_TABLE_CAPACITY, device_table_max_probe(), (unsigned) device_table_evictions());
+    printf("Ring: %u pushed, %u dropped, %u high water\n",
+           (unsigned) atomic_load(&ring.pushed), (unsigned) atomic_load(&ring.dropped), (unsigned) atomic_load(&ring.high_water));
+    printf("Reports: %u sent, %u suppressed, %u lost\n",
+           (unsigned) report_counters.sent, (unsigned) report_counters.suppressed, (unsigned) report_counters.lost);
+    printf("Discovery: %u queued, %u done, %u failed, %u timed out, %u rejected, max depth %d, latency %llu ms avg %u ms max\n",
+           (unsigned) discovery_counters.queued, (unsigned) discovery_counters.completed, (unsigned) discovery_counters.failed,
+           (unsigned) discovery_counters.timed_out, (unsigned) discovery_counters.rejected, discovery_counters.max_depth,
+           (unsigned long long) (discovery_counters.completed > 0 ? discovery_counters.latency_total_ms / discovery_counters.completed : 0),
+           (unsigned) discovery_counters.latency_max_ms);
+    printf("GATT cache: %d entries, %u hits, %u misses, %u invalidated, %u expired, %u evicted, %llu ms connection time saved\n",
+           gatt_cache_count(), (unsigned) gatt_cache_counters.hits, (unsigned) gatt_cache_counters.misses,
+           (unsigned) gatt_cache_counters.invalidated, (unsigned) gatt_cache_counters.expired,
+           (unsigned) gatt_cache_counters.evicted, (unsigned long long) gatt_cache_counters.saved_ms);
+    printf("Uplink: %u requests (%u POST), %llu bytes, %u connections opened\n",
+           (unsigned) hal_stub_stats.http_requests, (unsigned) hal_stub_stats.http_posts,
+           (unsigned long long) hal_stub_stats.http_bytes, (unsigned) hal_stub_stats.gattc_opens);
+    printf("UUID pool: %d/%d chunks at most, %d bases, %u dropped\n",
+           uuid_pool_stats.chunks_high_water, UUID_POOL_CHUNKS, uuid_pool_stats.bases_used,
+           (unsigned) (uuid_pool_stats.pool_exhausted + uuid_pool_stats.bases_exhausted));
+    printf("Memory: %zu bytes device table (%zu per device), %zu bytes UUID pool, %zu bytes ring, %ld KB max RSS\n",
+           sizeof(devices), sizeof(struct Device), (size_t) UUID_POOL_CHUNKS * sizeof(struct UuidChunk), sizeof(ring), usage.ru_maxrss);
+
+#if CONFIG_ESP_SPOOL
+    if (spool_counters.appended > 0) {
+        printf("Spool: %u batches (%llu bytes) stored, %u sent, %u dropped, %u waiting, backlog %u at most, "
+               "drained %.1f s after WiFi came back at %.0f B/s\n",
+               (unsigned) spool_counters.appended, (unsigned long long) spool_counters.appended_bytes,
+               (unsigned) spool_counters.drained, (unsigned) spool_counters.dropped, (unsigned) spool_pending(),
+               (unsigned) max_backlog, drained_ms / 1000.0,
+               spool_counters.drain_ms > 0 ? spool_counters.drained_bytes * 1000.0 / spool_counters.drain_ms : 0.0);
+        printf("Spool flash: %llu bytes programmed (write amplification %.2f), %u sectors erased\n",
+               (unsigned long long) hal_stub_stats.spool_written,
+               (double) hal_stub_stats.spool_written / spool_counters.appended_bytes, (unsigned) hal_stub_stats.spool_erases);
+    }
+#endif
+
+#if CONFIG_ESP_METRICS
+    // Core instrumentation, cycles are nanoseconds on the host
+    for (int stage = 0; stage < METRIC_STAGES; stage++) {
+        const struct MetricHistogram *histogram = &metrics.stages[stage];
+
+        if (histogram->count > 0) {
+            printf("Metrics %-12s %8u events, avg %8u, p50 < %8u, p99 < %8u, max %9u %s\n", metrics_stage_name(stage),
+                   (unsigned) histogram->count, (unsigned) (histogram->total / histogram->count),
+                   (unsigned) metrics_percentile(histogram, 50), (unsigned) metrics_percentile(histogram, 99),
+                   (unsigned) histogram->max, metrics_stage_unit(stage) == METRIC_UNIT_CYCLES ? "ns" : "us");
+        }
+    }
+#endif
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Overhead of the hot path instrumentation (metrics.h).
+//
+// Measures the histogram update alone, a timed section as the scanner core uses
+// it (two counter reads and the update), and the size and encode/decode time of
+// the metrics record. On the host the cycle counter is clock_gettime, on the
+// ESP32 it is a single register read, so the update is the part that carries over.
+
+#include "metrics.h"
+#include "wire_encoder.h"
+#include "wire_decoder.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ITERATIONS 10000000
+
+static volatile uint32_t sink;
+
+int main(int argc, char **argv) {
+    static uint8_t record[2048];
+    static struct WireMetrics decoded;
+    uint32_t value = 1;
+    uint64_t start;
+
+    metrics_reset();
+
+    // Spread over the buckets like real durations
+    start = histogram_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        value = value * 1103515245 + 12345;
+        metrics_add(METRIC_OBSERVATION, value >> (value & 31));
+    }
+    double add_ns = (double) (histogram_now_ns() - start) / ITERATIONS;
+
+    start = histogram_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        value = value * 1103515245 + 12345;
+        sink = value;
+    }
+    double loop_ns = (double) (histogram_now_ns() - start) / ITERATIONS;
+
+    start = histogram_now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        METRICS_START_CYCLES(started);
+        sink = i;
+        METRICS_STOP_CYCLES(METRIC_GAP_EVENT, started);
+    }
+    double section_ns = (double) (histogram_now_ns() - start) / ITERATIONS;
+
+    for (int stage = 0; stage < METRIC_STAGES; stage++) {
+        metrics_add(stage, 1000 + stage);
+    }
+
+    struct WireEncoder encoder;
+
+    start = histogram_now_ns();
+    for (int i = 0; i < 100000; i++) {
+        wire_encoder_init(&encoder, record, sizeof(record));
+        wire_encoder_add_metrics(&encoder, &metrics, i, hal_cycles_per_us());
+    }
+    double encode_ns = (double) (histogram_now_ns() - start) / 100000;
+
+    start = histogram_now_ns();
+    for (int i = 0; i < 100000; i++) {
+        if (wire_decode_metrics(record, encoder.length, &decoded) != 1) {
+            fprintf(stderr, "metrics record does not decode\n");
+            return 1;
+        }
+    }
+    double decode_ns = (double) (histogram_now_ns() - start) / 100000;
+
+    if (decoded.stages_count != METRIC_STAGES || decoded.stages[METRIC_OBSERVATION].count != ITERATIONS + 1) {
+        fprintf(stderr, "decoded metrics differ\n");
+        return 1;
+    }
+
+    printf("metrics_add              %6.1f ns\n", add_ns - loop_ns);
+    printf("timed section            %6.1f ns (counter reads included)\n", section_ns);
+    printf("record                   %6zu bytes, %d stages\n", encoder.length, decoded.stages_count);
+    printf("record encode            %6.0f ns\n", encode_ns);
+    printf("record decode            %6.0f ns\n", decode_ns);
+
+    return 0;
+}
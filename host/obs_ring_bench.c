@@ -0,0 +1,169 @@
+// Push latency and drops of the observation ring (obs_ring.h) with a consumer that
+// cannot keep up.
+//
+// A producer thread stands in for the Bluedroid callback and pushes 100,000
+// observations per second in bursts, each push timed. A consumer thread stands in for
+// the uplink task and spends a fixed time on every record it pops, or stops popping
+// now and then as it does during an uplink request. The producer sleeps between
+// bursts and the consumer yields while the ring is empty, so the bench also runs on a
+// single core. Scenarios go from a consumer that keeps up to one
+// that is saturated or stalled, so the ring runs full and pushes are dropped. Every
+// record carries a sequence number: the consumer checks they arrive in order and that
+// the gaps add up to the drops counted by the ring. Push times include reading the
+// clock, the first line gives that cost alone.
+
+#include "obs_ring.h"
+#include "histogram.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RUN_NS 500000000ull
+#define BURST_PERIOD_NS 500000
+#define BURST_RECORDS 50
+
+struct Scenario {
+    const char *name;
+    uint32_t work_ns;       // Consumer time per record
+    uint32_t stall_ms;      // Consumer stops popping this long...
+    uint32_t stall_every_ms;  // ...once per this period, 0 for never
+};
+
+static const struct Scenario scenarios[] = {
+    { "consumer keeps up (5 us/record)", 5000, 0, 0 },
+    { "consumer saturated (20 us/record)", 20000, 0, 0 },
+    { "consumer saturated (100 us/record)", 100000, 0, 0 },
+    { "stall 20 ms every 100 ms (5 us/record)", 5000, 20, 100 },
+};
+#define SCENARIOS (int) (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static struct ObsRing ring;
+static const struct Scenario *scenario;
+static _Atomic bool producer_done;
+
+// Consumer results
+static uint64_t popped;
+static uint64_t gaps;
+static uint32_t expected;
+static uint64_t out_of_order;
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+static void spin_until(uint64_t deadline_ns) {
+    while (histogram_now_ns() < deadline_ns) {
+    }
+}
+
+static void *consumer_thread(void *arg) {
+    struct Observation obs;
+    uint64_t started = histogram_now_ns();
+    uint64_t next_stall = started + (uint64_t) scenario->stall_every_ms * 1000000;
+
+    popped = 0;
+    gaps = 0;
+    expected = 0;
+    out_of_order = 0;
+
+    for (;;) {
+        if (scenario->stall_every_ms > 0 && histogram_now_ns() >= next_stall) {
+            spin_until(next_stall + (uint64_t) scenario->stall_ms * 1000000);
+            next_stall += (uint64_t) scenario->stall_every_ms * 1000000;
+        }
+
+        if (!obs_ring_pop(&ring, &obs)) {
+            if (atomic_load(&producer_done) && obs_ring_depth(&ring) == 0) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+
+        // Sequence number in the timestamp, dropped pushes leave a gap
+        if (obs.timestamp_ms < expected) {
+            out_of_order++;
+        } else {
+            gaps += obs.timestamp_ms - expected;
+        }
+        expected = obs.timestamp_ms + 1;
+        popped++;
+
+        spin_until(histogram_now_ns() + scenario->work_ns);
+    }
+
+    return NULL;
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+int main(void) {
+    struct Histogram clock_histogram = { 0 };
+
+    for (int i = 0; i < 100000; i++) {
+        uint64_t start = histogram_now_ns();
+        histogram_add(&clock_histogram, histogram_now_ns() - start);
+    }
+
+    printf("Ring of %d records of %d bytes, bursts of %d pushes every %d us for %llu ms per scenario\n\n",
+           OBS_RING_SIZE, (int) sizeof(struct Observation), BURST_RECORDS, BURST_PERIOD_NS / 1000,
+           (unsigned long long) (RUN_NS / 1000000));
+    histogram_print("clock", &clock_histogram);
+
+    for (int s = 0; s < SCENARIOS; s++) {
+        struct Histogram push_histogram = { 0 };
+        struct Observation obs;
+        pthread_t consumer;
+        uint32_t sequence = 0;
+
+        memset(&obs, 0, sizeof(obs));
+        obs.kind = OBS_ADV;
+        obs.adv_len = 31;
+
+        scenario = &scenarios[s];
+        obs_ring_init(&ring);
+        atomic_store(&producer_done, false);
+        pthread_create(&consumer, NULL, consumer_thread, NULL);
+
+        struct timespec next_burst;
+
+        clock_gettime(CLOCK_MONOTONIC, &next_burst);
+
+        for (uint64_t elapsed = 0; elapsed < RUN_NS; elapsed += BURST_PERIOD_NS) {
+            for (int i = 0; i < BURST_RECORDS; i++) {
+                obs.timestamp_ms = sequence++;
+
+                uint64_t start = histogram_now_ns();
+                obs_ring_push(&ring, &obs, NULL);
+                histogram_add(&push_histogram, histogram_now_ns() - start);
+            }
+
+            next_burst.tv_nsec += BURST_PERIOD_NS;
+            if (next_burst.tv_nsec >= 1000000000) {
+                next_burst.tv_nsec -= 1000000000;
+                next_burst.tv_sec++;
+            }
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_burst, NULL);
+        }
+
+        atomic_store(&producer_done, true);
+        pthread_join(consumer, NULL);
+
+        uint32_t dropped = atomic_load(&ring.dropped);
+
+        // Drops after the last record popped
+        gaps += sequence - expected;
+
+        printf("\n%s\n", scenario->name);
+        histogram_print("push", &push_histogram);
+        printf("%-10s %u pushed, %u dropped (%.1f%%) in %u overflows, high water %u, %s\n", "ring",
+               (unsigned) atomic_load(&ring.pushed), (unsigned) dropped, 100.0 * dropped / sequence,
+               (unsigned) atomic_load(&ring.overflows), (unsigned) atomic_load(&ring.high_water),
+               popped + dropped == sequence && gaps == dropped && out_of_order == 0 ? "sequence ok"
+                                                                                       : "SEQUENCE MISMATCH");
+    }
+
+    return 0;
+}
@@ -0,0 +1,224 @@
+// Replays a scan trace captured by trace_capture.c through the scanner core.
+//
+// The trace is the raw content of the "trace" partition, read with
+//   parttool.py read_partition --partition-name trace --output trace.bin
+// Sectors are replayed in sequence order, either at recorded speed (optionally
+// scaled) or as fast as possible, and per-event CPU time is reported.
+
+#include "hal_stub.h"
+#include "scanner_hal.h"
+#include "scanner_core.h"
+#include "device_table.h"
+#include "obs_ring.h"
+#include "scan_trace.h"
+#include "histogram.h"
+#include "adv_decoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+struct TraceSector {
+    uint32_t index;
+    uint32_t sequence;
+    uint32_t base_ms;
+};
+
+static struct ObsRing ring;
+
+static int compare_sectors(const void *a, const void *b) {
+    const struct TraceSector *x = a;
+    const struct TraceSector *y = b;
+
+    return (x->sequence > y->sequence) - (x->sequence < y->sequence);
+}
+
+static uint8_t *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = length > 0 ? malloc(length) : NULL;
+
+    if (data != NULL && fread(data, 1, length, file) != (size_t) length) {
+        free(data);
+        data = NULL;
+    }
+
+    fclose(file);
+    *size = data != NULL ? (size_t) length : 0;
+
+    return data;
+}
+
+// Sleep until the recorded time of the observation, scaled by speed
+static void wait_until(uint64_t anchor_ns, uint32_t anchor_ms, uint32_t timestamp_ms, double speed) {
+    uint64_t target = anchor_ns + (uint64_t) ((timestamp_ms - anchor_ms) * 1e6 / speed);
+    uint64_t now = histogram_now_ns();
+
+    if (target > now) {
+        struct timespec ts = { .tv_sec = (target - now) / 1000000000ull, .tv_nsec = (target - now) % 1000000000ull };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-f] [-s speed] [-v] trace.bin\n", program);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    bool fast = false;
+    double speed = 1.0;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            fast = true;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            hal_log_enabled = true;
+        } else if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+            speed = atof(argv[++i]);
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (path == NULL || speed <= 0) {
+        usage(argv[0]);
+    }
+
+    size_t size;
+    uint8_t *trace = read_file(path, &size);
+
+    if (trace == NULL) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        return 1;
+    }
+
+    // Partition is a ring, sectors are ordered by their sequence number
+    uint32_t sector_count = size / SCAN_TRACE_SECTOR_SIZE;
+    struct TraceSector *sectors = calloc(sector_count > 0 ? sector_count : 1, sizeof(*sectors));
+    uint32_t valid_sectors = 0;
+
+    for (uint32_t i = 0; i < sector_count; i++) {
+        struct TraceSector *sector = &sectors[valid_sectors];
+
+        if (scan_trace_read_header(trace + i * SCAN_TRACE_SECTOR_SIZE, &sector->sequence, &sector->base_ms)) {
+            sector->index = i;
+            valid_sectors++;
+        }
+    }
+
+    qsort(sectors, valid_sectors, sizeof(*sectors), compare_sectors);
+
+    scanner_core_init();
+    obs_ring_init(&ring);
+
+    struct Histogram adv_histogram = { 0 };
+    struct Histogram window_histogram = { 0 };
+
+    uint32_t records = 0;
+    uint32_t malformed = 0;
+    uint32_t boots = valid_sectors > 0 ? 1 : 0;
+    uint64_t traced_ms = 0;
+
+    uint32_t last_ms = 0;
+    uint32_t anchor_ms = 0;
+    uint64_t anchor_ns = histogram_now_ns();
+    uint64_t start_ns = anchor_ns;
+
+    for (uint32_t s = 0; s < valid_sectors; s++) {
+        const uint8_t *data = trace + sectors[s].index * SCAN_TRACE_SECTOR_SIZE;
+        size_t offset = SCAN_TRACE_HEADER_SIZE;
+        struct ScanTraceState state;
+
+        scan_trace_reset(&state, sectors[s].base_ms);
+
+        // Clock went back, the scanner rebooted and starts with empty state
+        if (s == 0 || sectors[s].base_ms < last_ms) {
+            if (s > 0) {
+                boots++;
+                scanner_core_init();
+            }
+            last_ms = sectors[s].base_ms;
+            anchor_ms = sectors[s].base_ms;
+            anchor_ns = histogram_now_ns();
+        }
+
+        while (offset < SCAN_TRACE_SECTOR_SIZE) {
+            struct Observation obs;
+            int n = scan_trace_decode(&state, data + offset, SCAN_TRACE_SECTOR_SIZE - offset, &obs);
+
+            if (n < 0) {
+                malformed++;
+            }
+            if (n <= 0) {
+                break;
+            }
+            offset += n;
+            records++;
+
+            traced_ms += obs.timestamp_ms - last_ms;
+            last_ms = obs.timestamp_ms;
+
+            if (!fast) {
+                wait_until(anchor_ns, anchor_ms, obs.timestamp_ms, speed);
+            }
+
+            hal_stub_set_time_ms(obs.timestamp_ms);
+            obs_ring_push(&ring, &obs, NULL);
+
+            // Draining ring like the uplink task does
+            while (obs_ring_pop(&ring, &obs)) {
+                uint64_t begin = histogram_now_ns();
+                scanner_core_process(&obs);
+                uint64_t elapsed = histogram_now_ns() - begin;
+
+                histogram_add(obs.kind == OBS_WINDOW_END ? &window_histogram : &adv_histogram, elapsed);
+            }
+        }
+    }
+
+    double wall_s = (histogram_now_ns() - start_ns) / 1e9;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("Trace: %u sectors, %u records, %u malformed, %u boots, %.1f s recorded\n",
+           (unsigned) valid_sectors, (unsigned) records, (unsigned) malformed, (unsigned) boots, traced_ms / 1000.0);
+    printf("Wall time %.3f s, %.0f events/s\n", wall_s, wall_s > 0 ? records / wall_s : 0.0);
+    histogram_print("adv", &adv_histogram);
+    histogram_print("window", &window_histogram);
+    printf("Device table: %d/%d used, max probe %d, %u evictions\n",
+           device_table_count(), DEVICE_TABLE_CAPACITY, device_table_max_probe(), (unsigned) device_table_evictions());
+    printf("Reports: %u sent, %u suppressed, %u lost\n",
+           (unsigned) report_counters.sent, (unsigned) report_counters.suppressed, (unsigned) report_counters.lost);
+
+    // Every identified device is a discovery connection the server can do without
+    printf("Identified: %u of %u devices from their advertisements\n",
+           (unsigned) report_counters.identified, (unsigned) report_counters.devices);
+    printf("Frames:");
+    for (int kind = ADV_KIND_NONE + 1; kind < ADV_KIND_COUNT; kind++) {
+        printf(" %s %u", adv_kind_name(kind), (unsigned) adv_decoder_counters.decoded[kind]);
+    }
+    printf("\n");
+    printf("Uplink: %u requests (%u POST), %llu bytes\n",
+           (unsigned) hal_stub_stats.http_requests, (unsigned) hal_stub_stats.http_posts,
+           (unsigned long long) hal_stub_stats.http_bytes);
+    printf("Memory: %ld KB max RSS\n", usage.ru_maxrss);
+
+    free(sectors);
+    free(trace);
+
+    return 0;
+}
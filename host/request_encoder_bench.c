@@ -0,0 +1,297 @@
+// Checks and cost of the bounded request encoder (request_encoder.h).
+//
+// The checks cover percent-encoding of every byte value, integers, truncation (only
+// complete pieces stay in the buffer) and rewinding, with every heap call of the thread
+// counted by the malloc wrapper of alloc_count.h: the encoder must not make any. The
+// benchmark encodes the query of a device with 20 services and 20 characteristics,
+// 128-bit UUIDs taken from a UUID list, appended the way build_device_query does, and
+// compares it with the concat() chain the query was built with before (a malloc per
+// piece, each previous string leaked there and freed here). Both format the UUIDs with
+// uuid_format, so it is also timed on its own and subtracted.
+
+#include "request_encoder.h"
+#include "uuid_list.h"
+#include "alloc_count.h"
+#include "histogram.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define URL_SIZE 2048
+#define SERVICES 20
+#define CHARS 20
+#define MIN_RUN_NS 200000000ull
+
+#define SERVER_PREFIX "http://192.168.0.10:8080/RESTServerScanner-1.0-SNAPSHOT/api/scanner?"
+#define DEVICE_ADDRESS "c0:11:22:33:44:55"
+#define DEVICE_NAME "Caf\xc3\xa9 Sensor #4 & Co"
+
+static int failures = 0;
+static volatile size_t sink;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+static bool is_unreserved(int c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || strchr("-._~:", c) != NULL;
+}
+
+static void check_encoder(void) {
+    struct RequestEncoder encoder;
+    char buffer[URL_SIZE];
+    char expected[URL_SIZE];
+    char input[256];
+    size_t length = 0;
+
+    // Every byte value on its own
+    for (int c = 1; c < 256; c++) {
+        input[c - 1] = (char) c;
+        if (c != 0 && is_unreserved(c)) {
+            expected[length++] = (char) c;
+        } else {
+            length += sprintf(expected + length, "%%%02X", c);
+        }
+    }
+    input[255] = '\0';
+    expected[length] = '\0';
+
+    request_encoder_init(&encoder, buffer, sizeof(buffer));
+    request_encoder_append_encoded(&encoder, input);
+    check(strcmp(buffer, expected) == 0 && encoder.length == length, "percent-encoding of every byte");
+
+    request_encoder_init(&encoder, buffer, sizeof(buffer));
+    request_encoder_append_encoded(&encoder, DEVICE_NAME);
+    check(strcmp(buffer, "Caf%C3%A9%20Sensor%20%234%20%26%20Co") == 0, "percent-encoding of a UTF-8 name");
+
+    request_encoder_init(&encoder, buffer, sizeof(buffer));
+    request_encoder_append_int(&encoder, 0);
+    request_encoder_append_char(&encoder, ',');
+    request_encoder_append_int(&encoder, -67);
+    request_encoder_append_char(&encoder, ',');
+    request_encoder_append_int(&encoder, INT_MIN);
+    request_encoder_append_char(&encoder, ',');
+    request_encoder_append_int(&encoder, INT_MAX);
+    check(strcmp(buffer, "0,-67,-2147483648,2147483647") == 0, "integers");
+
+    // 9 characters and the terminator fill 10 bytes
+    request_encoder_init(&encoder, buffer, 10);
+    request_encoder_append(&encoder, "rssi=");
+    request_encoder_append_int(&encoder, -67);
+    check(!encoder.truncated && strcmp(buffer, "rssi=-67") == 0, "append up to the size");
+    request_encoder_append(&encoder, "&x");
+    check(encoder.truncated && strcmp(buffer, "rssi=-67") == 0, "truncated append leaves the buffer");
+    request_encoder_append_char(&encoder, 'x');
+    check(encoder.truncated && encoder.length == 8, "appends after truncation are ignored");
+
+    request_encoder_rewind(&encoder, 5);
+    check(!encoder.truncated && strcmp(buffer, "rssi=") == 0, "rewind clears truncation");
+    request_encoder_append_encoded(&encoder, "a b");
+    check(encoder.truncated && strcmp(buffer, "rssi=") == 0, "no half encoded value");
+
+    request_encoder_rewind(&encoder, 5);
+    request_encoder_append_int(&encoder, -12345);
+    check(encoder.truncated && strcmp(buffer, "rssi=") == 0, "no half integer");
+
+    request_encoder_init(&encoder, buffer, 0);
+    request_encoder_append(&encoder, "");
+    check(encoder.truncated && encoder.length == 0, "empty buffer");
+}
+
+// Vendor UUIDs 6e40xxxx-b5a3-f393-e0a9-e50e24dcca9e, services then characteristics
+static void fill_uuids(struct UuidList *list) {
+    uint8_t bytes[16] = {
+        0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x00, 0x00, 0x40, 0x6e,
+    };
+    struct Uuid uuid;
+
+    uuid_pool_init();
+    uuid_list_init(list);
+
+    for (int i = 0; i < SERVICES + CHARS; i++) {
+        bytes[12] = i;
+        uuid_from_bytes(bytes, sizeof(bytes), &uuid);
+        uuid.role = i < SERVICES ? UUID_ROLE_SERVICE : UUID_ROLE_CHAR;
+        uuid_list_add(list, &uuid);
+    }
+}
+
+static void append_uuids(struct RequestEncoder *encoder, const char *key, const struct UuidList *list, uint8_t role) {
+    struct UuidListIterator it;
+    char str[UUID_STRING_LENGTH];
+    bool first = true;
+
+    request_encoder_append(encoder, key);
+    for (const struct Uuid *uuid = uuid_list_first(list, &it); uuid != NULL; uuid = uuid_list_next(&it)) {
+        if (uuid->role == role) {
+            if (!first) {
+                request_encoder_append_char(encoder, ',');
+            }
+            uuid_format(uuid, str);
+            request_encoder_append_encoded(encoder, str);
+            first = false;
+        }
+    }
+}
+
+static size_t encode_device(char *buffer, const struct UuidList *list) {
+    struct RequestEncoder encoder;
+
+    request_encoder_init(&encoder, buffer, URL_SIZE);
+    request_encoder_append(&encoder, SERVER_PREFIX "address=");
+    request_encoder_append_encoded(&encoder, DEVICE_ADDRESS);
+    request_encoder_append(&encoder, "&device=");
+    request_encoder_append_encoded(&encoder, DEVICE_NAME);
+    append_uuids(&encoder, "&chars=", list, UUID_ROLE_CHAR);
+    append_uuids(&encoder, "&services=", list, UUID_ROLE_SERVICE);
+    request_encoder_append(&encoder, "&rssi=");
+    request_encoder_append_int(&encoder, -67);
+
+    return encoder.truncated ? 0 : encoder.length;
+}
+
+// Old builder, the previous string is leaked by the caller in the firmware
+static char *concat(const char *str1, const char *str2) {
+    char *str3 = malloc(strlen(str1) + strlen(str2) + 1);
+
+    strcpy(str3, str1);
+    strcat(str3, str2);
+    return str3;
+}
+
+static char *concat_free(char *str1, const char *str2) {
+    char *str3 = concat(str1, str2);
+
+    free(str1);
+    return str3;
+}
+
+// Same query with the old concat() chain, name encoded as before (spaces only)
+static size_t concat_device(const struct UuidList *list) {
+    struct UuidListIterator it;
+    char str[UUID_STRING_LENGTH];
+    char *url = concat(SERVER_PREFIX, "address=");
+    char *services = concat("", "&services=");
+    char *chars = concat("", "&chars=");
+
+    url = concat_free(url, DEVICE_ADDRESS);
+    url = concat_free(url, "&device=");
+    url = concat_free(url, "Caf%C3%A9%20Sensor%20%234%20%26%20Co");
+
+    for (const struct Uuid *uuid = uuid_list_first(list, &it); uuid != NULL; uuid = uuid_list_next(&it)) {
+        char **field = uuid->role == UUID_ROLE_SERVICE ? &services : &chars;
+
+        if ((*field)[strlen(*field) - 1] != '=') {
+            *field = concat_free(*field, ",");
+        }
+        uuid_format(uuid, str);
+        *field = concat_free(*field, str);
+    }
+
+    url = concat_free(url, chars);
+    url = concat_free(url, services);
+    url = concat_free(url, "&rssi=");
+    url = concat_free(url, "-67");
+
+    size_t length = strlen(url);
+
+    free(url);
+    free(services);
+    free(chars);
+    return length;
+}
+
+// Formatting of the UUIDs alone, part of both builders
+static size_t format_uuids(const struct UuidList *list) {
+    struct UuidListIterator it;
+    char str[UUID_STRING_LENGTH];
+    size_t length = 0;
+
+    for (const struct Uuid *uuid = uuid_list_first(list, &it); uuid != NULL; uuid = uuid_list_next(&it)) {
+        uuid_format(uuid, str);
+        length += str[0];
+    }
+    return length;
+}
+
+static size_t build(int builder, char *buffer, const struct UuidList *list) {
+    switch (builder) {
+        case 0:
+            return encode_device(buffer, list);
+        case 1:
+            return concat_device(list);
+        default:
+            return format_uuids(list);
+    }
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+int main(void) {
+    struct AllocCount count;
+    struct UuidList list;
+    char buffer[URL_SIZE];
+
+    fill_uuids(&list);
+
+    alloc_count_start(&count);
+    check_encoder();
+    size_t length = encode_device(buffer, &list);
+    alloc_count_stop();
+
+    check(length > 0, "device query fits");
+    check(count.allocations == 0, "no heap allocation");
+    printf("Checks: %s, %llu heap allocations\n\n", failures == 0 ? "ok" : "FAILED", (unsigned long long) count.allocations);
+
+    printf("Device query with %d services and %d characteristics, %zu bytes\n\n", SERVICES, CHARS, length);
+    printf("%-18s %12s %16s %14s %14s\n", "builder", "ns/device", "without format", "allocs/device",
+           "bytes/device");
+
+    double ns[3];
+    struct AllocCount counts[3];
+
+    static const char *builders[] = { "request encoder", "concat() chain", "uuid_format only" };
+
+    check(concat_device(&list) == length, "same query from both builders");
+
+    // Formatting alone first, the other rows subtract it
+    for (int builder = 2; builder >= 0; builder--) {
+        uint64_t elapsed = 0;
+        uint64_t devices = 0;
+        struct AllocCount per_device;
+
+        alloc_count_start(&per_device);
+        build(builder, buffer, &list);
+        alloc_count_stop();
+
+        while (elapsed < MIN_RUN_NS) {
+            uint64_t start = histogram_now_ns();
+
+            for (int i = 0; i < 1000; i++) {
+                sink = build(builder, buffer, &list);
+            }
+            elapsed += histogram_now_ns() - start;
+            devices += 1000;
+        }
+
+        ns[builder] = (double) elapsed / devices;
+        counts[builder] = per_device;
+    }
+
+    for (int builder = 0; builder < 3; builder++) {
+        printf("%-18s %12.0f %16.0f %14llu %14llu\n", builders[builder], ns[builder], ns[builder] - ns[2],
+               (unsigned long long) counts[builder].allocations, (unsigned long long) counts[builder].bytes);
+    }
+
+    if (failures > 0) {
+        printf("\n%d checks FAILED\n", failures);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+// Cost of resolvable private address resolution (rpa.h).
+//
+// Checks ah() against the sample data of the Core specification, then times the
+// resolution of new private addresses against tables of 16 to 256 IRKs: addresses
+// of a known device (found half way through the table on average) and of unknown
+// devices (every IRK tried). The last part measures the resolution cache the
+// scanner core goes through, which answers repeated advertisements of an address.
+// On the host AES comes from mbedtls or OpenSSL, on the ESP32 from the AES peripheral.
+
+#include "rpa.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_IDENTITIES 256
+#define ADDRESSES 4096
+#define MIN_RUN_NS 200000000ull
+
+// Core 5.x, Vol 3, Part H, Appendix D.7
+static const uint8_t sample_irk[16] = {
+    0xec, 0x02, 0x34, 0xa3, 0x57, 0xc8, 0xad, 0x05, 0x34, 0x10, 0x10, 0xa6, 0x0a, 0x39, 0x7d, 0x9b,
+};
+static const uint8_t sample_prand[3] = { 0x70, 0x81, 0x94 };
+static const uint8_t sample_hash[3] = { 0x0d, 0xfb, 0xaa };
+
+static const int table_sizes[] = { 16, 64, 128, 256 };
+
+static struct RpaIdentity identities[MAX_IDENTITIES];
+static uint8_t known[ADDRESSES][6];
+static uint8_t unknown[ADDRESSES][6];
+
+static volatile int sink;
+
+// Private address generated with the IRK, prand with the resolvable tag
+static void make_rpa(const uint8_t *irk, uint8_t *bda) {
+    bda[0] = 0x40 | (rand() & 0x3f);
+    bda[1] = rand();
+    bda[2] = rand();
+    rpa_ah(irk, bda, bda + 3);
+}
+
+// Resolutions per second of the addresses against the first count identities
+static double time_match(uint8_t (*addresses)[6], int count, int *errors, bool expect_match) {
+    uint64_t elapsed = 0;
+    uint64_t resolutions = 0;
+
+    while (elapsed < MIN_RUN_NS) {
+        uint64_t start = histogram_now_ns();
+
+        for (int i = 0; i < ADDRESSES; i++) {
+            int found = rpa_match(identities, count, addresses[i]);
+
+            if ((found >= 0) != expect_match) {
+                (*errors)++;
+            }
+            sink += found;
+        }
+        elapsed += histogram_now_ns() - start;
+        resolutions += ADDRESSES;
+    }
+
+    return resolutions * 1e9 / elapsed;
+}
+
+int main(int argc, char **argv) {
+    uint8_t hash[3];
+    int errors = 0;
+
+    rpa_ah(sample_irk, sample_prand, hash);
+    printf("ah() sample data: %02x%02x%02x, %s\n", hash[0], hash[1], hash[2],
+           memcmp(hash, sample_hash, 3) == 0 ? "ok" : "MISMATCH");
+    if (memcmp(hash, sample_hash, 3) != 0) {
+        errors++;
+    }
+
+    srand(1);
+    for (int i = 0; i < MAX_IDENTITIES; i++) {
+        for (int j = 0; j < 16; j++) {
+            identities[i].irk[j] = rand();
+        }
+        identities[i].bda[5] = i;
+        identities[i].addr_type = RPA_ADDR_TYPE_PUBLIC_ID;
+    }
+
+    printf("\n%-6s %16s %16s %14s\n", "IRKs", "known/s", "unknown/s", "us unknown");
+
+    for (size_t t = 0; t < sizeof(table_sizes) / sizeof(table_sizes[0]); t++) {
+        int count = table_sizes[t];
+
+        for (int i = 0; i < ADDRESSES; i++) {
+            make_rpa(identities[rand() % count].irk, known[i]);
+            make_rpa(identities[MAX_IDENTITIES - 1].irk, unknown[i]);
+        }
+
+        // Unknown addresses come from an IRK outside the table, except for the full table
+        double known_rate = time_match(known, count, &errors, true);
+        double unknown_rate = count < MAX_IDENTITIES ? time_match(unknown, count, &errors, false) : 0;
+
+        if (count == MAX_IDENTITIES) {
+            for (int i = 0; i < ADDRESSES; i++) {
+                make_rpa(sample_irk, unknown[i]);
+            }
+            unknown_rate = time_match(unknown, count, &errors, false);
+        }
+
+        printf("%-6d %16.0f %16.0f %14.1f\n", count, known_rate, unknown_rate, 1e6 / unknown_rate);
+    }
+
+    // Scanner core path: RPA_MAX_IRKS identities, a population of addresses advertising again and again
+    int population = RPA_CACHE_SIZE / 2;
+    uint8_t identity[6];
+    uint8_t identity_type;
+
+    rpa_init();
+    for (int i = 0; i < RPA_MAX_IRKS; i++) {
+        rpa_add_identity(&identities[i]);
+    }
+    for (int i = 0; i < population; i++) {
+        make_rpa(identities[i % (RPA_MAX_IRKS * 2)].irk, known[i]);
+    }
+
+    uint64_t lookups = 0;
+    uint64_t start = histogram_now_ns();
+    while (histogram_now_ns() - start < MIN_RUN_NS) {
+        for (int i = 0; i < population; i++) {
+            sink += rpa_resolve(known[i], RPA_ADDR_TYPE_RANDOM, identity, &identity_type);
+        }
+        lookups += population;
+    }
+    double lookup_ns = (double) (histogram_now_ns() - start) / lookups;
+
+    printf("\nCache of %d entries, %d IRKs, %d addresses: %.1f ns per advertisement, %u lookups, %u hits, "
+           "%u resolved, %u unresolved, %u AES blocks\n", RPA_CACHE_SIZE, rpa_identity_count(), population, lookup_ns,
+           (unsigned) rpa_counters.lookups, (unsigned) rpa_counters.cache_hits, (unsigned) rpa_counters.resolved,
+           (unsigned) rpa_counters.unresolved, (unsigned) rpa_counters.aes_blocks);
+    printf("Errors: %d\n", errors);
+
+    return errors > 0;
+}
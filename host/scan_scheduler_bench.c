@@ -0,0 +1,257 @@
+// Adaptive scan scheduler (scan_scheduler.h) against the static setting it replaced.
+//
+// Simulates device populations coming and going over two hours of inquiry windows.
+// Every device advertises at its own interval, an advertising event is heard with
+// the probability of the scan duty cycle and, while scanning actively, a scannable
+// one costs a scan request and brings the scan response most of the time. Names are
+// in the advertisement, in the scan response only, or nowhere. The scheduler gets the
+// same window statistics the scanner core gives it on the ESP32; the uplink is assumed
+// to keep up.
+//
+// Reported per scenario: radio time, devices found per second of radio time, scan
+// requests, names learned, time from arrival to the first advertisement heard and
+// devices that left unheard.
+
+#include "scan_scheduler.h"
+#include "scanner_core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW_MS (SCANNING_DURATION * 1000)
+#define RUN_MS (2 * 3600 * 1000)
+#define MAX_DEVICES 1024
+
+// Static setting of the scanner before the scheduler: active, interval 0x50, window 0x30
+#define STATIC_INTERVAL 0x50
+#define STATIC_WINDOW 0x30
+
+#define SCAN_RSP_SUCCESS_PERCENT 90
+
+enum NamePlace { NAME_IN_ADV, NAME_IN_SCAN_RSP, NAME_NONE };
+
+struct SimDevice {
+    uint32_t arrive_ms;
+    uint32_t leave_ms;
+    uint32_t adv_interval_ms;
+    uint8_t name_place;
+    bool scannable;
+
+    // Scanner side
+    bool found;
+    bool named;
+    uint8_t name_attempts;
+    uint32_t found_ms;
+    uint32_t last_heard_ms;
+};
+
+struct Scenario {
+    const char *label;
+    int residents;              // Present from the start for the whole run
+    uint32_t arrival_ms;        // Mean time between arrivals, 0 for none
+    uint32_t min_stay_ms;
+    uint32_t max_stay_ms;
+    int crowd;                  // Devices arriving together half way through
+    uint32_t crowd_stay_ms;
+};
+
+struct Result {
+    double radio_s;
+    int found;
+    int present;
+    uint32_t scan_requests;
+    int named;
+    int nameable;
+    double latency_s;
+    int missed;
+    int changes;
+};
+
+static const struct Scenario scenarios[] = {
+    { "office", 40, 60000, 1800000, 5400000, 0, 0 },
+    { "store", 10, 10000, 120000, 600000, 0, 0 },
+    { "crowd", 20, 0, 0, 0, 150, 600000 },
+    { "empty room", 3, 0, 0, 0, 0, 0 },
+};
+
+static struct SimDevice population[MAX_DEVICES];
+static int population_count;
+
+static uint32_t rng_state;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint32_t random_between(uint32_t low, uint32_t high) {
+    return low + next_random() % (high - low + 1);
+}
+
+static void add_device(uint32_t arrive_ms, uint32_t leave_ms) {
+    struct SimDevice *device = &population[population_count++];
+    uint32_t kind = next_random() % 10;
+
+    memset(device, 0, sizeof(*device));
+    device->arrive_ms = arrive_ms;
+    device->leave_ms = leave_ms;
+    device->adv_interval_ms = random_between(100, 1000);
+
+    // 3 in 10 name in the advertisement, 4 in the scan response only, 3 no name. All but 2 scannable.
+    device->name_place = kind < 3 ? NAME_IN_ADV : kind < 7 ? NAME_IN_SCAN_RSP : NAME_NONE;
+    device->scannable = kind >= 1 && kind <= 8;
+}
+
+static void build_population(const struct Scenario *scenario) {
+    population_count = 0;
+    rng_state = 12345;
+
+    for (int i = 0; i < scenario->residents; i++) {
+        add_device(0, RUN_MS);
+    }
+    if (scenario->arrival_ms > 0) {
+        for (uint32_t t = random_between(0, scenario->arrival_ms * 2); t < RUN_MS && population_count < MAX_DEVICES;
+             t += random_between(0, scenario->arrival_ms * 2)) {
+            add_device(t, t + random_between(scenario->min_stay_ms, scenario->max_stay_ms));
+        }
+    }
+    for (int i = 0; i < scenario->crowd && population_count < MAX_DEVICES; i++) {
+        uint32_t t = RUN_MS / 2 + random_between(0, 60000);
+
+        add_device(t, t + scenario->crowd_stay_ms);
+    }
+}
+
+static void run(bool adaptive, struct Result *result) {
+    struct ScanScheduler scheduler;
+    struct ScanSettings settings = { STATIC_INTERVAL, STATIC_WINDOW, true };
+    double latency_total_ms = 0;
+
+    memset(result, 0, sizeof(*result));
+    scan_scheduler_init(&scheduler);
+    if (adaptive) {
+        settings = scheduler.settings;
+    }
+
+    for (int i = 0; i < population_count; i++) {
+        population[i].found = false;
+        population[i].named = false;
+        population[i].name_attempts = 0;
+    }
+    rng_state = 777;
+
+    for (uint32_t start = 0; start < RUN_MS; start += WINDOW_MS) {
+        uint32_t end = start + WINDOW_MS;
+        uint32_t heard_threshold = (uint32_t) ((uint64_t) settings.window * UINT32_MAX / settings.interval);
+        struct ScanWindowStats stats = { .listening_ms = WINDOW_MS * settings.window / settings.interval };
+
+        for (int i = 0; i < population_count; i++) {
+            struct SimDevice *device = &population[i];
+            uint32_t from = device->arrive_ms > start ? device->arrive_ms : start;
+            uint32_t to = device->leave_ms < end ? device->leave_ms : end;
+
+            // Advertising events of the device in this window, starting at a random offset
+            for (uint32_t t = from + next_random() % device->adv_interval_ms; t < to; t += device->adv_interval_ms) {
+                if (next_random() > heard_threshold) {
+                    continue;
+                }
+
+                stats.advertisements++;
+                device->last_heard_ms = t;
+
+                if (!device->found) {
+                    device->found = true;
+                    device->found_ms = t;
+                    stats.new_devices++;
+                    latency_total_ms += t - device->arrive_ms;
+                }
+                if (device->name_place == NAME_IN_ADV) {
+                    device->named = true;
+                }
+                if (settings.active && device->scannable) {
+                    result->scan_requests++;
+                    if (device->name_place == NAME_IN_SCAN_RSP && next_random() % 100 < SCAN_RSP_SUCCESS_PERCENT) {
+                        device->named = true;
+                    }
+                }
+            }
+        }
+
+        // Same accounting as scanner_core_scan_activity
+        for (int i = 0; i < population_count; i++) {
+            struct SimDevice *device = &population[i];
+
+            if (device->found && !device->named && device->name_attempts < CONFIG_ESP_SCAN_NAME_ATTEMPTS
+                    && device->last_heard_ms >= start && device->last_heard_ms < end) {
+                stats.unnamed++;
+                if (settings.active) {
+                    device->name_attempts++;
+                }
+            }
+        }
+
+        result->radio_s += stats.listening_ms / 1000.0;
+
+        if (adaptive && scan_scheduler_update(&scheduler, &stats)) {
+            settings = scheduler.settings;
+            result->changes++;
+        }
+    }
+
+    for (int i = 0; i < population_count; i++) {
+        const struct SimDevice *device = &population[i];
+
+        result->present++;
+        if (device->found) {
+            result->found++;
+        } else {
+            result->missed++;
+        }
+        if (device->name_place != NAME_NONE) {
+            result->nameable++;
+            result->named += device->named;
+        }
+    }
+    result->latency_s = result->found > 0 ? latency_total_ms / result->found / 1000.0 : 0;
+}
+
+static void print_result(const char *policy, const struct Result *result) {
+    printf("  %-9s %8.0f %6d/%-4d %10.2f %12u %6d/%-4d %10.2f %7d %8d\n", policy, result->radio_s, result->found,
+           result->present, result->found / result->radio_s, (unsigned) result->scan_requests, result->named,
+           result->nameable, result->latency_s, result->missed, result->changes);
+}
+
+int main(int argc, char **argv) {
+    int errors = 0;
+
+    printf("Two hours of %d s windows, duty %d-%d%%, window %d, %d quiet windows, %d name attempts\n\n",
+           SCANNING_DURATION, CONFIG_ESP_SCAN_MIN_DUTY, CONFIG_ESP_SCAN_MAX_DUTY, CONFIG_ESP_SCAN_WINDOW,
+           CONFIG_ESP_SCAN_QUIET_WINDOWS, CONFIG_ESP_SCAN_NAME_ATTEMPTS);
+    printf("  %-9s %8s %11s %10s %12s %11s %10s %7s %8s\n", "policy", "radio s", "found", "per radio s",
+           "scan reqs", "named", "latency s", "missed", "changes");
+
+    for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+        struct Result fixed;
+        struct Result adaptive;
+
+        build_population(&scenarios[s]);
+        printf("%s, %d devices\n", scenarios[s].label, population_count);
+
+        run(false, &fixed);
+        run(true, &adaptive);
+        print_result("static", &fixed);
+        print_result("adaptive", &adaptive);
+
+        // Less radio time must not cost devices
+        if (adaptive.found < fixed.found * 98 / 100) {
+            errors++;
+        }
+    }
+
+    printf("Errors: %d\n", errors);
+
+    return errors > 0;
+}
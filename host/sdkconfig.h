@@ -0,0 +1,185 @@
+#pragma once
+
+// Configuration for the host build, mirrors the defaults of main/Kconfig.projbuild.
+// Any value can be overridden from the compiler command line, e.g.
+// cmake -DCMAKE_C_FLAGS="-DCONFIG_ESP_DEVICE_TABLE_SIZE=1024"
+
+#ifndef CONFIG_ESP_IP_ADDRESS
+#define CONFIG_ESP_IP_ADDRESS "127.0.0.1:8080"
+#endif
+
+#ifndef CONFIG_ESP_DEVICE_TABLE_SIZE
+#define CONFIG_ESP_DEVICE_TABLE_SIZE 128
+#endif
+
+#ifndef CONFIG_ESP_UUID_POOL_CHUNKS
+#define CONFIG_ESP_UUID_POOL_CHUNKS 128
+#endif
+
+#ifndef CONFIG_ESP_UUID_BASES
+#define CONFIG_ESP_UUID_BASES 16
+#endif
+
+#ifndef CONFIG_ESP_DEVICE_MAX_AGE
+#define CONFIG_ESP_DEVICE_MAX_AGE 300
+#endif
+
+#ifndef CONFIG_ESP_OBS_RING_SIZE
+#define CONFIG_ESP_OBS_RING_SIZE 128
+#endif
+
+#ifndef CONFIG_ESP_UPLINK_BATCH
+#define CONFIG_ESP_UPLINK_BATCH 1
+#endif
+
+// Binary format and spool depend on batches in Kconfig and are off without them
+#if !CONFIG_ESP_UPLINK_BATCH
+#undef CONFIG_ESP_UPLINK_BINARY
+#define CONFIG_ESP_UPLINK_BINARY 0
+#undef CONFIG_ESP_SPOOL
+#define CONFIG_ESP_SPOOL 0
+#endif
+
+#ifndef CONFIG_ESP_UPLINK_BATCH_SIZE
+#define CONFIG_ESP_UPLINK_BATCH_SIZE 4096
+#endif
+
+#ifndef CONFIG_ESP_UPLINK_BINARY
+#define CONFIG_ESP_UPLINK_BINARY 1
+#endif
+
+#ifndef CONFIG_ESP_UPLINK_HTTPS
+#define CONFIG_ESP_UPLINK_HTTPS 0
+#endif
+
+#ifndef CONFIG_ESP_SPOOL
+#define CONFIG_ESP_SPOOL 1
+#endif
+
+#ifndef CONFIG_ESP_SPOOL_DRAIN_RATE
+#define CONFIG_ESP_SPOOL_DRAIN_RATE 16384
+#endif
+
+#ifndef CONFIG_ESP_DISCOVERY_QUEUE_SIZE
+#define CONFIG_ESP_DISCOVERY_QUEUE_SIZE 8
+#endif
+
+#ifndef CONFIG_ESP_DISCOVERY_MAX_CONNECTIONS
+#define CONFIG_ESP_DISCOVERY_MAX_CONNECTIONS 3
+#endif
+
+#ifndef CONFIG_ESP_DISCOVERY_TIMEOUT
+#define CONFIG_ESP_DISCOVERY_TIMEOUT 20
+#endif
+
+#ifndef CONFIG_ESP_DISCOVERY_QUEUE_TIMEOUT
+#define CONFIG_ESP_DISCOVERY_QUEUE_TIMEOUT 120
+#endif
+
+#ifndef CONFIG_ESP_GATT_CACHE
+#define CONFIG_ESP_GATT_CACHE 1
+#endif
+
+#ifndef CONFIG_ESP_GATT_CACHE_SIZE
+#define CONFIG_ESP_GATT_CACHE_SIZE 32
+#endif
+
+#ifndef CONFIG_ESP_GATT_CACHE_TTL
+#define CONFIG_ESP_GATT_CACHE_TTL 86400
+#endif
+
+#ifndef CONFIG_ESP_GATT_READ_VALUES
+#define CONFIG_ESP_GATT_READ_VALUES 1
+#endif
+
+#ifndef CONFIG_ESP_GATT_READ_UUIDS
+#define CONFIG_ESP_GATT_READ_UUIDS "2a00,2a01,2a19,2a24,2a25,2a26,2a27,2a28,2a29,2a23,2a50"
+#endif
+
+#ifndef CONFIG_ESP_GATT_MTU
+#define CONFIG_ESP_GATT_MTU 247
+#endif
+
+#ifndef CONFIG_ESP_GATT_VALUES_SIZE
+#define CONFIG_ESP_GATT_VALUES_SIZE 192
+#endif
+
+#ifndef CONFIG_ESP_SCAN_SCHEDULER
+#define CONFIG_ESP_SCAN_SCHEDULER 1
+#endif
+
+#ifndef CONFIG_ESP_SCAN_WINDOW
+#define CONFIG_ESP_SCAN_WINDOW 48
+#endif
+
+#ifndef CONFIG_ESP_SCAN_MIN_DUTY
+#define CONFIG_ESP_SCAN_MIN_DUTY 10
+#endif
+
+#ifndef CONFIG_ESP_SCAN_MAX_DUTY
+#define CONFIG_ESP_SCAN_MAX_DUTY 60
+#endif
+
+#ifndef CONFIG_ESP_SCAN_QUIET_WINDOWS
+#define CONFIG_ESP_SCAN_QUIET_WINDOWS 3
+#endif
+
+#ifndef CONFIG_ESP_SCAN_NAME_ATTEMPTS
+#define CONFIG_ESP_SCAN_NAME_ATTEMPTS 2
+#endif
+
+#ifndef CONFIG_ESP_SCAN_BACKLOG_LIMIT
+#define CONFIG_ESP_SCAN_BACKLOG_LIMIT 4
+#endif
+
+#ifndef CONFIG_ESP_ADV_DECODERS
+#define CONFIG_ESP_ADV_DECODERS 1
+#endif
+
+#ifndef CONFIG_ESP_RPA_RESOLUTION
+#define CONFIG_ESP_RPA_RESOLUTION 1
+#endif
+
+#ifndef CONFIG_ESP_RPA_IRKS
+#define CONFIG_ESP_RPA_IRKS ""
+#endif
+
+#ifndef CONFIG_ESP_RPA_MAX_IRKS
+#define CONFIG_ESP_RPA_MAX_IRKS 16
+#endif
+
+#ifndef CONFIG_ESP_RPA_CACHE_SIZE
+#define CONFIG_ESP_RPA_CACHE_SIZE 128
+#endif
+
+#ifndef CONFIG_ESP_ADDR_FILTER
+#define CONFIG_ESP_ADDR_FILTER 1
+#endif
+
+#ifndef CONFIG_ESP_ADDR_FILTER_MAX_ENTRIES
+#define CONFIG_ESP_ADDR_FILTER_MAX_ENTRIES 1024
+#endif
+
+#ifndef CONFIG_ESP_DELTA_REPORTING
+#define CONFIG_ESP_DELTA_REPORTING 0
+#endif
+
+#ifndef CONFIG_ESP_DELTA_RSSI_THRESHOLD
+#define CONFIG_ESP_DELTA_RSSI_THRESHOLD 10
+#endif
+
+#ifndef CONFIG_ESP_DELTA_LOST_TIMEOUT
+#define CONFIG_ESP_DELTA_LOST_TIMEOUT 30
+#endif
+
+#ifndef CONFIG_ESP_DELTA_SNAPSHOT_INTERVAL
+#define CONFIG_ESP_DELTA_SNAPSHOT_INTERVAL 300
+#endif
+
+#ifndef CONFIG_ESP_METRICS
+#define CONFIG_ESP_METRICS 1
+#endif
+
+#ifndef CONFIG_ESP_METRICS_INTERVAL
+#define CONFIG_ESP_METRICS_INTERVAL 12
+#endif
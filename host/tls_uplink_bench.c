@@ -0,0 +1,410 @@
+// Cost of the HTTPS uplink (CONFIG_ESP_UPLINK_HTTPS) with and without connection reuse
+// and TLS session resumption.
+//
+// A local TLS stand-in server with a self-signed RSA-2048 certificate answers the batch
+// POSTs of a simulated scanner over HTTP/1.1 keep-alive. TLS 1.2 only, like mbedTLS of
+// the firmware, with session tickets and no server session cache, so a resumed handshake
+// is always a ticket. The client verifies the certificate and speaks HTTP through
+// http_stream.h like the firmware does. Scenarios:
+//   - a new connection per report, every handshake full or resumed from the last ticket
+//   - a persistent connection dropped every few reports without close_notify (a WiFi
+//     drop), reconnecting with a full or a resumed handshake
+//   - a persistent connection never dropped
+// Reported per scenario: handshakes, how many were resumed, client and server CPU time of
+// a handshake (thread CPU clock, the handshake messages cross loopback) and TLS bytes on
+// the wire per report, both directions.
+
+#define _GNU_SOURCE
+
+#include "http_stream.h"
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPORTS 200
+#define BATCH_SIZE 600
+#define SERVER_PATH "/RESTServerScanner-1.0-SNAPSHOT/api/scanner"
+
+struct Scenario {
+    const char *name;
+    int reports_per_connection;     // 0 when the connection is never dropped
+    bool resume;
+};
+
+static const struct Scenario scenarios[] = {
+    { "connection per report, full handshake", 1, false },
+    { "connection per report, resumed", 1, true },
+    { "drop every 10 reports, full handshake", 10, false },
+    { "drop every 10 reports, resumed", 10, true },
+    { "drop every 50 reports, resumed", 50, true },
+    { "persistent, never dropped", 0, true },
+};
+#define SCENARIOS (int) (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static int listen_fd;
+
+// Handshake CPU time of the server thread, read by the client between scenarios
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t server_handshake_ns = 0;
+static uint32_t server_handshakes = 0;
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void fail(const char *what) {
+    fprintf(stderr, "%s failed\n", what);
+    ERR_print_errors_fp(stderr);
+    exit(1);
+}
+
+// Self-signed certificate for 127.0.0.1
+static void make_certificate(EVP_PKEY **key, X509 **cert) {
+    EVP_PKEY_CTX *key_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+
+    *key = NULL;
+    if (key_ctx == NULL || EVP_PKEY_keygen_init(key_ctx) <= 0 || EVP_PKEY_CTX_set_rsa_keygen_bits(key_ctx, 2048) <= 0
+            || EVP_PKEY_keygen(key_ctx, key) <= 0) {
+        fail("RSA key generation");
+    }
+    EVP_PKEY_CTX_free(key_ctx);
+
+    *cert = X509_new();
+    X509_set_version(*cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(*cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(*cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(*cert), 3600);
+    X509_set_pubkey(*cert, *key);
+
+    X509_NAME *name = X509_get_subject_name(*cert);
+
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *) "127.0.0.1", -1, -1, 0);
+    X509_set_issuer_name(*cert, name);
+
+    // Client checks the address like esp-tls checks the host of the URL
+    X509_EXTENSION *alt_name = X509V3_EXT_conf_nid(NULL, NULL, NID_subject_alt_name, "IP:127.0.0.1");
+
+    X509_add_ext(*cert, alt_name, -1);
+    X509_EXTENSION_free(alt_name);
+
+    if (X509_sign(*cert, *key, EVP_sha256()) == 0) {
+        fail("Certificate signing");
+    }
+}
+
+static int listen_local(int *port) {
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 8) < 0
+            || getsockname(fd, (struct sockaddr *) &addr, &addr_len) < 0) {
+        perror("listen");
+        exit(1);
+    }
+    *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+static int connect_local(int port) {
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)
+    };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Requests of one connection until the client goes away, answered with an empty 200
+static void serve_requests(SSL *ssl) {
+    static const char answer[] = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+    char buffer[4096];
+    size_t used = 0;
+
+    for (;;) {
+        char *end = memmem(buffer, used, "\r\n\r\n", 4);
+
+        if (end == NULL) {
+            if (used == sizeof(buffer)) {
+                return;
+            }
+
+            int len = SSL_read(ssl, buffer + used, sizeof(buffer) - used);
+
+            if (len <= 0) {
+                return;
+            }
+            used += len;
+            continue;
+        }
+
+        size_t head_len = end + 4 - buffer;
+        const char *length = strcasestr(buffer, "\r\nContent-Length:");
+        size_t body_len = length != NULL && length < end ? strtoul(length + 17, NULL, 10) : 0;
+
+        // Body is read and dropped, the uplink sends no pipelined requests
+        if (used > head_len + body_len) {
+            return;
+        }
+        for (size_t missing = head_len + body_len - used; missing > 0;) {
+            int len = SSL_read(ssl, buffer, missing < sizeof(buffer) ? missing : sizeof(buffer));
+
+            if (len <= 0) {
+                return;
+            }
+            missing -= len;
+        }
+
+        if (SSL_write(ssl, answer, sizeof(answer) - 1) <= 0) {
+            return;
+        }
+        used = 0;
+    }
+}
+
+static void *server_thread(void *arg) {
+    SSL_CTX *ctx = arg;
+
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        SSL *ssl = SSL_new(ctx);
+
+        SSL_set_fd(ssl, fd);
+
+        uint64_t started_ns = thread_cpu_ns();
+
+        if (SSL_accept(ssl) == 1) {
+            pthread_mutex_lock(&server_lock);
+            server_handshake_ns += thread_cpu_ns() - started_ns;
+            server_handshakes++;
+            pthread_mutex_unlock(&server_lock);
+
+            serve_requests(ssl);
+        }
+
+        SSL_free(ssl);
+        close(fd);
+    }
+    return NULL;
+}
+
+static SSL_CTX *server_context(EVP_PKEY *key, X509 *cert) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+
+    if (ctx == NULL || SSL_CTX_use_certificate(ctx, cert) != 1 || SSL_CTX_use_PrivateKey(ctx, key) != 1) {
+        fail("Server context");
+    }
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+
+    // Stateless resumption only, tickets are on by default
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    return ctx;
+}
+
+static SSL_CTX *client_context(X509 *cert) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+
+    if (ctx == NULL || X509_STORE_add_cert(SSL_CTX_get_cert_store(ctx), cert) != 1) {
+        fail("Client context");
+    }
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    return ctx;
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+struct Client {
+    SSL_CTX *ctx;
+    int port;
+    SSL *ssl;
+    int fd;
+    SSL_SESSION *session;
+    bool resume;
+    uint32_t handshakes;
+    uint32_t resumed;
+    uint64_t handshake_ns;
+    uint64_t bytes;
+};
+
+static void client_drop(struct Client *client) {
+    if (client->ssl == NULL) {
+        return;
+    }
+
+    BIO *bio = SSL_get_rbio(client->ssl);
+
+    client->bytes += BIO_number_read(bio) + BIO_number_written(bio);
+
+    // Connection lost, nothing is sent. OpenSSL would take the session as not resumable
+    // then, the saved session of esp-tls stays usable.
+    SSL_set_shutdown(client->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    SSL_free(client->ssl);
+    close(client->fd);
+    client->ssl = NULL;
+}
+
+static void client_connect(struct Client *client) {
+    client->fd = connect_local(client->port);
+    client->ssl = SSL_new(client->ctx);
+    SSL_set_fd(client->ssl, client->fd);
+    SSL_set1_host(client->ssl, "127.0.0.1");
+
+    if (client->resume && client->session != NULL) {
+        SSL_set_session(client->ssl, client->session);
+    }
+
+    uint64_t started_ns = thread_cpu_ns();
+
+    if (SSL_connect(client->ssl) != 1) {
+        fprintf(stderr, "%s\n", X509_verify_cert_error_string(SSL_get_verify_result(client->ssl)));
+        fail("Handshake");
+    }
+
+    client->handshake_ns += thread_cpu_ns() - started_ns;
+    client->handshakes++;
+    if (SSL_session_reused(client->ssl)) {
+        client->resumed++;
+    }
+
+    if (client->resume) {
+        if (client->session != NULL) {
+            SSL_SESSION_free(client->session);
+        }
+        client->session = SSL_get1_session(client->ssl);
+    }
+}
+
+static void client_report(struct Client *client, const char *head, size_t head_len, const char *body) {
+    struct HttpResponse response;
+    char buffer[512];
+
+    if (client->ssl == NULL) {
+        client_connect(client);
+    }
+
+    if (SSL_write(client->ssl, head, head_len) <= 0 || SSL_write(client->ssl, body, BATCH_SIZE) <= 0) {
+        fail("Request");
+    }
+
+    http_response_init(&response);
+    while (!http_response_done(&response)) {
+        int len = SSL_read(client->ssl, buffer, sizeof(buffer));
+
+        if (len <= 0 || http_response_feed(&response, buffer, len, NULL, NULL) < 0) {
+            fail("Response");
+        }
+    }
+
+    if (response.status != 200) {
+        fprintf(stderr, "Status %d\n", response.status);
+        exit(1);
+    }
+}
+
+static void run_scenario(const struct Scenario *scenario, SSL_CTX *ctx, int port, const char *head,
+                         size_t head_len, const char *body) {
+    struct Client client = { .ctx = ctx, .port = port, .resume = scenario->resume };
+
+    pthread_mutex_lock(&server_lock);
+    server_handshake_ns = 0;
+    server_handshakes = 0;
+    pthread_mutex_unlock(&server_lock);
+
+    for (int i = 0; i < REPORTS; i++) {
+        client_report(&client, head, head_len, body);
+
+        if (scenario->reports_per_connection > 0 && (i + 1) % scenario->reports_per_connection == 0) {
+            client_drop(&client);
+        }
+    }
+    client_drop(&client);
+
+    if (client.session != NULL) {
+        SSL_SESSION_free(client.session);
+    }
+
+    pthread_mutex_lock(&server_lock);
+    uint64_t server_ns = server_handshake_ns;
+    uint32_t server_count = server_handshakes;
+    pthread_mutex_unlock(&server_lock);
+
+    printf("%-40s %10u %8u %12.3f %12.3f %12.1f\n", scenario->name, (unsigned) client.handshakes,
+           (unsigned) client.resumed, client.handshakes > 0 ? client.handshake_ns / 1e6 / client.handshakes : 0,
+           server_count > 0 ? server_ns / 1e6 / server_count : 0, (double) client.bytes / REPORTS);
+}
+
+int main(void) {
+    EVP_PKEY *key;
+    X509 *cert;
+    int port;
+
+    make_certificate(&key, &cert);
+
+    SSL_CTX *server_ctx = server_context(key, cert);
+    SSL_CTX *client_ctx = client_context(cert);
+    pthread_t server;
+
+    listen_fd = listen_local(&port);
+    pthread_create(&server, NULL, server_thread, server_ctx);
+
+    // Request of the firmware, a binary batch of typical size
+    char url[128];
+    char head[512];
+    char body[BATCH_SIZE];
+    struct HttpUrl parsed;
+
+    snprintf(url, sizeof(url), "https://127.0.0.1:%d" SERVER_PATH, port);
+    memset(body, 0x5a, sizeof(body));
+
+    size_t head_len = 0;
+
+    if (http_parse_url(url, &parsed)) {
+        head_len = http_format_request(head, sizeof(head), &parsed, "application/x-ble-scanner-batch", BATCH_SIZE);
+    }
+    if (head_len == 0) {
+        fail("Request formatting");
+    }
+
+    printf("%d reports of %d bytes per scenario, TLS 1.2, RSA-2048 server certificate\n\n", REPORTS, BATCH_SIZE);
+    printf("%-40s %10s %8s %12s %12s %12s\n", "scenario", "handshakes", "resumed", "client ms", "server ms",
+           "bytes/report");
+
+    for (int i = 0; i < SCENARIOS; i++) {
+        run_scenario(&scenarios[i], client_ctx, port, head, head_len, body);
+    }
+
+    printf("\nms: CPU time of one handshake, the average of full and resumed ones in the scenario\n");
+    return 0;
+}
@@ -0,0 +1,146 @@
+// Requests and bytes on the wire of the batched uplink against per device GET requests.
+//
+// Every window a population of devices advertises through the scanner core and each
+// device is reported (delta reporting is off in the host build). The same windows are
+// sent in the three ways the core can report: binary batches, text batches (stub
+// server rejects the binary format with 415) and one GET per device (stub server
+// rejects every POST with 404), the fallback order of send_http_batch.
+// What the core learns about the server lasts until reboot, so every format starts
+// with a warm up window whose rejected requests are not counted. Bytes are the request
+// line, headers and body as http_stream.h formats them. Answers and TCP/IP headers (at
+// least 80 bytes per request on a kept alive connection) are left out and favour
+// per device requests.
+
+#include "hal_stub.h"
+#include "scanner_hal.h"
+#include "scanner_core.h"
+#include "device_table.h"
+#include "obs_ring.h"
+#include "wire_format.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Fewer than the metrics interval, no metrics record is posted
+#define WINDOWS 10
+#define ADVERTISEMENTS_PER_WINDOW 5
+
+static const int populations[] = { 10, 50, 120 };
+#define POPULATIONS (int) (sizeof(populations) / sizeof(populations[0]))
+
+struct Format {
+    const char *name;
+    const char *rejected_type;  // POSTs of this content type are rejected, any when NULL
+    int status;
+};
+
+static const struct Format formats[] = {
+    { "binary batch", NULL, 200 },
+    { "text batch", WIRE_CONTENT_TYPE, 415 },
+    { "GET per device", NULL, 404 },
+};
+#define FORMATS (int) (sizeof(formats) / sizeof(formats[0]))
+
+#if CONFIG_ESP_METRICS
+_Static_assert(WINDOWS + 1 < CONFIG_ESP_METRICS_INTERVAL, "Metrics record would be counted");
+#endif
+
+static uint32_t now_ms = 0;
+
+// Advertisement with flags and complete name, scan response with TX power
+static void advertise(int device, int8_t rssi) {
+    struct Observation obs = { .timestamp_ms = now_ms, .kind = OBS_ADV, .addr_type = 1, .rssi = rssi };
+    uint8_t *p = obs.data;
+    int name_len = snprintf((char *) p + 5, 20, "sensor-%d", device);
+
+    obs.bda[0] = 0xc0;
+    obs.bda[1] = 0x11;
+    obs.bda[2] = 0x22;
+    obs.bda[3] = device >> 8;
+    obs.bda[4] = device;
+    obs.bda[5] = 0x5a;
+
+    p[0] = 2; p[1] = 0x01; p[2] = 0x06;
+    p[3] = name_len + 1; p[4] = 0x09;
+    obs.adv_len = 5 + name_len;
+
+    p += obs.adv_len;
+    p[0] = 2; p[1] = 0x0a; p[2] = (uint8_t) -4;
+    obs.scan_rsp_len = 3;
+
+    scanner_core_process(&obs);
+}
+
+static void run_window(int population) {
+    for (int a = 0; a < ADVERTISEMENTS_PER_WINDOW; a++) {
+        for (int device = 0; device < population; device++) {
+            advertise(device, -50 - device % 30 - rand() % 4);
+        }
+        now_ms += SCANNING_DURATION * 1000 / ADVERTISEMENTS_PER_WINDOW;
+        hal_stub_set_time_ms(now_ms);
+    }
+
+    struct Observation obs = { .timestamp_ms = now_ms, .kind = OBS_WINDOW_END };
+
+    scanner_core_process(&obs);
+}
+
+int main(void) {
+    printf("%d windows of %d s, %d advertisements per device and window\n\n", WINDOWS, SCANNING_DURATION,
+           ADVERTISEMENTS_PER_WINDOW);
+    printf("%8s %-16s %9s %9s %12s %13s %11s\n", "devices", "format", "reports", "requests", "wire bytes",
+           "bytes/report", "vs GET");
+
+    uint64_t bytes[FORMATS][POPULATIONS];
+    uint32_t requests[FORMATS][POPULATIONS];
+    uint32_t reports[FORMATS][POPULATIONS];
+
+    for (int f = 0; f < FORMATS; f++) {
+        hal_stub_set_post_status(formats[f].rejected_type, formats[f].status);
+
+        for (int p = 0; p < POPULATIONS; p++) {
+            now_ms = 0;
+            hal_stub_set_time_ms(now_ms);
+            scanner_core_init();
+            srand(1);
+
+            // Warm up, the first batch finds out what the server accepts
+            if (p == 0) {
+                run_window(1);
+                scanner_core_init();
+            }
+
+            memset(&hal_stub_stats, 0, sizeof(hal_stub_stats));
+
+            for (int w = 0; w < WINDOWS; w++) {
+                run_window(populations[p]);
+            }
+
+            bytes[f][p] = hal_stub_stats.http_wire_bytes;
+            requests[f][p] = hal_stub_stats.http_requests;
+            reports[f][p] = report_counters.sent + report_counters.lost;
+        }
+    }
+
+    for (int p = 0; p < POPULATIONS; p++) {
+        for (int f = 0; f < FORMATS; f++) {
+            printf("%8d %-16s %9u %9u %12llu %13.1f %10.0f%%\n", populations[p], formats[f].name,
+                   (unsigned) reports[f][p], (unsigned) requests[f][p], (unsigned long long) bytes[f][p],
+                   reports[f][p] > 0 ? (double) bytes[f][p] / reports[f][p] : 0,
+                   100.0 * bytes[f][p] / bytes[FORMATS - 1][p]);
+        }
+    }
+
+    // Every format has to report the same devices
+    for (int p = 0; p < POPULATIONS; p++) {
+        for (int f = 1; f < FORMATS; f++) {
+            if (reports[f][p] != reports[0][p]) {
+                printf("\nREPORT COUNT MISMATCH for %d devices\n", populations[p]);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,402 @@
+// Benchmark of the binary uplink format against the text batches.
+//
+// Fills the device table with synthetic devices, then encodes them into batches
+// of CONFIG_ESP_UPLINK_BATCH_SIZE bytes in both formats and decodes the batches
+// again, the text ones with a minimal query string parser of the kind a
+// collector needs. Reports bytes per observation and encode/decode throughput,
+// for plain sightings and for reports carrying discovery results.
+
+#include "scanner_core.h"
+#include "device_table.h"
+#include "request_encoder.h"
+#include "uuid_list.h"
+#include "wire_encoder.h"
+#include "wire_decoder.h"
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#define BENCH_DEVICES 100
+#define MIN_RUN_NS 200000000ull
+
+// Vendor base of the 128-bit UUIDs, little endian (6e40xxxx-b5a3-f393-e0a9-e50e24dcca9e)
+static const uint8_t vendor_base[16] = {
+    0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x00, 0x00, 0x40, 0x6e,
+};
+
+static char batch[CONFIG_ESP_UPLINK_BATCH_SIZE];
+
+// Batches of one run, kept for the decode pass
+#define MAX_BATCHES 64
+
+struct Batches {
+    int count;
+    size_t total_bytes;
+    size_t length[MAX_BATCHES];
+    char data[MAX_BATCHES][CONFIG_ESP_UPLINK_BATCH_SIZE];
+};
+
+static struct Batches text_batches;
+static struct Batches wire_batches;
+
+static void add_uuid(struct Device *device, const uint8_t *bytes, int len, uint8_t role) {
+    struct Uuid uuid;
+
+    if (uuid_from_bytes(bytes, len, &uuid)) {
+        uuid.role = role;
+        uuid_list_add(&device->uuids, &uuid);
+        if (role == UUID_ROLE_SERVICE) {
+            device->services_count++;
+        } else {
+            device->chars_count++;
+        }
+    }
+}
+
+// Same shape as the loadgen discovery: two standard services and a vendor one, two characteristics each
+static void add_discovery(struct Device *device) {
+    uint8_t bytes[16];
+
+    for (int i = 0; i < 3; i++) {
+        bool vendor = i == 2;
+
+        if (vendor) {
+            memcpy(bytes, vendor_base, sizeof(bytes));
+            bytes[12] = 0x01;
+            add_uuid(device, bytes, 16, UUID_ROLE_SERVICE);
+        } else {
+            bytes[0] = i;
+            bytes[1] = 0x18;
+            add_uuid(device, bytes, 2, UUID_ROLE_SERVICE);
+        }
+
+        for (int j = 0; j < 2; j++) {
+            if (vendor) {
+                bytes[12] = 0x02 + j;
+                add_uuid(device, bytes, 16, UUID_ROLE_CHAR);
+            } else {
+                bytes[0] = i * 2 + j;
+                bytes[1] = 0x2a;
+                add_uuid(device, bytes, 2, UUID_ROLE_CHAR);
+            }
+        }
+    }
+}
+
+static void fill_devices(void) {
+    device_table_init();
+
+    for (int i = 0; i < BENCH_DEVICES; i++) {
+        uint8_t bda[6] = { 0xc0 | (i >> 24), i >> 16, i >> 8, i, 0x5a, 0xa5 };
+        int index = device_table_insert(bda, 1, 0);
+        struct Device *device = &devices[index];
+
+        snprintf(device->address, sizeof(device->address), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+        snprintf(device->name, sizeof(device->name), "dev-%d", i);
+        device->rssi = -40 - rand() % 55;
+        add_discovery(device);
+    }
+}
+
+static void save_batch(struct Batches *batches, size_t length) {
+    if (length > 0 && batches->count < MAX_BATCHES) {
+        memcpy(batches->data[batches->count], batch, length);
+        batches->length[batches->count++] = length;
+    }
+    batches->total_bytes += length;
+}
+
+// Encode every device once, cutting batches like add_device_to_batch
+static void encode_text(bool with_discovery, bool save) {
+    struct RequestEncoder encoder;
+
+    request_encoder_init(&encoder, batch, sizeof(batch));
+
+    for (int i = 0; i < DEVICE_TABLE_CAPACITY; i++) {
+        if (!devices[i].used) {
+            continue;
+        }
+
+        size_t length = encoder.length;
+
+        build_device_query(&encoder, i, with_discovery, false);
+        request_encoder_append_char(&encoder, '\n');
+
+        if (encoder.truncated) {
+            if (save) {
+                save_batch(&text_batches, length);
+            }
+            request_encoder_rewind(&encoder, 0);
+            build_device_query(&encoder, i, with_discovery, false);
+            request_encoder_append_char(&encoder, '\n');
+        }
+    }
+
+    if (save) {
+        save_batch(&text_batches, encoder.length);
+    }
+}
+
+static void encode_wire(bool with_discovery, bool save) {
+    struct WireEncoder encoder;
+
+    wire_encoder_init(&encoder, (uint8_t *) batch, sizeof(batch));
+
+    for (int i = 0; i < DEVICE_TABLE_CAPACITY; i++) {
+        if (!devices[i].used) {
+            continue;
+        }
+
+        if (!wire_encoder_add_device(&encoder, &devices[i], NULL, 0, with_discovery, false)) {
+            if (save) {
+                save_batch(&wire_batches, encoder.length);
+            }
+            wire_encoder_init(&encoder, (uint8_t *) batch, sizeof(batch));
+            wire_encoder_add_device(&encoder, &devices[i], NULL, 0, with_discovery, false);
+        }
+    }
+
+    if (save) {
+        save_batch(&wire_batches, encoder.length);
+    }
+}
+
+// Text decoding ----------------------------------------------------------------------------------
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// Percent-decode value up to end into out, returns its length
+static int decode_component(const char *p, const char *end, char *out, int size) {
+    int n = 0;
+
+    while (p < end && n < size - 1) {
+        if (*p == '%' && end - p >= 3) {
+            out[n++] = hex_value(p[1]) << 4 | hex_value(p[2]);
+            p += 3;
+        } else {
+            out[n++] = *p++;
+        }
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// "xxxx", "xxxxxxxx" or the 36 character form into little endian bytes
+static bool parse_uuid(const char *str, int len, struct WireUuid *uuid) {
+    int digits = 0;
+    uint8_t big[16];
+
+    for (int i = 0; i < len; i++) {
+        int v = hex_value(str[i]);
+
+        if (str[i] == '-') {
+            continue;
+        }
+        if (v < 0 || digits >= 32) {
+            return false;
+        }
+        if (digits % 2 == 0) {
+            big[digits / 2] = v << 4;
+        } else {
+            big[digits / 2] |= v;
+        }
+        digits++;
+    }
+
+    if (digits != 4 && digits != 8 && digits != 32) {
+        return false;
+    }
+
+    uuid->len = digits / 2;
+    for (int i = 0; i < uuid->len; i++) {
+        uuid->bytes[i] = big[uuid->len - 1 - i];
+    }
+    return true;
+}
+
+static void parse_uuid_list(const char *value, struct WireDevice *device, bool characteristic) {
+    char list[1024];
+    char *p = list;
+
+    decode_component(value, value + strcspn(value, "&\n"), list, sizeof(list));
+
+    while (*p != '\0' && device->uuids_count < WIRE_MAX_UUIDS) {
+        int len = strcspn(p, ",");
+        struct WireUuid *uuid = &device->uuids[device->uuids_count];
+
+        if (len == 1 && *p == '-') {
+            device->discovery_failed = true;
+        } else if (parse_uuid(p, len, uuid)) {
+            uuid->characteristic = characteristic;
+            device->uuids_count++;
+        }
+        p += len + (p[len] == ',');
+    }
+}
+
+// One query per line, returns number of devices
+static int decode_text(const char *data, size_t len, wire_device_handler_t handler, void *arg) {
+    static struct WireDevice device;
+    const char *end = data + len;
+    int count = 0;
+
+    while (data < end) {
+        const char *line_end = memchr(data, '\n', end - data);
+
+        if (line_end == NULL) {
+            line_end = end;
+        }
+
+        memset(&device, 0, offsetof(struct WireDevice, uuids));
+
+        for (const char *p = data; p < line_end; ) {
+            const char *value = memchr(p, '=', line_end - p);
+            const char *next = memchr(p, '&', line_end - p);
+
+            if (next == NULL) {
+                next = line_end;
+            }
+            if (value == NULL || value > next) {
+                p = next + 1;
+                continue;
+            }
+            value++;
+
+            if (strncmp(p, "address=", 8) == 0) {
+                char address[18];
+                unsigned b[6];
+
+                decode_component(value, next, address, sizeof(address));
+                if (sscanf(address, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) == 6) {
+                    for (int i = 0; i < 6; i++) {
+                        device.bda[i] = b[i];
+                    }
+                }
+            } else if (strncmp(p, "device=", 7) == 0) {
+                decode_component(value, next, device.name, sizeof(device.name));
+            } else if (strncmp(p, "services=", 9) == 0) {
+                device.discovery = true;
+                parse_uuid_list(value, &device, false);
+            } else if (strncmp(p, "chars=", 6) == 0) {
+                device.discovery = true;
+                parse_uuid_list(value, &device, true);
+            } else if (strncmp(p, "rssi=", 5) == 0) {
+                device.rssi = atoi(value);
+            } else if (strncmp(p, "lost=", 5) == 0) {
+                device.lost = *value == '1';
+            }
+
+            p = next + 1;
+        }
+
+        handler(&device, arg);
+        count++;
+        data = line_end + 1;
+    }
+
+    return count;
+}
+
+// Measurement ------------------------------------------------------------------------------------
+
+struct Checksum {
+    uint64_t sum;
+    int devices;
+    int uuids;
+};
+
+static void checksum_device(const struct WireDevice *device, void *arg) {
+    struct Checksum *checksum = arg;
+
+    checksum->sum += device->bda[3] + device->rssi + device->uuids_count;
+    checksum->devices++;
+    checksum->uuids += device->uuids_count;
+}
+
+static void decode_batches(const struct Batches *batches, bool wire, struct Checksum *checksum) {
+    for (int i = 0; i < batches->count; i++) {
+        if (wire) {
+            int n = wire_decode((const uint8_t *) batches->data[i], batches->length[i], checksum_device, checksum);
+
+            if (n < 0) {
+                fprintf(stderr, "wire_decode failed: %d\n", n);
+                exit(1);
+            }
+        } else {
+            decode_text(batches->data[i], batches->length[i], checksum_device, checksum);
+        }
+    }
+}
+
+// Nanoseconds per device of repeated encode or decode passes
+static double run(bool wire, bool decode, bool with_discovery) {
+    struct Checksum checksum = { 0 };
+    uint64_t start = histogram_now_ns();
+    uint64_t elapsed;
+    int passes = 0;
+
+    do {
+        if (decode) {
+            decode_batches(wire ? &wire_batches : &text_batches, wire, &checksum);
+        } else if (wire) {
+            encode_wire(with_discovery, false);
+        } else {
+            encode_text(with_discovery, false);
+        }
+        passes++;
+        elapsed = histogram_now_ns() - start;
+    } while (elapsed < MIN_RUN_NS);
+
+    return (double) elapsed / ((double) passes * BENCH_DEVICES);
+}
+
+static void bench(bool with_discovery) {
+    struct Checksum text_checksum = { 0 };
+    struct Checksum wire_checksum = { 0 };
+
+    memset(&text_batches, 0, sizeof(text_batches));
+    memset(&wire_batches, 0, sizeof(wire_batches));
+    encode_text(with_discovery, true);
+    encode_wire(with_discovery, true);
+
+    // Both formats have to carry the same content
+    decode_batches(&text_batches, false, &text_checksum);
+    decode_batches(&wire_batches, true, &wire_checksum);
+    if (text_checksum.sum != wire_checksum.sum || text_checksum.devices != BENCH_DEVICES) {
+        fprintf(stderr, "decoded content differs (text %d devices %d uuids, binary %d devices %d uuids)\n",
+                text_checksum.devices, text_checksum.uuids, wire_checksum.devices, wire_checksum.uuids);
+        exit(1);
+    }
+
+    printf("%s (%d devices, %d UUIDs each)\n", with_discovery ? "with discovery" : "sightings",
+           BENCH_DEVICES, wire_checksum.uuids / BENCH_DEVICES);
+    printf("  %-8s %9s %8s %12s %12s\n", "format", "B/obs", "batches", "encode ns", "decode ns");
+
+    for (int wire = 0; wire <= 1; wire++) {
+        const struct Batches *batches = wire ? &wire_batches : &text_batches;
+
+        printf("  %-8s %9.1f %8d %12.0f %12.0f\n", wire ? "binary" : "text",
+               (double) batches->total_bytes / BENCH_DEVICES, batches->count,
+               run(wire, false, with_discovery), run(wire, true, with_discovery));
+    }
+}
+
+int main(int argc, char **argv) {
+    srand(1);
+    fill_devices();
+
+    bench(false);
+    bench(true);
+
+    return 0;
+}
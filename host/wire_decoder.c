@@ -0,0 +1,293 @@
+#include "wire_decoder.h"
+
+#include <string.h>
+
+// Bases of the batch being decoded, indexed by their batch index
+struct Bases {
+    bool valid[256];
+    uint8_t bytes[256][16];
+};
+
+static uint16_t get_u16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static int decode_uuids(const uint8_t *p, size_t len, const struct Bases *bases, struct WireDevice *device) {
+    size_t pos = 2;
+
+    if (len < 2) {
+        return WIRE_ERROR_ITEM;
+    }
+
+    device->uuids_count = get_u16(p);
+    if (device->uuids_count > WIRE_MAX_UUIDS) {
+        return WIRE_ERROR_UUID;
+    }
+
+    for (int i = 0; i < device->uuids_count; i++) {
+        struct WireUuid *uuid = &device->uuids[i];
+
+        if (pos >= len) {
+            return WIRE_ERROR_ITEM;
+        }
+
+        uint8_t tag = p[pos++];
+        uint8_t kind = tag & ~WIRE_UUID_CHAR;
+
+        uuid->characteristic = (tag & WIRE_UUID_CHAR) != 0;
+
+        if (kind == WIRE_UUID_16 || kind == WIRE_UUID_32) {
+            uuid->len = kind == WIRE_UUID_16 ? 2 : 4;
+            if (pos + uuid->len > len) {
+                return WIRE_ERROR_ITEM;
+            }
+            memcpy(uuid->bytes, p + pos, uuid->len);
+            pos += uuid->len;
+        } else if (kind == WIRE_UUID_128) {
+            if (pos + 5 > len) {
+                return WIRE_ERROR_ITEM;
+            }
+            if (!bases->valid[p[pos]]) {
+                return WIRE_ERROR_BASE;
+            }
+            uuid->len = 16;
+            memcpy(uuid->bytes, bases->bytes[p[pos]], 12);
+            memcpy(uuid->bytes + 12, p + pos + 1, 4);
+            pos += 5;
+        } else {
+            return WIRE_ERROR_UUID;
+        }
+    }
+
+    return pos == len ? 0 : WIRE_ERROR_ITEM;
+}
+
+static int decode_device(const uint8_t *p, size_t len, const struct Bases *bases, struct WireDevice *device) {
+    size_t pos = 8;
+
+    if (len < 8) {
+        return WIRE_ERROR_ITEM;
+    }
+
+    uint8_t flags = p[0];
+
+    device->addr_type = flags >> WIRE_DEVICE_ADDR_TYPE_SHIFT;
+    device->lost = (flags & WIRE_DEVICE_LOST) != 0;
+    device->discovery = (flags & WIRE_DEVICE_DISCOVERY) != 0;
+    device->discovery_failed = (flags & WIRE_DEVICE_FAILED) != 0;
+    memcpy(device->bda, p + 1, 6);
+    device->rssi = (int8_t) p[7];
+    device->name[0] = '\0';
+    device->uuids_count = 0;
+    device->beacon_kind = 0;
+    device->beacon_len = 0;
+    device->values_count = 0;
+
+    if (flags & WIRE_DEVICE_NAME) {
+        if (pos >= len || pos + 1 + p[pos] > len) {
+            return WIRE_ERROR_ITEM;
+        }
+        memcpy(device->name, p + pos + 1, p[pos]);
+        device->name[p[pos]] = '\0';
+        pos += 1 + p[pos];
+    }
+
+    if (device->discovery) {
+        return decode_uuids(p + pos, len - pos, bases, device);
+    }
+
+    return pos == len ? 0 : WIRE_ERROR_ITEM;
+}
+
+static int decode_values(const uint8_t *p, size_t len, struct WireDevice *device) {
+    size_t pos = 0;
+
+    while (pos < len) {
+        if (pos + 3 > len || pos + 3 + p[pos + 2] > len || device->values_count >= WIRE_MAX_VALUES) {
+            return WIRE_ERROR_ITEM;
+        }
+
+        struct WireValue *value = &device->values[device->values_count++];
+
+        value->uuid16 = get_u16(p + pos);
+        value->len = p[pos + 2];
+        memcpy(value->bytes, p + pos + 3, value->len);
+        pos += 3 + value->len;
+    }
+    return 0;
+}
+
+static int check_header(const uint8_t *data, size_t len) {
+    if (len < WIRE_HEADER_SIZE || memcmp(data, WIRE_MAGIC, 3) != 0) {
+        return WIRE_ERROR_HEADER;
+    }
+    if (data[3] != WIRE_VERSION) {
+        return WIRE_ERROR_VERSION;
+    }
+    return 0;
+}
+
+int wire_decode(const uint8_t *data, size_t len, wire_device_handler_t handler, void *arg) {
+    // Too large for small thread stacks, one per thread for multi-threaded collectors
+    static _Thread_local struct Bases bases;
+    static _Thread_local struct WireDevice device;
+    size_t pos = WIRE_HEADER_SIZE;
+    int count = 0;
+
+    int err = check_header(data, len);
+
+    if (err < 0) {
+        return err;
+    }
+
+    memset(bases.valid, 0, sizeof(bases.valid));
+
+    while (pos < len) {
+        if (pos + WIRE_ITEM_HEADER_SIZE > len) {
+            return WIRE_ERROR_TRUNCATED;
+        }
+
+        uint8_t type = data[pos];
+        size_t item_len = get_u16(data + pos + 1);
+        const uint8_t *value = data + pos + WIRE_ITEM_HEADER_SIZE;
+
+        if (pos + WIRE_ITEM_HEADER_SIZE + item_len > len) {
+            return WIRE_ERROR_TRUNCATED;
+        }
+
+        if (type == WIRE_ITEM_BASE) {
+            if (item_len != 17) {
+                return WIRE_ERROR_ITEM;
+            }
+            bases.valid[value[0]] = true;
+            memcpy(bases.bytes[value[0]], value + 1, 16);
+        } else if (type == WIRE_ITEM_DEVICE) {
+            err = decode_device(value, item_len, &bases, &device);
+
+            if (err < 0) {
+                return err;
+            }
+
+            // Beacon and values items belong to the device before them
+            size_t next = pos + WIRE_ITEM_HEADER_SIZE + item_len;
+
+            if (next + WIRE_ITEM_HEADER_SIZE <= len && data[next] == WIRE_ITEM_BEACON) {
+                size_t beacon_len = get_u16(data + next + 1);
+
+                if (next + WIRE_ITEM_HEADER_SIZE + beacon_len > len) {
+                    return WIRE_ERROR_TRUNCATED;
+                }
+                if (beacon_len < 2 || beacon_len > 2 + sizeof(device.beacon)) {
+                    return WIRE_ERROR_ITEM;
+                }
+                device.beacon_kind = data[next + 3];
+                device.beacon_subtype = data[next + 4];
+                device.beacon_len = beacon_len - 2;
+                memcpy(device.beacon, data + next + 5, device.beacon_len);
+                item_len += WIRE_ITEM_HEADER_SIZE + beacon_len;
+                next += WIRE_ITEM_HEADER_SIZE + beacon_len;
+            }
+
+            if (next + WIRE_ITEM_HEADER_SIZE <= len && data[next] == WIRE_ITEM_VALUES) {
+                size_t values_len = get_u16(data + next + 1);
+
+                if (next + WIRE_ITEM_HEADER_SIZE + values_len > len) {
+                    return WIRE_ERROR_TRUNCATED;
+                }
+                err = decode_values(data + next + WIRE_ITEM_HEADER_SIZE, values_len, &device);
+                if (err < 0) {
+                    return err;
+                }
+                item_len += WIRE_ITEM_HEADER_SIZE + values_len;
+            }
+
+            handler(&device, arg);
+            count++;
+        }
+
+        // Unknown items are skipped
+
+        pos += WIRE_ITEM_HEADER_SIZE + item_len;
+    }
+
+    return count;
+}
+
+static int decode_metrics(const uint8_t *p, size_t len, struct WireMetrics *metrics) {
+    size_t pos = WIRE_METRICS_FIXED_SIZE;
+
+    if (len < WIRE_METRICS_FIXED_SIZE) {
+        return WIRE_ERROR_ITEM;
+    }
+
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->uptime_ms = get_u32(p);
+    metrics->cycles_per_us = get_u16(p + 4);
+    metrics->heap_free = get_u32(p + 6);
+    metrics->heap_min_free = get_u32(p + 10);
+    metrics->adv_dropped = get_u32(p + 14);
+
+    while (pos < len) {
+        struct WireStage *stage = &metrics->stages[metrics->stages_count];
+        const uint8_t *q = p + pos;
+
+        if (metrics->stages_count == WIRE_MAX_STAGES || pos + WIRE_METRICS_STAGE_SIZE > len) {
+            return WIRE_ERROR_ITEM;
+        }
+
+        uint8_t first = q[14];
+        uint8_t count = q[15];
+
+        if (first + count > 32 || pos + WIRE_METRICS_STAGE_SIZE + 4 * count > len) {
+            return WIRE_ERROR_ITEM;
+        }
+
+        stage->stage = q[0];
+        stage->unit = q[1];
+        stage->count = get_u32(q + 2);
+        stage->max = get_u32(q + 6);
+        stage->average = get_u32(q + 10);
+        for (int i = 0; i < count; i++) {
+            stage->buckets[first + i] = get_u32(q + WIRE_METRICS_STAGE_SIZE + 4 * i);
+        }
+
+        metrics->stages_count++;
+        pos += WIRE_METRICS_STAGE_SIZE + 4 * count;
+    }
+
+    return 0;
+}
+
+int wire_decode_metrics(const uint8_t *data, size_t len, struct WireMetrics *metrics) {
+    size_t pos = WIRE_HEADER_SIZE;
+    int err = check_header(data, len);
+
+    if (err < 0) {
+        return err;
+    }
+
+    while (pos < len) {
+        if (pos + WIRE_ITEM_HEADER_SIZE > len) {
+            return WIRE_ERROR_TRUNCATED;
+        }
+
+        size_t item_len = get_u16(data + pos + 1);
+
+        if (pos + WIRE_ITEM_HEADER_SIZE + item_len > len) {
+            return WIRE_ERROR_TRUNCATED;
+        }
+
+        if (data[pos] == WIRE_ITEM_METRICS) {
+            err = decode_metrics(data + pos + WIRE_ITEM_HEADER_SIZE, item_len, metrics);
+            return err < 0 ? err : 1;
+        }
+
+        pos += WIRE_ITEM_HEADER_SIZE + item_len;
+    }
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "wire_format.h"
+
+// Reference decoder of binary uplink batches (wire_format.h) for collectors.
+// Depends on nothing but the format header, UUIDs are returned as full bytes.
+
+#define WIRE_MAX_UUIDS 1024
+#define WIRE_MAX_VALUES 32
+
+#define WIRE_ERROR_HEADER   -1      // Bad magic
+#define WIRE_ERROR_VERSION  -2      // Unknown format version
+#define WIRE_ERROR_TRUNCATED -3     // Item runs past the end of the batch
+#define WIRE_ERROR_ITEM     -4      // Item shorter or longer than its content
+#define WIRE_ERROR_BASE     -5      // UUID refers to a base not sent before
+#define WIRE_ERROR_UUID     -6      // Unknown UUID kind or more than WIRE_MAX_UUIDS
+
+struct WireUuid {
+    bool characteristic;
+    uint8_t len;            // 2, 4 or 16
+    uint8_t bytes[16];      // Little endian, as sent over the air
+};
+
+struct WireValue {
+    uint16_t uuid16;
+    uint8_t len;
+    uint8_t bytes[255];     // As read from the characteristic
+};
+
+struct WireDevice {
+    uint8_t bda[6];
+    uint8_t addr_type;
+    int8_t rssi;
+    bool lost;
+    bool discovery;         // UUID list is present
+    bool discovery_failed;
+    char name[256];         // Empty when not sent
+    uint8_t beacon_kind;    // enum AdvKind of adv_decoder.h, 0 when not sent
+    uint8_t beacon_subtype;
+    uint8_t beacon_len;
+    uint8_t beacon[255];    // Frame, layout depends on the kind
+    int uuids_count;
+    struct WireUuid uuids[WIRE_MAX_UUIDS];
+    int values_count;       // Characteristic values read during discovery
+    struct WireValue values[WIRE_MAX_VALUES];
+};
+
+#define WIRE_MAX_STAGES 16
+
+struct WireStage {
+    uint8_t stage;          // enum MetricStage of metrics.h
+    uint8_t unit;           // 0 CPU cycles, 1 microseconds
+    uint32_t count;
+    uint32_t max;
+    uint32_t average;
+    uint32_t buckets[32];   // Bucket i counts durations in [2^(i-1), 2^i)
+};
+
+struct WireMetrics {
+    uint32_t uptime_ms;
+    uint16_t cycles_per_us;
+    uint32_t heap_free;
+    uint32_t heap_min_free;
+    uint32_t adv_dropped;
+    int stages_count;
+    struct WireStage stages[WIRE_MAX_STAGES];
+};
+
+// Device is only valid during the call
+typedef void (*wire_device_handler_t)(const struct WireDevice *device, void *arg);
+
+// Decode a batch, calling handler for every device item. Safe to call from several threads.
+// Returns the number of devices or a WIRE_ERROR_* code, devices before the error were delivered.
+int wire_decode(const uint8_t *data, size_t len, wire_device_handler_t handler, void *arg);
+
+// Decode the metrics item of a batch. Returns 1 when found, 0 when the batch has none,
+// or a WIRE_ERROR_* code.
+int wire_decode_metrics(const uint8_t *data, size_t len, struct WireMetrics *metrics);
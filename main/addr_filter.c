@@ -0,0 +1,329 @@
+#include "addr_filter.h"
+#include "scanner_hal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define FILTER_PRINT "FILTER"
+
+#define ADDRESS_MASK 0xffffffffffffULL
+#define OUI_MASK 0xffffff000000ULL
+
+// Public device address and public identity address (see rpa.h)
+#define ADDR_TYPE_PUBLIC 0x00
+#define ADDR_TYPE_PUBLIC_ID 0x02
+
+struct FilterHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t mode;
+    uint16_t reserved;
+    uint32_t count;
+    uint32_t checksum;
+};
+
+_Static_assert(sizeof(struct FilterHeader) == ADDR_FILTER_HEADER_SIZE, "Filter header layout");
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+// Keys differ in few bits (neighbouring tags), the finalizer of splitmix64 spreads them
+static uint64_t hash_key(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+// Word from the low half of the hash, bits from 6-bit fields of the high half
+static uint64_t *bloom_word(const struct AddrFilter *filter, uint64_t hash) {
+    return &filter->bloom[((hash & 0xffffffff) * filter->bloom_words) >> 32];
+}
+
+static uint64_t bloom_bits(uint64_t hash) {
+    uint64_t bits = 0;
+
+    for (int i = 0; i < ADDR_FILTER_BLOOM_HASHES; i++) {
+        bits |= 1ULL << ((hash >> (32 + 6 * i)) & 63);
+    }
+    return bits;
+}
+
+static void bloom_add(struct AddrFilter *filter, uint64_t key) {
+    uint64_t hash = hash_key(key);
+
+    *bloom_word(filter, hash) |= bloom_bits(hash);
+}
+
+static bool bloom_may_contain(const struct AddrFilter *filter, uint64_t key) {
+    uint64_t hash = hash_key(key);
+    uint64_t bits = bloom_bits(hash);
+
+    return (*bloom_word(filter, hash) & bits) == bits;
+}
+
+static void rebuild_bloom(struct AddrFilter *filter) {
+    memset(filter->bloom, 0, filter->bloom_words * sizeof(uint64_t));
+
+    for (int i = 0; i < filter->count; i++) {
+        bloom_add(filter, filter->keys[i]);
+    }
+}
+
+// Index of the key, or of the first larger key (insertion point) with found cleared
+static int search(const struct AddrFilter *filter, uint64_t key, bool *found) {
+    int low = 0;
+    int high = filter->count;
+
+    while (low < high) {
+        int middle = (low + high) / 2;
+
+        if (filter->keys[middle] < key) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    *found = low < filter->count && filter->keys[low] == key;
+    return low;
+}
+
+static bool is_listed(const struct AddrFilter *filter, uint64_t key, bool *bloom_hit) {
+    bool found = false;
+
+    if (!bloom_may_contain(filter, key)) {
+        return false;
+    }
+
+    *bloom_hit = true;
+    search(filter, key, &found);
+    return found;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t checksum(const uint64_t *keys, int count) {
+    const uint8_t *data = (const uint8_t *) keys;
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < (size_t) count * sizeof(uint64_t); i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+void addr_filter_init(struct AddrFilter *filter, uint64_t *keys, int capacity, uint64_t *bloom) {
+    memset(filter, 0, sizeof(*filter));
+
+    filter->keys = keys;
+    filter->capacity = capacity;
+    filter->bloom = bloom;
+    filter->bloom_words = ADDR_FILTER_BLOOM_WORDS(capacity);
+    addr_filter_clear(filter);
+}
+
+void addr_filter_clear(struct AddrFilter *filter) {
+    filter->count = 0;
+    memset(filter->bloom, 0, filter->bloom_words * sizeof(uint64_t));
+}
+
+bool addr_filter_set(struct AddrFilter *filter, const uint64_t *keys, int count) {
+    if (count > filter->capacity) {
+        return false;
+    }
+
+    memmove(filter->keys, keys, count * sizeof(uint64_t));
+    qsort(filter->keys, count, sizeof(uint64_t), compare_keys);
+
+    filter->count = 0;
+    for (int i = 0; i < count; i++) {
+        if (filter->count == 0 || filter->keys[filter->count - 1] != filter->keys[i]) {
+            filter->keys[filter->count++] = filter->keys[i];
+        }
+    }
+
+    rebuild_bloom(filter);
+    return true;
+}
+
+bool addr_filter_add(struct AddrFilter *filter, uint64_t key) {
+    bool found;
+    int index = search(filter, key, &found);
+
+    if (found) {
+        return true;
+    }
+    if (filter->count >= filter->capacity) {
+        return false;
+    }
+
+    memmove(&filter->keys[index + 1], &filter->keys[index], (filter->count - index) * sizeof(uint64_t));
+    filter->keys[index] = key;
+    filter->count++;
+
+    bloom_add(filter, key);
+    return true;
+}
+
+// Bits of a Bloom filter cannot be cleared, it is built again
+bool addr_filter_remove(struct AddrFilter *filter, uint64_t key) {
+    bool found;
+    int index = search(filter, key, &found);
+
+    if (!found) {
+        return false;
+    }
+
+    memmove(&filter->keys[index], &filter->keys[index + 1], (filter->count - index - 1) * sizeof(uint64_t));
+    filter->count--;
+
+    rebuild_bloom(filter);
+    return true;
+}
+
+static bool contains(const struct AddrFilter *filter, const uint8_t *bda, uint8_t addr_type, bool *bloom_hit) {
+    uint64_t key = addr_filter_address_key(bda);
+
+    if (is_listed(filter, key, bloom_hit)) {
+        return true;
+    }
+
+    return (addr_type == ADDR_TYPE_PUBLIC || addr_type == ADDR_TYPE_PUBLIC_ID)
+            && is_listed(filter, ADDR_FILTER_PREFIX_FLAG | (key & OUI_MASK), bloom_hit);
+}
+
+bool addr_filter_contains(const struct AddrFilter *filter, const uint8_t *bda, uint8_t addr_type) {
+    bool bloom_hit = false;
+
+    return contains(filter, bda, addr_type, &bloom_hit);
+}
+
+bool addr_filter_accepts(struct AddrFilter *filter, const uint8_t *bda, uint8_t addr_type) {
+    if (filter->mode == ADDR_FILTER_OFF) {
+        return true;
+    }
+
+    bool bloom_hit = false;
+    bool listed = contains(filter, bda, addr_type, &bloom_hit);
+    bool accepted = listed == (filter->mode == ADDR_FILTER_ALLOW);
+
+    filter->counters.checked++;
+    if (!accepted) {
+        filter->counters.rejected++;
+    }
+    if (bloom_hit) {
+        filter->counters.bloom_hits++;
+        if (!listed) {
+            filter->counters.false_positives++;
+        }
+    }
+
+    return accepted;
+}
+
+uint64_t addr_filter_address_key(const uint8_t *bda) {
+    uint64_t key = 0;
+
+    for (int i = 0; i < 6; i++) {
+        key = key << 8 | bda[i];
+    }
+    return key;
+}
+
+uint64_t addr_filter_prefix_key(const uint8_t *oui) {
+    return ADDR_FILTER_PREFIX_FLAG | (uint64_t) oui[0] << 40 | (uint64_t) oui[1] << 32 | (uint64_t) oui[2] << 24;
+}
+
+int addr_filter_parse_entry(const char *str, uint64_t *key) {
+    unsigned b[6];
+    uint8_t bytes[6];
+    int n = 0;
+
+    if (sscanf(str, " %2x:%2x:%2x:%2x:%2x:%2x%n", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &n) == 6 && n > 0) {
+        for (int i = 0; i < 6; i++) {
+            bytes[i] = b[i];
+        }
+        *key = addr_filter_address_key(bytes);
+    } else if (n = 0, sscanf(str, " %2x:%2x:%2x%n", &b[0], &b[1], &b[2], &n) == 3 && n > 0) {
+        for (int i = 0; i < 3; i++) {
+            bytes[i] = b[i];
+        }
+        *key = addr_filter_prefix_key(bytes);
+    } else {
+        return 0;
+    }
+
+    // Entry ends at white space, "aa:bb:cc:dd" is neither an address nor a prefix
+    if (str[n] != '\0' && !isspace((unsigned char) str[n])) {
+        return 0;
+    }
+    return n;
+}
+
+bool addr_filter_load(struct AddrFilter *filter) {
+    struct FilterHeader header;
+    size_t size = hal_filter_size();
+
+    addr_filter_clear(filter);
+    filter->mode = ADDR_FILTER_OFF;
+
+    if (size < sizeof(header) || !hal_filter_read(0, &header, sizeof(header))
+            || header.magic != ADDR_FILTER_MAGIC || header.version != ADDR_FILTER_VERSION) {
+        return false;
+    }
+
+    if (header.count > (uint32_t) filter->capacity || sizeof(header) + header.count * sizeof(uint64_t) > size
+            || header.mode > ADDR_FILTER_DENY) {
+        SCANNER_LOGE(FILTER_PRINT, "Address filter of %u entries does not fit, %d at most", (unsigned) header.count,
+                     filter->capacity);
+        return false;
+    }
+
+    if (!hal_filter_read(sizeof(header), filter->keys, header.count * sizeof(uint64_t))
+            || checksum(filter->keys, header.count) != header.checksum) {
+        SCANNER_LOGE(FILTER_PRINT, "Address filter in flash is corrupt");
+        return false;
+    }
+
+    // Images are built sorted, one that is not is sorted here
+    if (!addr_filter_set(filter, filter->keys, header.count)) {
+        return false;
+    }
+    filter->mode = header.mode;
+
+    return true;
+}
+
+bool addr_filter_save(const struct AddrFilter *filter) {
+    struct FilterHeader header = {
+        .magic = ADDR_FILTER_MAGIC,
+        .version = ADDR_FILTER_VERSION,
+        .mode = filter->mode,
+        .count = filter->count,
+        .checksum = checksum(filter->keys, filter->count),
+    };
+    size_t length = sizeof(header) + filter->count * sizeof(uint64_t);
+
+    if (length > hal_filter_size()) {
+        return false;
+    }
+
+    return hal_filter_erase(length)
+            && hal_filter_write(sizeof(header), filter->keys, filter->count * sizeof(uint64_t))
+            && hal_filter_write(0, &header, sizeof(header));
+}
+
+size_t addr_filter_memory(const struct AddrFilter *filter) {
+    return filter->capacity * sizeof(uint64_t) + filter->bloom_words * sizeof(uint64_t);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sdkconfig.h"
+
+// Allow or deny list of device addresses and OUI prefixes, checked before an
+// advertisement is parsed or its device looked up.
+//
+// Entries are 64-bit keys in a sorted array: an address is its 48 bits (first byte
+// most significant), a prefix sets ADDR_FILTER_PREFIX_FLAG above the 24 bits of the
+// OUI shifted into the top half of an address. Prefixes only match public addresses,
+// the top bits of random addresses carry no vendor. In front of the array a blocked
+// Bloom filter (every key sets ADDR_FILTER_BLOOM_HASHES bits of one 64-bit word)
+// answers most lookups of unlisted addresses with one memory access, only the rest
+// are searched for.
+//
+// The list is kept in the "filter" flash partition (hal_filter_* functions): a 16
+// byte header (magic, version, mode, entry count, FNV-1a checksum of the entries,
+// little endian) followed by the sorted keys. host/filter_image.py builds an image,
+// the filter command of the command channel edits the list in place.
+
+// Entries kept, set in Kconfig
+#define ADDR_FILTER_MAX_ENTRIES CONFIG_ESP_ADDR_FILTER_MAX_ENTRIES
+
+// Bloom filter bits per entry and bits set per key
+#define ADDR_FILTER_BLOOM_BITS 16
+#define ADDR_FILTER_BLOOM_HASHES 4
+
+// Bloom filter words for a capacity
+#define ADDR_FILTER_BLOOM_WORDS(capacity) (((capacity) * ADDR_FILTER_BLOOM_BITS + 63) / 64)
+
+#define ADDR_FILTER_PREFIX_FLAG (1ULL << 48)
+
+#define ADDR_FILTER_MAGIC 0x544c4641    // "AFLT"
+#define ADDR_FILTER_VERSION 1
+#define ADDR_FILTER_HEADER_SIZE 16
+
+enum AddrFilterMode {
+    ADDR_FILTER_OFF,        // Every address passes
+    ADDR_FILTER_ALLOW,      // Only listed addresses pass
+    ADDR_FILTER_DENY,       // Listed addresses are dropped
+};
+
+struct AddrFilterCounters {
+    uint32_t checked;
+    uint32_t rejected;
+    uint32_t bloom_hits;        // Lookups the Bloom filter could not answer
+    uint32_t false_positives;   // Bloom filter hits not in the list
+};
+
+// Keys and ADDR_FILTER_BLOOM_WORDS(capacity) Bloom filter words are provided by the owner
+struct AddrFilter {
+    uint8_t mode;
+    int count;
+    int capacity;
+    uint64_t *keys;
+    uint64_t *bloom;
+    uint32_t bloom_words;
+    struct AddrFilterCounters counters;
+};
+
+// Empty list, filter off
+void addr_filter_init(struct AddrFilter *filter, uint64_t *keys, int capacity, uint64_t *bloom);
+
+void addr_filter_clear(struct AddrFilter *filter);
+
+// Replace the list with count keys in any order, duplicates are dropped. Returns false
+// when they do not fit.
+bool addr_filter_set(struct AddrFilter *filter, const uint64_t *keys, int count);
+
+// Returns false when the list is full, adding a listed key succeeds
+bool addr_filter_add(struct AddrFilter *filter, uint64_t key);
+
+// Returns false when the key is not listed
+bool addr_filter_remove(struct AddrFilter *filter, uint64_t key);
+
+// Address or its OUI (public addresses, addr_type 0 or 2) is listed
+bool addr_filter_contains(const struct AddrFilter *filter, const uint8_t *bda, uint8_t addr_type);
+
+// Whether an advertisement of the address is processed, counted
+bool addr_filter_accepts(struct AddrFilter *filter, const uint8_t *bda, uint8_t addr_type);
+
+uint64_t addr_filter_address_key(const uint8_t *bda);
+uint64_t addr_filter_prefix_key(const uint8_t *oui);
+
+// Parse "xx:xx:xx:xx:xx:xx" (address) or "xx:xx:xx" (OUI prefix). Returns characters
+// consumed or 0 when malformed.
+int addr_filter_parse_entry(const char *str, uint64_t *key);
+
+// Load the list kept in flash, false when there is none or it is corrupt
+bool addr_filter_load(struct AddrFilter *filter);
+
+// Write the list to flash, entries first so a cut write leaves no valid header
+bool addr_filter_save(const struct AddrFilter *filter);
+
+// Memory of the list and its Bloom filter
+size_t addr_filter_memory(const struct AddrFilter *filter);
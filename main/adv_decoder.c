@@ -0,0 +1,317 @@
+#include "adv_decoder.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+// Manufacturer specific data decoders by company identifier (Bluetooth Assigned Numbers)
+#define COMPANY_DECODERS(X) \
+    X(0x0006, decode_microsoft) \
+    X(0x004C, decode_apple)
+
+// Service data decoders by 16-bit service UUID
+#define SERVICE_DECODERS(X) \
+    X(0xFD6F, decode_exposure) \
+    X(0xFE2C, decode_fast_pair) \
+    X(0xFEAA, decode_eddystone)
+
+// Switch cases of a decoder table, the compiler turns them into a jump table or a binary search
+#define DECODER_CASE(id, decoder) case id: return decoder(data, len, decoded);
+
+#define ADV_KIND_NAME(kind, name) name,
+
+static const char *const kind_names[ADV_KIND_COUNT] = { ADV_KINDS(ADV_KIND_NAME) };
+
+#define APPLE_TYPE_IBEACON 0x02
+#define IBEACON_LEN 21
+
+#define ALTBEACON_CODE 0xBEAC
+#define ALTBEACON_LEN 26            // Company, beacon code, beacon id, reference RSSI, reserved byte
+
+#define EDDYSTONE_UID 0x00
+#define EDDYSTONE_URL 0x10
+#define EDDYSTONE_TLM 0x20
+#define EDDYSTONE_EID 0x30
+
+#define FAST_PAIR_MODEL_ID_LEN 3
+#define EXPOSURE_LEN 20
+
+struct AdvDecoderCounters adv_decoder_counters;
+
+static bool set_frame(struct AdvDecoded *decoded, uint8_t kind, uint8_t subtype, const uint8_t *data, uint8_t len) {
+    decoded->kind = kind;
+    decoded->subtype = subtype;
+    decoded->frame.data = data;
+    decoded->frame.len = len;
+    return true;
+}
+
+// DECODERS ---------------------------------------------------------------------------------------
+
+// Continuity messages: type, length and payload, one after the other. An iBeacon
+// message wins over any other, otherwise the first message is reported.
+static bool decode_apple(const uint8_t *data, uint8_t len, struct AdvDecoded *decoded) {
+    bool found = false;
+    int i = 0;
+
+    while (i + 2 <= len) {
+        uint8_t type = data[i];
+        uint8_t message_len = data[i + 1];
+
+        if (i + 2 + message_len > len) {
+            break;
+        }
+        if (type == APPLE_TYPE_IBEACON && message_len == IBEACON_LEN) {
+            return set_frame(decoded, ADV_KIND_IBEACON, 0, data + i + 2, IBEACON_LEN);
+        }
+        if (!found) {
+            found = set_frame(decoded, ADV_KIND_APPLE, type, data + i + 2, message_len);
+        }
+        i += 2 + message_len;
+    }
+
+    return found;
+}
+
+// Scenario type, then the scenario specific payload (device type and salt of CDP beacons)
+static bool decode_microsoft(const uint8_t *data, uint8_t len, struct AdvDecoded *decoded) {
+    if (len < 2) {
+        return false;
+    }
+    return set_frame(decoded, ADV_KIND_MICROSOFT, data[0], data + 1, len - 1);
+}
+
+// Frame type, then the frame without it
+static bool decode_eddystone(const uint8_t *data, uint8_t len, struct AdvDecoded *decoded) {
+    if (len < 1) {
+        return false;
+    }
+
+    switch (data[0]) {
+    // Two reserved bytes at the end are optional
+    case EDDYSTONE_UID:
+        return len >= 18 && set_frame(decoded, ADV_KIND_EDDYSTONE_UID, 0, data + 1, 17);
+    case EDDYSTONE_URL:
+        return len >= 3 && len <= 20 && set_frame(decoded, ADV_KIND_EDDYSTONE_URL, 0, data + 1, len - 1);
+    case EDDYSTONE_TLM:
+        return len >= 2 && (data[1] != 0 || len == 14) && set_frame(decoded, ADV_KIND_EDDYSTONE_TLM, data[1], data + 2, len - 2);
+    case EDDYSTONE_EID:
+        return len == 10 && set_frame(decoded, ADV_KIND_EDDYSTONE_EID, 0, data + 1, 9);
+    default:
+        return false;
+    }
+}
+
+static bool decode_fast_pair(const uint8_t *data, uint8_t len, struct AdvDecoded *decoded) {
+    if (len < FAST_PAIR_MODEL_ID_LEN) {
+        return false;
+    }
+    return set_frame(decoded, ADV_KIND_FAST_PAIR, len == FAST_PAIR_MODEL_ID_LEN ? 0 : 1, data, len);
+}
+
+static bool decode_exposure(const uint8_t *data, uint8_t len, struct AdvDecoded *decoded) {
+    return len == EXPOSURE_LEN && set_frame(decoded, ADV_KIND_EXPOSURE, 0, data, len);
+}
+
+// AltBeacon is sent with the company identifier of the beacon maker
+static bool decode_altbeacon(const uint8_t *data, uint8_t len, struct AdvDecoded *decoded) {
+    if (len != ALTBEACON_LEN || (data[2] << 8 | data[3]) != ALTBEACON_CODE) {
+        return false;
+    }
+    return set_frame(decoded, ADV_KIND_ALTBEACON, 0, data + 4, 21);
+}
+
+static bool decode_company(uint16_t company, const uint8_t *data, uint8_t len, struct AdvDecoded *decoded) {
+    switch (company) {
+    COMPANY_DECODERS(DECODER_CASE)
+    default:
+        return false;
+    }
+}
+
+static bool decode_service(uint16_t uuid, const uint8_t *data, uint8_t len, struct AdvDecoded *decoded) {
+    switch (uuid) {
+    SERVICE_DECODERS(DECODER_CASE)
+    default:
+        return false;
+    }
+}
+
+bool adv_decode(const struct AdvReport *report, struct AdvDecoded *decoded) {
+    for (int i = 0; i < report->manufacturer_data_count; i++) {
+        const struct AdvField *field = &report->manufacturer_data[i];
+
+        if (field->len < 2) {
+            continue;
+        }
+
+        uint16_t company = field->data[0] | (field->data[1] << 8);
+
+        if (decode_company(company, field->data + 2, field->len - 2, decoded)
+                || decode_altbeacon(field->data, field->len, decoded)) {
+            adv_decoder_counters.decoded[decoded->kind]++;
+            return true;
+        }
+    }
+
+    for (int i = 0; i < report->service_data_count; i++) {
+        const struct AdvField *field = &report->service_data[i];
+
+        if (report->service_data_types[i] != AD_TYPE_SERVICE_DATA16 || field->len < 2) {
+            continue;
+        }
+
+        uint16_t uuid = field->data[0] | (field->data[1] << 8);
+
+        if (decode_service(uuid, field->data + 2, field->len - 2, decoded)) {
+            adv_decoder_counters.decoded[decoded->kind]++;
+            return true;
+        }
+    }
+
+    adv_decoder_counters.decoded[ADV_KIND_NONE]++;
+    set_frame(decoded, ADV_KIND_NONE, 0, NULL, 0);
+    return false;
+}
+
+// END DECODERS -----------------------------------------------------------------------------------
+
+// FORMATTING -------------------------------------------------------------------------------------
+
+// Bounded string being formatted, appends past the end are cut
+struct Formatter {
+    char *out;
+    size_t size;
+    size_t length;
+};
+
+static void format_append(struct Formatter *f, const char *fmt, ...) {
+    va_list args;
+
+    if (f->length + 1 >= f->size) {
+        return;
+    }
+
+    va_start(args, fmt);
+    int n = vsnprintf(f->out + f->length, f->size - f->length, fmt, args);
+    va_end(args);
+
+    if (n > 0) {
+        f->length += (size_t) n < f->size - f->length ? (size_t) n : f->size - f->length - 1;
+    }
+}
+
+// Identifiers make up most of the text, they are written without printf
+static void format_hex(struct Formatter *f, const uint8_t *data, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < len && f->length + 2 < f->size; i++) {
+        f->out[f->length++] = digits[data[i] >> 4];
+        f->out[f->length++] = digits[data[i] & 0x0f];
+    }
+    f->out[f->length] = '\0';
+}
+
+static uint16_t get_be16(const uint8_t *p) {
+    return p[0] << 8 | p[1];
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// Eddystone URL scheme prefixes and expansion codes
+static const char *const url_schemes[] = { "http://www.", "https://www.", "http://", "https://" };
+static const char *const url_expansions[] = {
+    ".com/", ".org/", ".edu/", ".net/", ".info/", ".biz/", ".gov/",
+    ".com", ".org", ".edu", ".net", ".info", ".biz", ".gov",
+};
+
+static void format_url(struct Formatter *f, const uint8_t *frame, size_t len) {
+    if (frame[1] < sizeof(url_schemes) / sizeof(url_schemes[0])) {
+        format_append(f, "%s", url_schemes[frame[1]]);
+    }
+
+    for (size_t i = 2; i < len; i++) {
+        uint8_t c = frame[i];
+
+        if (c < sizeof(url_expansions) / sizeof(url_expansions[0])) {
+            format_append(f, "%s", url_expansions[c]);
+        } else if (c > 0x20 && c < 0x7f) {
+            format_append(f, "%c", c);
+        }
+    }
+}
+
+// Temperature in 1/256 degree Celsius, 0x8000 when not supported
+static void format_temperature(struct Formatter *f, int16_t value) {
+    if ((uint16_t) value == 0x8000) {
+        format_append(f, "-");
+        return;
+    }
+
+    int centi = value * 100 / 256;
+
+    format_append(f, "%s%d.%02d", centi < 0 ? "-" : "", (centi < 0 ? -centi : centi) / 100, (centi < 0 ? -centi : centi) % 100);
+}
+
+int adv_decoded_format(uint8_t kind, uint8_t subtype, const uint8_t *frame, size_t len, char *out, size_t size) {
+    struct Formatter f = { .out = out, .size = size, .length = 0 };
+
+    if (size == 0) {
+        return 0;
+    }
+    out[0] = '\0';
+
+    format_append(&f, "%s:", adv_kind_name(kind));
+
+    if (kind == ADV_KIND_IBEACON && len == IBEACON_LEN) {
+        format_hex(&f, frame, 4);
+        for (int i = 4; i < 10; i += 2) {
+            format_append(&f, "-");
+            format_hex(&f, frame + i, 2);
+        }
+        format_append(&f, "-");
+        format_hex(&f, frame + 10, 6);
+        format_append(&f, ":%u:%u:%d", get_be16(frame + 16), get_be16(frame + 18), (int8_t) frame[20]);
+
+    } else if (kind == ADV_KIND_ALTBEACON && len == 21) {
+        format_hex(&f, frame, 20);
+        format_append(&f, ":%d", (int8_t) frame[20]);
+
+    } else if (kind == ADV_KIND_EDDYSTONE_UID && len == 17) {
+        format_append(&f, "%d:", (int8_t) frame[0]);
+        format_hex(&f, frame + 1, 10);
+        format_append(&f, ":");
+        format_hex(&f, frame + 11, 6);
+
+    } else if (kind == ADV_KIND_EDDYSTONE_URL && len >= 2) {
+        format_append(&f, "%d:", (int8_t) frame[0]);
+        format_url(&f, frame, len);
+
+    } else if (kind == ADV_KIND_EDDYSTONE_TLM && subtype == 0 && len == 12) {
+        format_append(&f, "%u:", get_be16(frame));
+        format_temperature(&f, (int16_t) get_be16(frame + 2));
+        format_append(&f, ":%u:%u", (unsigned) get_be32(frame + 4), (unsigned) get_be32(frame + 8));
+
+    } else if (kind == ADV_KIND_EDDYSTONE_EID && len == 9) {
+        format_append(&f, "%d:", (int8_t) frame[0]);
+        format_hex(&f, frame + 1, 8);
+
+    } else if (kind == ADV_KIND_EXPOSURE && len == EXPOSURE_LEN) {
+        format_hex(&f, frame, 16);
+        format_append(&f, ":");
+        format_hex(&f, frame + 16, 4);
+
+    // Subtype and raw frame for the rest
+    } else {
+        format_append(&f, "%02x:", subtype);
+        format_hex(&f, frame, len);
+    }
+
+    return (int) f.length;
+}
+
+const char *adv_kind_name(uint8_t kind) {
+    return kind < ADV_KIND_COUNT ? kind_names[kind] : "unknown";
+}
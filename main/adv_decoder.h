@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "adv_parser.h"
+
+// Decoders of well known manufacturer specific and service data formats, so a
+// device can be identified from its advertisements without connecting to it.
+// Decoders are looked up by company identifier (manufacturer data) or 16-bit
+// service UUID (service data), see the tables in adv_decoder.c.
+//
+// Every kind has a frame of fixed layout pointing into the advertisement:
+//
+//   IBEACON        proximity UUID[16], u16 major, u16 minor (big endian), i8 TX power at 1 m
+//   ALTBEACON      beacon id[20], i8 reference RSSI at 1 m
+//   EDDYSTONE_UID  i8 TX power at 0 m, namespace[10], instance[6]
+//   EDDYSTONE_URL  i8 TX power at 0 m, u8 URL scheme, encoded URL (up to 17 bytes)
+//   EDDYSTONE_TLM  subtype is the TLM version, version 0: u16 battery mV, s8.8 temperature,
+//                  u32 advertisement count, u32 uptime in 0.1 s (big endian); version 1: encrypted
+//   EDDYSTONE_EID  i8 TX power at 0 m, ephemeral id[8]
+//   APPLE          subtype is the continuity message type, frame its payload
+//   MICROSOFT      subtype is the scenario type (1 for CDP beacons), frame the rest
+//   FAST_PAIR      subtype 0 with the 3 byte model id of a discoverable device,
+//                  subtype 1 with the account key data of a paired one
+//   EXPOSURE       rolling proximity identifier[16], associated encrypted metadata[4]
+
+#define ADV_KINDS(X) \
+    X(NONE,          "none") \
+    X(IBEACON,       "ibeacon") \
+    X(ALTBEACON,     "altbeacon") \
+    X(EDDYSTONE_UID, "eddystone-uid") \
+    X(EDDYSTONE_URL, "eddystone-url") \
+    X(EDDYSTONE_TLM, "eddystone-tlm") \
+    X(EDDYSTONE_EID, "eddystone-eid") \
+    X(APPLE,         "apple") \
+    X(MICROSOFT,     "microsoft") \
+    X(FAST_PAIR,     "fast-pair") \
+    X(EXPOSURE,      "exposure")
+
+#define ADV_KIND_ENUM(kind, name) ADV_KIND_##kind,
+
+enum AdvKind {
+    ADV_KINDS(ADV_KIND_ENUM)
+    ADV_KIND_COUNT
+};
+
+// Longest frame kept per device, longer frames (Apple continuity) are cut
+#define ADV_DECODED_MAX 28
+
+// Enough for every formatted frame of ADV_DECODED_MAX bytes
+#define ADV_DECODED_STRING_MAX 128
+
+struct AdvDecoded {
+    uint8_t kind;           // enum AdvKind
+    uint8_t subtype;        // Kind specific, see above
+    struct AdvField frame;  // View into the advertisement, no data is copied
+};
+
+// Decoded frames by kind, totals since boot
+struct AdvDecoderCounters {
+    uint32_t decoded[ADV_KIND_COUNT];   // ADV_KIND_NONE counts reports nothing was recognised in
+};
+
+extern struct AdvDecoderCounters adv_decoder_counters;
+
+// Decode the first recognised manufacturer or service data structure of a parsed report,
+// manufacturer data goes first. Returns false (kind ADV_KIND_NONE) when there is none.
+bool adv_decode(const struct AdvReport *report, struct AdvDecoded *decoded);
+
+// Name of a kind as sent in text reports, "unknown" when out of range
+const char *adv_kind_name(uint8_t kind);
+
+// Format a decoded frame as "<kind name>:<fields>", fields separated by ':' in the order of
+// the frame layout, identifiers in hex. Returns the string length (cut to size - 1).
+int adv_decoded_format(uint8_t kind, uint8_t subtype, const uint8_t *frame, size_t len, char *out, size_t size);
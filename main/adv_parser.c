@@ -0,0 +1,115 @@
+#include "adv_parser.h"
+
+#include <string.h>
+
+static void set_field(struct AdvField *field, const uint8_t *data, uint8_t len) {
+    // First occurrence wins, advertisement data is walked before scan response
+    if (field->data == NULL) {
+        field->data = data;
+        field->len = len;
+    }
+}
+
+static void handle_structure(struct AdvReport *report, uint8_t type, const uint8_t *data, uint8_t len) {
+    switch (type) {
+    case AD_TYPE_FLAGS:
+        set_field(&report->flags, data, len);
+        break;
+
+    // Complete name replaces a shortened one
+    case AD_TYPE_NAME_COMPLETE:
+        if (!report->name_complete) {
+            report->name.data = data;
+            report->name.len = len;
+            report->name_complete = true;
+        }
+        break;
+    case AD_TYPE_NAME_SHORT:
+        set_field(&report->name, data, len);
+        break;
+
+    case AD_TYPE_TX_POWER:
+        if (len >= 1) {
+            report->has_tx_power = true;
+            report->tx_power = (int8_t) data[0];
+        }
+        break;
+    case AD_TYPE_APPEARANCE:
+        set_field(&report->appearance, data, len);
+        break;
+
+    case AD_TYPE_UUID16_INCOMPLETE:
+    case AD_TYPE_UUID16_COMPLETE:
+        set_field(&report->uuid16, data, len);
+        break;
+    case AD_TYPE_UUID32_INCOMPLETE:
+    case AD_TYPE_UUID32_COMPLETE:
+        set_field(&report->uuid32, data, len);
+        break;
+    case AD_TYPE_UUID128_INCOMPLETE:
+    case AD_TYPE_UUID128_COMPLETE:
+        set_field(&report->uuid128, data, len);
+        break;
+
+    case AD_TYPE_SERVICE_DATA16:
+    case AD_TYPE_SERVICE_DATA32:
+    case AD_TYPE_SERVICE_DATA128:
+        if (report->service_data_count < ADV_MAX_SERVICE_DATA) {
+            report->service_data[report->service_data_count].data = data;
+            report->service_data[report->service_data_count].len = len;
+            report->service_data_types[report->service_data_count++] = type;
+        }
+        break;
+
+    case AD_TYPE_MANUFACTURER:
+        if (report->manufacturer_data_count < ADV_MAX_MANUFACTURER_DATA) {
+            report->manufacturer_data[report->manufacturer_data_count].data = data;
+            report->manufacturer_data[report->manufacturer_data_count++].len = len;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Walk length-type-value structures of one payload
+static int parse_payload(struct AdvReport *report, const uint8_t *payload, int payload_len) {
+    int structures = 0;
+    int offset = 0;
+
+    while (offset < payload_len) {
+        uint8_t length = payload[offset];
+
+        // Zero length marks early end of significant data
+        if (length == 0) {
+            break;
+        }
+
+        if (offset + 1 + length > payload_len) {
+            report->malformed = true;
+            break;
+        }
+
+        handle_structure(report, payload[offset + 1], &payload[offset + 2], length - 1);
+        structures++;
+        offset += length + 1;
+    }
+
+    return structures;
+}
+
+int adv_parse(const uint8_t *adv, int adv_len, const uint8_t *scan_rsp, int scan_rsp_len, struct AdvReport *report) {
+    memset(report, 0, sizeof(struct AdvReport));
+
+    int structures = 0;
+
+    if (adv != NULL) {
+        structures += parse_payload(report, adv, adv_len);
+    }
+    if (scan_rsp != NULL) {
+        structures += parse_payload(report, scan_rsp, scan_rsp_len);
+    }
+
+    return structures;
+}
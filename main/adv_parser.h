@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ADV_MAX_SERVICE_DATA 4
+#define ADV_MAX_MANUFACTURER_DATA 2
+
+// AD types (Bluetooth Assigned Numbers, Generic Access Profile)
+#define AD_TYPE_FLAGS              0x01
+#define AD_TYPE_UUID16_INCOMPLETE  0x02
+#define AD_TYPE_UUID16_COMPLETE    0x03
+#define AD_TYPE_UUID32_INCOMPLETE  0x04
+#define AD_TYPE_UUID32_COMPLETE    0x05
+#define AD_TYPE_UUID128_INCOMPLETE 0x06
+#define AD_TYPE_UUID128_COMPLETE   0x07
+#define AD_TYPE_NAME_SHORT         0x08
+#define AD_TYPE_NAME_COMPLETE      0x09
+#define AD_TYPE_TX_POWER           0x0A
+#define AD_TYPE_SERVICE_DATA16     0x16
+#define AD_TYPE_APPEARANCE         0x19
+#define AD_TYPE_SERVICE_DATA32     0x20
+#define AD_TYPE_SERVICE_DATA128    0x21
+#define AD_TYPE_MANUFACTURER       0xFF
+
+// View into the advertisement buffer, no data is copied
+struct AdvField {
+    const uint8_t *data;
+    uint8_t len;
+};
+
+// Every AD structure of interest found in one report (adv data + scan response)
+struct AdvReport {
+    struct AdvField flags;
+    struct AdvField name;
+    bool name_complete;
+    bool has_tx_power;
+    int8_t tx_power;
+    struct AdvField appearance;
+    struct AdvField uuid16;
+    struct AdvField uuid32;
+    struct AdvField uuid128;
+    struct AdvField service_data[ADV_MAX_SERVICE_DATA];
+    uint8_t service_data_types[ADV_MAX_SERVICE_DATA];
+    int service_data_count;
+    struct AdvField manufacturer_data[ADV_MAX_MANUFACTURER_DATA];
+    int manufacturer_data_count;
+    bool malformed;
+};
+
+// Parse advertisement and scan response payloads in a single pass.
+// Returns number of AD structures walked, report->malformed is set when a length runs past the buffer.
+int adv_parse(const uint8_t *adv, int adv_len, const uint8_t *scan_rsp, int scan_rsp_len, struct AdvReport *report);
@@ -0,0 +1,167 @@
+#include "command.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Scan interval and window limits of the HCI LE Set Scan Parameters command
+#define SCAN_PARAM_MIN 0x0004
+#define SCAN_PARAM_MAX 0x4000
+
+void command_reader_init(struct CommandReader *reader) {
+    reader->length = 0;
+    reader->overflow = false;
+    reader->malformed = 0;
+}
+
+static void end_line(struct CommandReader *reader, uint32_t now_ms, command_handler_t handler, void *arg) {
+    struct Command command;
+
+    reader->line[reader->length] = '\0';
+
+    if (!reader->overflow && reader->length > 0) {
+        if (command_parse(reader->line, &command)) {
+            command.received_ms = now_ms;
+            handler(&command, arg);
+        } else {
+            reader->malformed++;
+        }
+    } else if (reader->overflow) {
+        reader->malformed++;
+    }
+
+    reader->length = 0;
+    reader->overflow = false;
+}
+
+void command_reader_feed(struct CommandReader *reader, const char *data, int len, uint32_t now_ms,
+                         command_handler_t handler, void *arg) {
+    for (int i = 0; i < len; i++) {
+        char c = data[i];
+
+        if (c == '\n') {
+            end_line(reader, now_ms, handler, arg);
+        } else if (c == '\r') {
+            continue;
+        } else if (reader->length < COMMAND_LINE_LENGTH - 1) {
+            reader->line[reader->length++] = c;
+        } else {
+            reader->overflow = true;
+        }
+    }
+}
+
+void command_reader_finish(struct CommandReader *reader, uint32_t now_ms, command_handler_t handler, void *arg) {
+    if (reader->length > 0 || reader->overflow) {
+        end_line(reader, now_ms, handler, arg);
+    }
+}
+
+void command_reader_discard(struct CommandReader *reader) {
+    reader->length = 0;
+    reader->overflow = false;
+}
+
+bool command_parse(const char *line, struct Command *command) {
+    char verb[16];
+    int offset = 0;
+    unsigned id = 0;
+
+    memset(command, 0, sizeof(*command));
+
+    // Optional id in front of the verb
+    if (sscanf(line, " %u%n", &id, &offset) == 1) {
+        command->id = id;
+        line += offset;
+    }
+
+    if (sscanf(line, " %15s%n", verb, &offset) != 1) {
+        return false;
+    }
+    line += offset;
+
+    if (strcmp(verb, "discover") == 0) {
+        unsigned b[6];
+        char rest;
+
+        if (sscanf(line, " %2x:%2x:%2x:%2x:%2x:%2x %c", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &rest) != 6) {
+            return false;
+        }
+        for (int i = 0; i < 6; i++) {
+            command->bda[i] = b[i];
+        }
+        command->kind = COMMAND_DISCOVER;
+
+    } else if (strcmp(verb, "scan") == 0) {
+        unsigned interval, window;
+        char rest;
+
+        if (sscanf(line, " %u %u %c", &interval, &window, &rest) != 2 || interval < SCAN_PARAM_MIN || interval > SCAN_PARAM_MAX
+                || window < SCAN_PARAM_MIN || window > interval) {
+            return false;
+        }
+        command->kind = COMMAND_SCAN_PARAMS;
+        command->scan.interval = interval;
+        command->scan.window = window;
+
+    } else if (strcmp(verb, "flush") == 0) {
+        command->kind = COMMAND_FLUSH;
+
+    } else if (strcmp(verb, "metrics") == 0) {
+        command->kind = COMMAND_METRICS;
+
+    } else if (strcmp(verb, "irk") == 0) {
+        char rest;
+        int n = rpa_parse_identity(line, &command->identity);
+
+        if (n == 0 || sscanf(line + n, " %c", &rest) == 1) {
+            return false;
+        }
+        command->kind = COMMAND_IRK;
+
+    } else if (strcmp(verb, "filter") == 0) {
+        char op[8];
+
+        if (sscanf(line, " %7s%n", op, &offset) != 1) {
+            return false;
+        }
+        line += offset;
+        command->kind = COMMAND_FILTER;
+
+        if (strcmp(op, "add") == 0 || strcmp(op, "remove") == 0) {
+            command->filter.op = op[0] == 'a' ? COMMAND_FILTER_ADD : COMMAND_FILTER_REMOVE;
+
+            while (command->filter.count < COMMAND_FILTER_ENTRIES
+                    && (offset = addr_filter_parse_entry(line, &command->filter.keys[command->filter.count])) > 0) {
+                command->filter.count++;
+                line += offset;
+            }
+        } else if (strcmp(op, "clear") == 0) {
+            command->filter.op = COMMAND_FILTER_CLEAR;
+        } else {
+            command->filter.op = COMMAND_FILTER_MODE;
+            if (strcmp(op, "allow") == 0) {
+                command->filter.mode = ADDR_FILTER_ALLOW;
+            } else if (strcmp(op, "deny") == 0) {
+                command->filter.mode = ADDR_FILTER_DENY;
+            } else if (strcmp(op, "off") == 0) {
+                command->filter.mode = ADDR_FILTER_OFF;
+            } else {
+                return false;
+            }
+        }
+
+        char rest;
+
+        // Entries are required by add and remove, nothing may follow
+        if (sscanf(line, " %c", &rest) == 1
+                || ((command->filter.op == COMMAND_FILTER_ADD || command->filter.op == COMMAND_FILTER_REMOVE)
+                    && command->filter.count == 0)) {
+            return false;
+        }
+
+    } else {
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "rpa.h"
+#include "addr_filter.h"
+
+// Commands sent by the server over the command channel, one per line:
+//
+//   [id] discover xx:xx:xx:xx:xx:xx     queue discovery of the device
+//   [id] scan <interval> <window>        change scan parameters (units of 0.625 ms)
+//   [id] flush                           end the current inquiry window now
+//   [id] metrics                         log the instrumentation metrics and send them to the server
+//   [id] irk <IRK> xx:xx:xx:xx:xx:xx [random]
+//                                        resolve private addresses generated with the IRK (32 hex digits)
+//                                        to the identity address, see rpa.h
+//   [id] filter allow|deny|off          address filter mode, see addr_filter.h
+//   [id] filter add|remove <entry>...   up to COMMAND_FILTER_ENTRIES addresses (xx:xx:xx:xx:xx:xx)
+//                                        or OUI prefixes (xx:xx:xx)
+//   [id] filter clear                   empty the address filter list
+//
+// The optional numeric id is echoed back once the command was applied, so the
+// server can measure latency and send again what was never acknowledged.
+
+#define COMMAND_LINE_LENGTH 96
+
+#define COMMAND_FILTER_ENTRIES 4
+
+enum CommandKind {
+    COMMAND_DISCOVER,
+    COMMAND_SCAN_PARAMS,
+    COMMAND_FLUSH,
+    COMMAND_METRICS,
+    COMMAND_IRK,
+    COMMAND_FILTER,
+};
+
+enum CommandFilterOp {
+    COMMAND_FILTER_MODE,
+    COMMAND_FILTER_ADD,
+    COMMAND_FILTER_REMOVE,
+    COMMAND_FILTER_CLEAR,
+};
+
+struct Command {
+    uint8_t kind;
+    uint32_t id;            // 0 when the server did not assign one
+    uint32_t received_ms;
+    union {
+        uint8_t bda[6];
+        struct {
+            uint16_t interval;
+            uint16_t window;
+        } scan;
+        struct RpaIdentity identity;
+        struct {
+            uint8_t op;
+            uint8_t mode;           // enum AddrFilterMode
+            uint8_t count;
+            uint64_t keys[COMMAND_FILTER_ENTRIES];
+        } filter;
+    };
+};
+
+// Assembles lines from a response body that may arrive in several chunks
+struct CommandReader {
+    char line[COMMAND_LINE_LENGTH];
+    int length;
+    bool overflow;          // Line too long, skipped up to the next newline
+    uint32_t malformed;
+};
+
+typedef void (*command_handler_t)(const struct Command *command, void *arg);
+
+void command_reader_init(struct CommandReader *reader);
+
+// Feed body bytes, handler is called for every complete and valid command line
+void command_reader_feed(struct CommandReader *reader, const char *data, int len, uint32_t now_ms,
+                         command_handler_t handler, void *arg);
+
+// End of body, a last line without newline is parsed too
+void command_reader_finish(struct CommandReader *reader, uint32_t now_ms, command_handler_t handler, void *arg);
+
+// Drop a partial line after a failed transfer, it may be cut anywhere
+void command_reader_discard(struct CommandReader *reader);
+
+// Parse one line, returns false for an unknown or malformed command
+bool command_parse(const char *line, struct Command *command);
@@ -0,0 +1,311 @@
+#include "device_table.h"
+
+#include <string.h>
+
+#define EMPTY_BUCKET -1
+#define NO_SLOT -1
+
+// Hash bucket, full hash is kept so probing and deletion never touch the devices array
+struct Bucket {
+    uint32_t hash;
+    int16_t slot;
+};
+
+struct Device devices[DEVICE_TABLE_CAPACITY];
+
+static struct Bucket buckets[DEVICE_TABLE_BUCKETS];
+
+// LRU list (most recent at head) and free list share the next links
+static int16_t lru_prev[DEVICE_TABLE_CAPACITY];
+static int16_t lru_next[DEVICE_TABLE_CAPACITY];
+static int16_t lru_head = NO_SLOT;
+static int16_t lru_tail = NO_SLOT;
+static int16_t free_head = NO_SLOT;
+
+// Devices under discovery, never evicted or expired
+static bool pinned[DEVICE_TABLE_CAPACITY];
+static int used_count = 0;
+
+static int max_probe = 0;
+static uint32_t evictions = 0;
+
+// FNV-1a over the 6 address bytes and the address type, with a final mix so low bits are usable
+static uint32_t hash_key(const uint8_t *bda, uint8_t addr_type) {
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < DEVICE_ADDR_LEN; i++) {
+        hash = (hash ^ bda[i]) * 16777619u;
+    }
+    hash = (hash ^ addr_type) * 16777619u;
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+static int next_bucket(int bucket) {
+    return (bucket + 1 == DEVICE_TABLE_BUCKETS) ? 0 : bucket + 1;
+}
+
+static bool key_matches(int slot, const uint8_t *bda, uint8_t addr_type) {
+    return devices[slot].addr_type == addr_type && memcmp(devices[slot].bda, bda, DEVICE_ADDR_LEN) == 0;
+}
+
+// Bucket holding given slot
+static int find_bucket(int slot) {
+    int bucket = hash_key(devices[slot].bda, devices[slot].addr_type) % DEVICE_TABLE_BUCKETS;
+
+    while (buckets[bucket].slot != slot) {
+        bucket = next_bucket(bucket);
+    }
+
+    return bucket;
+}
+
+static void lru_unlink(int slot) {
+    if (lru_prev[slot] != NO_SLOT) {
+        lru_next[lru_prev[slot]] = lru_next[slot];
+    } else {
+        lru_head = lru_next[slot];
+    }
+
+    if (lru_next[slot] != NO_SLOT) {
+        lru_prev[lru_next[slot]] = lru_prev[slot];
+    } else {
+        lru_tail = lru_prev[slot];
+    }
+}
+
+static void lru_push_head(int slot) {
+    lru_prev[slot] = NO_SLOT;
+    lru_next[slot] = lru_head;
+
+    if (lru_head != NO_SLOT) {
+        lru_prev[lru_head] = slot;
+    }
+    lru_head = slot;
+
+    if (lru_tail == NO_SLOT) {
+        lru_tail = slot;
+    }
+}
+
+// Backward shift deletion keeps linear probing free of tombstones
+static void index_remove(int slot) {
+    int hole = find_bucket(slot);
+    int bucket = hole;
+
+    while (true) {
+        bucket = next_bucket(bucket);
+
+        if (buckets[bucket].slot == EMPTY_BUCKET) {
+            break;
+        }
+
+        int home = buckets[bucket].hash % DEVICE_TABLE_BUCKETS;
+
+        // Entry can move into the hole only if the hole lies between its home and its current bucket
+        bool movable = (hole <= bucket) ? (home <= hole || home > bucket)
+                                        : (home <= hole && home > bucket);
+        if (movable) {
+            buckets[hole] = buckets[bucket];
+            hole = bucket;
+        }
+    }
+
+    buckets[hole].slot = EMPTY_BUCKET;
+}
+
+void device_table_init(void) {
+    memset(devices, 0, sizeof(devices));
+    uuid_pool_init();
+
+    for (int i = 0; i < DEVICE_TABLE_BUCKETS; i++) {
+        buckets[i].slot = EMPTY_BUCKET;
+    }
+
+    // Chaining every slot into the free list
+    for (int i = 0; i < DEVICE_TABLE_CAPACITY; i++) {
+        lru_prev[i] = NO_SLOT;
+        lru_next[i] = (i + 1 < DEVICE_TABLE_CAPACITY) ? i + 1 : NO_SLOT;
+        uuid_list_init(&devices[i].uuids);
+    }
+
+    free_head = 0;
+    lru_head = NO_SLOT;
+    lru_tail = NO_SLOT;
+    memset(pinned, 0, sizeof(pinned));
+    used_count = 0;
+    max_probe = 0;
+    evictions = 0;
+}
+
+int device_table_find(const uint8_t *bda, uint8_t addr_type) {
+    uint32_t hash = hash_key(bda, addr_type);
+    int bucket = hash % DEVICE_TABLE_BUCKETS;
+
+    while (buckets[bucket].slot != EMPTY_BUCKET) {
+        if (buckets[bucket].hash == hash && key_matches(buckets[bucket].slot, bda, addr_type)) {
+            return buckets[bucket].slot;
+        }
+        bucket = next_bucket(bucket);
+    }
+
+    return -1;
+}
+
+void device_table_remove(int index) {
+    if (index < 0 || index >= DEVICE_TABLE_CAPACITY || !devices[index].used) {
+        return;
+    }
+
+    index_remove(index);
+    lru_unlink(index);
+
+    devices[index].used = false;
+    uuid_list_clear(&devices[index].uuids);
+    lru_next[index] = free_head;
+    free_head = index;
+
+    pinned[index] = false;
+    used_count--;
+}
+
+int device_table_victim(void) {
+    if (free_head != NO_SLOT) {
+        return -1;
+    }
+
+    int victim = lru_tail;
+
+    while (victim != NO_SLOT && pinned[victim]) {
+        victim = lru_prev[victim];
+    }
+    return victim;
+}
+
+int device_table_insert(const uint8_t *bda, uint8_t addr_type, uint32_t now_ms) {
+
+    // Table full, evicting least recently seen device
+    if (free_head == NO_SLOT) {
+        int victim = device_table_victim();
+
+        if (victim < 0) {
+            return -1;
+        }
+
+        device_table_remove(victim);
+        evictions++;
+    }
+
+    int slot = free_head;
+    free_head = lru_next[slot];
+
+    memset(&devices[slot], 0, sizeof(struct Device));
+    memcpy(devices[slot].bda, bda, DEVICE_ADDR_LEN);
+    devices[slot].addr_type = addr_type;
+    devices[slot].used = true;
+    devices[slot].last_seen = now_ms;
+    uuid_list_init(&devices[slot].uuids);
+
+    // Inserting into the hash index
+    uint32_t hash = hash_key(bda, addr_type);
+    int bucket = hash % DEVICE_TABLE_BUCKETS;
+    int probe = 0;
+
+    while (buckets[bucket].slot != EMPTY_BUCKET) {
+        bucket = next_bucket(bucket);
+        probe++;
+    }
+
+    buckets[bucket].hash = hash;
+    buckets[bucket].slot = slot;
+
+    if (probe > max_probe) {
+        max_probe = probe;
+    }
+
+    lru_push_head(slot);
+    used_count++;
+
+    return slot;
+}
+
+void device_table_touch(int index, uint32_t now_ms) {
+    devices[index].last_seen = now_ms;
+
+    if (lru_head != index) {
+        lru_unlink(index);
+        lru_push_head(index);
+    }
+}
+
+int device_table_expire(uint32_t now_ms, uint32_t max_age_ms) {
+    int removed = 0;
+    int slot = lru_tail;
+
+    // Walking from the oldest entry until a fresh one is found
+    while (slot != NO_SLOT && now_ms - devices[slot].last_seen > max_age_ms) {
+        int prev = lru_prev[slot];
+
+        if (!pinned[slot]) {
+            device_table_remove(slot);
+            removed++;
+        }
+        slot = prev;
+    }
+
+    return removed;
+}
+
+void device_table_pin(int index, bool pin) {
+    if (index >= 0 && index < DEVICE_TABLE_CAPACITY) {
+        pinned[index] = pin;
+    }
+}
+
+int device_table_count(void) {
+    return used_count;
+}
+
+int device_table_max_probe(void) {
+    return max_probe;
+}
+
+int device_table_longest_run(void) {
+    int longest = 0;
+    int start = 0;
+
+    // Starting after an empty bucket so a run wrapping around the end is counted whole
+    while (start < DEVICE_TABLE_BUCKETS && buckets[start].slot != EMPTY_BUCKET) {
+        start++;
+    }
+    if (start == DEVICE_TABLE_BUCKETS) {
+        return DEVICE_TABLE_BUCKETS;
+    }
+
+    int run = 0;
+
+    for (int i = 1; i <= DEVICE_TABLE_BUCKETS; i++) {
+        int bucket = (start + i) % DEVICE_TABLE_BUCKETS;
+
+        if (buckets[bucket].slot != EMPTY_BUCKET) {
+            run++;
+            if (run > longest) {
+                longest = run;
+            }
+        } else {
+            run = 0;
+        }
+    }
+
+    return longest;
+}
+
+uint32_t device_table_evictions(void) {
+    return evictions;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+#include "uuid_list.h"
+#include "adv_decoder.h"
+
+// Number of device slots, set in Kconfig
+#define DEVICE_TABLE_CAPACITY CONFIG_ESP_DEVICE_TABLE_SIZE
+
+// Hash index is kept at most half full so probe sequences stay short
+#define DEVICE_TABLE_BUCKETS (DEVICE_TABLE_CAPACITY * 2)
+
+#define DEVICE_ADDR_LEN 6
+
+// Device structure
+struct Device {
+   uint8_t bda[DEVICE_ADDR_LEN];
+   uint8_t addr_type;
+   uint8_t rpa[DEVICE_ADDR_LEN];  // Current private address of a resolved identity (addr_type 2 or 3, see rpa.h)
+   bool used;
+   uint32_t last_seen;
+   char name[50];
+   bool name_complete;
+   uint8_t name_attempts;      // Windows scanned actively without getting the complete name
+   char address[18];
+   int rssi;
+   bool in_range;
+   bool reported;
+   bool name_changed;
+   int reported_rssi;
+   bool discovery_failed;
+   uint16_t services_count;
+   uint16_t chars_count;
+   struct UuidList uuids;      // Services and characteristics in discovery order, see uuid_list.h
+   uint8_t beacon_kind;        // Last frame recognised in the advertisements, see adv_decoder.h
+   uint8_t beacon_subtype;
+   uint8_t beacon_len;
+   bool beacon_changed;        // Kind or subtype changed since the last report
+   uint8_t beacon[ADV_DECODED_MAX];
+};
+
+extern struct Device devices[DEVICE_TABLE_CAPACITY];
+
+// Reset table, index and LRU order
+void device_table_init(void);
+
+// Slot of a known device or -1
+int device_table_find(const uint8_t *bda, uint8_t addr_type);
+
+// Claim a slot for a new device, evicting the least recently seen one when full
+int device_table_insert(const uint8_t *bda, uint8_t addr_type, uint32_t now_ms);
+
+// Slot the next insert evicts, -1 while a slot is free or when every device is pinned
+int device_table_victim(void);
+
+// Mark device as seen now (moves it to the head of the LRU order)
+void device_table_touch(int index, uint32_t now_ms);
+
+// Drop a single device
+void device_table_remove(int index);
+
+// Drop every device not seen for max_age_ms, returns number of removed devices
+int device_table_expire(uint32_t now_ms, uint32_t max_age_ms);
+
+// Protect a slot (device under discovery) from eviction and expiry
+void device_table_pin(int index, bool pin);
+
+int device_table_count(void);
+
+// Statistics
+int device_table_max_probe(void);
+
+// Longest run of occupied buckets, the probe length of the worst miss. Walks the whole index.
+int device_table_longest_run(void);
+uint32_t device_table_evictions(void);
@@ -0,0 +1,125 @@
+#include "discovery_queue.h"
+
+#include <string.h>
+
+struct DiscoveryTarget discovery_targets[DISCOVERY_QUEUE_SIZE];
+struct DiscoveryCounters discovery_counters;
+
+static int depth = 0;
+
+void discovery_queue_init(void) {
+    memset(discovery_targets, 0, sizeof(discovery_targets));
+    memset(&discovery_counters, 0, sizeof(discovery_counters));
+    depth = 0;
+}
+
+bool discovery_queue_add(const uint8_t *bda, uint32_t now_ms) {
+    struct DiscoveryTarget *free_target = NULL;
+
+    for (int i = 0; i < DISCOVERY_QUEUE_SIZE; i++) {
+        if (discovery_targets[i].state == DISCOVERY_FREE) {
+            if (free_target == NULL) {
+                free_target = &discovery_targets[i];
+            }
+        } else if (memcmp(discovery_targets[i].bda, bda, sizeof(discovery_targets[i].bda)) == 0) {
+            return true;
+        }
+    }
+
+    if (free_target == NULL) {
+        discovery_counters.rejected++;
+        return false;
+    }
+
+    memset(free_target, 0, sizeof(*free_target));
+    memcpy(free_target->bda, bda, sizeof(free_target->bda));
+    free_target->state = DISCOVERY_QUEUED;
+    free_target->device_index = -1;
+    free_target->queued_ms = now_ms;
+
+    if (discovery_counters.queued == 0) {
+        discovery_counters.first_queued_ms = now_ms;
+    }
+    discovery_counters.queued++;
+
+    depth++;
+    if (depth > discovery_counters.max_depth) {
+        discovery_counters.max_depth = depth;
+    }
+
+    return true;
+}
+
+struct DiscoveryTarget *discovery_queue_find(const uint8_t *bda) {
+    if (depth == 0) {
+        return NULL;
+    }
+
+    for (int i = 0; i < DISCOVERY_QUEUE_SIZE; i++) {
+        if (discovery_targets[i].state != DISCOVERY_FREE && memcmp(discovery_targets[i].bda, bda, sizeof(discovery_targets[i].bda)) == 0) {
+            return &discovery_targets[i];
+        }
+    }
+
+    return NULL;
+}
+
+struct DiscoveryTarget *discovery_queue_find_device(int device_index) {
+    if (depth == 0 || device_index < 0) {
+        return NULL;
+    }
+
+    for (int i = 0; i < DISCOVERY_QUEUE_SIZE; i++) {
+        if (discovery_targets[i].state != DISCOVERY_FREE && discovery_targets[i].device_index == device_index) {
+            return &discovery_targets[i];
+        }
+    }
+
+    return NULL;
+}
+
+int discovery_queue_depth(void) {
+    return depth;
+}
+
+int discovery_queue_in_flight(void) {
+    int in_flight = 0;
+
+    for (int i = 0; i < DISCOVERY_QUEUE_SIZE; i++) {
+        if (discovery_targets[i].state == DISCOVERY_CONNECTING || discovery_targets[i].state == DISCOVERY_CONNECTED) {
+            in_flight++;
+        }
+    }
+
+    return in_flight;
+}
+
+void discovery_queue_finish(struct DiscoveryTarget *target, bool failed, uint32_t now_ms) {
+    target->state = DISCOVERY_DONE;
+    target->failed = failed;
+    target->done_ms = now_ms;
+}
+
+void discovery_queue_release(struct DiscoveryTarget *target) {
+    if (target->state == DISCOVERY_FREE) {
+        return;
+    }
+
+    if (target->timed_out) {
+        discovery_counters.timed_out++;
+    } else if (target->failed) {
+        discovery_counters.failed++;
+    } else {
+        uint32_t latency = target->done_ms - target->queued_ms;
+
+        discovery_counters.completed++;
+        discovery_counters.latency_total_ms += latency;
+        if (latency > discovery_counters.latency_max_ms) {
+            discovery_counters.latency_max_ms = latency;
+        }
+    }
+
+    target->state = DISCOVERY_FREE;
+    target->device_index = -1;
+    depth--;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+
+// Number of discovery targets queued or in flight at the same time
+#define DISCOVERY_QUEUE_SIZE CONFIG_ESP_DISCOVERY_QUEUE_SIZE
+
+#if CONFIG_ESP_GATT_READ_VALUES
+// Bytes of characteristic values kept per target
+#define DISCOVERY_VALUES_SIZE CONFIG_ESP_GATT_VALUES_SIZE
+#endif
+
+// Discovery target life cycle
+enum DiscoveryState {
+    DISCOVERY_FREE,
+    DISCOVERY_QUEUED,       // Waiting for an advertisement of the target
+    DISCOVERY_CONNECTING,   // Connection requested
+    DISCOVERY_CONNECTED,    // Services and characteristics are being read
+    DISCOVERY_DONE,         // Finished or failed, waiting to be reported
+};
+
+// Device the server asked to discover, with its own connection state
+struct DiscoveryTarget {
+    uint8_t state;
+    bool failed;
+    bool timed_out;         // Failed on the queue or discovery timeout, counted as timed out only
+    bool cache_checked;     // GATT cache was asked once already
+    uint8_t bda[6];
+    int device_index;
+    uint32_t queued_ms;
+    uint32_t started_ms;
+    uint32_t done_ms;
+    uint32_t adv_hash;      // Advertisement the discovery started with, see gatt_cache_adv_hash
+#if CONFIG_ESP_GATT_READ_VALUES
+    uint16_t values_len;
+    uint8_t values[DISCOVERY_VALUES_SIZE];  // u16 UUID, u8 length and the bytes of every value read
+#endif
+};
+
+struct DiscoveryCounters {
+    uint32_t queued;
+    uint32_t rejected;          // Queue was full
+    uint32_t completed;
+    uint32_t failed;
+    uint32_t timed_out;
+    int max_depth;
+    uint64_t latency_total_ms;  // From queueing to done, completed targets only
+    uint32_t latency_max_ms;
+    uint32_t first_queued_ms;
+};
+
+extern struct DiscoveryTarget discovery_targets[DISCOVERY_QUEUE_SIZE];
+extern struct DiscoveryCounters discovery_counters;
+
+void discovery_queue_init(void);
+
+// Queue target, returns false when the queue is full. A target already in the queue is kept as it is.
+bool discovery_queue_add(const uint8_t *bda, uint32_t now_ms);
+
+// Target with given address or NULL
+struct DiscoveryTarget *discovery_queue_find(const uint8_t *bda);
+
+// Target being discovered on given device slot or NULL
+struct DiscoveryTarget *discovery_queue_find_device(int device_index);
+
+// Targets not yet released
+int discovery_queue_depth(void);
+
+// Targets connecting or connected
+int discovery_queue_in_flight(void);
+
+// Connection finished, results wait for the next report
+void discovery_queue_finish(struct DiscoveryTarget *target, bool failed, uint32_t now_ms);
+
+// Free target slot, counting it as completed, failed or timed out
+void discovery_queue_release(struct DiscoveryTarget *target);
@@ -0,0 +1,188 @@
+#include "ext_adv.h"
+#include "adv_parser.h"
+
+#include <string.h>
+
+void ext_adv_init(struct ExtAdvAssembler *assembler) {
+    memset(assembler, 0, sizeof(*assembler));
+}
+
+static bool same_key(const struct ExtAdvKey *a, const struct ExtAdvKey *b) {
+    return a->sid == b->sid && a->addr_type == b->addr_type && memcmp(a->bda, b->bda, 6) == 0;
+}
+
+static struct ExtAdvSlot *find_slot(struct ExtAdvAssembler *assembler, const struct ExtAdvKey *key) {
+    for (int i = 0; i < EXT_ADV_SLOTS; i++) {
+        struct ExtAdvSlot *slot = &assembler->slots[i];
+
+        if (slot->used && same_key(&slot->key, key)) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+// Whether fragment belongs to an evicted chain, the chain is forgotten with its last fragment
+static bool discard_fragment(struct ExtAdvAssembler *assembler, const struct ExtAdvKey *key, uint8_t data_status) {
+    for (int i = 0; i < assembler->discarding_count; i++) {
+        if (same_key(&assembler->discarding[i], key)) {
+            if (data_status != EXT_ADV_DATA_INCOMPLETE) {
+                assembler->discarding[i] = assembler->discarding[--assembler->discarding_count];
+                assembler->discarding_next = assembler->discarding_count;
+            }
+            assembler->counters.discarded++;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Remember evicted chain, overwriting the oldest entry when the list is full
+static void start_discarding(struct ExtAdvAssembler *assembler, const struct ExtAdvKey *key) {
+    assembler->discarding[assembler->discarding_next] = *key;
+    assembler->discarding_next = (assembler->discarding_next + 1) % EXT_ADV_SLOTS;
+    if (assembler->discarding_count < EXT_ADV_SLOTS) {
+        assembler->discarding_count++;
+    }
+}
+
+static void release_slot(struct ExtAdvAssembler *assembler, struct ExtAdvSlot *slot) {
+    slot->used = false;
+    assembler->slots_used--;
+}
+
+// Free slot, taking over an expired one or the oldest one when all are busy
+static struct ExtAdvSlot *allocate_slot(struct ExtAdvAssembler *assembler, uint32_t now_ms) {
+    struct ExtAdvSlot *oldest = NULL;
+
+    for (int i = 0; i < EXT_ADV_SLOTS; i++) {
+        struct ExtAdvSlot *slot = &assembler->slots[i];
+
+        if (!slot->used) {
+            return slot;
+        }
+        if (now_ms - slot->started_ms > EXT_ADV_FRAGMENT_TIMEOUT_MS) {
+            assembler->counters.expired++;
+            release_slot(assembler, slot);
+            return slot;
+        }
+        if (oldest == NULL || now_ms - slot->started_ms > now_ms - oldest->started_ms) {
+            oldest = slot;
+        }
+    }
+
+    assembler->counters.evicted++;
+    start_discarding(assembler, &oldest->key);
+    release_slot(assembler, oldest);
+    return oldest;
+}
+
+static void complete_report(struct ExtAdvAssembler *assembler, const uint8_t *data, size_t len, bool truncated,
+                            struct ExtAdvData *report) {
+    report->data = data;
+    report->len = len;
+    report->truncated = truncated;
+
+    assembler->counters.reports++;
+    if (truncated) {
+        assembler->counters.truncated++;
+    }
+    if (len > assembler->counters.max_len) {
+        assembler->counters.max_len = len;
+    }
+}
+
+bool ext_adv_add(struct ExtAdvAssembler *assembler, const uint8_t *bda, uint8_t addr_type, uint8_t sid,
+                 uint8_t data_status, const uint8_t *fragment, size_t len, uint32_t now_ms, struct ExtAdvData *report) {
+    struct ExtAdvKey key = { .addr_type = addr_type, .sid = sid };
+    struct ExtAdvSlot *slot = NULL;
+
+    assembler->counters.fragments++;
+
+    // Lookups are skipped in the common case of nothing being reassembled
+    if (assembler->slots_used > 0 || assembler->discarding_count > 0) {
+        memcpy(key.bda, bda, 6);
+        slot = find_slot(assembler, &key);
+
+        if (slot == NULL && assembler->discarding_count > 0 && discard_fragment(assembler, &key, data_status)) {
+            return false;
+        }
+    }
+
+    // Single fragment report (every legacy advertisement), passed on without copying
+    if (slot == NULL && data_status != EXT_ADV_DATA_INCOMPLETE) {
+        if (len > EXT_ADV_MAX_DATA) {
+            len = EXT_ADV_MAX_DATA;
+        }
+        complete_report(assembler, fragment, len, data_status == EXT_ADV_DATA_TRUNCATED, report);
+        return true;
+    }
+
+    if (slot == NULL) {
+        memcpy(key.bda, bda, 6);
+        slot = allocate_slot(assembler, now_ms);
+        slot->used = true;
+        slot->key = key;
+        slot->len = 0;
+        slot->started_ms = now_ms;
+        assembler->slots_used++;
+    }
+
+    // Chain longer than any valid advertisement, what fits is reported as truncated
+    bool overflow = slot->len + len > EXT_ADV_MAX_DATA;
+
+    if (overflow) {
+        len = EXT_ADV_MAX_DATA - slot->len;
+    }
+
+    memcpy(slot->data + slot->len, fragment, len);
+    slot->len += len;
+
+    if (data_status == EXT_ADV_DATA_INCOMPLETE && !overflow) {
+        return false;
+    }
+
+    assembler->counters.reassembled++;
+    release_slot(assembler, slot);
+    complete_report(assembler, slot->data, slot->len, overflow || data_status == EXT_ADV_DATA_TRUNCATED, report);
+
+    return true;
+}
+
+// AD structures describing the device, used by the scanner core
+static bool is_identity_type(uint8_t type) {
+    return type == AD_TYPE_FLAGS || (type >= AD_TYPE_UUID16_INCOMPLETE && type <= AD_TYPE_TX_POWER)
+            || type == AD_TYPE_APPEARANCE;
+}
+
+size_t ext_adv_compact(const uint8_t *data, size_t len, uint8_t *out, size_t size) {
+    size_t used = 0;
+
+    if (len <= size) {
+        memcpy(out, data, len);
+        return len;
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        size_t i = 0;
+
+        while (i < len) {
+            size_t field_len = data[i];
+
+            // Zero length marks the end of significant data, a structure running past the end is cut off
+            if (field_len == 0 || i + 1 + field_len > len) {
+                break;
+            }
+
+            bool identity = is_identity_type(data[i + 1]);
+
+            if (identity == (pass == 0) && used + 1 + field_len <= size) {
+                memcpy(out + used, data + i, 1 + field_len);
+                used += 1 + field_len;
+            }
+            i += 1 + field_len;
+        }
+    }
+
+    return used;
+}
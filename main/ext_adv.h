@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Reassembly of BLE 5 extended advertising reports. The controller splits an
+// advertisement longer than one HCI event into fragments reported one after
+// the other with the Data_Status "incomplete", the last one carries "complete"
+// (or "truncated" when the controller missed part of the chain). Fragments of
+// different advertisers may be interleaved, so reports in progress are kept per
+// advertiser (address, address type and advertising SID).
+
+// Longest advertising data of one extended advertisement (Core 5.x, Vol 6, Part B, 2.3.4.9)
+#define EXT_ADV_MAX_DATA 1650
+
+// Reports reassembled at the same time, the oldest is dropped to make room
+#define EXT_ADV_SLOTS 4
+
+// Chain whose next fragment did not arrive within this time is dropped
+#define EXT_ADV_FRAGMENT_TIMEOUT_MS 1000
+
+// Data_Status of an HCI LE Extended Advertising Report
+#define EXT_ADV_DATA_COMPLETE   0x00
+#define EXT_ADV_DATA_INCOMPLETE 0x01
+#define EXT_ADV_DATA_TRUNCATED  0x02
+
+// Advertiser of a report chain
+struct ExtAdvKey {
+    uint8_t bda[6];
+    uint8_t addr_type;
+    uint8_t sid;
+};
+
+struct ExtAdvSlot {
+    bool used;
+    struct ExtAdvKey key;
+    uint16_t len;
+    uint32_t started_ms;
+    uint8_t data[EXT_ADV_MAX_DATA];
+};
+
+struct ExtAdvCounters {
+    uint32_t fragments;     // Fragments passed to ext_adv_add
+    uint32_t reports;       // Reports completed
+    uint32_t reassembled;   // Completed reports made of several fragments
+    uint32_t truncated;     // Completed reports with data missing
+    uint32_t evicted;       // Incomplete reports dropped for a newer one
+    uint32_t expired;       // Incomplete reports dropped after EXT_ADV_FRAGMENT_TIMEOUT_MS
+    uint32_t discarded;     // Fragments of evicted reports, dropped up to the end of their chain
+    uint16_t max_len;       // Longest completed report
+};
+
+// Used by a single task (the Bluedroid callback task on the ESP32)
+struct ExtAdvAssembler {
+    struct ExtAdvSlot slots[EXT_ADV_SLOTS];
+    int slots_used;
+
+    // Chains evicted before their last fragment, their remaining fragments would
+    // otherwise read as a new report missing its beginning
+    struct ExtAdvKey discarding[EXT_ADV_SLOTS];
+    int discarding_count;
+    int discarding_next;
+
+    struct ExtAdvCounters counters;
+};
+
+// Completed report, data stays valid until the next ext_adv_add call
+struct ExtAdvData {
+    const uint8_t *data;
+    uint16_t len;
+    bool truncated;
+};
+
+void ext_adv_init(struct ExtAdvAssembler *assembler);
+
+// Add one report fragment. Returns true when it completes a report, which is
+// stored into report. Unfragmented reports point at the fragment itself.
+bool ext_adv_add(struct ExtAdvAssembler *assembler, const uint8_t *bda, uint8_t addr_type, uint8_t sid,
+                 uint8_t data_status, const uint8_t *fragment, size_t len, uint32_t now_ms, struct ExtAdvData *report);
+
+// Copy AD structures of a report into out (size bytes). Everything is copied
+// when it fits, otherwise flags, UUID lists, names, TX power and appearance go
+// first and the remaining structures fill what is left. Returns bytes written.
+size_t ext_adv_compact(const uint8_t *data, size_t len, uint8_t *out, size_t size);
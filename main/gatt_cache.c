@@ -0,0 +1,365 @@
+#include "gatt_cache.h"
+#include "scanner_hal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define CACHE_PRINT "GATT_CACHE"
+
+#define INDEX_KEY "index"
+#define ENTRY_KEY_PREFIX "g"
+#define INDEX_VERSION 2
+
+#define GATT_CACHE_TTL_S CONFIG_ESP_GATT_CACHE_TTL
+
+// Devices with more services and characteristics are not cached
+#define ENTRY_MAX_UUIDS 64
+
+// Services and characteristics after the header, each as a byte holding the role
+// (bit 7) and UUID length followed by the UUID bytes
+#define ENTRY_ROLE_CHAR 0x80
+#define ENTRY_MAX_SIZE (sizeof(struct EntryHeader) + ENTRY_MAX_UUIDS * 17)
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME  16777619u
+
+// Cached device, the entry blob is stored under a key derived from bda
+struct CacheSlot {
+    uint8_t bda[6];
+    uint8_t used;
+    uint8_t reserved;
+    uint32_t stored_s;
+};
+
+// Index blob, also carries the cache clock across reboots
+struct CacheIndex {
+    uint32_t version;
+    uint32_t clock_s;
+    struct CacheSlot slots[GATT_CACHE_SIZE];
+};
+
+struct EntryHeader {
+    uint32_t adv_hash;
+    uint32_t discovery_ms;
+    uint16_t count;
+};
+
+struct GattCacheCounters gatt_cache_counters;
+
+static struct CacheIndex cache_index;
+
+// Uptime clock in seconds, continued from the value saved with the index
+static uint32_t clock_base_s = 0;
+static uint64_t clock_elapsed_ms = 0;
+static uint32_t clock_last_ms = 0;
+static bool clock_started = false;
+
+static uint8_t entry_buffer[ENTRY_MAX_SIZE];
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+static uint32_t cache_clock_s(uint32_t now_ms) {
+    if (clock_started) {
+        clock_elapsed_ms += now_ms - clock_last_ms;
+    }
+    clock_last_ms = now_ms;
+    clock_started = true;
+
+    return clock_base_s + (uint32_t) (clock_elapsed_ms / 1000);
+}
+
+// NVS keys are limited to 15 characters, the prefix followed by the address in hex
+static void entry_key(const uint8_t *bda, char *key) {
+    sprintf(key, ENTRY_KEY_PREFIX "%02x%02x%02x%02x%02x%02x", bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+}
+
+static struct CacheSlot *find_slot(const uint8_t *bda) {
+    for (int i = 0; i < GATT_CACHE_SIZE; i++) {
+        if (cache_index.slots[i].used && memcmp(cache_index.slots[i].bda, bda, 6) == 0) {
+            return &cache_index.slots[i];
+        }
+    }
+    return NULL;
+}
+
+// Free slot or the oldest one, NULL when every slot other than except is taken
+static struct CacheSlot *oldest_slot(const struct CacheSlot *except) {
+    struct CacheSlot *oldest = NULL;
+
+    for (int i = 0; i < GATT_CACHE_SIZE; i++) {
+        struct CacheSlot *slot = &cache_index.slots[i];
+
+        if (slot == except) {
+            continue;
+        }
+        if (!slot->used) {
+            return slot;
+        }
+        if (oldest == NULL || slot->stored_s < oldest->stored_s) {
+            oldest = slot;
+        }
+    }
+    return oldest;
+}
+
+static void save_index(uint32_t now_ms) {
+    cache_index.clock_s = cache_clock_s(now_ms);
+
+    if (!hal_store_write(INDEX_KEY, &cache_index, sizeof(cache_index))) {
+        gatt_cache_counters.errors++;
+    }
+}
+
+static void remove_slot(struct CacheSlot *slot) {
+    char key[16];
+
+    entry_key(slot->bda, key);
+    hal_store_erase(key);
+    slot->used = false;
+}
+
+// FNV-1a over one advertisement field, prefixed by its AD type
+static uint32_t hash_field(uint32_t hash, uint8_t type, const uint8_t *data, int len) {
+    if (data == NULL) {
+        return hash;
+    }
+
+    hash = (hash ^ type) * FNV_PRIME;
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// Rebuild UUID list of the device, bases are interned again as they may differ since the entry was stored
+static bool read_uuid_list(const uint8_t *p, const uint8_t *end, int count, struct Device *device) {
+    uuid_list_clear(&device->uuids);
+    device->services_count = 0;
+    device->chars_count = 0;
+
+    for (int i = 0; i < count; i++) {
+        struct Uuid uuid;
+        int len = p < end ? *p & ~ENTRY_ROLE_CHAR : 0;
+
+        if (p + 1 + len > end || !uuid_from_bytes(p + 1, len, &uuid)) {
+            return false;
+        }
+
+        uuid.role = (*p & ENTRY_ROLE_CHAR) ? UUID_ROLE_CHAR : UUID_ROLE_SERVICE;
+        p += 1 + len;
+
+        if (!uuid_list_add(&device->uuids, &uuid)) {
+            return false;
+        }
+
+        if (uuid.role == UUID_ROLE_SERVICE) {
+            device->services_count++;
+        } else {
+            device->chars_count++;
+        }
+    }
+    return true;
+}
+
+static uint8_t *write_uuid_list(uint8_t *p, const struct Device *device) {
+    struct UuidListIterator it;
+
+    for (const struct Uuid *uuid = uuid_list_first(&device->uuids, &it); uuid != NULL; uuid = uuid_list_next(&it)) {
+        int len = uuid_to_bytes(uuid, p + 1);
+
+        p[0] = len | (uuid->role == UUID_ROLE_CHAR ? ENTRY_ROLE_CHAR : 0);
+        p += 1 + len;
+    }
+    return p;
+}
+
+// ------------------------------------------------------------------------------------------------
+
+void gatt_cache_init(void) {
+    size_t len = sizeof(cache_index);
+
+    memset(&gatt_cache_counters, 0, sizeof(gatt_cache_counters));
+    clock_elapsed_ms = 0;
+    clock_started = false;
+
+    bool loaded = hal_store_read(INDEX_KEY, &cache_index, &len);
+
+    if (!loaded || len != sizeof(cache_index) || cache_index.version != INDEX_VERSION) {
+        // Index written by another firmware (version or size changed), its entries can not be enumerated.
+        // Only the keys of the cache are dropped, the rest of the store (RPA identities) stays.
+        if (loaded) {
+            hal_store_erase_prefix(ENTRY_KEY_PREFIX);
+            hal_store_erase(INDEX_KEY);
+        }
+        memset(&cache_index, 0, sizeof(cache_index));
+        cache_index.version = INDEX_VERSION;
+    }
+
+    clock_base_s = cache_index.clock_s;
+
+    SCANNER_LOGI(CACHE_PRINT, "%d cached devices", gatt_cache_count());
+}
+
+uint32_t gatt_cache_adv_hash(const struct AdvReport *report) {
+    uint32_t hash = FNV_OFFSET;
+
+    hash = hash_field(hash, AD_TYPE_FLAGS, report->flags.data, report->flags.len);
+    hash = hash_field(hash, AD_TYPE_APPEARANCE, report->appearance.data, report->appearance.len);
+    hash = hash_field(hash, AD_TYPE_UUID16_COMPLETE, report->uuid16.data, report->uuid16.len);
+    hash = hash_field(hash, AD_TYPE_UUID32_COMPLETE, report->uuid32.data, report->uuid32.len);
+    hash = hash_field(hash, AD_TYPE_UUID128_COMPLETE, report->uuid128.data, report->uuid128.len);
+
+    // Only the UUID part of service data, the rest are readings
+    for (int i = 0; i < report->service_data_count; i++) {
+        uint8_t type = report->service_data_types[i];
+        int uuid_len = type == AD_TYPE_SERVICE_DATA16 ? 2 : (type == AD_TYPE_SERVICE_DATA32 ? 4 : 16);
+
+        if (report->service_data[i].len >= uuid_len) {
+            hash = hash_field(hash, type, report->service_data[i].data, uuid_len);
+        }
+    }
+
+    // Only the company identifier of manufacturer data
+    for (int i = 0; i < report->manufacturer_data_count; i++) {
+        if (report->manufacturer_data[i].len >= 2) {
+            hash = hash_field(hash, AD_TYPE_MANUFACTURER, report->manufacturer_data[i].data, 2);
+        }
+    }
+
+    return hash;
+}
+
+bool gatt_cache_lookup(const uint8_t *bda, uint32_t adv_hash, uint32_t now_ms, struct Device *device) {
+    struct CacheSlot *slot = find_slot(bda);
+    char key[16];
+
+    if (slot == NULL) {
+        gatt_cache_counters.misses++;
+        return false;
+    }
+
+    if (GATT_CACHE_TTL_S > 0 && cache_clock_s(now_ms) - slot->stored_s > GATT_CACHE_TTL_S) {
+        gatt_cache_counters.expired++;
+        gatt_cache_counters.misses++;
+        remove_slot(slot);
+        save_index(now_ms);
+        return false;
+    }
+
+    size_t len = sizeof(entry_buffer);
+    struct EntryHeader header;
+
+    entry_key(bda, key);
+
+    bool valid = hal_store_read(key, entry_buffer, &len) && len >= sizeof(header);
+
+    if (valid) {
+        memcpy(&header, entry_buffer, sizeof(header));
+        valid = header.count <= ENTRY_MAX_UUIDS;
+    }
+
+    // Device now advertises something else, its attribute table may have changed too
+    if (valid && header.adv_hash != adv_hash) {
+        SCANNER_LOGI(CACHE_PRINT, "Advertisement of %02x:%02x:%02x:%02x:%02x:%02x changed, dropping cache entry",
+                     bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+        gatt_cache_counters.invalidated++;
+        gatt_cache_counters.misses++;
+        remove_slot(slot);
+        save_index(now_ms);
+        return false;
+    }
+
+    if (valid) {
+        valid = read_uuid_list(entry_buffer + sizeof(header), entry_buffer + len, header.count, device);
+    }
+
+    if (!valid) {
+        gatt_cache_counters.errors++;
+        gatt_cache_counters.misses++;
+        remove_slot(slot);
+        save_index(now_ms);
+        return false;
+    }
+
+    gatt_cache_counters.hits++;
+    gatt_cache_counters.saved_ms += header.discovery_ms;
+
+    return true;
+}
+
+void gatt_cache_store(const uint8_t *bda, uint32_t adv_hash, uint32_t discovery_ms, uint32_t now_ms, const struct Device *device) {
+    struct EntryHeader header = {
+        .adv_hash = adv_hash,
+        .discovery_ms = discovery_ms,
+        .count = device->uuids.count,
+    };
+    char key[16];
+
+    if (header.count > ENTRY_MAX_UUIDS) {
+        return;
+    }
+
+    memcpy(entry_buffer, &header, sizeof(header));
+    uint8_t *p = write_uuid_list(entry_buffer + sizeof(header), device);
+
+    struct CacheSlot *slot = find_slot(bda);
+
+    if (slot == NULL) {
+        slot = oldest_slot(NULL);
+
+        if (slot->used) {
+            gatt_cache_counters.evicted++;
+            remove_slot(slot);
+        }
+    }
+
+    entry_key(bda, key);
+
+    // Storage full, making room by dropping the oldest other entry once
+    bool written = hal_store_write(key, entry_buffer, p - entry_buffer);
+
+    if (!written) {
+        struct CacheSlot *oldest = oldest_slot(slot);
+
+        if (oldest != NULL && oldest->used) {
+            gatt_cache_counters.evicted++;
+            remove_slot(oldest);
+            written = hal_store_write(key, entry_buffer, p - entry_buffer);
+        }
+    }
+
+    if (!written) {
+        SCANNER_LOGE(CACHE_PRINT, "Cannot store discovery of %02x:%02x:%02x:%02x:%02x:%02x",
+                     bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+        gatt_cache_counters.errors++;
+        slot->used = false;
+        save_index(now_ms);
+        return;
+    }
+
+    memcpy(slot->bda, bda, 6);
+    slot->used = true;
+    slot->stored_s = cache_clock_s(now_ms);
+    gatt_cache_counters.stored++;
+
+    save_index(now_ms);
+}
+
+void gatt_cache_invalidate(const uint8_t *bda) {
+    struct CacheSlot *slot = find_slot(bda);
+
+    if (slot != NULL) {
+        gatt_cache_counters.invalidated++;
+        remove_slot(slot);
+        save_index(hal_now_ms());
+    }
+}
+
+int gatt_cache_count(void) {
+    int count = 0;
+
+    for (int i = 0; i < GATT_CACHE_SIZE; i++) {
+        count += cache_index.slots[i].used;
+    }
+    return count;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+#include "device_table.h"
+#include "adv_parser.h"
+
+// Persistent cache of discovery results (services and characteristics) keyed by
+// device address. Entries live in NVS through the hal_store_* functions, one blob
+// per device plus an index blob used for the size cap and eviction.
+//
+// An entry is dropped when it is older than the TTL, when the advertisement of
+// the device no longer matches the one seen at discovery time or when the device
+// indicates Service Changed. Age is counted in scanner uptime, time spent powered
+// off does not age entries.
+
+// Maximum number of cached devices, set in Kconfig
+#define GATT_CACHE_SIZE CONFIG_ESP_GATT_CACHE_SIZE
+
+struct GattCacheCounters {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t invalidated;   // Advertisement changed or Service Changed indication
+    uint32_t expired;
+    uint32_t stored;
+    uint32_t evicted;       // Dropped to respect the size cap or for lack of storage
+    uint32_t errors;        // Storage failures
+    uint64_t saved_ms;      // Connection time the hits did not spend, as measured at discovery
+};
+
+extern struct GattCacheCounters gatt_cache_counters;
+
+// Load index from storage
+void gatt_cache_init(void);
+
+// Hash of the advertisement fields describing what a device offers (flags, appearance,
+// service UUIDs, service data UUIDs and manufacturer ids). Name, TX power and payloads
+// that change between advertisements are left out.
+uint32_t gatt_cache_adv_hash(const struct AdvReport *report);
+
+// Copy cached services and characteristics into device, returns false on a miss
+bool gatt_cache_lookup(const uint8_t *bda, uint32_t adv_hash, uint32_t now_ms, struct Device *device);
+
+// Remember discovery results of device, discovery_ms is how long the connection took
+void gatt_cache_store(const uint8_t *bda, uint32_t adv_hash, uint32_t discovery_ms, uint32_t now_ms, const struct Device *device);
+
+// Drop entry of device, if any
+void gatt_cache_invalidate(const uint8_t *bda);
+
+int gatt_cache_count(void);
@@ -0,0 +1,216 @@
+#include "gatt_reader.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Room a variable length value needs at the end of a Read Multiple request, with less it
+// would most likely come back cut and be read again anyway
+#define VARIABLE_MIN_ROOM 8
+
+struct FixedLength {
+    uint16_t uuid16;
+    uint8_t len;
+};
+
+// Characteristics of the Bluetooth SIG assigned numbers with a value of fixed length
+static const struct FixedLength fixed_lengths[] = {
+    { 0x2a01, 2 },  // Appearance
+    { 0x2a04, 8 },  // Peripheral Preferred Connection Parameters
+    { 0x2a05, 4 },  // Service Changed
+    { 0x2a07, 1 },  // Tx Power Level
+    { 0x2a0f, 2 },  // Local Time Information
+    { 0x2a19, 1 },  // Battery Level
+    { 0x2a23, 8 },  // System ID
+    { 0x2a50, 7 },  // PnP ID
+    { 0x2a6d, 4 },  // Pressure
+    { 0x2a6e, 2 },  // Temperature
+    { 0x2a6f, 2 },  // Humidity
+    { 0x2aa6, 1 },  // Central Address Resolution
+};
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+static int first_in_state(const struct GattReadPlan *plan, uint8_t state, bool variable) {
+    for (int i = 0; i < plan->count; i++) {
+        if (plan->chars[i].state == state && (plan->chars[i].fixed_len == 0) == variable) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void deliver(struct GattReadPlan *plan, int index, const uint8_t *value, size_t len,
+                    gatt_value_handler_t handler, void *arg) {
+    plan->chars[index].state = GATT_READ_DONE;
+    plan->values++;
+    handler(plan->chars[index].uuid16, value, len, arg);
+}
+
+// Answer did not split as planned, every value of the request is read on its own
+static void retry_single(struct GattReadPlan *plan) {
+    for (int i = 0; i < plan->batch_count; i++) {
+        plan->chars[plan->batch[i]].state = GATT_READ_SINGLE;
+        plan->retries++;
+    }
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+int gatt_reader_parse_uuids(const char *str, uint16_t *uuids, int max) {
+    int count = 0;
+
+    while (*str != '\0' && count < max) {
+        char *end;
+        unsigned long value = strtoul(str, &end, 16);
+
+        if (end != str && value <= 0xffff && (*end == '\0' || *end == ',' || isspace((unsigned char) *end))) {
+            uuids[count++] = value;
+        }
+
+        // Skipping to the next entry
+        while (*end != '\0' && *end != ',' && !isspace((unsigned char) *end)) {
+            end++;
+        }
+        while (*end == ',' || isspace((unsigned char) *end)) {
+            end++;
+        }
+        str = end;
+    }
+    return count;
+}
+
+bool gatt_reader_wanted(const uint16_t *uuids, int count, uint16_t uuid16) {
+    for (int i = 0; i < count; i++) {
+        if (uuids[i] == uuid16) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint8_t gatt_reader_fixed_len(uint16_t uuid16) {
+    for (size_t i = 0; i < sizeof(fixed_lengths) / sizeof(fixed_lengths[0]); i++) {
+        if (fixed_lengths[i].uuid16 == uuid16) {
+            return fixed_lengths[i].len;
+        }
+    }
+    return 0;
+}
+
+void gatt_reader_init(struct GattReadPlan *plan) {
+    memset(plan, 0, sizeof(*plan));
+    plan->mtu = GATT_READER_DEFAULT_MTU;
+}
+
+void gatt_reader_set_mtu(struct GattReadPlan *plan, uint16_t mtu) {
+    plan->mtu = mtu < GATT_READER_DEFAULT_MTU ? GATT_READER_DEFAULT_MTU : mtu;
+}
+
+bool gatt_reader_add(struct GattReadPlan *plan, uint16_t handle, uint16_t uuid16) {
+    if (plan->count >= GATT_READER_MAX_CHARS) {
+        return false;
+    }
+
+    struct GattReadChar *read_char = &plan->chars[plan->count++];
+
+    read_char->handle = handle;
+    read_char->uuid16 = uuid16;
+    read_char->fixed_len = gatt_reader_fixed_len(uuid16);
+    read_char->state = GATT_READ_PENDING;
+    return true;
+}
+
+int gatt_reader_next(struct GattReadPlan *plan, uint16_t *handles) {
+    int single = first_in_state(plan, GATT_READ_SINGLE, false);
+
+    plan->batch_count = 0;
+
+    if (single < 0) {
+        single = first_in_state(plan, GATT_READ_SINGLE, true);
+    }
+    if (single >= 0) {
+        plan->batch[plan->batch_count++] = single;
+    } else {
+        int variable = first_in_state(plan, GATT_READ_PENDING, true);
+        int slots = GATT_READER_MAX_BATCH - (variable >= 0 ? 1 : 0);
+        size_t room = plan->mtu - 1;
+
+        // Fixed length values while they fit in the answer
+        for (int i = 0; i < plan->count && plan->batch_count < slots; i++) {
+            const struct GattReadChar *read_char = &plan->chars[i];
+
+            if (read_char->state == GATT_READ_PENDING && read_char->fixed_len > 0 && read_char->fixed_len <= room) {
+                plan->batch[plan->batch_count++] = i;
+                room -= read_char->fixed_len;
+            }
+        }
+
+        // One variable length value last, it gets what is left of the answer
+        if (variable >= 0 && (plan->batch_count == 0 || room >= VARIABLE_MIN_ROOM)) {
+            plan->batch[plan->batch_count++] = variable;
+        }
+    }
+
+    for (int i = 0; i < plan->batch_count; i++) {
+        handles[i] = plan->chars[plan->batch[i]].handle;
+    }
+    if (plan->batch_count > 0) {
+        plan->requests++;
+    }
+    return plan->batch_count;
+}
+
+void gatt_reader_complete(struct GattReadPlan *plan, const uint8_t *data, size_t len, gatt_value_handler_t handler,
+                          void *arg) {
+    if (plan->batch_count == 1) {
+        deliver(plan, plan->batch[0], data, len, handler, arg);
+        plan->batch_count = 0;
+        return;
+    }
+
+    int last = plan->batch[plan->batch_count - 1];
+    bool variable = plan->chars[last].fixed_len == 0;
+    size_t fixed_total = 0;
+
+    for (int i = 0; i < plan->batch_count; i++) {
+        fixed_total += plan->chars[plan->batch[i]].fixed_len;
+    }
+
+    // Device disagrees with the length table
+    if (variable ? len < fixed_total : len != fixed_total) {
+        retry_single(plan);
+        plan->batch_count = 0;
+        return;
+    }
+
+    size_t pos = 0;
+
+    for (int i = 0; i < plan->batch_count - (variable ? 1 : 0); i++) {
+        int index = plan->batch[i];
+
+        deliver(plan, index, data + pos, plan->chars[index].fixed_len, handler, arg);
+        pos += plan->chars[index].fixed_len;
+    }
+
+    // Answer filling the MTU may have cut the last value
+    if (variable) {
+        if (len >= (size_t) plan->mtu - 1) {
+            plan->chars[last].state = GATT_READ_SINGLE;
+            plan->retries++;
+        } else {
+            deliver(plan, last, data + pos, len - pos, handler, arg);
+        }
+    }
+    plan->batch_count = 0;
+}
+
+void gatt_reader_failed(struct GattReadPlan *plan) {
+    // One unreadable value fails the whole Read Multiple request
+    if (plan->batch_count > 1) {
+        retry_single(plan);
+    } else if (plan->batch_count == 1) {
+        plan->chars[plan->batch[0]].state = GATT_READ_DONE;
+    }
+    plan->batch_count = 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Plans the characteristic value reads of one discovery connection. Values are read
+// with ATT Read Multiple where the protocol allows it: the response is the bare
+// concatenation of the values, so only the last value of a request may have a
+// length not known in advance. Values of known fixed length (table in gatt_reader.c)
+// are batched together with at most one variable length value, every other variable
+// length value takes a request of its own. A request of one value is a single read.
+// An answer that does not add up is read again value by value; a device answering a
+// wrong fixed length next to a variable length value cannot be told apart and is split
+// by the table.
+
+// Readable characteristics of a connection that are read at most
+#define GATT_READER_MAX_CHARS 16
+
+// Handles of one Read Multiple request (ESP_GATT_MAX_READ_MULTI_HANDLES of Bluedroid)
+#define GATT_READER_MAX_BATCH 10
+
+// UUIDs of the configured set at most
+#define GATT_READER_MAX_UUIDS 32
+
+#define GATT_READER_DEFAULT_MTU 23
+
+enum GattReadState {
+    GATT_READ_PENDING,
+    GATT_READ_SINGLE,       // Read Multiple answer did not split, read on its own
+    GATT_READ_DONE,
+};
+
+struct GattReadChar {
+    uint16_t handle;
+    uint16_t uuid16;
+    uint8_t fixed_len;      // 0 when the length is not known in advance
+    uint8_t state;
+};
+
+struct GattReadPlan {
+    uint16_t mtu;
+    int count;
+    struct GattReadChar chars[GATT_READER_MAX_CHARS];
+    int batch[GATT_READER_MAX_BATCH];   // Indexes of the request in flight
+    int batch_count;
+    uint16_t requests;
+    uint16_t values;
+    uint16_t retries;       // Values read again because a Read Multiple answer was ambiguous
+};
+
+// Value read, uuid16 of the characteristic
+typedef void (*gatt_value_handler_t)(uint16_t uuid16, const uint8_t *value, size_t len, void *arg);
+
+// Parse a comma or space separated list of 16-bit UUIDs in hex ("2a19,2a24"). Returns the
+// number of UUIDs stored, entries that do not parse are skipped.
+int gatt_reader_parse_uuids(const char *str, uint16_t *uuids, int max);
+
+bool gatt_reader_wanted(const uint16_t *uuids, int count, uint16_t uuid16);
+
+// Value length of a standard characteristic, 0 when it varies
+uint8_t gatt_reader_fixed_len(uint16_t uuid16);
+
+void gatt_reader_init(struct GattReadPlan *plan);
+
+// ATT MTU agreed for the connection, default until the exchange completes
+void gatt_reader_set_mtu(struct GattReadPlan *plan, uint16_t mtu);
+
+// Add a readable characteristic, returns false when the plan is full
+bool gatt_reader_add(struct GattReadPlan *plan, uint16_t handle, uint16_t uuid16);
+
+// Handles of the next request, returns their number, 1 for a single read and 0 when
+// every value was read
+int gatt_reader_next(struct GattReadPlan *plan, uint16_t *handles);
+
+// Answer of the request returned by gatt_reader_next, calls handler for every value it splits into
+void gatt_reader_complete(struct GattReadPlan *plan, const uint8_t *data, size_t len, gatt_value_handler_t handler,
+                          void *arg);
+
+// Request failed, its values are given up (a failed Read Multiple is retried as single reads)
+void gatt_reader_failed(struct GattReadPlan *plan);
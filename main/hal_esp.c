@@ -0,0 +1,893 @@
+#include "scanner_hal.h"
+#include "scanner_core.h"
+#include "hal_esp.h"
+#include "metrics.h"
+
+#include "esp_wifi.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+
+#include "esp_http_client.h"
+#if CONFIG_ESP_UPLINK_HTTPS
+#include "esp_tls.h"
+#include "esp_crt_bundle.h"
+#include "http_stream.h"
+#endif
+
+#include "esp_gattc_api.h"
+#include "esp_gap_ble_api.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "hal/cpu_hal.h"
+#include "esp_private/esp_clk.h"
+#include "nvs.h"
+#include "esp_partition.h"
+#include "aes/esp_aes.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define HTTP_PRINT "HTTP"
+#define WIFI_DEBUG_PRINT "WIFI_STA"
+#define STORE_PRINT "STORE"
+
+#define STORE_NAMESPACE "scanner"
+
+#define SPOOL_PARTITION_LABEL "spool"
+#define SPOOL_PARTITION_SUBTYPE 0x41
+
+#define FILTER_PARTITION_LABEL "filter"
+#define FILTER_PARTITION_SUBTYPE 0x42
+
+#define NAME_WIFI      CONFIG_ESP_WIFI_SSID
+#define PASSWORD_WIFI  CONFIG_ESP_WIFI_PASSWORD
+
+#define UPLINK_IDLE_TIMEOUT_US ((int64_t) CONFIG_ESP_UPLINK_IDLE_TIMEOUT * 1000000)
+
+#if CONFIG_ESP_UPLINK_HTTPS
+#define UPLINK_TLS_TIMEOUT_MS 10000
+// Request line and headers, the URL of a device query is up to 2 KB
+#define UPLINK_HEAD_SIZE 2304
+#define UPLINK_RX_SIZE 1024
+
+#if CONFIG_ESP_UPLINK_TLS_RESUMPTION && !CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+#error "Resuming TLS sessions needs ESP-TLS client session tickets (CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS)"
+#endif
+#endif
+
+#define COMMAND_URL SERVER_URL "/commands"
+#define COMMAND_URL_SIZE 256
+#define COMMAND_POLL_WAIT_S CONFIG_ESP_COMMAND_POLL_WAIT
+#define COMMAND_TASK_STACK_SIZE 4096
+#define COMMAND_TASK_PRIORITY 4
+#define COMMAND_MAX_ACKS 16
+#define COMMAND_ACK_WAIT_MS 1000
+#define COMMAND_RETRY_MIN_MS 1000
+#define COMMAND_RETRY_MAX_MS 30000
+
+// VARIABLES -----------------------------------------------------
+
+static volatile bool connected_to_wifi = false;
+
+static uint16_t global_gattc_interface_type = ESP_GATT_IF_NONE;
+
+#if CONFIG_ESP_UPLINK_HTTPS
+// Long-lived TLS connection owned by the uplink task, HTTP/1.1 is spoken over it by http_stream.h
+static esp_tls_t *uplink_tls = NULL;
+static char uplink_head[UPLINK_HEAD_SIZE];
+static char uplink_rx[UPLINK_RX_SIZE];
+
+#if CONFIG_ESP_UPLINK_TLS_RESUMPTION
+// Ticket of the last handshake, kept across reconnects and WiFi drops
+static esp_tls_client_session_t *uplink_session = NULL;
+#endif
+
+// TLS statistics, handshakes offering a ticket are counted apart from full ones
+static uint32_t tls_full_handshakes = 0;
+static uint32_t tls_resumed_handshakes = 0;
+static uint64_t tls_full_us = 0;
+static uint64_t tls_resumed_us = 0;
+static uint64_t uplink_bytes = 0;
+#else
+// Long-lived HTTP client owned by the uplink task
+static esp_http_client_handle_t uplink_client = NULL;
+#endif
+static int64_t uplink_last_used_us = 0;
+static volatile bool uplink_reset_requested = false;
+
+// Uplink statistics
+static uint32_t uplink_requests = 0;
+static uint32_t uplink_connects = 0;
+static uint32_t uplink_errors = 0;
+static int32_t uplink_heap_delta = 0;
+
+#if CONFIG_ESP_COMMAND_CHANNEL
+// Command channel, the reader is used by the command task only
+static TaskHandle_t command_task_handle = NULL;
+static void (*command_callback)(const struct Command *command) = NULL;
+static struct CommandReader command_reader;
+
+// Ids of applied commands waiting for the next poll and commands not yet applied
+static portMUX_TYPE command_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t command_acks[COMMAND_MAX_ACKS];
+static int command_ack_count = 0;
+static volatile int commands_pending = 0;
+
+// Command channel statistics
+static uint32_t command_polls = 0;
+static uint32_t command_errors = 0;
+#endif
+
+// NVS namespace of the scanner, opened on first use (nvs_flash_init runs in app_main)
+static nvs_handle_t store_handle;
+static bool store_opened = false;
+
+// Spool partition, looked up on first use
+static const esp_partition_t *spool_partition = NULL;
+static bool spool_looked_up = false;
+
+// Address filter partition, looked up on first use
+static const esp_partition_t *filter_partition = NULL;
+static bool filter_looked_up = false;
+
+// TIME / GAP / GATTC -----------------------------------------------------------------------------
+
+uint32_t hal_now_ms(void) {
+    return (uint32_t) (esp_timer_get_time() / 1000);
+}
+
+// Counter of the calling core, durations are only valid for code not moving between cores
+uint32_t hal_cycle_count(void) {
+    return cpu_hal_get_cycle_count();
+}
+
+// Current CPU frequency, the default frequency option is named after the target
+uint32_t hal_cycles_per_us(void) {
+    return (uint32_t) (esp_clk_cpu_freq() / 1000000);
+}
+
+uint32_t hal_timer_us(void) {
+    return (uint32_t) esp_timer_get_time();
+}
+
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+
+// Extended scanner receives legacy and extended advertisements, on the 1M PHY and optionally on the Coded PHY.
+// Auxiliary packets on the 2M PHY are followed by the controller.
+void hal_esp_set_scan_params(const esp_ble_scan_params_t *params) {
+    esp_ble_ext_scan_cfg_t phy_cfg = {
+        .scan_type = params->scan_type,
+        .scan_interval = params->scan_interval,
+        .scan_window = params->scan_window,
+    };
+    esp_ble_ext_scan_params_t ext_params = {
+        .own_addr_type = params->own_addr_type,
+        .filter_policy = params->scan_filter_policy,
+        .scan_duplicate = params->scan_duplicate,
+#if CONFIG_ESP_EXT_SCAN_CODED
+        .cfg_mask = ESP_BLE_GAP_EXT_SCAN_CFG_UNCODE_MASK | ESP_BLE_GAP_EXT_SCAN_CFG_CODE_MASK,
+#else
+        .cfg_mask = ESP_BLE_GAP_EXT_SCAN_CFG_UNCODE_MASK,
+#endif
+        .uncoded_cfg = phy_cfg,
+        .coded_cfg = phy_cfg,
+    };
+
+    esp_ble_gap_set_ext_scan_params(&ext_params);
+}
+
+void hal_gap_start_scanning(uint32_t duration_s) {
+    // Duration in units of 10 ms, ESP_GAP_BLE_SCAN_TIMEOUT_EVT reports its end
+    esp_ble_gap_start_ext_scan(duration_s * 100, 0);
+}
+
+void hal_gap_stop_scanning(void) {
+    esp_ble_gap_stop_ext_scan();
+}
+
+#else
+
+void hal_esp_set_scan_params(const esp_ble_scan_params_t *params) {
+    esp_ble_gap_set_scan_params((esp_ble_scan_params_t *) params);
+}
+
+void hal_gap_start_scanning(uint32_t duration_s) {
+    esp_ble_gap_start_scanning(duration_s);
+}
+
+void hal_gap_stop_scanning(void) {
+    esp_ble_gap_stop_scanning();
+}
+
+#endif
+
+void hal_esp_set_gattc_if(uint16_t gattc_if) {
+    global_gattc_interface_type = gattc_if;
+}
+
+void hal_gattc_open(const uint8_t *bda, uint8_t addr_type) {
+    esp_bd_addr_t remote_bda;
+    memcpy(remote_bda, bda, sizeof(remote_bda));
+
+    esp_ble_gattc_open(global_gattc_interface_type, remote_bda, addr_type, true);
+}
+
+void hal_gattc_close(const uint8_t *bda) {
+    esp_bd_addr_t remote_bda;
+    memcpy(remote_bda, bda, sizeof(remote_bda));
+
+    esp_ble_gap_disconnect(remote_bda);
+}
+
+// HTTP -------------------------------------------------------------------------------------------
+
+#if CONFIG_ESP_UPLINK_HTTPS
+
+// Drop persistent connection, the session ticket is kept for the next one
+static void close_uplink_tls(void) {
+    if (uplink_tls != NULL) {
+        esp_tls_conn_destroy(uplink_tls);
+        uplink_tls = NULL;
+    }
+}
+
+// TCP connect and TLS handshake, resuming the last session when there is a ticket
+static bool open_uplink_tls(const struct HttpUrl *url) {
+    esp_tls_cfg_t tls_config = {
+        .crt_bundle_attach = esp_crt_bundle_attach,
+        .timeout_ms = UPLINK_TLS_TIMEOUT_MS,
+#if CONFIG_ESP_UPLINK_TLS_RESUMPTION
+        .client_session = uplink_session,
+#endif
+    };
+    bool resuming = tls_config.client_session != NULL;
+
+    uplink_tls = esp_tls_init();
+    if (uplink_tls == NULL) {
+        return false;
+    }
+
+    int64_t started_us = esp_timer_get_time();
+
+    if (esp_tls_conn_new_sync(url->host, strlen(url->host), url->port, &tls_config, uplink_tls) != 1) {
+        ESP_LOGE(HTTP_PRINT, "TLS connection to %s:%d failed", url->host, url->port);
+        close_uplink_tls();
+        return false;
+    }
+
+    uint32_t handshake_us = (uint32_t) (esp_timer_get_time() - started_us);
+
+    uplink_connects++;
+    if (resuming) {
+        tls_resumed_handshakes++;
+        tls_resumed_us += handshake_us;
+    } else {
+        tls_full_handshakes++;
+        tls_full_us += handshake_us;
+    }
+#if CONFIG_ESP_METRICS
+    metrics_add(METRIC_TLS_HANDSHAKE, handshake_us);
+#endif
+
+#if CONFIG_ESP_UPLINK_TLS_RESUMPTION
+    // Newest ticket replaces the one offered
+    esp_tls_client_session_t *session = esp_tls_get_client_session(uplink_tls);
+
+    if (session != NULL) {
+        if (uplink_session != NULL) {
+            esp_tls_free_client_session(uplink_session);
+        }
+        uplink_session = session;
+    }
+#endif
+
+    return true;
+}
+
+static bool write_all(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = esp_tls_conn_write(uplink_tls, data, len);
+
+        if (written >= 0) {
+            data += written;
+            len -= written;
+            uplink_bytes += written;
+        } else if (written != ESP_TLS_ERR_SSL_WANT_READ && written != ESP_TLS_ERR_SSL_WANT_WRITE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void handle_response_body(const char *data, size_t len, void *arg) {
+    scanner_core_on_http_data(data, len);
+}
+
+// Request on the open connection, returns HTTP status or -1. received is set once any
+// byte of the answer arrived, close when the server ends the connection after it.
+static int exchange(size_t head_len, const char *body, int body_len, bool *received, bool *close) {
+    struct HttpResponse response;
+
+    http_response_init(&response);
+
+    if (!write_all(uplink_head, head_len) || (body != NULL && !write_all(body, body_len))) {
+        return -1;
+    }
+
+    while (!http_response_done(&response)) {
+        ssize_t len = esp_tls_conn_read(uplink_tls, uplink_rx, sizeof(uplink_rx));
+
+        if (len == ESP_TLS_ERR_SSL_WANT_READ || len == ESP_TLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (len < 0) {
+            return -1;
+        }
+        if (len == 0) {
+            if (!http_response_closed(&response)) {
+                return -1;
+            }
+            break;
+        }
+
+        *received = true;
+        uplink_bytes += len;
+        if (http_response_feed(&response, uplink_rx, len, handle_response_body, NULL) < 0) {
+            return -1;
+        }
+    }
+
+    *close = response.close;
+    return response.status;
+}
+
+// Perform request on persistent connection, returns HTTP status or -1
+int hal_http_request(const char *url, const char *content_type, const char *body, int body_len) {
+    struct HttpUrl parsed;
+    int64_t now_us = esp_timer_get_time();
+    size_t head_len = 0;
+
+    if (http_parse_url(url, &parsed)) {
+        head_len = http_format_request(uplink_head, sizeof(uplink_head), &parsed, body != NULL ? content_type : NULL,
+                                       body != NULL ? body_len : 0);
+    }
+    if (head_len == 0) {
+        ESP_LOGE(HTTP_PRINT, "Cannot request %.64s", url);
+        return -1;
+    }
+
+    // WiFi dropped since last request, or the server has probably dropped the connection already
+    if (uplink_reset_requested || (uplink_tls != NULL && now_us - uplink_last_used_us > UPLINK_IDLE_TIMEOUT_US)) {
+        uplink_reset_requested = false;
+        close_uplink_tls();
+    }
+
+    uint32_t free_heap = esp_get_free_heap_size();
+    int status = -1;
+
+    METRICS_START_US(started);
+
+    // Connection kept open may have been closed by the server, which fails the request
+    // before any answer. It is sent again once on a new connection then.
+    for (int attempt = 0; attempt < 2 && status < 0; attempt++) {
+        bool reused = uplink_tls != NULL;
+        bool received = false;
+        bool close = false;
+
+        if (!reused && !open_uplink_tls(&parsed)) {
+            break;
+        }
+
+        status = exchange(head_len, body, body_len, &received, &close);
+
+        if (status < 0 || close) {
+            close_uplink_tls();
+        }
+        if (status < 0 && (!reused || received)) {
+            break;
+        }
+    }
+
+    METRICS_STOP_US(METRIC_HTTP_REQUEST, started);
+
+    uplink_requests++;
+    uplink_heap_delta += (int32_t) free_heap - (int32_t) esp_get_free_heap_size();
+    uplink_last_used_us = esp_timer_get_time();
+
+    if (status < 0) {
+        ESP_LOGE(HTTP_PRINT, "Request failed");
+        uplink_errors++;
+    }
+
+    return status;
+}
+
+#else
+
+// Handling HTTP Events
+static esp_err_t handle_http_events(esp_http_client_event_t *http_event) {
+    switch(http_event->event_id) {
+        case HTTP_EVENT_ON_CONNECTED:
+            uplink_connects++;
+            break;
+        case HTTP_EVENT_ON_FINISH:
+            break;
+
+        // If data was received
+        case HTTP_EVENT_ON_DATA:
+            if (!esp_http_client_is_chunked_response(http_event->client)) {
+                scanner_core_on_http_data((const char *) http_event->data, http_event->data_len);
+            }
+            break;
+        case HTTP_EVENT_HEADER_SENT:
+            break;
+        case HTTP_EVENT_ON_HEADER:
+            break;
+        case HTTP_EVENT_ERROR:
+            break;
+        case HTTP_EVENT_DISCONNECTED:
+            break;
+    }
+    return ESP_OK;
+}
+
+// Drop persistent connection, next request connects again
+static void close_uplink_client(void) {
+    if (uplink_client != NULL) {
+        esp_http_client_cleanup(uplink_client);
+        uplink_client = NULL;
+    }
+}
+
+// Get persistent client, (re)creating it lazily
+static esp_http_client_handle_t get_uplink_client(void) {
+    int64_t now_us = esp_timer_get_time();
+
+    // WiFi dropped since last request
+    if (uplink_reset_requested) {
+        uplink_reset_requested = false;
+        close_uplink_client();
+    }
+
+    // Closing connection the server has probably dropped already
+    if (uplink_client != NULL && now_us - uplink_last_used_us > UPLINK_IDLE_TIMEOUT_US) {
+        esp_http_client_close(uplink_client);
+    }
+
+    if (uplink_client == NULL) {
+        esp_http_client_config_t http_client_config = {
+            .url = SERVER_URL,
+            .event_handler = handle_http_events,
+            .buffer_size = 1024,
+            .buffer_size_tx = 1024,
+            .keep_alive_enable = true,
+        };
+        uplink_client = esp_http_client_init(&http_client_config);
+
+        if (uplink_client != NULL) {
+            esp_http_client_set_header(uplink_client, "Connection", "keep-alive");
+        }
+    }
+
+    return uplink_client;
+}
+
+// Perform request on persistent client, returns HTTP status or -1
+int hal_http_request(const char *url, const char *content_type, const char *body, int body_len) {
+    esp_http_client_handle_t client = get_uplink_client();
+
+    if (client == NULL) {
+        return -1;
+    }
+
+    esp_http_client_set_url(client, url);
+
+    if (body != NULL) {
+        esp_http_client_set_method(client, HTTP_METHOD_POST);
+        esp_http_client_set_header(client, "Content-Type", content_type);
+        esp_http_client_set_post_field(client, body, body_len);
+    } else {
+        esp_http_client_set_method(client, HTTP_METHOD_GET);
+        esp_http_client_set_post_field(client, NULL, 0);
+    }
+
+    uint32_t free_heap = esp_get_free_heap_size();
+
+    METRICS_START_US(started);
+    esp_err_t err = esp_http_client_perform(client);
+    METRICS_STOP_US(METRIC_HTTP_REQUEST, started);
+    int status = (err == ESP_OK) ? esp_http_client_get_status_code(client) : -1;
+
+    uplink_requests++;
+    uplink_heap_delta += (int32_t) free_heap - (int32_t) esp_get_free_heap_size();
+    uplink_last_used_us = esp_timer_get_time();
+
+    // Reconnecting lazily on next request
+    if (err != ESP_OK) {
+        ESP_LOGE(HTTP_PRINT, "Request failed: %s", esp_err_to_name(err));
+        uplink_errors++;
+        close_uplink_client();
+    }
+
+    return status;
+}
+
+#endif
+
+void hal_log_stats(void) {
+    ESP_LOGI(HTTP_PRINT, "Uplink: %u requests, %u connects, %u errors, %d bytes heap per request, %u bytes free",
+             (unsigned) uplink_requests, (unsigned) uplink_connects, (unsigned) uplink_errors,
+             uplink_requests > 0 ? (int) (uplink_heap_delta / (int32_t) uplink_requests) : 0,
+             (unsigned) esp_get_free_heap_size());
+#if CONFIG_ESP_UPLINK_HTTPS
+    // Handshake times include the TCP connect and the network round trips
+    ESP_LOGI(HTTP_PRINT, "TLS: %u full handshakes (%u ms avg), %u resumed (%u ms avg), %u bytes per request",
+             (unsigned) tls_full_handshakes, tls_full_handshakes > 0 ? (unsigned) (tls_full_us / tls_full_handshakes / 1000) : 0,
+             (unsigned) tls_resumed_handshakes,
+             tls_resumed_handshakes > 0 ? (unsigned) (tls_resumed_us / tls_resumed_handshakes / 1000) : 0,
+             uplink_requests > 0 ? (unsigned) (uplink_bytes / uplink_requests) : 0);
+#endif
+#if CONFIG_ESP_COMMAND_CHANNEL
+    ESP_LOGI(HTTP_PRINT, "Command channel: %u polls, %u errors, %u malformed commands",
+             (unsigned) command_polls, (unsigned) command_errors, (unsigned) command_reader.malformed);
+#endif
+}
+
+// COMMAND CHANNEL --------------------------------------------------------------------------------
+
+#if CONFIG_ESP_COMMAND_CHANNEL
+
+static void deliver_command(const struct Command *command, void *arg) {
+    portENTER_CRITICAL(&command_mux);
+    commands_pending++;
+    portEXIT_CRITICAL(&command_mux);
+
+    command_callback(command);
+}
+
+// Response body of a poll holds one command per line
+static esp_err_t handle_command_events(esp_http_client_event_t *http_event) {
+    if (http_event->event_id == HTTP_EVENT_ON_DATA) {
+        command_reader_feed(&command_reader, (const char *) http_event->data, http_event->data_len,
+                            hal_now_ms(), deliver_command, NULL);
+    }
+    return ESP_OK;
+}
+
+void hal_esp_command_done(const struct Command *command, bool applied) {
+    bool wake;
+
+    portENTER_CRITICAL(&command_mux);
+    // Commands without id are not acknowledged, an ack lost to a full list makes the server send the command again
+    if (applied && command->id != 0 && command_ack_count < COMMAND_MAX_ACKS) {
+        command_acks[command_ack_count++] = command->id;
+    }
+    commands_pending--;
+    wake = commands_pending == 0;
+    portEXIT_CRITICAL(&command_mux);
+
+    if (wake) {
+        xTaskNotifyGive(command_task_handle);
+    }
+}
+
+// Poll URL carrying the acknowledgements collected since the last poll
+static void build_command_url(char *url, size_t size) {
+    uint32_t acks[COMMAND_MAX_ACKS];
+    int count;
+
+    portENTER_CRITICAL(&command_mux);
+    count = command_ack_count;
+    memcpy(acks, command_acks, count * sizeof(acks[0]));
+    command_ack_count = 0;
+    portEXIT_CRITICAL(&command_mux);
+
+    int length = snprintf(url, size, COMMAND_URL "?wait=%d", COMMAND_POLL_WAIT_S);
+
+    for (int i = 0; i < count && length < (int) size; i++) {
+        length += snprintf(url + length, size - length, i == 0 ? "&ack=%u" : ",%u", (unsigned) acks[i]);
+    }
+}
+
+// Long-poll loop, the server holds each request until it has commands or the wait expires
+static void command_task(void *arg) {
+    static char url[COMMAND_URL_SIZE];
+    int retry_ms = COMMAND_RETRY_MIN_MS;
+
+    esp_http_client_config_t http_client_config = {
+        .url = COMMAND_URL,
+        .event_handler = handle_command_events,
+        .timeout_ms = (COMMAND_POLL_WAIT_S + 5) * 1000,
+        .buffer_size = 512,
+        .keep_alive_enable = true,
+#if CONFIG_ESP_UPLINK_HTTPS
+        .crt_bundle_attach = esp_crt_bundle_attach,
+#endif
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&http_client_config);
+
+    while (true) {
+        if (!connected_to_wifi || client == NULL) {
+            vTaskDelay(pdMS_TO_TICKS(COMMAND_RETRY_MIN_MS));
+            continue;
+        }
+
+        build_command_url(url, sizeof(url));
+        esp_http_client_set_url(client, url);
+
+        esp_err_t err = esp_http_client_perform(client);
+        int status = (err == ESP_OK) ? esp_http_client_get_status_code(client) : -1;
+
+        command_polls++;
+
+        // Server without command endpoint or unreachable, backing off
+        if (status != 200 && status != 204) {
+            command_reader_discard(&command_reader);
+
+            ESP_LOGE(HTTP_PRINT, "Command poll failed (%d, %s), retrying in %d ms", status, esp_err_to_name(err), retry_ms);
+            command_errors++;
+            esp_http_client_close(client);
+            vTaskDelay(pdMS_TO_TICKS(retry_ms));
+            retry_ms = retry_ms * 2 > COMMAND_RETRY_MAX_MS ? COMMAND_RETRY_MAX_MS : retry_ms * 2;
+            continue;
+        }
+        command_reader_finish(&command_reader, hal_now_ms(), deliver_command, NULL);
+        retry_ms = COMMAND_RETRY_MIN_MS;
+
+        // Waiting for the uplink task to apply the commands, so the next poll acknowledges them right away
+        TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(COMMAND_ACK_WAIT_MS);
+
+        while (commands_pending > 0 && (int32_t) (deadline - xTaskGetTickCount()) > 0) {
+            ulTaskNotifyTake(pdTRUE, deadline - xTaskGetTickCount());
+        }
+    }
+}
+
+void hal_esp_start_command_channel(void (*on_command)(const struct Command *command)) {
+    command_callback = on_command;
+    command_reader_init(&command_reader);
+
+    xTaskCreate(command_task, "commands", COMMAND_TASK_STACK_SIZE, NULL, COMMAND_TASK_PRIORITY, &command_task_handle);
+}
+
+#endif
+
+// END COMMAND CHANNEL ----------------------------------------------------------------------------
+
+// END HTTP ---------------------------------------------------------------------------------------
+
+// STORAGE ----------------------------------------------------------------------------------------
+
+static bool open_store(void) {
+    if (!store_opened) {
+        esp_err_t err = nvs_open(STORE_NAMESPACE, NVS_READWRITE, &store_handle);
+
+        if (err != ESP_OK) {
+            ESP_LOGE(STORE_PRINT, "Cannot open NVS namespace: %s", esp_err_to_name(err));
+            return false;
+        }
+        store_opened = true;
+    }
+    return true;
+}
+
+bool hal_store_read(const char *key, void *data, size_t *len) {
+    return open_store() && nvs_get_blob(store_handle, key, data, len) == ESP_OK;
+}
+
+bool hal_store_write(const char *key, const void *data, size_t len) {
+    if (!open_store()) {
+        return false;
+    }
+
+    esp_err_t err = nvs_set_blob(store_handle, key, data, len);
+
+    if (err == ESP_OK) {
+        err = nvs_commit(store_handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(STORE_PRINT, "Cannot write %s: %s", key, esp_err_to_name(err));
+    }
+
+    return err == ESP_OK;
+}
+
+void hal_store_erase(const char *key) {
+    if (open_store() && nvs_erase_key(store_handle, key) == ESP_OK) {
+        nvs_commit(store_handle);
+    }
+}
+
+void hal_store_erase_prefix(const char *prefix) {
+    size_t prefix_len = strlen(prefix);
+    bool erased = false;
+
+    if (!open_store()) {
+        return;
+    }
+
+    // Search starts over after every erase, an iterator is not kept across changes of the namespace
+    for (;;) {
+        nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, STORE_NAMESPACE, NVS_TYPE_ANY);
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        bool found = false;
+
+        while (it != NULL && !found) {
+            nvs_entry_info_t info;
+
+            nvs_entry_info(it, &info);
+            if (strncmp(info.key, prefix, prefix_len) == 0) {
+                strcpy(key, info.key);
+                found = true;
+            } else {
+                it = nvs_entry_next(it);
+            }
+        }
+        nvs_release_iterator(it);
+
+        if (!found || nvs_erase_key(store_handle, key) != ESP_OK) {
+            break;
+        }
+        erased = true;
+    }
+
+    if (erased) {
+        nvs_commit(store_handle);
+    }
+}
+
+static const esp_partition_t *get_spool_partition(void) {
+    if (!spool_looked_up) {
+        spool_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, SPOOL_PARTITION_SUBTYPE, SPOOL_PARTITION_LABEL);
+        spool_looked_up = true;
+
+        if (spool_partition == NULL) {
+            ESP_LOGE(STORE_PRINT, "No \"%s\" partition", SPOOL_PARTITION_LABEL);
+        }
+    }
+    return spool_partition;
+}
+
+size_t hal_spool_size(void) {
+    return get_spool_partition() != NULL ? spool_partition->size : 0;
+}
+
+bool hal_spool_read(size_t offset, void *data, size_t len) {
+    return get_spool_partition() != NULL && esp_partition_read(spool_partition, offset, data, len) == ESP_OK;
+}
+
+bool hal_spool_write(size_t offset, const void *data, size_t len) {
+    return get_spool_partition() != NULL && esp_partition_write(spool_partition, offset, data, len) == ESP_OK;
+}
+
+bool hal_spool_erase_sector(size_t offset) {
+    return get_spool_partition() != NULL && esp_partition_erase_range(spool_partition, offset, SPI_FLASH_SEC_SIZE) == ESP_OK;
+}
+
+static const esp_partition_t *get_filter_partition(void) {
+    if (!filter_looked_up) {
+        filter_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, FILTER_PARTITION_SUBTYPE, FILTER_PARTITION_LABEL);
+        filter_looked_up = true;
+
+        if (filter_partition == NULL) {
+            ESP_LOGE(STORE_PRINT, "No \"%s\" partition", FILTER_PARTITION_LABEL);
+        }
+    }
+    return filter_partition;
+}
+
+size_t hal_filter_size(void) {
+    return get_filter_partition() != NULL ? filter_partition->size : 0;
+}
+
+bool hal_filter_read(size_t offset, void *data, size_t len) {
+    return get_filter_partition() != NULL && esp_partition_read(filter_partition, offset, data, len) == ESP_OK;
+}
+
+bool hal_filter_write(size_t offset, const void *data, size_t len) {
+    return get_filter_partition() != NULL && esp_partition_write(filter_partition, offset, data, len) == ESP_OK;
+}
+
+bool hal_filter_erase(size_t len) {
+    size_t sectors_len = (len + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE * SPI_FLASH_SEC_SIZE;
+
+    return get_filter_partition() != NULL && sectors_len <= filter_partition->size
+            && esp_partition_erase_range(filter_partition, 0, sectors_len) == ESP_OK;
+}
+
+// END STORAGE ------------------------------------------------------------------------------------
+
+// CRYPTO -----------------------------------------------------------------------------------------
+
+// The AES peripheral takes the key with every block, setting it is a copy into the context
+void hal_aes128_encrypt(const uint8_t *key, const uint8_t *in, uint8_t *out) {
+    esp_aes_context context;
+
+    esp_aes_init(&context);
+    esp_aes_setkey(&context, key, 128);
+    esp_aes_crypt_ecb(&context, ESP_AES_ENCRYPT, in, out);
+    esp_aes_free(&context);
+}
+
+// END CRYPTO -------------------------------------------------------------------------------------
+
+// WIFI -------------------------------------------------------------------------------------------
+
+bool hal_wifi_connected(void) {
+    return connected_to_wifi;
+}
+
+// Handling WiFi events
+static void got_wifi_event(void* arg, esp_event_base_t wifi_event, int32_t wifi_event_num, void* wifi_raw_event) {
+
+    // If WiFi scanning started or disconnected from Access Point
+    if (wifi_event == WIFI_EVENT && (wifi_event_num == WIFI_EVENT_STA_START || wifi_event_num == WIFI_EVENT_STA_DISCONNECTED)) {
+        ESP_LOGE(WIFI_DEBUG_PRINT, "Trying to connect to Wifi");
+
+        connected_to_wifi = false;
+        uplink_reset_requested = true;
+
+        ESP_ERROR_CHECK(esp_wifi_connect());
+
+    // If connected
+    } else if (wifi_event == IP_EVENT && wifi_event_num == IP_EVENT_STA_GOT_IP) {
+
+        // Getting IP
+        ip_event_got_ip_t* ip_event = (ip_event_got_ip_t*) wifi_raw_event;
+        ESP_LOGE(WIFI_DEBUG_PRINT, "CONNECTED TO WIFI");
+        ESP_LOGI(WIFI_DEBUG_PRINT, "IP address:" IPSTR, IP2STR(&ip_event->ip_info.ip));
+
+        connected_to_wifi = true;
+    }
+}
+
+void connect_to_wifi(void) {
+    // Initialize the underlying TCP/IP stack
+    ESP_ERROR_CHECK(esp_netif_init());
+
+    // Initializing default WiFi event loop
+    ESP_ERROR_CHECK(esp_event_loop_create_default());
+
+    // Creating WiFi station
+    esp_netif_create_default_wifi_sta();
+
+    // Initializing WiFi configuration options
+    wifi_init_config_t wifi_init_config = WIFI_INIT_CONFIG_DEFAULT();
+
+    // Initializing WiFi allocate resource for WiFi driver
+    ESP_ERROR_CHECK(esp_wifi_init(&wifi_init_config));
+
+    esp_event_handler_instance_t id_event_instance;
+    esp_event_handler_instance_t ip_event_instance;
+
+    // Setting callbacks for WiFi events
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &got_wifi_event, NULL, &id_event_instance));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_wifi_event, NULL, &ip_event_instance));
+
+
+    wifi_config_t wifi_config = {
+        .sta = {
+            .ssid = NAME_WIFI,
+            .password = PASSWORD_WIFI,
+	        .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+
+            .pmf_cfg = {
+                .capable = true,
+                .required = false
+            },
+        },
+    };
+
+    // Setting operating mode to station
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+    // Setting configuration of the station
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+
+    // Starting WiFi
+    ESP_ERROR_CHECK(esp_wifi_start());
+}
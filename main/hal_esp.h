@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "command.h"
+
+#include "esp_gap_ble_api.h"
+
+// ESP-IDF backend of scanner_hal.h
+
+// GATT interface registered in ESP_GATTC_REG_EVT
+void hal_esp_set_gattc_if(uint16_t gattc_if);
+
+// Set scan parameters, completion is reported by ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT, or by
+// ESP_GAP_BLE_SET_EXT_SCAN_PARAMS_COMPLETE_EVT when the extended scanner is used (BLE 5 targets)
+void hal_esp_set_scan_params(const esp_ble_scan_params_t *params);
+
+// Bring up WiFi station, reconnects on its own
+void connect_to_wifi(void);
+
+// Start the task long-polling the server for commands. on_command runs on that task
+// and must hand every command over to hal_esp_command_done eventually.
+void hal_esp_start_command_channel(void (*on_command)(const struct Command *command));
+
+// Command was applied (acknowledged to the server with the next poll) or rejected
+void hal_esp_command_done(const struct Command *command, bool applied);
@@ -0,0 +1,248 @@
+#include "http_stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+// Header name matches, value returned without leading blanks
+static const char *header_value(const char *line, const char *name) {
+    size_t name_len = strlen(name);
+
+    if (strncasecmp(line, name, name_len) != 0 || line[name_len] != ':') {
+        return NULL;
+    }
+
+    line += name_len + 1;
+    while (*line == ' ' || *line == '\t') {
+        line++;
+    }
+    return line;
+}
+
+// Responses to requests other than HEAD that never have a body
+static bool has_no_body(int status) {
+    return (status >= 100 && status < 200) || status == 204 || status == 304;
+}
+
+static int parse_status_line(struct HttpResponse *response) {
+    int status;
+
+    if (sscanf(response->line, "HTTP/1.%*d %3d", &status) != 1 || status < 100) {
+        return -1;
+    }
+
+    response->status = status;
+    response->state = HTTP_RESPONSE_HEADERS;
+
+    // HTTP/1.0 closes unless asked otherwise
+    response->close = strncmp(response->line, "HTTP/1.0", 8) == 0;
+    return 0;
+}
+
+static int parse_header_line(struct HttpResponse *response) {
+    const char *value;
+
+    // Blank line ends the headers
+    if (response->line_len == 0) {
+        if (has_no_body(response->status)) {
+            response->state = HTTP_RESPONSE_DONE;
+        } else if (response->chunked) {
+            response->state = HTTP_RESPONSE_CHUNK_SIZE;
+        } else if (response->has_length) {
+            response->state = response->remaining > 0 ? HTTP_RESPONSE_BODY : HTTP_RESPONSE_DONE;
+        } else {
+            response->state = HTTP_RESPONSE_UNTIL_CLOSE;
+            response->close = true;
+        }
+        return 0;
+    }
+
+    if ((value = header_value(response->line, "Content-Length")) != NULL) {
+        char *end;
+        unsigned long length = strtoul(value, &end, 10);
+
+        if (end == value || length > UINT32_MAX) {
+            return -1;
+        }
+        response->has_length = true;
+        response->remaining = length;
+    } else if ((value = header_value(response->line, "Transfer-Encoding")) != NULL) {
+        response->chunked = strstr(value, "chunked") != NULL;
+    } else if ((value = header_value(response->line, "Connection")) != NULL) {
+        if (strncasecmp(value, "close", 5) == 0) {
+            response->close = true;
+        } else if (strncasecmp(value, "keep-alive", 10) == 0) {
+            response->close = false;
+        }
+    }
+    return 0;
+}
+
+static int parse_chunk_size(struct HttpResponse *response) {
+    char *end;
+    unsigned long size = strtoul(response->line, &end, 16);
+
+    // Chunk extensions after ';' are ignored
+    if (end == response->line || (*end != '\0' && *end != ';' && *end != ' ') || size > UINT32_MAX) {
+        return -1;
+    }
+
+    response->remaining = size;
+    response->state = size > 0 ? HTTP_RESPONSE_CHUNK_DATA : HTTP_RESPONSE_TRAILERS;
+    return 0;
+}
+
+// Complete line in response->line, without CRLF
+static int parse_line(struct HttpResponse *response) {
+    switch (response->state) {
+    case HTTP_RESPONSE_STATUS:
+        return parse_status_line(response);
+    case HTTP_RESPONSE_HEADERS:
+        return parse_header_line(response);
+    case HTTP_RESPONSE_CHUNK_SIZE:
+        return parse_chunk_size(response);
+    case HTTP_RESPONSE_CHUNK_END:
+        response->state = HTTP_RESPONSE_CHUNK_SIZE;
+        return response->line_len == 0 ? 0 : -1;
+    case HTTP_RESPONSE_TRAILERS:
+        if (response->line_len == 0) {
+            response->state = HTTP_RESPONSE_DONE;
+        }
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+static bool in_body(const struct HttpResponse *response) {
+    return response->state == HTTP_RESPONSE_BODY || response->state == HTTP_RESPONSE_CHUNK_DATA
+            || response->state == HTTP_RESPONSE_UNTIL_CLOSE;
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+bool http_parse_url(const char *url, struct HttpUrl *parsed) {
+    const char *host;
+
+    if (strncmp(url, "https://", 8) == 0) {
+        parsed->https = true;
+        parsed->port = 443;
+        host = url + 8;
+    } else if (strncmp(url, "http://", 7) == 0) {
+        parsed->https = false;
+        parsed->port = 80;
+        host = url + 7;
+    } else {
+        return false;
+    }
+
+    size_t host_len = strcspn(host, ":/?");
+
+    if (host_len == 0 || host_len >= sizeof(parsed->host)) {
+        return false;
+    }
+    memcpy(parsed->host, host, host_len);
+    parsed->host[host_len] = '\0';
+
+    const char *rest = host + host_len;
+
+    if (*rest == ':') {
+        char *end;
+
+        parsed->port = (int) strtol(rest + 1, &end, 10);
+        if (end == rest + 1 || parsed->port <= 0 || parsed->port > 65535) {
+            return false;
+        }
+        rest = end;
+    }
+
+    parsed->target = *rest != '\0' ? rest : "/";
+    return true;
+}
+
+size_t http_format_request(char *out, size_t size, const struct HttpUrl *url, const char *content_type,
+                           size_t body_len) {
+    char host[HTTP_STREAM_HOST_MAX + 8];
+    int length;
+
+    // Port is left out when it is the default of the scheme
+    if (url->port == (url->https ? 443 : 80)) {
+        snprintf(host, sizeof(host), "%s", url->host);
+    } else {
+        snprintf(host, sizeof(host), "%s:%d", url->host, url->port);
+    }
+
+    if (content_type != NULL) {
+        length = snprintf(out, size, "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n\r\n",
+                          url->target, host, content_type, (unsigned) body_len);
+    } else {
+        length = snprintf(out, size, "GET %s HTTP/1.1\r\nHost: %s\r\n\r\n", url->target, host);
+    }
+
+    return length > 0 && (size_t) length < size ? (size_t) length : 0;
+}
+
+void http_response_init(struct HttpResponse *response) {
+    memset(response, 0, sizeof(*response));
+    response->state = HTTP_RESPONSE_STATUS;
+}
+
+int http_response_feed(struct HttpResponse *response, const char *data, size_t len, http_body_handler_t handler,
+                       void *arg) {
+    size_t pos = 0;
+
+    while (pos < len && response->state != HTTP_RESPONSE_DONE) {
+        if (response->state == HTTP_RESPONSE_ERROR) {
+            return -1;
+        }
+
+        // Body bytes go to the handler as they are
+        if (in_body(response)) {
+            size_t n = len - pos;
+
+            if (response->state != HTTP_RESPONSE_UNTIL_CLOSE && n > response->remaining) {
+                n = response->remaining;
+            }
+            if (handler != NULL) {
+                handler(data + pos, n, arg);
+            }
+            pos += n;
+
+            if (response->state != HTTP_RESPONSE_UNTIL_CLOSE) {
+                response->remaining -= n;
+                if (response->remaining == 0) {
+                    response->state = response->state == HTTP_RESPONSE_BODY ? HTTP_RESPONSE_DONE
+                            : HTTP_RESPONSE_CHUNK_END;
+                }
+            }
+            continue;
+        }
+
+        // Line by line otherwise, CR is dropped and the end of a long line too
+        char c = data[pos++];
+
+        if (c == '\n') {
+            response->line[response->line_len] = '\0';
+
+            if (parse_line(response) < 0) {
+                response->state = HTTP_RESPONSE_ERROR;
+                return -1;
+            }
+            response->line_len = 0;
+        } else if (c != '\r' && response->line_len < sizeof(response->line) - 1) {
+            response->line[response->line_len++] = c;
+        }
+    }
+
+    return (int) pos;
+}
+
+bool http_response_closed(struct HttpResponse *response) {
+    if (response->state == HTTP_RESPONSE_UNTIL_CLOSE) {
+        response->state = HTTP_RESPONSE_DONE;
+    }
+    return response->state == HTTP_RESPONSE_DONE;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// HTTP/1.1 over a byte stream the caller owns, for the uplink that talks to esp_tls
+// directly (CONFIG_ESP_UPLINK_HTTPS). Requests are formatted into a caller buffer,
+// responses are parsed as they arrive in any number of pieces, with Content-Length,
+// chunked or connection close framing. Never allocates.
+
+// Longest status or header line kept, the rest of a longer line is ignored
+#define HTTP_STREAM_LINE_MAX 128
+
+// Host part of an URL at most ("host:port")
+#define HTTP_STREAM_HOST_MAX 64
+
+enum HttpResponseState {
+    HTTP_RESPONSE_STATUS,
+    HTTP_RESPONSE_HEADERS,
+    HTTP_RESPONSE_BODY,             // Content-Length bytes
+    HTTP_RESPONSE_CHUNK_SIZE,
+    HTTP_RESPONSE_CHUNK_DATA,
+    HTTP_RESPONSE_CHUNK_END,        // CRLF after the chunk data
+    HTTP_RESPONSE_TRAILERS,
+    HTTP_RESPONSE_UNTIL_CLOSE,      // Body ends when the server closes the connection
+    HTTP_RESPONSE_DONE,
+    HTTP_RESPONSE_ERROR,
+};
+
+struct HttpResponse {
+    uint8_t state;
+    int status;
+    bool chunked;
+    bool has_length;
+    bool close;             // Server closes the connection after this response
+    uint32_t remaining;     // Body or chunk bytes still to come
+    size_t line_len;
+    char line[HTTP_STREAM_LINE_MAX];
+};
+
+// Piece of the response body
+typedef void (*http_body_handler_t)(const char *data, size_t len, void *arg);
+
+struct HttpUrl {
+    bool https;
+    char host[HTTP_STREAM_HOST_MAX];   // Without the port
+    int port;
+    const char *target;                // Path and query, points into the URL
+};
+
+// Split an absolute "http://" or "https://" URL, false when it is neither or the host is too long
+bool http_parse_url(const char *url, struct HttpUrl *parsed);
+
+// Request line and headers of a keep-alive request, a POST when content_type is set.
+// Returns the length, 0 when it does not fit.
+size_t http_format_request(char *out, size_t size, const struct HttpUrl *url, const char *content_type,
+                           size_t body_len);
+
+void http_response_init(struct HttpResponse *response);
+
+// Feed received bytes. Returns the bytes used, which is less than len only once the
+// response is complete (state HTTP_RESPONSE_DONE), or -1 when it is malformed.
+int http_response_feed(struct HttpResponse *response, const char *data, size_t len, http_body_handler_t handler,
+                       void *arg);
+
+// Server closed the connection, returns true when that completed the response
+bool http_response_closed(struct HttpResponse *response);
+
+static inline bool http_response_done(const struct HttpResponse *response) {
+    return response->state == HTTP_RESPONSE_DONE;
+}
@@ -0,0 +1,77 @@
+#include "metrics.h"
+
+#include <string.h>
+
+#define METRICS_PRINT "METRICS"
+
+struct Metrics metrics;
+
+static const char *const stage_names[METRIC_STAGES] = {
+    [METRIC_GAP_EVENT] = "gap_event",
+    [METRIC_GATT_EVENT] = "gatt_event",
+    [METRIC_OBSERVATION] = "observation",
+    [METRIC_REPORT] = "report",
+    [METRIC_HTTP_REQUEST] = "http_request",
+    [METRIC_DISCOVERY] = "discovery",
+    [METRIC_TLS_HANDSHAKE] = "tls_handshake",
+};
+
+void metrics_reset(void) {
+    memset(&metrics, 0, sizeof(metrics));
+}
+
+void metrics_add(enum MetricStage stage, uint32_t value) {
+    struct MetricHistogram *histogram = &metrics.stages[stage];
+    int bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+
+    if (bucket >= METRIC_BUCKETS) {
+        bucket = METRIC_BUCKETS - 1;
+    }
+
+    histogram->count++;
+    histogram->total += value;
+    histogram->buckets[bucket]++;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+const char *metrics_stage_name(enum MetricStage stage) {
+    return stage_names[stage];
+}
+
+int metrics_stage_unit(enum MetricStage stage) {
+    return stage <= METRIC_OBSERVATION ? METRIC_UNIT_CYCLES : METRIC_UNIT_US;
+}
+
+uint32_t metrics_percentile(const struct MetricHistogram *histogram, int percentile) {
+    uint64_t target = (uint64_t) histogram->count * percentile / 100;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < METRIC_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if (seen > target) {
+            return (1u << i) < histogram->max ? (1u << i) : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void metrics_log(void) {
+    for (int stage = 0; stage < METRIC_STAGES; stage++) {
+        const struct MetricHistogram *histogram = &metrics.stages[stage];
+        const char *unit = metrics_stage_unit(stage) == METRIC_UNIT_CYCLES ? "cycles" : "us";
+
+        if (histogram->count == 0) {
+            continue;
+        }
+
+        SCANNER_LOGI(METRICS_PRINT, "%-12s %u events, avg %u, p50 < %u, p99 < %u, max %u %s",
+                     stage_names[stage], (unsigned) histogram->count, (unsigned) (histogram->total / histogram->count),
+                     (unsigned) metrics_percentile(histogram, 50), (unsigned) metrics_percentile(histogram, 99),
+                     (unsigned) histogram->max, unit);
+    }
+
+    SCANNER_LOGI(METRICS_PRINT, "heap %u free, %u min free, %u advertisements dropped",
+                 (unsigned) metrics.heap_free, (unsigned) metrics.heap_min_free, (unsigned) metrics.adv_dropped);
+}
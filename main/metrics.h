@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sdkconfig.h"
+#include "scanner_hal.h"
+
+// Hot path instrumentation. Every stage has a log2 histogram, bucket i counts
+// durations in [2^(i-1), 2^i). Callbacks that never block are timed with the CPU
+// cycle counter, stages waiting for the network or a peer in microseconds.
+// Histograms are written by a single task each and read without locking, an
+// export may see a record half updated. Everything compiles out unless
+// CONFIG_ESP_METRICS.
+
+// Values are sent in the metrics record of the wire format, append new stages only
+enum MetricStage {
+    METRIC_GAP_EVENT = 0,       // handle_gap_events
+    METRIC_GATT_EVENT = 1,      // handle_gatt_events
+    METRIC_OBSERVATION = 2,     // scanner_core_process of one observation other than window end
+    METRIC_REPORT = 3,          // Window end: show_found_devices including the uplink requests
+    METRIC_HTTP_REQUEST = 4,    // esp_http_client_perform of one uplink request
+    METRIC_DISCOVERY = 5,       // Connection request to the end of GATT discovery
+    METRIC_TLS_HANDSHAKE = 6,   // TCP connect and TLS handshake of the HTTPS uplink
+    METRIC_STAGES,
+};
+
+#define METRIC_UNIT_CYCLES 0
+#define METRIC_UNIT_US     1
+
+#define METRIC_BUCKETS 32
+
+struct MetricHistogram {
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+    uint32_t buckets[METRIC_BUCKETS];
+};
+
+struct Metrics {
+    struct MetricHistogram stages[METRIC_STAGES];
+
+    // Gauges, set by the application before an export
+    uint32_t heap_free;
+    uint32_t heap_min_free;
+    uint32_t adv_dropped;       // Advertisement reports dropped while the observation ring was full
+};
+
+extern struct Metrics metrics;
+
+#if CONFIG_ESP_METRICS
+#define METRICS_START_CYCLES(name) uint32_t name = hal_cycle_count()
+#define METRICS_STOP_CYCLES(stage, name) metrics_add((stage), hal_cycle_count() - (name))
+#define METRICS_START_US(name) uint32_t name = hal_timer_us()
+#define METRICS_STOP_US(stage, name) metrics_add((stage), hal_timer_us() - (name))
+#else
+#define METRICS_START_CYCLES(name)
+#define METRICS_STOP_CYCLES(stage, name)
+#define METRICS_START_US(name)
+#define METRICS_STOP_US(stage, name)
+#endif
+
+void metrics_reset(void);
+
+// Record one duration in the unit of the stage
+void metrics_add(enum MetricStage stage, uint32_t value);
+
+const char *metrics_stage_name(enum MetricStage stage);
+
+// METRIC_UNIT_CYCLES or METRIC_UNIT_US
+int metrics_stage_unit(enum MetricStage stage);
+
+// Upper bound of the bucket holding given percentile (0-100), at most the maximum
+uint32_t metrics_percentile(const struct MetricHistogram *histogram, int percentile);
+
+// One line per stage with events, on the console
+void metrics_log(void);
@@ -0,0 +1,65 @@
+#include "obs_ring.h"
+
+#include <string.h>
+
+_Static_assert((OBS_RING_SIZE & (OBS_RING_SIZE - 1)) == 0, "Observation ring size must be a power of two");
+
+void obs_ring_init(struct ObsRing *ring) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->pushed, 0);
+    atomic_init(&ring->dropped, 0);
+    atomic_init(&ring->overflows, 0);
+    atomic_init(&ring->high_water, 0);
+    ring->was_full = false;
+}
+
+bool obs_ring_push(struct ObsRing *ring, const struct Observation *obs, bool *was_empty) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t depth = head - tail;
+
+    // Ring full, dropping record
+    if (depth == OBS_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+
+        // Counting each overflow episode once
+        if (!ring->was_full) {
+            ring->was_full = true;
+            atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+        }
+        return false;
+    }
+
+    ring->was_full = false;
+    memcpy(&ring->records[head & (OBS_RING_SIZE - 1)], obs, sizeof(struct Observation));
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    atomic_fetch_add_explicit(&ring->pushed, 1, memory_order_relaxed);
+    if (depth + 1 > atomic_load_explicit(&ring->high_water, memory_order_relaxed)) {
+        atomic_store_explicit(&ring->high_water, depth + 1, memory_order_relaxed);
+    }
+
+    if (was_empty != NULL) {
+        *was_empty = (depth == 0);
+    }
+    return true;
+}
+
+bool obs_ring_pop(struct ObsRing *ring, struct Observation *obs) {
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail) {
+        return false;
+    }
+
+    memcpy(obs, &ring->records[tail & (OBS_RING_SIZE - 1)], sizeof(struct Observation));
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+uint32_t obs_ring_depth(struct ObsRing *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) - atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "sdkconfig.h"
+
+// Ring size in records, must be a power of two
+#define OBS_RING_SIZE CONFIG_ESP_OBS_RING_SIZE
+
+#define OBS_DATA_LEN 62
+
+// Kind of observation record
+enum ObservationKind {
+    OBS_ADV,             // Advertisement report, data holds adv_len adv bytes followed by scan_rsp_len scan response bytes
+    OBS_WINDOW_END,      // Inquiry window completed
+    OBS_SERVICE,         // Discovered service of device bda, data holds the UUID bytes, adv_len the UUID length
+    OBS_CHAR,            // Discovered characteristic of device bda, same layout as OBS_SERVICE
+    OBS_OPEN_FAILED,     // Connection to device bda failed
+    OBS_DISCONNECTED,    // Device bda disconnected
+    OBS_CONNECTED,       // Connection to device bda opened
+    OBS_SERVICE_CHANGED, // Device bda indicated Service Changed
+    OBS_VALUE,           // Characteristic value of device bda, data holds the 16-bit UUID and the value, adv_len the value length
+};
+
+// Compact record passed from Bluetooth callbacks to the uplink task
+struct Observation {
+    uint32_t timestamp_ms;
+    uint8_t kind;
+    uint8_t addr_type;
+    int8_t rssi;
+    uint8_t adv_len;
+    uint8_t scan_rsp_len;
+    uint8_t bda[6];
+    uint8_t data[OBS_DATA_LEN];
+};
+
+// Single producer / single consumer ring, producer is the Bluedroid callback task
+struct ObsRing {
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    _Atomic uint32_t pushed;
+    _Atomic uint32_t dropped;
+    _Atomic uint32_t overflows;
+    _Atomic uint32_t high_water;
+    bool was_full;
+    struct Observation records[OBS_RING_SIZE];
+};
+
+void obs_ring_init(struct ObsRing *ring);
+
+// Producer side, returns false (and counts a drop) when the ring is full.
+// was_empty is set when the consumer has to be woken up.
+bool obs_ring_push(struct ObsRing *ring, const struct Observation *obs, bool *was_empty);
+
+// Consumer side, returns false when the ring is empty
+bool obs_ring_pop(struct ObsRing *ring, struct Observation *obs);
+
+uint32_t obs_ring_depth(struct ObsRing *ring);
@@ -0,0 +1,135 @@
+#include "request_encoder.h"
+
+#include <stdint.h>
+#include <string.h>
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+// RFC 3986 unreserved characters, plus ':' which is allowed unescaped in a query and keeps addresses readable.
+// Bytes from 0x80 are all escaped.
+static const uint8_t unreserved[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0,
+};
+
+// Check that n more characters fit next to the terminator
+static bool has_room(struct RequestEncoder *encoder, size_t n) {
+    if (encoder->truncated || encoder->length + n + 1 > encoder->size) {
+        encoder->truncated = true;
+        return false;
+    }
+    return true;
+}
+
+void request_encoder_init(struct RequestEncoder *encoder, char *data, size_t size) {
+    encoder->data = data;
+    encoder->size = size;
+    encoder->length = 0;
+    encoder->truncated = (size == 0);
+
+    if (size > 0) {
+        data[0] = '\0';
+    }
+}
+
+void request_encoder_append(struct RequestEncoder *encoder, const char *str) {
+    size_t n = strlen(str);
+
+    if (!has_room(encoder, n)) {
+        return;
+    }
+
+    memcpy(encoder->data + encoder->length, str, n);
+    encoder->length += n;
+    encoder->data[encoder->length] = '\0';
+}
+
+void request_encoder_append_encoded(struct RequestEncoder *encoder, const char *str) {
+    size_t start = encoder->length;
+    const unsigned char *p = (const unsigned char *) str;
+
+    while (*p != '\0') {
+        // Run of unreserved characters copied at once
+        size_t run = 0;
+
+        while (unreserved[p[run]]) {
+            run++;
+        }
+        if (run > 0) {
+            if (!has_room(encoder, run)) {
+                break;
+            }
+            memcpy(encoder->data + encoder->length, p, run);
+            encoder->length += run;
+            p += run;
+        }
+
+        if (*p != '\0') {
+            if (!has_room(encoder, 3)) {
+                break;
+            }
+            encoder->data[encoder->length++] = '%';
+            encoder->data[encoder->length++] = hex_digits[*p >> 4];
+            encoder->data[encoder->length++] = hex_digits[*p & 0x0f];
+            p++;
+        }
+    }
+
+    // Never leave half of a value in the buffer
+    if (encoder->truncated) {
+        encoder->length = start;
+    }
+
+    if (encoder->size > 0) {
+        encoder->data[encoder->length] = '\0';
+    }
+}
+
+void request_encoder_append_int(struct RequestEncoder *encoder, int value) {
+    char digits[12];
+    int count = 0;
+    unsigned int magnitude = (value < 0) ? 0u - (unsigned int) value : (unsigned int) value;
+
+    do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    if (value < 0) {
+        digits[count++] = '-';
+    }
+
+    if (!has_room(encoder, count)) {
+        return;
+    }
+
+    while (count > 0) {
+        encoder->data[encoder->length++] = digits[--count];
+    }
+    encoder->data[encoder->length] = '\0';
+}
+
+void request_encoder_append_char(struct RequestEncoder *encoder, char c) {
+    if (!has_room(encoder, 1)) {
+        return;
+    }
+
+    encoder->data[encoder->length++] = c;
+    encoder->data[encoder->length] = '\0';
+}
+
+void request_encoder_rewind(struct RequestEncoder *encoder, size_t length) {
+    if (encoder->size == 0 || length > encoder->length) {
+        return;
+    }
+
+    encoder->length = length;
+    encoder->truncated = false;
+    encoder->data[length] = '\0';
+}
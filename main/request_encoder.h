@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Bounded string builder writing into a caller provided buffer, never allocates.
+// Once an append does not fit the encoder is marked truncated and ignores further
+// appends, the buffer always holds a null terminated prefix of complete pieces.
+struct RequestEncoder {
+    char *data;
+    size_t size;
+    size_t length;
+    bool truncated;
+};
+
+void request_encoder_init(struct RequestEncoder *encoder, char *data, size_t size);
+
+// Append string as is
+void request_encoder_append(struct RequestEncoder *encoder, const char *str);
+
+// Append string percent-encoded as RFC 3986 query component (only unreserved characters and ':' are kept)
+void request_encoder_append_encoded(struct RequestEncoder *encoder, const char *str);
+
+// Append decimal integer
+void request_encoder_append_int(struct RequestEncoder *encoder, int value);
+
+// Append single character
+void request_encoder_append_char(struct RequestEncoder *encoder, char c);
+
+// Drop everything appended after given length and clear truncation
+void request_encoder_rewind(struct RequestEncoder *encoder, size_t length);
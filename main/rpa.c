@@ -0,0 +1,303 @@
+#include "rpa.h"
+#include "scanner_hal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#define RPA_PRINT "RPA"
+
+#define STORE_KEY "rpa_irks"
+
+#define NO_IDENTITY -1
+
+// Cache is 4-way set associative, a new result replaces the entries of its set in turn
+#define CACHE_WAYS 4
+#define CACHE_SETS (RPA_CACHE_SIZE / CACHE_WAYS)
+
+_Static_assert((RPA_CACHE_SIZE & (RPA_CACHE_SIZE - 1)) == 0, "Resolved address cache size must be a power of two");
+
+// Resolution result of one private address, identity is an index into identities
+struct CacheEntry {
+    uint8_t bda[6];
+    bool used;
+    int16_t identity;
+};
+
+// Identities added by command, as kept in persistent storage
+struct StoredIdentities {
+    uint32_t count;
+    struct RpaIdentity identities[RPA_MAX_IRKS];
+};
+
+struct RpaCounters rpa_counters;
+
+// Identities from Kconfig first, then the ones added by command
+static struct RpaIdentity identities[RPA_MAX_IRKS];
+static int identities_count = 0;
+static int config_count = 0;
+
+static struct CacheEntry cache[CACHE_SETS][CACHE_WAYS];
+static uint8_t cache_victim[CACHE_SETS];
+
+static struct StoredIdentities stored;
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Both halves of the address are pseudo random
+static uint32_t cache_set(const uint8_t *bda) {
+    uint32_t key = (bda[0] << 16 | bda[1] << 8 | bda[2]) ^ (bda[3] << 16 | bda[4] << 8 | bda[5]);
+
+    return (key ^ (key >> 12)) & (CACHE_SETS - 1);
+}
+
+static struct CacheEntry *cache_find(const uint8_t *bda) {
+    struct CacheEntry *set = cache[cache_set(bda)];
+
+    for (int i = 0; i < CACHE_WAYS; i++) {
+        if (set[i].used && memcmp(set[i].bda, bda, 6) == 0) {
+            return &set[i];
+        }
+    }
+    return NULL;
+}
+
+static struct CacheEntry *cache_replace(const uint8_t *bda) {
+    uint32_t set = cache_set(bda);
+    struct CacheEntry *entry = &cache[set][cache_victim[set]];
+
+    cache_victim[set] = (cache_victim[set] + 1) % CACHE_WAYS;
+    entry->used = true;
+    memcpy(entry->bda, bda, 6);
+
+    return entry;
+}
+
+// Results, including misses, are only valid for the identities they were computed with
+static void clear_cache(void) {
+    memset(cache, 0, sizeof(cache));
+    memset(cache_victim, 0, sizeof(cache_victim));
+}
+
+static void save_identities(void) {
+    stored.count = identities_count - config_count;
+    memcpy(stored.identities, identities + config_count, stored.count * sizeof(struct RpaIdentity));
+
+    if (!hal_store_write(STORE_KEY, &stored, sizeof(stored.count) + stored.count * sizeof(struct RpaIdentity))) {
+        SCANNER_LOGE(RPA_PRINT, "Cannot store identity resolving keys");
+    }
+}
+
+// Identity with the same IRK or identity address, or NULL
+static struct RpaIdentity *find_identity(const struct RpaIdentity *identity) {
+    for (int i = 0; i < identities_count; i++) {
+        if (memcmp(identities[i].irk, identity->irk, RPA_IRK_LEN) == 0 || memcmp(identities[i].bda, identity->bda, 6) == 0) {
+            return &identities[i];
+        }
+    }
+    return NULL;
+}
+
+static bool add_identity(const struct RpaIdentity *identity) {
+    struct RpaIdentity *existing = find_identity(identity);
+
+    if (existing != NULL) {
+        *existing = *identity;
+    } else if (identities_count < RPA_MAX_IRKS) {
+        identities[identities_count++] = *identity;
+    } else {
+        return false;
+    }
+
+    clear_cache();
+    return true;
+}
+
+// Entries of CONFIG_ESP_RPA_IRKS are separated by ';'
+static void load_config(void) {
+    const char *p = CONFIG_ESP_RPA_IRKS;
+
+    while (*p != '\0') {
+        struct RpaIdentity identity;
+        int n = rpa_parse_identity(p, &identity);
+
+        if (n == 0) {
+            SCANNER_LOGE(RPA_PRINT, "Malformed identity resolving key in configuration: %s", p);
+            return;
+        }
+        if (!add_identity(&identity)) {
+            SCANNER_LOGE(RPA_PRINT, "More than %d identity resolving keys configured", RPA_MAX_IRKS);
+            return;
+        }
+
+        p += n;
+        while (*p == ';' || isspace((unsigned char) *p)) {
+            p++;
+        }
+    }
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+void rpa_init(void) {
+    size_t len = sizeof(stored);
+
+    identities_count = 0;
+    memset(&rpa_counters, 0, sizeof(rpa_counters));
+    clear_cache();
+
+    load_config();
+    config_count = identities_count;
+
+    if (hal_store_read(STORE_KEY, &stored, &len) && len >= sizeof(stored.count)
+            && len == sizeof(stored.count) + stored.count * sizeof(struct RpaIdentity)) {
+        for (uint32_t i = 0; i < stored.count; i++) {
+            add_identity(&stored.identities[i]);
+        }
+    }
+
+    if (identities_count > 0) {
+        SCANNER_LOGI(RPA_PRINT, "%d identity resolving keys (%d configured)", identities_count, config_count);
+    }
+}
+
+bool rpa_add_identity(const struct RpaIdentity *identity) {
+    if (!add_identity(identity)) {
+        return false;
+    }
+
+    save_identities();
+    return true;
+}
+
+int rpa_identity_count(void) {
+    return identities_count;
+}
+
+bool rpa_is_resolvable(const uint8_t *bda, uint8_t addr_type) {
+    return addr_type == RPA_ADDR_TYPE_RANDOM && (bda[0] & 0xc0) == 0x40;
+}
+
+void rpa_ah(const uint8_t *irk, const uint8_t *prand, uint8_t *hash) {
+    uint8_t block[16] = { 0 };
+    uint8_t out[16];
+
+    // r' is prand padded with zeros, ah is the 24 least significant bits of e(irk, r')
+    memcpy(block + 13, prand, 3);
+    hal_aes128_encrypt(irk, block, out);
+    memcpy(hash, out + 13, 3);
+}
+
+int rpa_match(const struct RpaIdentity *list, int count, const uint8_t *bda) {
+    uint8_t hash[3];
+
+    // Address is prand (most significant half) followed by hash
+    for (int i = 0; i < count; i++) {
+        rpa_ah(list[i].irk, bda, hash);
+        rpa_counters.aes_blocks++;
+
+        if (memcmp(hash, bda + 3, 3) == 0) {
+            return i;
+        }
+    }
+    return NO_IDENTITY;
+}
+
+bool rpa_resolve(const uint8_t *bda, uint8_t addr_type, uint8_t *identity_bda, uint8_t *identity_type) {
+    if (identities_count == 0 || !rpa_is_resolvable(bda, addr_type)) {
+        return false;
+    }
+
+    struct CacheEntry *entry = cache_find(bda);
+
+    rpa_counters.lookups++;
+
+    if (entry != NULL) {
+        rpa_counters.cache_hits++;
+    } else {
+        entry = cache_replace(bda);
+        entry->identity = rpa_match(identities, identities_count, bda);
+
+        if (entry->identity != NO_IDENTITY) {
+            rpa_counters.resolved++;
+        } else {
+            rpa_counters.unresolved++;
+        }
+    }
+
+    if (entry->identity == NO_IDENTITY) {
+        return false;
+    }
+
+    memcpy(identity_bda, identities[entry->identity].bda, 6);
+    *identity_type = identities[entry->identity].addr_type;
+    return true;
+}
+
+bool rpa_lookup(const uint8_t *bda, uint8_t *identity_bda, uint8_t *identity_type) {
+    const struct CacheEntry *entry = cache_find(bda);
+
+    if (entry == NULL || entry->identity == NO_IDENTITY) {
+        return false;
+    }
+
+    memcpy(identity_bda, identities[entry->identity].bda, 6);
+    *identity_type = identities[entry->identity].addr_type;
+    return true;
+}
+
+int rpa_parse_identity(const char *str, struct RpaIdentity *identity) {
+    const char *p = str;
+    unsigned b[6];
+    int n = 0;
+
+    while (isspace((unsigned char) *p)) {
+        p++;
+    }
+
+    for (int i = 0; i < RPA_IRK_LEN; i++, p += 2) {
+        int high = hex_value(p[0]);
+        int low = high >= 0 ? hex_value(p[1]) : -1;
+
+        if (low < 0) {
+            return 0;
+        }
+        identity->irk[i] = high << 4 | low;
+    }
+
+    if (!isspace((unsigned char) *p)
+            || sscanf(p, " %2x:%2x:%2x:%2x:%2x:%2x%n", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &n) != 6) {
+        return 0;
+    }
+    p += n;
+
+    for (int i = 0; i < 6; i++) {
+        identity->bda[i] = b[i];
+    }
+    identity->addr_type = RPA_ADDR_TYPE_PUBLIC_ID;
+
+    const char *q = p;
+
+    while (isspace((unsigned char) *q)) {
+        q++;
+    }
+    if (strncmp(q, "random", 6) == 0 && !isalnum((unsigned char) q[6])) {
+        identity->addr_type = RPA_ADDR_TYPE_RANDOM_ID;
+        p = q + 6;
+    }
+
+    return p - str;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+
+// Resolution of resolvable private addresses (Core 5.x, Vol 6, Part B, 1.3.2.2).
+// Devices sharing their identity resolving key (IRK) with the scanner are tracked
+// under their identity address however often their private address rotates.
+//
+// IRKs are provisioned in Kconfig and with the "irk" command of the command
+// channel, the latter are kept in persistent storage. Every private address is
+// resolved once against all IRKs (one AES block per IRK), the result (including
+// no match) is kept in a 4-way set associative cache so later advertisements of the same
+// address cost a single lookup.
+
+// Identity resolving keys kept, set in Kconfig
+#define RPA_MAX_IRKS CONFIG_ESP_RPA_MAX_IRKS
+
+// Resolution results kept, set in Kconfig. Must be a power of two.
+#define RPA_CACHE_SIZE CONFIG_ESP_RPA_CACHE_SIZE
+
+// Address types as in HCI LE Advertising Report events: random device address and resolved identities
+#define RPA_ADDR_TYPE_RANDOM    0x01
+#define RPA_ADDR_TYPE_PUBLIC_ID 0x02
+#define RPA_ADDR_TYPE_RANDOM_ID 0x03
+
+#define RPA_IRK_LEN 16
+
+struct RpaIdentity {
+    uint8_t irk[RPA_IRK_LEN];   // Most significant byte first
+    uint8_t bda[6];             // Identity address
+    uint8_t addr_type;          // RPA_ADDR_TYPE_PUBLIC_ID or RPA_ADDR_TYPE_RANDOM_ID
+};
+
+struct RpaCounters {
+    uint32_t lookups;       // Private addresses looked up
+    uint32_t cache_hits;
+    uint32_t resolved;      // Cache misses matching an IRK
+    uint32_t unresolved;    // Cache misses matching none
+    uint32_t aes_blocks;    // ah() evaluations
+};
+
+extern struct RpaCounters rpa_counters;
+
+// Load IRKs from Kconfig and persistent storage, clear the cache
+void rpa_init(void);
+
+// Add an identity, replacing one with the same IRK or identity address. Kept in
+// persistent storage. Returns false when the table is full.
+bool rpa_add_identity(const struct RpaIdentity *identity);
+
+int rpa_identity_count(void);
+
+// Random address with the resolvable private address tag (most significant bits 01)
+bool rpa_is_resolvable(const uint8_t *bda, uint8_t addr_type);
+
+// Identity of a resolvable private address. Returns false when the address is not
+// resolvable or no IRK matches it.
+bool rpa_resolve(const uint8_t *bda, uint8_t addr_type, uint8_t *identity_bda, uint8_t *identity_type);
+
+// Same as rpa_resolve for addresses resolved before, without any AES on a cache miss
+bool rpa_lookup(const uint8_t *bda, uint8_t *identity_bda, uint8_t *identity_type);
+
+// Index of the first identity in identities whose IRK generated the address, or -1
+int rpa_match(const struct RpaIdentity *identities, int count, const uint8_t *bda);
+
+// Random address hash function ah (Core 5.x, Vol 3, Part H, 2.2.2), prand and hash most significant byte first
+void rpa_ah(const uint8_t *irk, const uint8_t *prand, uint8_t *hash);
+
+// Parse "<32 hex digits IRK> xx:xx:xx:xx:xx:xx [random]", the identity address is
+// public unless followed by "random". Returns characters consumed or 0 when malformed.
+int rpa_parse_identity(const char *str, struct RpaIdentity *identity);
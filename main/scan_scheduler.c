@@ -0,0 +1,129 @@
+#include "scan_scheduler.h"
+#include "obs_ring.h"
+
+#include <string.h>
+
+// Longest scan interval the controller accepts (10.24 s)
+#define SCAN_INTERVAL_MAX 0x4000
+
+#define TOP_LEVEL (SCAN_SCHEDULER_LEVELS - 1)
+
+// Observations waiting for the uplink task when the window ends, more is a backlog
+#define QUEUED_LIMIT (OBS_RING_SIZE / 2)
+
+// Advertisements of a window jumping this many times over the average rate, and by at least
+// as many advertisements as SURGE_MIN, mean a crowd arrived
+#define SURGE_FACTOR 2
+#define SURGE_MIN 20
+
+_Static_assert(CONFIG_ESP_SCAN_MIN_DUTY <= CONFIG_ESP_SCAN_MAX_DUTY, "Minimum scan duty cycle above the maximum");
+
+// HELPER FUNCTIONS -------------------------------------------------------------------------------
+
+// Duty cycle of a level in percent, evenly spaced between the Kconfig bounds
+static int level_duty(int level) {
+    return CONFIG_ESP_SCAN_MIN_DUTY + (CONFIG_ESP_SCAN_MAX_DUTY - CONFIG_ESP_SCAN_MIN_DUTY) * level / TOP_LEVEL;
+}
+
+static void level_settings(int level, bool active, struct ScanSettings *settings) {
+    uint32_t interval = (uint32_t) CONFIG_ESP_SCAN_WINDOW * 100 / level_duty(level);
+
+    settings->window = CONFIG_ESP_SCAN_WINDOW;
+    settings->interval = interval > SCAN_INTERVAL_MAX ? SCAN_INTERVAL_MAX : interval;
+    settings->active = active;
+}
+
+static bool has_backlog(const struct ScanWindowStats *stats) {
+    return stats->dropped > 0 || stats->queued >= QUEUED_LIMIT
+            || (CONFIG_ESP_SCAN_BACKLOG_LIMIT > 0 && stats->stored >= CONFIG_ESP_SCAN_BACKLOG_LIMIT);
+}
+
+// Something in range a higher duty cycle finds sooner
+static bool has_demand(struct ScanScheduler *scheduler, const struct ScanWindowStats *stats) {
+    bool surge = false;
+
+    if (stats->listening_ms > 0) {
+        uint32_t rate = (uint32_t) ((uint64_t) stats->advertisements * 1000 / stats->listening_ms);
+        uint32_t expected = (uint32_t) ((uint64_t) scheduler->rate * stats->listening_ms / 1000);
+
+        surge = stats->advertisements > expected * SURGE_FACTOR + SURGE_MIN;
+        scheduler->rate = (scheduler->rate * 3 + rate) / 4;
+    }
+
+    return surge || stats->new_devices > 0 || stats->unnamed > 0 || stats->discoveries > 0;
+}
+
+// END HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+void scan_scheduler_init(struct ScanScheduler *scheduler) {
+    memset(scheduler, 0, sizeof(*scheduler));
+
+    scheduler->level = TOP_LEVEL;
+    scheduler->active = true;
+    level_settings(scheduler->level, scheduler->active, &scheduler->settings);
+}
+
+bool scan_scheduler_update(struct ScanScheduler *scheduler, const struct ScanWindowStats *stats) {
+    struct ScanSchedulerCounters *counters = &scheduler->counters;
+    bool demand = has_demand(scheduler, stats);
+
+    if (scheduler->pinned) {
+        return false;
+    }
+
+    // Backlog wins over demand, more advertisements would only be dropped
+    if (has_backlog(stats)) {
+        scheduler->quiet_windows = 0;
+        scheduler->named_windows = 0;
+        scheduler->active = false;
+        if (scheduler->level > 0) {
+            scheduler->level--;
+        }
+        counters->shed++;
+
+    } else {
+        if (demand) {
+            scheduler->quiet_windows = 0;
+            if (scheduler->level < TOP_LEVEL) {
+                scheduler->level = TOP_LEVEL;
+                counters->raised++;
+            }
+        } else if (++scheduler->quiet_windows >= CONFIG_ESP_SCAN_QUIET_WINDOWS) {
+            scheduler->quiet_windows = 0;
+            if (scheduler->level > 0) {
+                scheduler->level--;
+                counters->lowered++;
+            }
+        }
+
+        if (stats->unnamed > 0) {
+            scheduler->named_windows = 0;
+            scheduler->active = true;
+        } else if (++scheduler->named_windows >= CONFIG_ESP_SCAN_QUIET_WINDOWS) {
+            scheduler->active = false;
+        }
+    }
+
+    struct ScanSettings next;
+
+    level_settings(scheduler->level, scheduler->active, &next);
+
+    if (next.interval == scheduler->settings.interval && next.window == scheduler->settings.window
+            && next.active == scheduler->settings.active) {
+        return false;
+    }
+
+    scheduler->settings = next;
+    return true;
+}
+
+void scan_scheduler_pin(struct ScanScheduler *scheduler, uint16_t interval, uint16_t window) {
+    scheduler->pinned = true;
+    scheduler->settings.interval = interval;
+    scheduler->settings.window = window;
+    scheduler->settings.active = true;
+}
+
+int scan_scheduler_duty(const struct ScanSettings *settings) {
+    return settings->interval > 0 ? settings->window * 1000 / settings->interval : 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+
+// Scan duty cycle and mode chosen at the end of every inquiry window from what the
+// window brought: new devices, devices still waiting for their name, discovery
+// targets waiting for an advertisement, and how well the uplink keeps up.
+//
+// The duty cycle moves between CONFIG_ESP_SCAN_MIN_DUTY and CONFIG_ESP_SCAN_MAX_DUTY
+// in SCAN_SCHEDULER_LEVELS steps, the scan window stays at CONFIG_ESP_SCAN_WINDOW and
+// the interval stretches. Any demand raises it to the top at once, it only steps down
+// after CONFIG_ESP_SCAN_QUIET_WINDOWS windows without demand. Active scanning (a
+// SCAN_REQ to every scannable advertiser) is kept while devices wait for a name from
+// their scan response, passive scanning takes over the same number of windows after
+// the last one. A backlog of observations or stored batches steps the duty cycle down
+// and scans passively whatever the demand.
+
+#define SCAN_SCHEDULER_LEVELS 5
+
+// Scan parameters in units of 0.625 ms, as in esp_ble_scan_params_t
+struct ScanSettings {
+    uint16_t interval;
+    uint16_t window;
+    bool active;
+};
+
+// Inquiry window just ended
+struct ScanWindowStats {
+    uint32_t listening_ms;      // Radio time, scan window share of the time scanning was enabled
+    uint32_t advertisements;    // Advertisement reports
+    uint32_t new_devices;
+    uint32_t unnamed;           // Devices in range waiting for their name from a scan response
+    uint32_t discoveries;       // Discovery targets waiting for their device to advertise
+    uint32_t queued;            // Observations waiting for the uplink task at the end of the window
+    uint32_t dropped;           // Observations dropped during the window
+    uint32_t stored;            // Batches waiting in the spool
+};
+
+// Totals since boot
+struct ScanSchedulerCounters {
+    uint32_t raised;            // Windows raising the duty cycle
+    uint32_t lowered;           // Windows lowering it after a quiet period
+    uint32_t shed;              // Windows lowering it because of a backlog
+};
+
+struct ScanScheduler {
+    int level;                  // Duty cycle step, 0 is CONFIG_ESP_SCAN_MIN_DUTY
+    bool active;
+    bool pinned;                // Parameters set by the server, left as they are
+    int quiet_windows;          // Consecutive windows without demand
+    int named_windows;          // Consecutive windows without devices waiting for a name
+    uint32_t rate;              // Advertisements per radio second, moving average
+    struct ScanSettings settings;
+    struct ScanSchedulerCounters counters;
+};
+
+// Start at the top duty cycle, scanning actively
+void scan_scheduler_init(struct ScanScheduler *scheduler);
+
+// Account for the window just ended and choose the settings of the next one.
+// Returns true when they differ from the current ones.
+bool scan_scheduler_update(struct ScanScheduler *scheduler, const struct ScanWindowStats *stats);
+
+// Parameters set from outside (scan command), kept until reboot
+void scan_scheduler_pin(struct ScanScheduler *scheduler, uint16_t interval, uint16_t window);
+
+// Listening share in permille
+int scan_scheduler_duty(const struct ScanSettings *settings);
@@ -0,0 +1,179 @@
+#include "scan_trace.h"
+
+#include <string.h>
+
+#define RECORD_ADDR_TYPE_MASK 0x03
+#define RECORD_SAME_BDA       0x04
+#define RECORD_WINDOW_END     0x08
+#define RECORD_SCAN_RSP       0x10
+#define RECORD_END            0xFF
+
+static void put_u32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    return (uint32_t) in[0] | ((uint32_t) in[1] << 8) | ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+void scan_trace_reset(struct ScanTraceState *state, uint32_t base_ms) {
+    state->last_ms = base_ms;
+    state->has_bda = false;
+}
+
+void scan_trace_write_header(uint8_t *out, uint32_t sequence, uint32_t base_ms) {
+    put_u32(out, SCAN_TRACE_MAGIC);
+    put_u32(out + 4, sequence);
+    put_u32(out + 8, base_ms);
+    put_u32(out + 12, 0);
+}
+
+bool scan_trace_read_header(const uint8_t *in, uint32_t *sequence, uint32_t *base_ms) {
+    if (get_u32(in) != SCAN_TRACE_MAGIC) {
+        return false;
+    }
+
+    *sequence = get_u32(in + 4);
+    *base_ms = get_u32(in + 8);
+
+    return true;
+}
+
+int scan_trace_encode(struct ScanTraceState *state, const struct Observation *obs, uint8_t *out, size_t size) {
+    uint8_t record[SCAN_TRACE_MAX_RECORD];
+    size_t n = 1;
+
+    if (obs->kind != OBS_ADV && obs->kind != OBS_WINDOW_END) {
+        return 0;
+    }
+
+    uint8_t header = obs->addr_type & RECORD_ADDR_TYPE_MASK;
+
+    // Time delta as unsigned LEB128, modular so the ms clock may wrap
+    uint32_t delta = obs->timestamp_ms - state->last_ms;
+    do {
+        record[n++] = (delta & 0x7f) | (delta >= 0x80 ? 0x80 : 0);
+        delta >>= 7;
+    } while (delta != 0);
+
+    if (obs->kind == OBS_WINDOW_END) {
+        header = RECORD_WINDOW_END;
+    } else {
+        size_t data_len = obs->adv_len + obs->scan_rsp_len;
+
+        if (data_len > OBS_DATA_LEN) {
+            return -1;
+        }
+
+        // Advertisers repeat, the same address usually shows up back to back
+        if (state->has_bda && memcmp(state->last_bda, obs->bda, sizeof(obs->bda)) == 0) {
+            header |= RECORD_SAME_BDA;
+        } else {
+            memcpy(record + n, obs->bda, sizeof(obs->bda));
+            n += sizeof(obs->bda);
+        }
+
+        record[n++] = (uint8_t) obs->rssi;
+        record[n++] = obs->adv_len;
+
+        if (obs->scan_rsp_len > 0) {
+            header |= RECORD_SCAN_RSP;
+            record[n++] = obs->scan_rsp_len;
+        }
+
+        memcpy(record + n, obs->data, data_len);
+        n += data_len;
+    }
+
+    if (n > size) {
+        return -1;
+    }
+
+    record[0] = header;
+    memcpy(out, record, n);
+
+    state->last_ms = obs->timestamp_ms;
+    if (obs->kind == OBS_ADV) {
+        memcpy(state->last_bda, obs->bda, sizeof(obs->bda));
+        state->has_bda = true;
+    }
+
+    return (int) n;
+}
+
+int scan_trace_decode(struct ScanTraceState *state, const uint8_t *in, size_t len, struct Observation *obs) {
+    size_t n = 1;
+
+    if (len == 0 || in[0] == RECORD_END) {
+        return 0;
+    }
+
+    uint8_t header = in[0];
+    if (header & 0x80) {
+        return -1;
+    }
+
+    uint32_t delta = 0;
+    for (int shift = 0; ; shift += 7) {
+        if (n >= len || shift > 28) {
+            return -1;
+        }
+        delta |= (uint32_t) (in[n] & 0x7f) << shift;
+        if ((in[n++] & 0x80) == 0) {
+            break;
+        }
+    }
+
+    memset(obs, 0, sizeof(*obs));
+    obs->timestamp_ms = state->last_ms + delta;
+
+    if (header & RECORD_WINDOW_END) {
+        obs->kind = OBS_WINDOW_END;
+        state->last_ms = obs->timestamp_ms;
+        return (int) n;
+    }
+
+    obs->kind = OBS_ADV;
+    obs->addr_type = header & RECORD_ADDR_TYPE_MASK;
+
+    if (header & RECORD_SAME_BDA) {
+        if (!state->has_bda) {
+            return -1;
+        }
+        memcpy(obs->bda, state->last_bda, sizeof(obs->bda));
+    } else {
+        if (n + sizeof(obs->bda) > len) {
+            return -1;
+        }
+        memcpy(obs->bda, in + n, sizeof(obs->bda));
+        n += sizeof(obs->bda);
+    }
+
+    if (n + 2 > len) {
+        return -1;
+    }
+    obs->rssi = (int8_t) in[n++];
+    obs->adv_len = in[n++];
+
+    if (header & RECORD_SCAN_RSP) {
+        if (n + 1 > len) {
+            return -1;
+        }
+        obs->scan_rsp_len = in[n++];
+    }
+
+    size_t data_len = obs->adv_len + obs->scan_rsp_len;
+    if (data_len > OBS_DATA_LEN || n + data_len > len) {
+        return -1;
+    }
+    memcpy(obs->data, in + n, data_len);
+    n += data_len;
+
+    state->last_ms = obs->timestamp_ms;
+    memcpy(state->last_bda, obs->bda, sizeof(obs->bda));
+    state->has_bda = true;
+
+    return (int) n;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "obs_ring.h"
+
+// Binary scan trace format shared by the on-device capture and host replay.
+//
+// A trace is a sequence of sectors. Each sector starts with a 16 byte header
+// (magic, sequence number, base timestamp in ms, all little endian) followed by
+// records. Records never cross a sector boundary and the first 0xFF byte
+// (erased flash) ends the sector.
+//
+// Record layout:
+//   header byte   bits 0-1 address type, bit 2 same address as previous record,
+//                 bit 3 window end, bit 4 scan response present, bit 7 always 0
+//   varint        milliseconds since previous record (or since the sector base)
+//   bda[6]        only when the address differs from the previous record
+//   rssi, adv_len, scan_rsp_len (only with bit 4), adv and scan response bytes
+//
+// Window end records carry only the header byte and the time delta.
+
+#define SCAN_TRACE_SECTOR_SIZE 4096
+#define SCAN_TRACE_HEADER_SIZE 16
+#define SCAN_TRACE_MAGIC 0x52544353
+
+// Upper bound of one encoded record
+#define SCAN_TRACE_MAX_RECORD (1 + 5 + 6 + 3 + OBS_DATA_LEN)
+
+// Delta encoding state, reset at the start of every sector
+struct ScanTraceState {
+    uint32_t last_ms;
+    uint8_t last_bda[6];
+    bool has_bda;
+};
+
+void scan_trace_reset(struct ScanTraceState *state, uint32_t base_ms);
+
+void scan_trace_write_header(uint8_t *out, uint32_t sequence, uint32_t base_ms);
+
+// Returns false when the sector is erased or not a trace sector
+bool scan_trace_read_header(const uint8_t *in, uint32_t *sequence, uint32_t *base_ms);
+
+// Encode OBS_ADV or OBS_WINDOW_END observation. Returns encoded length, 0 for
+// observations that are not traced and -1 when the record does not fit.
+int scan_trace_encode(struct ScanTraceState *state, const struct Observation *obs, uint8_t *out, size_t size);
+
+// Decode next record. Returns consumed length, 0 at the end of the sector and -1
+// for a malformed record.
+int scan_trace_decode(struct ScanTraceState *state, const uint8_t *in, size_t len, struct Observation *obs);
@@ -2,16 +2,6 @@
 #include "esp_bt_main.h"
 #include "esp_gattc_api.h"
 
-#include "freertos/event_groups.h"
-#include "esp_wifi.h"
-#include "esp_event.h"
-
-#include "esp_http_client.h"
-
-#include "esp_crt_bundle.h"
-#include "esp_tls.h"
-#include "esp_netif.h"
-
 #include "nvs.h"
 #include "nvs_flash.h"
 
@@ -19,411 +9,566 @@
 #include "esp_gatt_common_api.h"
 #include "esp_gap_ble_api.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+
+#include "obs_ring.h"
+#include "scanner_core.h"
+#include "scanner_hal.h"
+#include "hal_esp.h"
+#include "ext_adv.h"
+#include "trace_capture.h"
+#include "metrics.h"
+#include "scan_scheduler.h"
+#include "gatt_reader.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 #define DEBUG_PRINT "SCANNER_PRINT"
-#define HTTP_PRINT "HTTP"
 #define WIFI_DEBUG_PRINT "WIFI_STA"
 
-#define NAME_WIFI      CONFIG_ESP_WIFI_SSID
-#define PASSWORD_WIFI  CONFIG_ESP_WIFI_PASSWORD
-#define SERVER_ADDR      CONFIG_ESP_IP_ADDRESS
+#define UPLINK_TASK_STACK_SIZE 4096
+#define UPLINK_TASK_PRIORITY 5
+#define UPLINK_TASK_CORE ((CONFIG_ESP_UPLINK_TASK_CORE < 0) ? tskNO_AFFINITY : CONFIG_ESP_UPLINK_TASK_CORE)
+#define UPLINK_POLL_MS 100
 
-#define UUID_LENGTH 37
-#define SCANNING_DURATION 5
+// Open GATT connections tracked on the Bluedroid task, as many as Bluedroid allows
+#define MAX_CONNECTIONS CONFIG_BT_ACL_CONNECTIONS
 
-// STRUCTS -------------------------------------------------------
+// Reasons the uplink task was woken up
+#define UPLINK_NOTIFY_RING    0x01
+#define UPLINK_NOTIFY_WINDOW  0x02
+#define UPLINK_NOTIFY_COMMAND 0x04
 
+#define COMMAND_QUEUE_SIZE CONFIG_ESP_COMMAND_QUEUE_SIZE
 
-// Device structure
-struct Device {
-   char name[50];
-   char address[18];
-   int rssi;
-   bool in_range;
-   int services_count;
-   int chars_count;
-   char services[20][UUID_LENGTH];
-   char chars[20][UUID_LENGTH];
-};
+#if CONFIG_ESP_CONTINUOUS_SCAN
+// Scan never completes, inquiry windows are cut by the flush timer
+#define SCAN_DURATION 0
+#else
+#define SCAN_DURATION SCANNING_DURATION
+#endif
+
+// STRUCTS -------------------------------------------------------
 
-// Scanning parameters
+// Scanning parameters, interval, window and type are chosen by the scan scheduler when enabled
 static esp_ble_scan_params_t scanning_parameters = {
     .scan_type              = BLE_SCAN_TYPE_ACTIVE,
     .own_addr_type          = BLE_ADDR_TYPE_PUBLIC,
     .scan_filter_policy     = BLE_SCAN_FILTER_ALLOW_ALL,
     .scan_interval          = 0x50,
     .scan_window            = 0x30,
+#if CONFIG_ESP_DELTA_REPORTING
+    // Controller forwards each device once per inquiry window
+    .scan_duplicate         = BLE_SCAN_DUPLICATE_ENABLE
+#else
     .scan_duplicate         = BLE_SCAN_DUPLICATE_DISABLE
+#endif
 };
 
 // ---------------------------------------------------------------
 
 // VARIABLES -----------------------------------------------------
 
-struct Device devices[10];
+// Observations passed from Bluetooth callbacks to the uplink task
+static struct ObsRing observation_ring;
+static TaskHandle_t uplink_task_handle = NULL;
+
+#if CONFIG_ESP_CONTINUOUS_SCAN
+static esp_timer_handle_t flush_timer = NULL;
+#endif
+
+#if CONFIG_ESP_COMMAND_CHANNEL
+// Commands passed from the command channel task to the uplink task
+static QueueHandle_t command_queue = NULL;
+
+// Command statistics, dropped is written by the command channel task only
+static volatile uint32_t commands_dropped = 0;
+static uint32_t commands_applied = 0;
+static uint32_t commands_rejected = 0;
+static uint64_t command_latency_total_ms = 0;
+static uint32_t command_latency_max_ms = 0;
+
+static void log_commands(void);
+#endif
+
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+// Extended advertising reports being reassembled, used by the Bluedroid task only
+static struct ExtAdvAssembler ext_adv_assembler;
+#endif
+
+// Time scanning was enabled, updated from GAP events
+static portMUX_TYPE duty_mux = portMUX_INITIALIZER_UNLOCKED;
+static int64_t scan_started_us = 0;
+static int64_t first_scan_us = 0;
+static int64_t scan_enabled_us = 0;
+
+// Enabled time at the start of the current inquiry window
+static int64_t window_started_us = 0;
+static int64_t window_enabled_us = 0;
+
+// Radio time of all windows so far, and devices found at the start of the current window
+static int64_t listening_total_us = 0;
+static uint32_t window_devices = 0;
+
+// Scannable advertisements received while scanning actively, each one answered by a SCAN_REQ
+// from the controller. Written by the Bluedroid task only.
+static volatile uint32_t scan_requests = 0;
+static uint32_t window_scan_requests = 0;
+
+#if CONFIG_ESP_SCAN_SCHEDULER
+// Scan parameters of the next window, used by the uplink task only
+static struct ScanScheduler scan_scheduler;
+static uint32_t window_dropped = 0;
+#endif
+
+// Address of each open connection, GATT events after ESP_GATTC_OPEN_EVT only carry conn_id
+struct Connection {
+    bool used;
+    uint16_t conn_id;
+    esp_bd_addr_t bda;
+#if CONFIG_ESP_GATT_READ_VALUES
+    struct GattReadPlan plan;   // Values read once the services are found
+#endif
+};
+
+static struct Connection connections[MAX_CONNECTIONS];
 
-int connected_device_index = -1;
-int devices_count = 0;
+#if CONFIG_ESP_GATT_READ_VALUES
+_Static_assert(GATT_READER_MAX_BATCH <= ESP_GATT_MAX_READ_MULTI_HANDLES, "Read Multiple batch size");
 
-static bool connected_to_device = false;
-bool connected_to_wifi = false;
-static bool is_discovering = false;
+// Characteristics whose values are read, from CONFIG_ESP_GATT_READ_UUIDS
+static uint16_t read_uuids[GATT_READER_MAX_UUIDS];
+static int read_uuids_count = 0;
 
-char* device_to_discover = "";
+// Value reads of closed connections. Written by the Bluedroid task only.
+static volatile uint32_t read_connections = 0;
+static volatile uint32_t read_requests = 0;
+static volatile uint32_t read_values = 0;
+static volatile uint32_t read_retries = 0;
+#endif
 
 static void handle_gap_events(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *gap_cb_param);
 static void handle_gatt_events(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_interface_type, esp_ble_gattc_cb_param_t *gattc_cb_param);
 
-static esp_gattc_cb_t gattc_cb = handle_gatt_events;
-static uint16_t global_gattc_interface_type = ESP_GATT_IF_NONE;
-
-// HELPER FUNCTIONS ---------------------------------------------------------------------------
+// SCAN DUTY CYCLE --------------------------------------------------------------------------------
 
-// Convert UUID to String
-static char *get_str_from_uuid(esp_bt_uuid_t uuid, char *str, size_t size) {
+// Scan was enabled by the controller
+static void duty_scan_started(void) {
+    int64_t now_us = esp_timer_get_time();
 
-    if (uuid.len == 2 && size >= 5) {
-        sprintf(str, "%04x", uuid.uuid.uuid16);
-    } else if (uuid.len == 4 && size >= 9) {
-        sprintf(str, "%08x", uuid.uuid.uuid32);
-    } else if (uuid.len == 16 && size >= 37) {
-        uint8_t *p = uuid.uuid.uuid128;
-        sprintf(str, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
-                p[15], p[14], p[13], p[12], p[11], p[10], p[9], p[8],
-                p[7], p[6], p[5], p[4], p[3], p[2], p[1], p[0]);
-    } else {
-        return NULL;
+    portENTER_CRITICAL(&duty_mux);
+    if (scan_started_us == 0) {
+        scan_started_us = now_us;
     }
-
-    return str;
-}
-
-// Extract String Address 
-static void *get_string_from_raw_addr(esp_bd_addr_t peripheral_addr, char *str){
-    if (peripheral_addr != NULL) {
-        sprintf(str, "%02x:%02x:%02x:%02x:%02x:%02x", peripheral_addr[0], peripheral_addr[1], peripheral_addr[2], peripheral_addr[3], peripheral_addr[4], peripheral_addr[5]);
+    if (first_scan_us == 0) {
+        first_scan_us = now_us;
     }
-    return;
-}
-
-char* concat(const char *str1, const char *str2) {
-    char *str3 = malloc(strlen(str1) + strlen(str2) + 1);
-    strcpy(str3, str1);
-    strcat(str3, str2);
-    return str3;
+    portEXIT_CRITICAL(&duty_mux);
 }
 
-// ------------------------------------------------------------------------------------------------
-
-// HTTP -------------------------------------------------------------------------------------------
-
-// Handling HTTP Events
-esp_err_t handle_http_events(esp_http_client_event_t *http_event) {
-    switch(http_event->event_id) {
-        case HTTP_EVENT_ON_CONNECTED:
-            break;
-        case HTTP_EVENT_ON_FINISH:
-            break;
-
-        // If data was received
-        case HTTP_EVENT_ON_DATA:
-            if (!esp_http_client_is_chunked_response(http_event->client)) {
-                device_to_discover = strdup((char*)http_event->data);
-                device_to_discover[http_event->data_len] = '\0';
-                is_discovering = true;
+// Scan completed or was stopped
+static void duty_scan_stopped(void) {
+    int64_t now_us = esp_timer_get_time();
 
-                ESP_LOGE(HTTP_PRINT, "Got discovery request for device: %s", device_to_discover);
-            }
-            break;
-        case HTTP_EVENT_HEADER_SENT:
-            break;
-        case HTTP_EVENT_ON_HEADER:
-            break;
-        case HTTP_EVENT_ERROR:
-            break;
-        case HTTP_EVENT_DISCONNECTED:
-            break;
+    portENTER_CRITICAL(&duty_mux);
+    if (scan_started_us != 0) {
+        scan_enabled_us += now_us - scan_started_us;
+        scan_started_us = 0;
     }
-    return ESP_OK;
+    portEXIT_CRITICAL(&duty_mux);
 }
 
-// Send data to server
-static void send_http_request_with_url(int device_index) {
+// Log share of time the scan was enabled and the radio was listening, for the last window and since the first
+// scan, and what the radio time brought. Returns radio time of the last window in milliseconds.
+static uint32_t log_duty_cycle(void) {
+    int64_t now_us = esp_timer_get_time();
+    int64_t enabled_us;
+    int64_t since_us;
 
-    char *server_addr = SERVER_ADDR;
+    portENTER_CRITICAL(&duty_mux);
+    enabled_us = scan_enabled_us + (scan_started_us != 0 ? now_us - scan_started_us : 0);
+    since_us = first_scan_us;
+    portEXIT_CRITICAL(&duty_mux);
 
-    char *http_str = "http://";
-    http_str = concat(http_str, server_addr);
-    http_str = concat(http_str, "/RESTServerScanner-1.0-SNAPSHOT/api/scanner?address=");
+    if (since_us == 0 || now_us <= since_us) {
+        return 0;
+    }
 
-    http_str = concat(http_str, devices[device_index].address);
+    if (window_started_us == 0) {
+        window_started_us = since_us;
+    }
 
-    char device_name[50];
+    // Permille of wall time, radio listens scan_window out of every scan_interval of the window
+    int64_t window_listening_us = (enabled_us - window_enabled_us) * scanning_parameters.scan_window / scanning_parameters.scan_interval;
+    int window_enabled = (now_us > window_started_us) ? (int) ((enabled_us - window_enabled_us) * 1000 / (now_us - window_started_us)) : 0;
+    int total_enabled = (int) (enabled_us * 1000 / (now_us - since_us));
+    int window_listening = (now_us > window_started_us) ? (int) (window_listening_us * 1000 / (now_us - window_started_us)) : 0;
 
-    char *services = "";
-    char *chars = "";
+    listening_total_us += window_listening_us;
+    int total_listening = (int) (listening_total_us * 1000 / (now_us - since_us));
 
-    int offset = 0;
-    int index = 0;
+    ESP_LOGI(DEBUG_PRINT, "Scan duty cycle: window %d.%d%% enabled, %d.%d%% listening; total %d.%d%% enabled, %d.%d%% listening",
+             window_enabled / 10, window_enabled % 10, window_listening / 10, window_listening % 10,
+             total_enabled / 10, total_enabled % 10, total_listening / 10, total_listening % 10);
 
-    // Adding device name to http string
-    if (devices[device_index].name != NULL) {
+    // Devices per second of radio time in hundredths
+    uint32_t requests = scan_requests;
+    uint32_t window_rate = window_listening_us > 0 ? (uint32_t) ((report_counters.devices - window_devices) * 100000000LL / window_listening_us) : 0;
+    uint32_t total_rate = listening_total_us > 0 ? (uint32_t) (report_counters.devices * 100000000LL / listening_total_us) : 0;
 
-        http_str = concat(http_str, "&device=");
+    ESP_LOGI(DEBUG_PRINT, "Scan yield: window %u devices, %u.%02u per radio second, %u scan requests; total %u devices in %u radio seconds, "
+             "%u.%02u per radio second, %u scan requests", (unsigned) (report_counters.devices - window_devices),
+             (unsigned) (window_rate / 100), (unsigned) (window_rate % 100), (unsigned) (requests - window_scan_requests),
+             (unsigned) report_counters.devices, (unsigned) (listening_total_us / 1000000), (unsigned) (total_rate / 100),
+             (unsigned) (total_rate % 100), (unsigned) requests);
 
-        // Filtering http string
-        for(index = 0; devices[device_index].name[index] != '\0'; index++) {
-            if(devices[device_index].name[index] == ' ') {
-                device_name[index+offset] = '%';
-                device_name[index+offset+1] = '2';
-                device_name[index+offset+2] = '0';
-                offset += 2;
-            } else if(devices[device_index].name[index] == '+') {
-                device_name[index+offset] = '%';
-                device_name[index+offset+1] = '2';
-                device_name[index+offset+2] = 'B';
-                offset += 2;
-            } else {
-                device_name[index+offset] = devices[device_index].name[index];
-            }
-        }
+    window_started_us = now_us;
+    window_enabled_us = enabled_us;
+    window_devices = report_counters.devices;
+    window_scan_requests = requests;
 
-        device_name[index+offset] = '\0';
-        http_str = concat(http_str, device_name);
-    }
-
-    // Adding services to http string
-    if ((strcmp((char*)devices[device_index].address, device_to_discover) == 0)  
-                && devices[device_index].services_count > 0) {
-        device_to_discover = "\0";
-        is_discovering = false;
-        services = concat(services, "&services=");
-                    
-        for (int i = 0; i < devices[device_index].services_count; i++) {
-            services = concat(services, devices[device_index].services[i]);
-                if (i != devices[device_index].services_count - 1) {
-                    services = concat(services, ",");
-                }
-        }
+    return (uint32_t) (window_listening_us / 1000);
+}
 
-        // Adding characteristics to http string
-        if (devices[device_index].chars_count > 0) {
-            chars = concat(chars, "&chars=");
-            chars = concat(chars, devices[device_index].chars[0]);
-            for (int i = 0; i < devices[device_index].chars_count; i++) {
-                chars = concat(chars, devices[device_index].chars[i]);
-                if  (i != devices[device_index].chars_count - 1) {
-                    chars = concat(chars, ",");
-                }
+// Scannable advertisement of a legacy or extended report heard while scanning actively
+static void count_scan_request(bool scannable) {
+    if (scannable && scanning_parameters.scan_type == BLE_SCAN_TYPE_ACTIVE) {
+        scan_requests++;
+    }
+}
 
-            }
+// New scan parameters take effect once scanning is restarted from ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT
+static void apply_scan_parameters(uint16_t interval, uint16_t window, bool active) {
+    ESP_LOGI(DEBUG_PRINT, "Scan parameters: interval %u, window %u, %s", interval, window, active ? "active" : "passive");
 
-        }
+    scanning_parameters.scan_interval = interval;
+    scanning_parameters.scan_window = window;
+    scanning_parameters.scan_type = active ? BLE_SCAN_TYPE_ACTIVE : BLE_SCAN_TYPE_PASSIVE;
 
-        http_str = concat(http_str, chars);
-        http_str = concat(http_str, services);
-    }
+    hal_gap_stop_scanning();
+    hal_esp_set_scan_params(&scanning_parameters);
+}
 
-    // Adding RSSI value to http string
-    http_str = concat(http_str, "&rssi=");
+#if CONFIG_ESP_SCAN_SCHEDULER
 
-    char num_str[5];
-    itoa(devices[device_index].rssi, num_str, 10);
-    http_str = concat(http_str, num_str);
+// Choosing scan parameters of the next window from what the last one brought
+static void schedule_scan(uint32_t listening_ms) {
+    struct ScanActivity activity;
+    uint32_t dropped = atomic_load(&observation_ring.dropped);
 
-    ESP_LOGE(HTTP_PRINT, "SENDING DATA TO SERVER");
+    scanner_core_scan_activity(scanning_parameters.scan_type == BLE_SCAN_TYPE_ACTIVE, &activity);
 
-    esp_http_client_config_t http_client_config = {
-        .url = http_str,
-        .event_handler = handle_http_events,
-        .buffer_size = 1024,
-        .buffer_size_tx = 1024,
+    struct ScanWindowStats stats = {
+        .listening_ms = listening_ms,
+        .advertisements = activity.advertisements,
+        .new_devices = activity.new_devices,
+        .unnamed = activity.unnamed,
+        .discoveries = activity.discoveries,
+        .queued = obs_ring_depth(&observation_ring),
+        .dropped = dropped - window_dropped,
+        .stored = activity.stored,
     };
-    esp_http_client_handle_t http_client_handle = esp_http_client_init(&http_client_config);
+    window_dropped = dropped;
 
-    // Sending data
-    esp_err_t err = esp_http_client_perform(http_client_handle);
+    const struct ScanSettings *settings = &scan_scheduler.settings;
+    const struct ScanSchedulerCounters *counters = &scan_scheduler.counters;
 
-    esp_http_client_cleanup(http_client_handle);
+    if (scan_scheduler_update(&scan_scheduler, &stats)) {
+        apply_scan_parameters(settings->interval, settings->window, settings->active);
+    }
 
+    ESP_LOGI(DEBUG_PRINT, "Scan scheduler: %u advertisements/s, %u new, %u unnamed, %u to discover, %u queued, %u stored; "
+             "next %u.%u%% %s%s (%u raised, %u lowered, %u shed)", (unsigned) scan_scheduler.rate, (unsigned) stats.new_devices,
+             (unsigned) stats.unnamed, (unsigned) stats.discoveries, (unsigned) stats.queued, (unsigned) stats.stored,
+             scan_scheduler_duty(settings) / 10, scan_scheduler_duty(settings) % 10, settings->active ? "active" : "passive",
+             scan_scheduler.pinned ? " (set by server)" : "", (unsigned) counters->raised, (unsigned) counters->lowered,
+             (unsigned) counters->shed);
 }
 
-// END HTTP ---------------------------------------------------------------------------------------
-
-// WIFI -------------------------------------------------------------------------------------------
-
-// Handling WiFi events
-static void got_wifi_event(void* arg, esp_event_base_t wifi_event, int32_t wifi_event_num, void* wifi_raw_event) {
-
-    // If WiFi scanning started or disconnected from Access Point
-    if (wifi_event == WIFI_EVENT && (wifi_event_num == WIFI_EVENT_STA_START || WIFI_EVENT_STA_DISCONNECTED)) {
-        ESP_LOGE(WIFI_DEBUG_PRINT, "Trying to connect to Wifi");
-
-        connected_to_wifi = false;
-
-        ESP_ERROR_CHECK(esp_wifi_connect());
+#endif
 
-    // If connected
-    } else if (wifi_event == IP_EVENT && wifi_event_num == IP_EVENT_STA_GOT_IP) {
+// UPLINK TASK ------------------------------------------------------------------------------------
 
-        // Getting IP
-        ip_event_got_ip_t* ip_event = (ip_event_got_ip_t*) wifi_raw_event;
-        ESP_LOGE(WIFI_DEBUG_PRINT, "CONNECTED TO WIFI");
-        ESP_LOGI(WIFI_DEBUG_PRINT, "IP address:" IPSTR, IP2STR(&ip_event->ip_info.ip));
-
-        connected_to_wifi = true;
+#if CONFIG_ESP_METRICS
+// Gauges of the metrics record, taken right before it is sent
+static void update_metrics_gauges(void) {
+    metrics.heap_free = esp_get_free_heap_size();
+    metrics.heap_min_free = esp_get_minimum_free_heap_size();
+    metrics.adv_dropped = atomic_load(&observation_ring.dropped);
+}
+#endif
+
+#if CONFIG_ESP_GATT_READ_VALUES
+// Requests per connection in hundredths, the round trips value reads added to discovery
+static void log_value_reads(void) {
+    uint32_t connections_read = read_connections;
+    uint32_t per_connection = connections_read > 0 ? read_requests * 100 / connections_read : 0;
+
+    ESP_LOGI(DEBUG_PRINT, "GATT values: %u read in %u requests (%u read again) over %u connections, "
+             "%u.%02u requests per connection", (unsigned) read_values, (unsigned) read_requests,
+             (unsigned) read_retries, (unsigned) connections_read, (unsigned) (per_connection / 100),
+             (unsigned) (per_connection % 100));
+}
+#endif
+
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+// Counters are written by the Bluedroid task, a torn read only skews one log line
+static void log_ext_adv(void) {
+    const struct ExtAdvCounters *counters = &ext_adv_assembler.counters;
+
+    ESP_LOGI(DEBUG_PRINT, "Extended advertising: %u fragments, %u reports (%u reassembled, %u truncated), "
+             "%u evicted, %u expired, longest %u bytes",
+             (unsigned) counters->fragments, (unsigned) counters->reports, (unsigned) counters->reassembled,
+             (unsigned) counters->truncated, (unsigned) counters->evicted, (unsigned) counters->expired,
+             (unsigned) counters->max_len);
+}
+#endif
+
+// Handling one observation on the uplink task
+static void handle_observation(struct Observation *obs) {
+#if CONFIG_ESP_TRACE_CAPTURE
+    trace_capture_record(obs);
+#endif
+#if CONFIG_ESP_METRICS
+    if (obs->kind == OBS_WINDOW_END) {
+        update_metrics_gauges();
+    }
+#endif
+    scanner_core_process(obs);
+
+    if (obs->kind == OBS_WINDOW_END) {
+        ESP_LOGI(DEBUG_PRINT, "Observations: %u pushed, %u dropped, %u overflows, %u high water",
+                 (unsigned) atomic_load(&observation_ring.pushed), (unsigned) atomic_load(&observation_ring.dropped),
+                 (unsigned) atomic_load(&observation_ring.overflows), (unsigned) atomic_load(&observation_ring.high_water));
+        uint32_t listening_ms = log_duty_cycle();
+#if CONFIG_ESP_SCAN_SCHEDULER
+        schedule_scan(listening_ms);
+#else
+        (void) listening_ms;
+#endif
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+        log_ext_adv();
+#endif
+#if CONFIG_ESP_GATT_READ_VALUES
+        log_value_reads();
+#endif
+#if CONFIG_ESP_COMMAND_CHANNEL
+        log_commands();
+#endif
     }
 }
 
-void connect_to_wifi(void) {
-    // Initialize the underlying TCP/IP stack
-    ESP_ERROR_CHECK(esp_netif_init());
+#if CONFIG_ESP_CONTINUOUS_SCAN || CONFIG_ESP_COMMAND_CHANNEL
+// Reporting the window while the scan keeps running
+static void end_window(void) {
+    struct Observation window_end = {
+        .kind = OBS_WINDOW_END,
+        .timestamp_ms = (uint32_t) (esp_timer_get_time() / 1000),
+    };
+    handle_observation(&window_end);
 
-    // Initializing default WiFi event loop
-    ESP_ERROR_CHECK(esp_event_loop_create_default());
+#if CONFIG_ESP_DELTA_REPORTING && CONFIG_ESP_CONTINUOUS_SCAN
+    // Duplicate filter is not reset by a scan restart anymore
+    esp_ble_scan_dupilcate_list_flush();
+#endif
+}
+#endif
+
+#if CONFIG_ESP_COMMAND_CHANNEL
+
+// Applying command on the uplink task, the command channel acknowledges it to the server
+static void apply_command(const struct Command *command) {
+    bool applied = true;
+
+    switch (command->kind) {
+    case COMMAND_DISCOVER:
+#if CONFIG_ESP_RPA_RESOLUTION
+    case COMMAND_IRK:
+#endif
+#if CONFIG_ESP_ADDR_FILTER
+    case COMMAND_FILTER:
+#endif
+        applied = scanner_core_command(command);
+        break;
 
-    // Creating WiFi station
-    esp_netif_create_default_wifi_sta();
+#if CONFIG_ESP_METRICS
+    case COMMAND_METRICS:
+        update_metrics_gauges();
+        applied = scanner_core_command(command);
+        break;
+#endif
+
+    // Server takes over from the scan scheduler, scanning actively as before it existed
+    case COMMAND_SCAN_PARAMS:
+#if CONFIG_ESP_SCAN_SCHEDULER
+        scan_scheduler_pin(&scan_scheduler, command->scan.interval, command->scan.window);
+#endif
+        apply_scan_parameters(command->scan.interval, command->scan.window, true);
+        break;
 
-    // Initializing WiFi configuration options
-    wifi_init_config_t wifi_init_config = WIFI_INIT_CONFIG_DEFAULT();
+    // Window ends now, the next one gets a full period
+    case COMMAND_FLUSH:
+        end_window();
+#if CONFIG_ESP_CONTINUOUS_SCAN
+        esp_timer_stop(flush_timer);
+        esp_timer_start_periodic(flush_timer, SCANNING_DURATION * 1000000ULL);
+#endif
+        break;
 
-    // Initializing WiFi allocate resource for WiFi driver
-    ESP_ERROR_CHECK(esp_wifi_init(&wifi_init_config));
+    default:
+        applied = false;
+        break;
+    }
 
-    esp_event_handler_instance_t id_event_instance;
-    esp_event_handler_instance_t ip_event_instance;
+    if (applied) {
+        uint32_t latency = (uint32_t) (esp_timer_get_time() / 1000) - command->received_ms;
 
-    // Setting callbacks for WiFi events
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &got_wifi_event, NULL, &id_event_instance));
-    ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_wifi_event, NULL, &ip_event_instance));
+        commands_applied++;
+        command_latency_total_ms += latency;
+        if (latency > command_latency_max_ms) {
+            command_latency_max_ms = latency;
+        }
+    } else {
+        commands_rejected++;
+    }
 
+    hal_esp_command_done(command, applied);
+}
 
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = NAME_WIFI,
-            .password = PASSWORD_WIFI,
-	        .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+static void log_commands(void) {
+    ESP_LOGI(DEBUG_PRINT, "Commands: %u applied, %u rejected, %u dropped, latency %u ms avg %u ms max",
+             (unsigned) commands_applied, (unsigned) commands_rejected, (unsigned) commands_dropped,
+             commands_applied > 0 ? (unsigned) (command_latency_total_ms / commands_applied) : 0,
+             (unsigned) command_latency_max_ms);
+}
 
-            .pmf_cfg = {
-                .capable = true,
-                .required = false
-            },
-        },
-    };
+// Queueing command received by the command channel task, never blocks
+static void queue_command(const struct Command *command) {
+    if (xQueueSend(command_queue, command, 0) != pdTRUE) {
+        commands_dropped++;
+        hal_esp_command_done(command, false);
+        return;
+    }
 
-    // Setting operating mode to station
-    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    xTaskNotify(uplink_task_handle, UPLINK_NOTIFY_COMMAND, eSetBits);
+}
 
-    // Setting configuration of the station
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+#endif
 
-    // Starting WiFi
-    ESP_ERROR_CHECK(esp_wifi_start());
-}
+// Uplink task, drains observations into the scanner core
+static void uplink_task(void *arg) {
+    struct Observation obs;
 
-// ------------------------------------------------------------------------------------------------
+    while (true) {
+        uint32_t notified = 0;
 
-// Print found devices
-static void show_found_devices() {
-    for(int i = 0; i < devices_count; i++) {
+        // Woken up by the first record pushed into an empty ring, by the flush timer or by a command
+        xTaskNotifyWait(0, UINT32_MAX, &notified, pdMS_TO_TICKS(UPLINK_POLL_MS));
 
-        if (devices[i].in_range == true) {
+        while (obs_ring_pop(&observation_ring, &obs)) {
+            handle_observation(&obs);
+        }
 
-            // If connected, send information about device to server
-            if (connected_to_wifi == true) {
-                send_http_request_with_url(i);
-            }
+        // Stored batches start draining within one poll period of getting an IP address
+        scanner_core_poll((uint32_t) (esp_timer_get_time() / 1000));
 
-            if (devices[i].name != NULL) {
-            ESP_LOGI("FOUND DEVICE", "(%s, %s, %d)", devices[i].address, devices[i].name, devices[i].rssi);
-            } else {
-                ESP_LOGI("FOUND DEVICE", "(%s, %d)", devices[i].address, devices[i].rssi);
-            }
+#if CONFIG_ESP_CONTINUOUS_SCAN
+        if (notified & UPLINK_NOTIFY_WINDOW) {
+            end_window();
+        }
+#endif
+
+#if CONFIG_ESP_COMMAND_CHANNEL
+        struct Command command;
 
-            devices[i].in_range = false;
+        while (xQueueReceive(command_queue, &command, 0) == pdTRUE) {
+            apply_command(&command);
         }
+#endif
     }
 }
 
-// Adding new device to device structure
-static int add_device(esp_ble_gap_cb_param_t *gap_cb_param) {
-    struct Device new_device;
-
-    uint8_t *peripheral_name = NULL;
-    uint8_t peripheral_name_length = 0;
-    
-    // Getting device name
-    peripheral_name = esp_ble_resolve_adv_data(gap_cb_param->scan_rst.ble_adv, ESP_BLE_AD_TYPE_NAME_CMPL, &peripheral_name_length);
-
-    if (peripheral_name != NULL) {
-        snprintf(new_device.name, (int) peripheral_name_length+1, "%s", (char *) peripheral_name);
-        //strcpy(new_device.name, device_name);
-    } else {
-        //char null_str[50] = "null";
-        strcpy(new_device.name, "-");
+#if CONFIG_ESP_CONTINUOUS_SCAN
+// Periodic inquiry window cut, runs on the esp_timer task
+static void flush_timer_callback(void *arg) {
+    if (uplink_task_handle != NULL) {
+        xTaskNotify(uplink_task_handle, UPLINK_NOTIFY_WINDOW, eSetBits);
     }
+}
+#endif
 
-    get_string_from_raw_addr(gap_cb_param->scan_rst.bda, new_device.address);
-
-    new_device.rssi = gap_cb_param->scan_rst.rssi;
+// Queueing observation from a Bluetooth callback, never blocks
+static void push_observation(struct Observation *obs) {
+    bool was_empty = false;
 
-    new_device.services_count = 0;
-    new_device.chars_count = 0;
-    new_device.in_range = true;
+    obs->timestamp_ms = (uint32_t) (esp_timer_get_time() / 1000);
 
-    if (devices_count >= 10) {
-        printf("Connected device: %d", connected_device_index);
-        memset(devices, 0, sizeof(devices));
-        devices_count = 0;
+    if (obs_ring_push(&observation_ring, obs, &was_empty) && was_empty && uplink_task_handle != NULL) {
+        xTaskNotify(uplink_task_handle, UPLINK_NOTIFY_RING, eSetBits);
     }
+}
 
-    devices[devices_count] = new_device;
+// Queueing connection event of given device
+static void push_connection_observation(uint8_t kind, const uint8_t *bda) {
+    struct Observation obs = { .kind = kind };
 
-    return devices_count++;
+    memcpy(obs.bda, bda, sizeof(obs.bda));
+    push_observation(&obs);
 }
 
-// Update name and RSSI value of the known device
-static void update_device_info(int device_index, esp_ble_gap_cb_param_t *gap_cb_param) {
-    devices[device_index].rssi = gap_cb_param->scan_rst.rssi;
-    devices[device_index].in_range = true;
+// Queueing discovered service or characteristic, UUID is stored as little endian bytes
+static void push_uuid_observation(uint8_t kind, const uint8_t *bda, esp_bt_uuid_t uuid) {
+    struct Observation obs = { .kind = kind, .adv_len = uuid.len };
 
-    if (strcmp((char *)devices[device_index].name, "-") == 0) {
+    memcpy(obs.bda, bda, sizeof(obs.bda));
 
-        uint8_t *peripheral_name = NULL;
-        uint8_t peripheral_name_length = 0;
-        
-        peripheral_name = esp_ble_resolve_adv_data(gap_cb_param->scan_rst.ble_adv, ESP_BLE_AD_TYPE_NAME_CMPL, &peripheral_name_length);
-
-        if (peripheral_name != NULL) {
-            snprintf(devices[device_index].name, (int) peripheral_name_length+1, "%s", (char *) peripheral_name);
-            //strcpy(new_device.name, device_name);
-        } else {
-            //char null_str[50] = "null";
-            strcpy(devices[device_index].name, "-");
+    if (uuid.len == ESP_UUID_LEN_16) {
+        obs.data[0] = uuid.uuid.uuid16 & 0xff;
+        obs.data[1] = uuid.uuid.uuid16 >> 8;
+    } else if (uuid.len == ESP_UUID_LEN_32) {
+        for (int i = 0; i < 4; i++) {
+            obs.data[i] = (uuid.uuid.uuid32 >> (8 * i)) & 0xff;
         }
-
+    } else if (uuid.len == ESP_UUID_LEN_128) {
+        memcpy(obs.data, uuid.uuid.uuid128, ESP_UUID_LEN_128);
+    } else {
+        return;
     }
 
+    push_observation(&obs);
 }
 
-// Start services and characteristics extraction
-static void discover_device(int current_device, esp_ble_gap_cb_param_t *gap_cb_param) {
-    if (connected_to_device == false) {
-        connected_to_device = true;
-        connected_device_index = current_device;
-        esp_ble_gap_stop_scanning();
+// ------------------------------------------------------------------------------------------------
 
-        ESP_LOGI(DEBUG_PRINT, "Trying to connect to peripheral");
+// Connection with given id, NULL when unknown
+static struct Connection *find_connection(uint16_t conn_id) {
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (connections[i].used && connections[i].conn_id == conn_id) {
+            return &connections[i];
+        }
+    }
+    return NULL;
+}
 
-        // Connecting to device
-        esp_ble_gattc_open(global_gattc_interface_type, gap_cb_param->scan_rst.bda, gap_cb_param->scan_rst.ble_addr_type, true);
+static void add_connection(uint16_t conn_id, const uint8_t *bda) {
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        if (!connections[i].used) {
+            connections[i].used = true;
+            connections[i].conn_id = conn_id;
+            memcpy(connections[i].bda, bda, sizeof(esp_bd_addr_t));
+#if CONFIG_ESP_GATT_READ_VALUES
+            gatt_reader_init(&connections[i].plan);
+#endif
+            return;
+        }
     }
 }
 
@@ -431,9 +576,13 @@ static void discover_device(int current_device, esp_ble_gap_cb_param_t *gap_cb_p
 static void discover_characteristics(esp_ble_gattc_cb_param_t *gattc_cb_parameters, esp_gatt_if_t gattc_interface_type) {
 
     esp_gattc_char_elem_t *characteristic_element = NULL;
+    struct Connection *connection = find_connection(gattc_cb_parameters->search_res.conn_id);
+
+    if (connection == NULL) {
+        return;
+    }
 
-    char uuid_str[UUID_LENGTH];
-    get_str_from_uuid(gattc_cb_parameters->search_res.srvc_id.uuid, devices[connected_device_index].services[devices[connected_device_index].services_count++], UUID_LENGTH);
+    push_uuid_observation(OBS_SERVICE, connection->bda, gattc_cb_parameters->search_res.srvc_id.uuid);
 
     uint16_t found_chars = 0;
 
@@ -453,8 +602,17 @@ static void discover_characteristics(esp_ble_gattc_cb_param_t *gattc_cb_paramete
             if (found_chars > 0) {
                 for (int i = 0; i < found_chars; i++) {
 
-                    char char_uuid_str[UUID_LENGTH];
-                    get_str_from_uuid(characteristic_element[i].uuid, devices[connected_device_index].chars[devices[connected_device_index].chars_count++], UUID_LENGTH);
+                    push_uuid_observation(OBS_CHAR, connection->bda, characteristic_element[i].uuid);
+
+#if CONFIG_ESP_GATT_READ_VALUES
+                    // Planning value read of wanted readable characteristic
+                    if ((characteristic_element[i].properties & ESP_GATT_CHAR_PROP_BIT_READ)
+                            && characteristic_element[i].uuid.len == ESP_UUID_LEN_16
+                            && gatt_reader_wanted(read_uuids, read_uuids_count, characteristic_element[i].uuid.uuid.uuid16)) {
+                        gatt_reader_add(&connection->plan, characteristic_element[i].char_handle,
+                                        characteristic_element[i].uuid.uuid.uuid16);
+                    }
+#endif
 
                     ESP_LOGI(DEBUG_PRINT, "Characteristic UUID: %x", characteristic_element[i].uuid.uuid.uuid16);
                 }
@@ -469,6 +627,66 @@ static void discover_characteristics(esp_ble_gattc_cb_param_t *gattc_cb_paramete
 
 }
 
+#if CONFIG_ESP_GATT_READ_VALUES
+
+// Queueing characteristic value, values longer than an observation are cut
+static void push_value_observation(uint16_t uuid16, const uint8_t *value, size_t len, void *arg) {
+    const struct Connection *connection = arg;
+    struct Observation obs = { .kind = OBS_VALUE, .adv_len = len < OBS_DATA_LEN - 2 ? len : OBS_DATA_LEN - 2 };
+
+    memcpy(obs.bda, connection->bda, sizeof(obs.bda));
+    obs.data[0] = uuid16 & 0xff;
+    obs.data[1] = uuid16 >> 8;
+    memcpy(obs.data + 2, value, obs.adv_len);
+
+    push_observation(&obs);
+}
+
+// Sending next value read of the connection, closing it once every value was read
+static void read_next_values(esp_gatt_if_t gattc_interface_type, struct Connection *connection) {
+    esp_gattc_multi_t read_multi;
+    int count = gatt_reader_next(&connection->plan, read_multi.handles);
+    esp_err_t err;
+
+    if (count == 0) {
+        esp_ble_gattc_close(gattc_interface_type, connection->conn_id);
+        return;
+    }
+
+    if (count == 1) {
+        err = esp_ble_gattc_read_char(gattc_interface_type, connection->conn_id, read_multi.handles[0], ESP_GATT_AUTH_REQ_NONE);
+    } else {
+        read_multi.num_attr = count;
+        err = esp_ble_gattc_read_multiple(gattc_interface_type, connection->conn_id, &read_multi, ESP_GATT_AUTH_REQ_NONE);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(DEBUG_PRINT, "Reading values failed: %d", err);
+        esp_ble_gattc_close(gattc_interface_type, connection->conn_id);
+    }
+}
+
+// Answer of a single or Read Multiple request
+static void handle_read(esp_gatt_if_t gattc_interface_type, esp_ble_gattc_cb_param_t *gattc_cb_param) {
+    struct Connection *connection = find_connection(gattc_cb_param->read.conn_id);
+
+    if (connection == NULL) {
+        return;
+    }
+
+    if (gattc_cb_param->read.status == ESP_GATT_OK) {
+        gatt_reader_complete(&connection->plan, gattc_cb_param->read.value, gattc_cb_param->read.value_len,
+                             push_value_observation, connection);
+    } else {
+        ESP_LOGW(DEBUG_PRINT, "Value read failed: %d", gattc_cb_param->read.status);
+        gatt_reader_failed(&connection->plan);
+    }
+
+    read_next_values(gattc_interface_type, connection);
+}
+
+#endif
+
 // Handling GATT events
 static void handle_gatt_events(esp_gattc_cb_event_t gattc_cb_event, esp_gatt_if_t gattc_interface_type, esp_ble_gattc_cb_param_t *gattc_cb_param){
 
@@ -479,10 +697,10 @@ static void handle_gatt_events(esp_gattc_cb_event_t gattc_cb_event, esp_gatt_if_
     // When GATT client is registered
     case ESP_GATTC_REG_EVT:
         if (gattc_cb_param->reg.status == ESP_GATT_OK) {
-            global_gattc_interface_type = gattc_interface_type;
+            hal_esp_set_gattc_if(gattc_interface_type);
         }
         // Setting scanning parameters
-        esp_ble_gap_set_scan_params(&scanning_parameters);
+        hal_esp_set_scan_params(&scanning_parameters);
         break;
 
     // Opening event
@@ -490,13 +708,39 @@ static void handle_gatt_events(esp_gattc_cb_event_t gattc_cb_event, esp_gatt_if_
         // If open failed
         if (gattc_cb_param->open.status != ESP_GATT_OK){
             ESP_LOGE(DEBUG_PRINT, "Failed to open device: %d", gattc_cb_parameters->open.status);
-            strcpy(devices[connected_device_index].services[devices[connected_device_index].services_count++], "-");
-            strcpy(devices[connected_device_index].chars[devices[connected_device_index].chars_count++], "-");
+            push_connection_observation(OBS_OPEN_FAILED, gattc_cb_param->open.remote_bda);
             break;
         }
         // if success
         ESP_LOGI(DEBUG_PRINT, "Successfully open device");
+        add_connection(gattc_cb_param->open.conn_id, gattc_cb_param->open.remote_bda);
+        push_connection_observation(OBS_CONNECTED, gattc_cb_param->open.remote_bda);
+
+#if CONFIG_ESP_GATT_READ_VALUES
+        // Larger MTU for the value reads, exchanged while services are discovered
+        if (CONFIG_ESP_GATT_MTU > GATT_READER_DEFAULT_MTU) {
+            esp_ble_gattc_send_mtu_req(gattc_interface_type, gattc_cb_param->open.conn_id);
+        }
+#endif
+        break;
+
+#if CONFIG_ESP_GATT_READ_VALUES
+    // MTU exchange completed
+    case ESP_GATTC_CFG_MTU_EVT: {
+        struct Connection *connection = find_connection(gattc_cb_param->cfg_mtu.conn_id);
+
+        if (connection != NULL && gattc_cb_param->cfg_mtu.status == ESP_GATT_OK) {
+            gatt_reader_set_mtu(&connection->plan, gattc_cb_param->cfg_mtu.mtu);
+        }
+        break;
+    }
+
+    // Value read
+    case ESP_GATTC_READ_CHAR_EVT:
+    case ESP_GATTC_READ_MULTIPLE_EVT:
+        handle_read(gattc_interface_type, gattc_cb_param);
         break;
+#endif
 
     // Servies discovering completed
     case ESP_GATTC_DIS_SRVC_CMPL_EVT:
@@ -506,71 +750,154 @@ static void handle_gatt_events(esp_gattc_cb_event_t gattc_cb_event, esp_gatt_if_
             break;
         }
         // Geting services from local cache
-        esp_ble_gattc_search_service(gattc_interface_type, gattc_cb_param->cfg_mtu.conn_id, NULL);
+        esp_ble_gattc_search_service(gattc_interface_type, gattc_cb_param->dis_srvc_cmpl.conn_id, NULL);
         break;
 
-    // Disconnected from device
-    case ESP_GATTC_DISCONNECT_EVT:
-        connected_to_device = false;
-        connected_device_index = -1;
-        esp_ble_gap_start_scanning(SCANNING_DURATION);
+    // Disconnected from device, scanning was never stopped for it
+    case ESP_GATTC_DISCONNECT_EVT: {
+        struct Connection *connection = find_connection(gattc_cb_param->disconnect.conn_id);
+
+        if (connection != NULL) {
+#if CONFIG_ESP_GATT_READ_VALUES
+            read_connections++;
+            read_requests += connection->plan.requests;
+            read_values += connection->plan.values;
+            read_retries += connection->plan.retries;
+#endif
+            connection->used = false;
+        }
+        push_connection_observation(OBS_DISCONNECTED, gattc_cb_param->disconnect.remote_bda);
         break;
+    }
 
     // Found service
     case ESP_GATTC_SEARCH_RES_EVT: {
         ESP_LOGI(DEBUG_PRINT, "Service found");
 
-        char uuid_str[UUID_LENGTH];
-        esp_bt_uuid_t u = gattc_cb_parameters->search_res.srvc_id.uuid;
-        ESP_LOGI(DEBUG_PRINT, "UUID: %s", get_str_from_uuid(u, uuid_str, UUID_LENGTH));
-
         discover_characteristics(gattc_cb_parameters, gattc_interface_type);
         break;
     }
+    // Attribute table of the device changed, cached discovery results are stale
+    case ESP_GATTC_SRVC_CHG_EVT:
+        push_connection_observation(OBS_SERVICE_CHANGED, gattc_cb_param->srvc_chg.remote_bda);
+        break;
+
     // Services searching completed
-    case ESP_GATTC_SEARCH_CMPL_EVT:
+    case ESP_GATTC_SEARCH_CMPL_EVT: {
         ESP_LOGE(DEBUG_PRINT, "Services discovery complete");
 
+#if CONFIG_ESP_GATT_READ_VALUES
+        // Reading values before disconnecting
+        struct Connection *connection = find_connection(gattc_cb_parameters->search_cmpl.conn_id);
+
+        if (connection != NULL) {
+            read_next_values(gattc_interface_type, connection);
+            break;
+        }
+#endif
+
         // Disconnecting from device
-        esp_ble_gattc_close(gattc_interface_type, gattc_cb_parameters->search_res.conn_id);
-         break;
+        esp_ble_gattc_close(gattc_interface_type, gattc_cb_parameters->search_cmpl.conn_id);
+        break;
+    }
     default:
         break;
     }
 }
 
 
+// Inquiry completed, reporting is left to the uplink task
+static void scan_completed(void) {
+    duty_scan_stopped();
+
+    struct Observation obs = { .kind = OBS_WINDOW_END };
+    push_observation(&obs);
+
+    ESP_LOGI(DEBUG_PRINT, "Restarting scanning ------------------------------------------------");
+    hal_gap_start_scanning(SCAN_DURATION);
+}
+
+static void scan_started(esp_bt_status_t status) {
+    // If failed
+    if (status != ESP_BT_STATUS_SUCCESS) {
+        ESP_LOGE(DEBUG_PRINT, "Failed to start scanning: %x", status);
+        hal_gap_start_scanning(SCAN_DURATION);
+        return;
+    }
+    ESP_LOGI(DEBUG_PRINT, "Scanning started");
+    duty_scan_started();
+}
+
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+// Fragment of an extended (or legacy) advertising report, completed reports are queued like legacy ones
+static void handle_ext_adv_report(const esp_ble_gap_ext_adv_reprot_t *report) {
+    struct ExtAdvData data;
+
+    // Fragments of one advertisement share its event type, it is counted with the last one
+    count_scan_request((report->event_type & ESP_BLE_ADV_REPORT_EXT_SCAN_IND) != 0
+                       && (report->event_type & ESP_BLE_ADV_REPORT_EXT_SCAN_RSP) == 0
+                       && report->data_status != EXT_ADV_DATA_INCOMPLETE);
+
+    if (!ext_adv_add(&ext_adv_assembler, report->addr, report->addr_type, report->sid, report->data_status,
+                     report->adv_data, report->adv_data_len, (uint32_t) (esp_timer_get_time() / 1000), &data)) {
+        return;
+    }
+
+    // Scan responses come as reports of their own, the core merges them into the device
+    struct Observation obs = {
+        .kind = OBS_ADV,
+        .addr_type = report->addr_type,
+        .rssi = report->rssi,
+    };
+    memcpy(obs.bda, report->addr, sizeof(obs.bda));
+    obs.adv_len = ext_adv_compact(data.data, data.len, obs.data, sizeof(obs.data));
+    push_observation(&obs);
+}
+#endif
+
 // Handling GAP events
 static void handle_gap_events(esp_gap_ble_cb_event_t gap_cb_event, esp_ble_gap_cb_param_t *gattc_cb_param)
 {
-    uint8_t *peripheral_name = NULL;
-    uint8_t peripheral_name_length = 0;
-    char peripheral_address[18];
-
     switch (gap_cb_event) {
 
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    // Extended scanner events, advertising reports may be fragmented
+    case ESP_GAP_BLE_SET_EXT_SCAN_PARAMS_COMPLETE_EVT:
+        hal_gap_start_scanning(SCAN_DURATION);
+        break;
+
+    case ESP_GAP_BLE_EXT_SCAN_START_COMPLETE_EVT:
+        scan_started(gattc_cb_param->ext_scan_start.status);
+        break;
+
+    case ESP_GAP_BLE_EXT_SCAN_STOP_COMPLETE_EVT:
+        ESP_LOGI(DEBUG_PRINT, "Scanning stopped");
+        duty_scan_stopped();
+        break;
+
+    case ESP_GAP_BLE_EXT_ADV_REPORT_EVT:
+        handle_ext_adv_report(&gattc_cb_param->ext_adv_report.params);
+        break;
+
+    case ESP_GAP_BLE_SCAN_TIMEOUT_EVT:
+        scan_completed();
+        break;
+#else
     // Scanning parameters set
     case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT: {
-        esp_ble_gap_start_scanning(SCANNING_DURATION);
+        hal_gap_start_scanning(SCAN_DURATION);
         break;
     }
 
     // Scanning started
     case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
-
-        // If failed
-        if (gattc_cb_param->scan_start_cmpl.status != ESP_BT_STATUS_SUCCESS) {
-            ESP_LOGE(DEBUG_PRINT, "Failed to start scanning: %x", gattc_cb_param->scan_start_cmpl.status);
-            esp_ble_gap_start_scanning(SCANNING_DURATION);
-            break;
-        }
-        ESP_LOGI(DEBUG_PRINT, "Scanning started");
-
+        scan_started(gattc_cb_param->scan_start_cmpl.status);
         break;
 
     // Scanning stopped
     case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
         ESP_LOGI(DEBUG_PRINT, "Scanning stopped");
+        duty_scan_stopped();
         break;
 
     // Got scanning result
@@ -580,55 +907,60 @@ static void handle_gap_events(esp_gap_ble_cb_event_t gap_cb_event, esp_ble_gap_c
         switch (gap_cb_param->scan_rst.search_evt) {
 
         // Got inquiry result for device
-        case ESP_GAP_SEARCH_INQ_RES_EVT:
-            peripheral_name = esp_ble_resolve_adv_data(gap_cb_param->scan_rst.ble_adv, ESP_BLE_AD_TYPE_NAME_CMPL, &peripheral_name_length);
-            get_string_from_raw_addr(gap_cb_param->scan_rst.bda, peripheral_address);
-
-            int current_device = -1;
-            bool new_device_found = false;
-
-            char device_name[50];
-
-            if (peripheral_address != NULL) {
-                for(int i = 0; i < devices_count; i++) {
-                    if (strcmp((char *)devices[i].address, peripheral_address) == 0) {
-                        new_device_found = true;
-                        current_device = i;
-
-                        update_device_info(i, gap_cb_param);
-                        break;
-                    }
-                }
-
-                if (new_device_found == false && strcmp(device_to_discover, "") == 0) {
-                    current_device = add_device(gap_cb_param);
-                }
-            }
-
-            // Start device discovering
-            if (is_discovering == true && strcmp((char*)devices[current_device].address, device_to_discover) == 0) {
-                is_discovering = false;
-                ESP_LOGI(DEBUG_PRINT, "Searched device %s\n", peripheral_address);
-                discover_device(current_device, gap_cb_param);
-            }
+        case ESP_GAP_SEARCH_INQ_RES_EVT: {
+            count_scan_request(gap_cb_param->scan_rst.ble_evt_type == ESP_BLE_EVT_CONN_ADV
+                               || gap_cb_param->scan_rst.ble_evt_type == ESP_BLE_EVT_DISC_ADV);
+
+            struct Observation obs = {
+                .kind = OBS_ADV,
+                .addr_type = gap_cb_param->scan_rst.ble_addr_type,
+                .rssi = gap_cb_param->scan_rst.rssi,
+                .adv_len = gap_cb_param->scan_rst.adv_data_len,
+                .scan_rsp_len = gap_cb_param->scan_rst.scan_rsp_len,
+            };
+            memcpy(obs.bda, gap_cb_param->scan_rst.bda, sizeof(obs.bda));
+            memcpy(obs.data, gap_cb_param->scan_rst.ble_adv, obs.adv_len + obs.scan_rsp_len);
+            push_observation(&obs);
             break;
+        }
 
         // Inquiry completed
         case ESP_GAP_SEARCH_INQ_CMPL_EVT:
-            show_found_devices();
-            ESP_LOGI(DEBUG_PRINT, "Restarting scanning ------------------------------------------------");
-            esp_ble_gap_start_scanning(SCANNING_DURATION);
+            scan_completed();
             break;
+
         default:
             break;
         }
         break;
     }
+#endif
     default:
         break;
     }
 }
 
+#if CONFIG_ESP_METRICS
+// Timed entry points registered with Bluedroid, the handlers are inlined into them
+static void timed_gap_events(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param) {
+    METRICS_START_CYCLES(started);
+    handle_gap_events(event, param);
+    METRICS_STOP_CYCLES(METRIC_GAP_EVENT, started);
+}
+
+static void timed_gatt_events(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param) {
+    METRICS_START_CYCLES(started);
+    handle_gatt_events(event, gattc_if, param);
+    METRICS_STOP_CYCLES(METRIC_GATT_EVENT, started);
+}
+
+#define GAP_CALLBACK timed_gap_events
+#define GATT_CALLBACK timed_gatt_events
+#else
+#define GAP_CALLBACK handle_gap_events
+#define GATT_CALLBACK handle_gatt_events
+#endif
+
 void app_main(void) {
 
     // ESP_ERROR_CHECK checks outcome of a function,
@@ -637,6 +969,39 @@ void app_main(void) {
     // Flash initialization
     ESP_ERROR_CHECK(nvs_flash_init());
 
+    scanner_core_init();
+    obs_ring_init(&observation_ring);
+#if CONFIG_ESP_SCAN_SCHEDULER
+    scan_scheduler_init(&scan_scheduler);
+    scanning_parameters.scan_interval = scan_scheduler.settings.interval;
+    scanning_parameters.scan_window = scan_scheduler.settings.window;
+    scanning_parameters.scan_type = scan_scheduler.settings.active ? BLE_SCAN_TYPE_ACTIVE : BLE_SCAN_TYPE_PASSIVE;
+#endif
+#if CONFIG_BT_BLE_50_FEATURES_SUPPORTED
+    ext_adv_init(&ext_adv_assembler);
+#endif
+
+#if CONFIG_ESP_COMMAND_CHANNEL
+    command_queue = xQueueCreate(COMMAND_QUEUE_SIZE, sizeof(struct Command));
+#endif
+
+#if CONFIG_ESP_TRACE_CAPTURE
+    trace_capture_init();
+#endif
+
+    // Starting uplink task before Bluetooth callbacks can produce observations
+    xTaskCreatePinnedToCore(uplink_task, "uplink", UPLINK_TASK_STACK_SIZE, NULL, UPLINK_TASK_PRIORITY, &uplink_task_handle, UPLINK_TASK_CORE);
+
+#if CONFIG_ESP_CONTINUOUS_SCAN
+    // Cutting inquiry windows of the never ending scan
+    esp_timer_create_args_t flush_timer_args = {
+        .callback = flush_timer_callback,
+        .name = "window_flush",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&flush_timer_args, &flush_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(flush_timer, SCANNING_DURATION * 1000000ULL));
+#endif
+
     // Releasing controller memory
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 
@@ -653,9 +1018,17 @@ void app_main(void) {
     // Enabling Bluetooth
     esp_bluedroid_enable();
 
+#if CONFIG_ESP_GATT_READ_VALUES
+    // MTU offered in exchanges, the peer may settle for less
+    read_uuids_count = gatt_reader_parse_uuids(CONFIG_ESP_GATT_READ_UUIDS, read_uuids, GATT_READER_MAX_UUIDS);
+    if (CONFIG_ESP_GATT_MTU > GATT_READER_DEFAULT_MTU) {
+        esp_ble_gatt_set_local_mtu(CONFIG_ESP_GATT_MTU);
+    }
+#endif
+
     // Setting GAP and GATT callbacks
-    esp_ble_gap_register_callback(handle_gap_events);
-    esp_ble_gattc_register_callback(handle_gatt_events);
+    esp_ble_gap_register_callback(GAP_CALLBACK);
+    esp_ble_gattc_register_callback(GATT_CALLBACK);
 
     esp_ble_gattc_app_register(0);
 
@@ -663,4 +1036,9 @@ void app_main(void) {
 
     // Connect to WiFi
     connect_to_wifi();
+
+#if CONFIG_ESP_COMMAND_CHANNEL
+    // Long-polling the server for commands once WiFi is up
+    hal_esp_start_command_channel(queue_command);
+#endif
 }
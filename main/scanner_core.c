@@ -0,0 +1,1552 @@
+#include "scanner_core.h"
+#include "scanner_hal.h"
+#include "device_table.h"
+#include "request_encoder.h"
+#include "adv_parser.h"
+#include "adv_decoder.h"
+#include "discovery_queue.h"
+#include "gatt_cache.h"
+#include "wire_encoder.h"
+#include "metrics.h"
+#include "spool.h"
+#include "rpa.h"
+#include "addr_filter.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DEBUG_PRINT "SCANNER_PRINT"
+#define HTTP_PRINT "HTTP"
+
+#define URL_BUFFER_SIZE 2048
+
+#define DEVICE_MAX_AGE_MS (CONFIG_ESP_DEVICE_MAX_AGE * 1000)
+
+#define DISCOVERY_TIMEOUT_MS (CONFIG_ESP_DISCOVERY_TIMEOUT * 1000)
+#define DISCOVERY_QUEUE_TIMEOUT_MS (CONFIG_ESP_DISCOVERY_QUEUE_TIMEOUT * 1000)
+
+// Connections in flight, bounded by what the controller supports
+#if defined(CONFIG_BTDM_CTRL_BLE_MAX_CONN) && CONFIG_BTDM_CTRL_BLE_MAX_CONN < CONFIG_ESP_DISCOVERY_MAX_CONNECTIONS
+#define DISCOVERY_MAX_CONNECTIONS CONFIG_BTDM_CTRL_BLE_MAX_CONN
+#else
+#define DISCOVERY_MAX_CONNECTIONS CONFIG_ESP_DISCOVERY_MAX_CONNECTIONS
+#endif
+
+#if CONFIG_ESP_SPOOL
+// Drain may run ahead of its rate by one full record
+#define SPOOL_DRAIN_BURST SPOOL_RECORD_MAX
+#endif
+
+#if CONFIG_ESP_DELTA_REPORTING
+#define DELTA_LOST_TIMEOUT_MS (CONFIG_ESP_DELTA_LOST_TIMEOUT * 1000)
+#define DELTA_SNAPSHOT_INTERVAL_MS (CONFIG_ESP_DELTA_SNAPSHOT_INTERVAL * 1000)
+
+// Reported devices evicted from the full table and waiting for their lost report,
+// report indices past the device table refer to them
+#define EVICTED_MAX 8
+#define REPORT_SLOTS (DEVICE_TABLE_CAPACITY + EVICTED_MAX)
+#else
+#define REPORT_SLOTS DEVICE_TABLE_CAPACITY
+#endif
+
+// VARIABLES -----------------------------------------------------
+
+// Address being received in an HTTP response, which may arrive in several chunks
+static char response_address[18];
+static int response_address_length = 0;
+
+struct ReportCounters report_counters;
+
+// URL of a single device request, also used to send stored batches line by line
+static char url_buffer[URL_BUFFER_SIZE];
+
+#if CONFIG_ESP_DELTA_REPORTING
+static uint32_t last_snapshot_ms = 0;
+static bool snapshot_done = false;
+
+static struct Device evicted_devices[EVICTED_MAX];
+static int evicted_count = 0;
+
+// Lost reports of evicted devices queued since the last window end
+static uint32_t evicted_lost = 0;
+#endif
+
+#if CONFIG_ESP_METRICS
+static void send_metrics(uint32_t now_ms);
+#endif
+
+#if CONFIG_ESP_SCAN_SCHEDULER
+// Advertisements and new devices since the last scanner_core_scan_activity call
+static struct ScanActivity scan_activity;
+static uint32_t scan_activity_since_ms = 0;
+#endif
+
+#if CONFIG_ESP_ADDR_FILTER
+// Allow or deny list, edited by commands and written back to flash at the end of the window
+static uint64_t filter_keys[ADDR_FILTER_MAX_ENTRIES];
+static uint64_t filter_bloom[ADDR_FILTER_BLOOM_WORDS(ADDR_FILTER_MAX_ENTRIES)];
+static struct AddrFilter addr_filter;
+static bool addr_filter_dirty = false;
+#endif
+
+// HELPER FUNCTIONS ---------------------------------------------------------------------------
+
+// Extract String Address
+static void get_string_from_raw_addr(const uint8_t *peripheral_addr, char *str){
+    if (peripheral_addr != NULL) {
+        sprintf(str, "%02x:%02x:%02x:%02x:%02x:%02x", peripheral_addr[0], peripheral_addr[1], peripheral_addr[2], peripheral_addr[3], peripheral_addr[4], peripheral_addr[5]);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+// HTTP -------------------------------------------------------------------------------------------
+
+// Parse "xx:xx:xx:xx:xx:xx"
+static bool parse_address(const char *str, uint8_t *bda) {
+    for (int i = 0; i < 6; i++) {
+        unsigned value;
+
+        if (sscanf(str + i * 3, "%2x", &value) != 1 || (i < 5 && str[i * 3 + 2] != ':')) {
+            return false;
+        }
+        bda[i] = value;
+    }
+
+    return true;
+}
+
+// Server answered with addresses of devices to discover, separated by anything that is not part of an address
+void scanner_core_on_http_data(const char *data, int len) {
+    for (int i = 0; i < len; i++) {
+        char c = data[i];
+        bool address_char = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F') || c == ':';
+
+        if (!address_char) {
+            response_address_length = 0;
+            continue;
+        }
+
+        response_address[response_address_length++] = c;
+
+        if (response_address_length == sizeof(response_address) - 1) {
+            uint8_t bda[6];
+
+            response_address[response_address_length] = '\0';
+            response_address_length = 0;
+
+            if (parse_address(response_address, bda)) {
+                if (discovery_queue_add(bda, hal_now_ms())) {
+                    SCANNER_LOGE(HTTP_PRINT, "Got discovery request for device: %s", response_address);
+                } else {
+                    SCANNER_LOGE(HTTP_PRINT, "Discovery queue full, dropping %s", response_address);
+                }
+            }
+        }
+    }
+}
+
+#if CONFIG_ESP_ADDR_FILTER
+static bool apply_filter_command(const struct Command *command) {
+    bool applied = true;
+
+    switch (command->filter.op) {
+    case COMMAND_FILTER_MODE:
+        addr_filter.mode = command->filter.mode;
+        break;
+
+    case COMMAND_FILTER_ADD:
+        for (int i = 0; i < command->filter.count; i++) {
+            applied &= addr_filter_add(&addr_filter, command->filter.keys[i]);
+        }
+        break;
+
+    case COMMAND_FILTER_REMOVE:
+        for (int i = 0; i < command->filter.count; i++) {
+            applied &= addr_filter_remove(&addr_filter, command->filter.keys[i]);
+        }
+        break;
+
+    case COMMAND_FILTER_CLEAR:
+        addr_filter_clear(&addr_filter);
+        break;
+
+    default:
+        return false;
+    }
+
+    addr_filter_dirty = true;
+    SCANNER_LOGI(HTTP_PRINT, "Address filter %s with %d entries", addr_filter.mode == ADDR_FILTER_ALLOW ? "allows"
+                 : addr_filter.mode == ADDR_FILTER_DENY ? "denies" : "off", addr_filter.count);
+    return applied;
+}
+#endif
+
+bool scanner_core_command(const struct Command *command) {
+    char address[18];
+
+#if CONFIG_ESP_METRICS
+    if (command->kind == COMMAND_METRICS) {
+        send_metrics(hal_now_ms());
+        return true;
+    }
+#endif
+
+#if CONFIG_ESP_RPA_RESOLUTION
+    if (command->kind == COMMAND_IRK) {
+        get_string_from_raw_addr(command->identity.bda, address);
+
+        if (!rpa_add_identity(&command->identity)) {
+            SCANNER_LOGE(HTTP_PRINT, "No room for identity resolving key of %s", address);
+            return false;
+        }
+
+        SCANNER_LOGI(HTTP_PRINT, "Got identity resolving key for %s", address);
+        return true;
+    }
+#endif
+
+#if CONFIG_ESP_ADDR_FILTER
+    if (command->kind == COMMAND_FILTER) {
+        return apply_filter_command(command);
+    }
+#endif
+
+    if (command->kind != COMMAND_DISCOVER) {
+        return false;
+    }
+
+    get_string_from_raw_addr(command->bda, address);
+
+    if (!discovery_queue_add(command->bda, hal_now_ms())) {
+        SCANNER_LOGE(HTTP_PRINT, "Discovery queue full, dropping command for %s", address);
+        return false;
+    }
+
+    SCANNER_LOGI(HTTP_PRINT, "Got discovery command for device: %s", address);
+    return true;
+}
+
+// Whether device has discovery results waiting to be reported
+static bool is_discovery_report(int device_index) {
+    struct DiscoveryTarget *target = discovery_queue_find_device(device_index);
+
+    return target != NULL && target->state == DISCOVERY_DONE;
+}
+
+// Discovery results were queued for the server, a connection still in progress is left alone
+static void finish_discovery_report(int device_index) {
+    struct DiscoveryTarget *target = discovery_queue_find_device(device_index);
+
+    if (target != NULL && target->state == DISCOVERY_DONE) {
+        device_table_pin(device_index, false);
+        discovery_queue_release(target);
+    }
+}
+
+// Append comma separated list of the device UUIDs with given role, "-" marks a failed discovery
+static void append_uuid_list(struct RequestEncoder *encoder, const char *key, const struct Device *device, uint8_t role) {
+    struct UuidListIterator it;
+    char str[UUID_STRING_LENGTH];
+    bool first = true;
+
+    request_encoder_append(encoder, key);
+
+    for (const struct Uuid *uuid = uuid_list_first(&device->uuids, &it); uuid != NULL; uuid = uuid_list_next(&it)) {
+        if (uuid->role != role) {
+            continue;
+        }
+        if (!first) {
+            request_encoder_append_char(encoder, ',');
+        }
+        uuid_format(uuid, str);
+        request_encoder_append_encoded(encoder, str);
+        first = false;
+    }
+
+    if (device->discovery_failed) {
+        request_encoder_append(encoder, first ? "-" : ",-");
+    }
+}
+
+#if CONFIG_ESP_GATT_READ_VALUES
+
+// Append comma separated "uuid:hex" list of the values read during discovery
+static void append_values(struct RequestEncoder *encoder, const struct DiscoveryTarget *target) {
+    static const char hex[] = "0123456789abcdef";
+    char uuid[5];
+
+    request_encoder_append(encoder, "&values=");
+
+    for (int pos = 0; pos < target->values_len; pos += 3 + target->values[pos + 2]) {
+        const uint8_t *value = target->values + pos;
+
+        if (pos > 0) {
+            request_encoder_append_char(encoder, ',');
+        }
+        snprintf(uuid, sizeof(uuid), "%02x%02x", value[1], value[0]);
+        request_encoder_append(encoder, uuid);
+        request_encoder_append_char(encoder, ':');
+
+        for (int i = 0; i < value[2]; i++) {
+            request_encoder_append_char(encoder, hex[value[3 + i] >> 4]);
+            request_encoder_append_char(encoder, hex[value[3 + i] & 0x0f]);
+        }
+    }
+}
+
+#endif
+
+// Device of a report index, an evicted device past the table
+static struct Device *report_device_at(int device_index) {
+#if CONFIG_ESP_DELTA_REPORTING
+    if (device_index >= DEVICE_TABLE_CAPACITY) {
+        return &evicted_devices[device_index - DEVICE_TABLE_CAPACITY];
+    }
+#endif
+    return &devices[device_index];
+}
+
+// Build query string describing a device (without leading '?')
+void build_device_query(struct RequestEncoder *encoder, int device_index, bool with_discovery, bool lost) {
+    struct Device *device = report_device_at(device_index);
+
+    request_encoder_append(encoder, "address=");
+    request_encoder_append_encoded(encoder, device->address);
+
+    // Adding device name
+    request_encoder_append(encoder, "&device=");
+    request_encoder_append_encoded(encoder, device->name);
+
+#if CONFIG_ESP_ADV_DECODERS
+    // Adding recognised beacon or manufacturer frame
+    if (device->beacon_kind != ADV_KIND_NONE && !lost) {
+        char beacon[ADV_DECODED_STRING_MAX];
+
+        adv_decoded_format(device->beacon_kind, device->beacon_subtype, device->beacon, device->beacon_len,
+                           beacon, sizeof(beacon));
+        request_encoder_append(encoder, "&beacon=");
+        request_encoder_append_encoded(encoder, beacon);
+    }
+#endif
+
+    // Adding characteristics and services
+    if (with_discovery) {
+        if (device->chars_count > 0 || device->discovery_failed) {
+            append_uuid_list(encoder, "&chars=", device, UUID_ROLE_CHAR);
+        }
+        append_uuid_list(encoder, "&services=", device, UUID_ROLE_SERVICE);
+
+#if CONFIG_ESP_GATT_READ_VALUES
+        const struct DiscoveryTarget *target = discovery_queue_find_device(device_index);
+
+        if (target != NULL && target->values_len > 0) {
+            append_values(encoder, target);
+        }
+#endif
+    }
+
+    // Adding RSSI value
+    request_encoder_append(encoder, "&rssi=");
+    request_encoder_append_int(encoder, device->rssi);
+
+    // Device left range
+    if (lost) {
+        request_encoder_append(encoder, "&lost=1");
+    }
+}
+
+// Server does not know the endpoint or the format
+static bool is_rejected(int status) {
+    return status == 404 || status == 405 || status == 415 || status == 501;
+}
+
+// Send data to server
+static void send_http_request_with_url(int device_index, bool lost) {
+    struct RequestEncoder encoder;
+    bool with_discovery = !lost && is_discovery_report(device_index);
+
+    request_encoder_init(&encoder, url_buffer, sizeof(url_buffer));
+    request_encoder_append(&encoder, SERVER_URL "?");
+    build_device_query(&encoder, device_index, with_discovery, lost);
+
+    if (encoder.truncated) {
+        SCANNER_LOGE(HTTP_PRINT, "Request for %s truncated", report_device_at(device_index)->address);
+        return;
+    }
+
+    if (with_discovery) {
+        finish_discovery_report(device_index);
+    }
+
+    SCANNER_LOGE(HTTP_PRINT, "SENDING DATA TO SERVER");
+
+    // Sending data
+    hal_http_request(url_buffer, NULL, NULL, 0);
+}
+
+#if CONFIG_ESP_UPLINK_BATCH
+
+// Batch of device queries from one inquiry window, one query per line, or the
+// binary encoding of the same devices (wire_format.h)
+static char batch_body[CONFIG_ESP_UPLINK_BATCH_SIZE];
+static struct RequestEncoder batch_encoder = { .data = batch_body, .size = sizeof(batch_body) };
+static int batch_devices[REPORT_SLOTS];
+static bool batch_lost[REPORT_SLOTS];
+static int batch_devices_count = 0;
+
+// Cleared when the server does not accept batches
+static bool batch_supported = true;
+
+#if CONFIG_ESP_UPLINK_BINARY
+static struct WireEncoder wire_encoder;
+
+// Cleared when the server does not accept the binary format, text batches are sent then
+static bool binary_supported = true;
+#endif
+
+#if CONFIG_ESP_SPOOL
+// Token bucket of the spool drain in bytes, goes negative after a large record
+static int32_t drain_tokens = 0;
+static uint32_t drain_polled_ms = 0;
+
+// Server could not be reached or failed, as opposed to rejecting the request
+static bool is_failed(int status) {
+    return status < 0 || status >= 500;
+}
+#endif
+
+static void reset_batch(void) {
+    size_t size = sizeof(batch_body);
+
+#if CONFIG_ESP_SPOOL
+    // Any batch may end up in the spool, it must fit into one record
+    if (spool_available() && size > SPOOL_RECORD_MAX) {
+        size = SPOOL_RECORD_MAX;
+    }
+#endif
+
+    batch_encoder.size = size;
+    request_encoder_rewind(&batch_encoder, 0);
+#if CONFIG_ESP_UPLINK_BINARY
+    wire_encoder_init(&wire_encoder, (uint8_t *) batch_body, size);
+#endif
+    batch_devices_count = 0;
+}
+
+#if CONFIG_ESP_SPOOL
+
+// Keep the batch in flash until the server can be reached again
+static void store_batch(void) {
+    uint8_t kind = SPOOL_KIND_TEXT;
+    size_t length = batch_encoder.length;
+
+#if CONFIG_ESP_UPLINK_BINARY
+    if (binary_supported) {
+        kind = SPOOL_KIND_BINARY;
+        length = wire_encoder.length;
+    }
+#endif
+
+    if (spool_append(kind, batch_body, length, hal_now_ms())) {
+        SCANNER_LOGE(HTTP_PRINT, "STORED BATCH OF %d DEVICES (%d BYTES), %u WAITING",
+                     batch_devices_count, (int) length, (unsigned) spool_pending());
+    } else {
+        SCANNER_LOGE(HTTP_PRINT, "Cannot store batch of %d devices (%d bytes), dropping it", batch_devices_count, (int) length);
+    }
+}
+
+#endif
+
+// Send whole batch in a single POST, falling back to per device GET for old servers
+static void send_http_batch(void) {
+    bool send_single = !batch_supported;
+
+    if (batch_devices_count == 0) {
+        return;
+    }
+
+#if CONFIG_ESP_SPOOL
+    // Sent later by scanner_core_poll
+    if (!hal_wifi_connected()) {
+        store_batch();
+        send_single = false;
+    } else
+#endif
+#if CONFIG_ESP_UPLINK_BINARY
+    if (binary_supported) {
+        SCANNER_LOGE(HTTP_PRINT, "SENDING BINARY BATCH OF %d DEVICES (%d BYTES) TO SERVER",
+                     batch_devices_count, (int) wire_encoder.length);
+
+        int status = hal_http_request(SERVER_URL, WIRE_CONTENT_TYPE, batch_body, wire_encoder.length);
+
+        // Text query strings of this batch would not fit into the buffer, it goes out device by device
+        if (is_rejected(status)) {
+            SCANNER_LOGE(HTTP_PRINT, "Server rejected binary batch (%d), falling back to text batches", status);
+            binary_supported = false;
+            send_single = true;
+        }
+#if CONFIG_ESP_SPOOL
+        else if (is_failed(status)) {
+            store_batch();
+        }
+#endif
+    } else
+#endif
+    if (batch_supported) {
+        SCANNER_LOGE(HTTP_PRINT, "SENDING BATCH OF %d DEVICES TO SERVER", batch_devices_count);
+
+        // Sending data
+        int status = hal_http_request(SERVER_URL, "text/plain", batch_body, batch_encoder.length);
+
+        // Server does not know the batch endpoint
+        if (is_rejected(status)) {
+            SCANNER_LOGE(HTTP_PRINT, "Server rejected batch (%d), falling back to per device requests", status);
+            batch_supported = false;
+            send_single = true;
+        }
+#if CONFIG_ESP_SPOOL
+        else if (is_failed(status)) {
+            store_batch();
+        }
+#endif
+    }
+
+    if (send_single) {
+        for (int i = 0; i < batch_devices_count; i++) {
+            send_http_request_with_url(batch_devices[i], batch_lost[i]);
+        }
+    }
+
+    // Discovery results are released only once sent, so the fallback requests still carry them
+    for (int i = 0; i < batch_devices_count; i++) {
+        if (!batch_lost[i]) {
+            finish_discovery_report(batch_devices[i]);
+        }
+    }
+
+    reset_batch();
+}
+
+#if CONFIG_ESP_UPLINK_BINARY
+
+// Binary counterpart of add_device_to_batch
+static bool add_device_to_binary_batch(int device_index, bool with_discovery, bool lost) {
+    const struct Device *device = report_device_at(device_index);
+    const uint8_t *values = NULL;
+    size_t values_len = 0;
+
+#if CONFIG_ESP_GATT_READ_VALUES
+    const struct DiscoveryTarget *target = with_discovery ? discovery_queue_find_device(device_index) : NULL;
+
+    if (target != NULL) {
+        values = target->values;
+        values_len = target->values_len;
+    }
+#endif
+
+    if (!wire_encoder_add_device(&wire_encoder, device, values, values_len, with_discovery, lost)) {
+        send_http_batch();
+
+        // Server may have just rejected the binary format
+        if (!binary_supported) {
+            return false;
+        }
+
+        // Device does not fit into a batch at all
+        if (!wire_encoder_add_device(&wire_encoder, device, values, values_len, with_discovery, lost)) {
+            send_http_request_with_url(device_index, lost);
+            return true;
+        }
+    }
+
+    batch_lost[batch_devices_count] = lost;
+    batch_devices[batch_devices_count++] = device_index;
+    return true;
+}
+
+#endif
+
+// Append device to current batch, flushing it first when there is no room left
+static void add_device_to_batch(int device_index, bool lost) {
+    bool with_discovery = !lost && is_discovery_report(device_index);
+    size_t batch_length = batch_encoder.length;
+
+#if CONFIG_ESP_UPLINK_BINARY
+    if (binary_supported && add_device_to_binary_batch(device_index, with_discovery, lost)) {
+        return;
+    }
+#endif
+
+    build_device_query(&batch_encoder, device_index, with_discovery, lost);
+    request_encoder_append_char(&batch_encoder, '\n');
+
+    // No room left, sending current batch and trying again with an empty one
+    if (batch_encoder.truncated) {
+        request_encoder_rewind(&batch_encoder, batch_length);
+        send_http_batch();
+
+        build_device_query(&batch_encoder, device_index, with_discovery, lost);
+        request_encoder_append_char(&batch_encoder, '\n');
+    }
+
+    // Device does not fit into a batch at all
+    if (batch_encoder.truncated) {
+        request_encoder_rewind(&batch_encoder, 0);
+        send_http_request_with_url(device_index, lost);
+        return;
+    }
+
+    batch_lost[batch_devices_count] = lost;
+    batch_devices[batch_devices_count++] = device_index;
+}
+
+#if CONFIG_ESP_SPOOL
+
+// Stored text batch for a server without batch support, one GET per line. Lines
+// sent before a failure are sent again with the retry.
+static int send_stored_lines(size_t length) {
+    size_t start = 0;
+
+    while (start < length) {
+        const char *line = batch_body + start;
+        const char *end = memchr(line, '\n', length - start);
+        size_t line_length = end != NULL ? (size_t) (end - line) : length - start;
+
+        if (line_length > 0) {
+            snprintf(url_buffer, sizeof(url_buffer), SERVER_URL "?%.*s", (int) line_length, line);
+
+            int status = hal_http_request(url_buffer, NULL, NULL, 0);
+
+            if (is_failed(status)) {
+                return status;
+            }
+        }
+        start += line_length + 1;
+    }
+
+    return 200;
+}
+
+// Send stored batch in batch_body, its age lets the server place the observations in time
+static int send_stored_batch(uint8_t kind, size_t length, uint32_t age_ms) {
+    char url[sizeof(SERVER_URL) + 32];
+
+    if (kind == SPOOL_KIND_TEXT && !batch_supported) {
+        return send_stored_lines(length);
+    }
+
+    if (age_ms == SPOOL_AGE_UNKNOWN) {
+        snprintf(url, sizeof(url), SERVER_URL "?spooled=1");
+    } else {
+        snprintf(url, sizeof(url), SERVER_URL "?spooled=1&age_ms=%u", (unsigned) age_ms);
+    }
+
+    int status = hal_http_request(url, kind == SPOOL_KIND_BINARY ? WIRE_CONTENT_TYPE : "text/plain", batch_body, length);
+
+    if (is_rejected(status)) {
+        if (kind == SPOOL_KIND_TEXT) {
+            SCANNER_LOGE(HTTP_PRINT, "Server rejected batch (%d), falling back to per device requests", status);
+            batch_supported = false;
+            return send_stored_lines(length);
+        }
+
+        // Stored binary batches cannot be converted, they are dropped
+#if CONFIG_ESP_UPLINK_BINARY
+        if (binary_supported) {
+            SCANNER_LOGE(HTTP_PRINT, "Server rejected binary batch (%d), falling back to text batches", status);
+            binary_supported = false;
+        }
+#endif
+    }
+
+    return status;
+}
+
+// Drain stored batches oldest first, at most CONFIG_ESP_SPOOL_DRAIN_RATE bytes per second on average
+static void drain_spool(uint32_t now_ms) {
+    uint32_t elapsed_ms = now_ms - drain_polled_ms;
+
+    drain_polled_ms = now_ms;
+
+    if (!hal_wifi_connected() || spool_pending() == 0) {
+        return;
+    }
+
+    spool_counters.drain_ms += elapsed_ms;
+
+    int64_t tokens = drain_tokens + (int64_t) elapsed_ms * CONFIG_ESP_SPOOL_DRAIN_RATE / 1000;
+    drain_tokens = tokens > SPOOL_DRAIN_BURST ? SPOOL_DRAIN_BURST : (int32_t) tokens;
+
+    // Batch buffer is empty between inquiry windows, show_found_devices resets it before use
+    while (drain_tokens > 0) {
+        uint8_t kind;
+        uint32_t age_ms;
+        size_t length = spool_peek(&kind, batch_body, sizeof(batch_body), now_ms, &age_ms);
+
+        if (length == 0) {
+            break;
+        }
+
+        int status = send_stored_batch(kind, length, age_ms);
+
+        // Record stays in the spool, tried again on a later poll
+        if (is_failed(status)) {
+            break;
+        }
+
+        drain_tokens -= length;
+        spool_consume(is_rejected(status));
+    }
+}
+
+static void log_spool_stats(void) {
+    if (spool_counters.appended == 0 && spool_pending() == 0) {
+        return;
+    }
+
+    uint32_t throughput = spool_counters.drain_ms > 0 ? (uint32_t) (spool_counters.drained_bytes * 1000 / spool_counters.drain_ms) : 0;
+
+    // Bytes programmed into flash per byte of batch stored, times 100
+    uint32_t amplification = spool_counters.appended_bytes > 0
+            ? (uint32_t) (spool_counters.flash_written * 100 / spool_counters.appended_bytes) : 0;
+
+    SCANNER_LOGI(HTTP_PRINT, "Spool: %u batches (%u bytes) waiting, %u stored, %u sent, %u dropped, %u errors, "
+                 "drain %u B/s, write amplification %u.%02u, %u of %d sectors erased",
+                 (unsigned) spool_pending(), (unsigned) spool_pending_bytes(), (unsigned) spool_counters.appended,
+                 (unsigned) spool_counters.drained, (unsigned) spool_counters.dropped, (unsigned) spool_counters.errors,
+                 (unsigned) throughput, (unsigned) (amplification / 100), (unsigned) (amplification % 100),
+                 (unsigned) spool_counters.sectors_erased, spool_sectors());
+}
+
+#endif
+
+#endif
+
+#if CONFIG_ESP_METRICS
+
+#define METRICS_URL SERVER_URL "/metrics"
+#define METRICS_RECORD_SIZE (WIRE_HEADER_SIZE + WIRE_ITEM_HEADER_SIZE + WIRE_METRICS_FIXED_SIZE \
+                             + METRIC_STAGES * (WIRE_METRICS_STAGE_SIZE + 4 * METRIC_BUCKETS))
+
+static uint8_t metrics_record[METRICS_RECORD_SIZE];
+
+// Histograms keep changing on other tasks while the record is encoded
+static struct Metrics metrics_snapshot;
+
+// Cleared when the server has no metrics endpoint
+static bool metrics_supported = true;
+static int windows_since_metrics = 0;
+
+// Log metrics and POST them as a binary record, histograms are totals since boot
+static void send_metrics(uint32_t now_ms) {
+    struct WireEncoder encoder;
+
+    metrics_log();
+
+    if (!metrics_supported) {
+        return;
+    }
+
+    metrics_snapshot = metrics;
+    wire_encoder_init(&encoder, metrics_record, sizeof(metrics_record));
+    wire_encoder_add_metrics(&encoder, &metrics_snapshot, now_ms, hal_cycles_per_us());
+
+    int status = hal_http_request(METRICS_URL, WIRE_CONTENT_TYPE, (const char *) metrics_record, encoder.length);
+
+    if (is_rejected(status)) {
+        SCANNER_LOGE(HTTP_PRINT, "Server rejected metrics (%d), keeping them on the console", status);
+        metrics_supported = false;
+    }
+}
+
+#endif
+
+// END HTTP ---------------------------------------------------------------------------------------
+
+// Queue report of one device for the server
+static void report_device(int device_index, bool lost) {
+#if CONFIG_ESP_UPLINK_BATCH
+    add_device_to_batch(device_index, lost);
+#else
+    send_http_request_with_url(device_index, lost);
+#endif
+}
+
+#if CONFIG_ESP_DELTA_REPORTING
+
+// Whether device is new or changed enough since its last report
+static bool needs_report(int device_index, bool snapshot) {
+    struct Device *device = &devices[device_index];
+    int rssi_change = device->rssi - device->reported_rssi;
+
+    return snapshot || !device->reported || device->name_changed
+            || rssi_change >= CONFIG_ESP_DELTA_RSSI_THRESHOLD || rssi_change <= -CONFIG_ESP_DELTA_RSSI_THRESHOLD
+            || device->beacon_changed || is_discovery_report(device_index);
+}
+
+// Queue lost reports of the evicted devices, returns their number
+static uint32_t report_evicted_devices(void) {
+    uint32_t lost = evicted_count;
+
+    for (int i = 0; i < evicted_count; i++) {
+        report_device(DEVICE_TABLE_CAPACITY + i, true);
+
+        SCANNER_LOGI("LOST DEVICE", "(%s, %s, evicted)", evicted_devices[i].address, evicted_devices[i].name);
+    }
+
+    evicted_count = 0;
+    return lost;
+}
+
+#endif
+
+// Devices are reported while WiFi is up, or into the spool while it is down
+static bool can_report(void) {
+#if CONFIG_ESP_SPOOL
+    return hal_wifi_connected() || spool_available();
+#else
+    return hal_wifi_connected();
+#endif
+}
+
+#if CONFIG_ESP_DELTA_REPORTING
+
+// Keep a reported device the full table is about to evict for its lost report at the
+// window end. While nothing can be reported the snapshot after reconnecting covers it.
+static void keep_evicted_device(int device_index) {
+    if (!devices[device_index].reported || !can_report()) {
+        return;
+    }
+
+    // No room left, the kept devices are sent now
+    if (evicted_count == EVICTED_MAX) {
+#if CONFIG_ESP_UPLINK_BATCH
+        reset_batch();
+        evicted_lost += report_evicted_devices();
+        send_http_batch();
+#else
+        evicted_lost += report_evicted_devices();
+#endif
+    }
+
+    struct Device *evicted = &evicted_devices[evicted_count++];
+
+    *evicted = devices[device_index];
+
+    // Services and characteristics go back to the pool with the slot, lost reports do not carry them
+    uuid_list_init(&evicted->uuids);
+}
+
+#endif
+
+// Print found devices
+static void show_found_devices(uint32_t now_ms) {
+    uint32_t sent = 0;
+    uint32_t suppressed = 0;
+    uint32_t lost = 0;
+
+#if CONFIG_ESP_UPLINK_BATCH
+    // Buffer may hold the last record drained from the spool
+    reset_batch();
+#endif
+
+#if CONFIG_ESP_DELTA_REPORTING
+    // Server may have missed reports while WiFi was down
+    if (!can_report()) {
+        snapshot_done = false;
+    }
+
+    // Periodic full snapshot lets the server resynchronise
+    bool snapshot = !snapshot_done || (DELTA_SNAPSHOT_INTERVAL_MS > 0 && now_ms - last_snapshot_ms >= DELTA_SNAPSHOT_INTERVAL_MS);
+
+    if (snapshot && can_report()) {
+        last_snapshot_ms = now_ms;
+        snapshot_done = true;
+    }
+#endif
+
+    for(int i = 0; i < DEVICE_TABLE_CAPACITY; i++) {
+
+        // Devices with discovery results are reported even when they did not advertise while connected
+        if (devices[i].used && (devices[i].in_range == true || is_discovery_report(i))) {
+
+            // If connected, send information about device to server
+            if (can_report()) {
+#if CONFIG_ESP_DELTA_REPORTING
+                if (needs_report(i, snapshot)) {
+                    report_device(i, false);
+                    devices[i].reported = true;
+                    devices[i].reported_rssi = devices[i].rssi;
+                    devices[i].name_changed = false;
+                    devices[i].beacon_changed = false;
+                    sent++;
+                } else {
+                    suppressed++;
+                }
+#else
+                report_device(i, false);
+                sent++;
+#endif
+            }
+
+            SCANNER_LOGI("FOUND DEVICE", "(%s, %s, %d)", devices[i].address, devices[i].name, devices[i].rssi);
+
+            devices[i].in_range = false;
+
+#if CONFIG_ESP_DELTA_REPORTING
+        // Reported device has not been seen for a while
+        } else if (devices[i].used && devices[i].reported && now_ms - devices[i].last_seen >= DELTA_LOST_TIMEOUT_MS
+                && can_report()) {
+            report_device(i, true);
+            devices[i].reported = false;
+            lost++;
+
+            SCANNER_LOGI("LOST DEVICE", "(%s, %s)", devices[i].address, devices[i].name);
+#endif
+        }
+    }
+
+#if CONFIG_ESP_DELTA_REPORTING
+    // Reported devices evicted during the window
+    if (can_report()) {
+        lost += evicted_lost + report_evicted_devices();
+        evicted_lost = 0;
+    }
+#endif
+
+#if CONFIG_ESP_UPLINK_BATCH
+    send_http_batch();
+#endif
+
+    report_counters.sent += sent;
+    report_counters.suppressed += suppressed;
+    report_counters.lost += lost;
+
+    SCANNER_LOGI(HTTP_PRINT, "Window: %u sent, %u suppressed, %u lost (total %u sent, %u suppressed, %u lost)",
+                 (unsigned) sent, (unsigned) suppressed, (unsigned) lost, (unsigned) report_counters.sent,
+                 (unsigned) report_counters.suppressed, (unsigned) report_counters.lost);
+}
+
+// Copy advertised name, a complete name replaces a shortened one
+static void update_device_name(struct Device *device, const struct AdvReport *report) {
+    if (report->name.data != NULL && (!device->name_complete || report->name_complete)) {
+        char name[sizeof(device->name)];
+
+        snprintf(name, sizeof(name), "%.*s", (int) report->name.len, (const char *) report->name.data);
+        if (strcmp(name, device->name) != 0) {
+            strcpy(device->name, name);
+            device->name_changed = true;
+        }
+        device->name_complete = report->name_complete;
+    }
+}
+
+#if CONFIG_ESP_ADV_DECODERS
+
+// Keep the last recognised frame, a new kind or subtype is reported like a name change
+static void update_device_beacon(struct Device *device, const struct AdvReport *report) {
+    struct AdvDecoded decoded;
+
+    if (!adv_decode(report, &decoded)) {
+        return;
+    }
+
+    if (device->beacon_kind == ADV_KIND_NONE) {
+        report_counters.identified++;
+    }
+    if (decoded.kind != device->beacon_kind || decoded.subtype != device->beacon_subtype) {
+        device->beacon_changed = true;
+    }
+
+    device->beacon_kind = decoded.kind;
+    device->beacon_subtype = decoded.subtype;
+    device->beacon_len = decoded.frame.len < ADV_DECODED_MAX ? decoded.frame.len : ADV_DECODED_MAX;
+    memcpy(device->beacon, decoded.frame.data, device->beacon_len);
+}
+
+#endif
+
+// Adding new device to device table
+static int add_device(const struct Observation *obs, const struct AdvReport *report) {
+#if CONFIG_ESP_DELTA_REPORTING
+    int victim = device_table_victim();
+
+    if (victim >= 0) {
+        keep_evicted_device(victim);
+    }
+#endif
+
+    int device_index = device_table_insert(obs->bda, obs->addr_type, obs->timestamp_ms);
+
+    if (device_index < 0) {
+        return -1;
+    }
+
+    struct Device *new_device = &devices[device_index];
+
+    report_counters.devices++;
+#if CONFIG_ESP_SCAN_SCHEDULER
+    scan_activity.new_devices++;
+#endif
+
+    // Getting device name
+    strcpy(new_device->name, "-");
+    update_device_name(new_device, report);
+#if CONFIG_ESP_ADV_DECODERS
+    update_device_beacon(new_device, report);
+#endif
+
+    // Address string is formatted once and reused for every report
+    get_string_from_raw_addr(obs->bda, new_device->address);
+
+    new_device->rssi = obs->rssi;
+    new_device->in_range = true;
+
+    return device_index;
+}
+
+// Update name and RSSI value of the known device
+static void update_device_info(int device_index, const struct Observation *obs, const struct AdvReport *report) {
+    device_table_touch(device_index, obs->timestamp_ms);
+
+    devices[device_index].rssi = obs->rssi;
+    devices[device_index].in_range = true;
+
+    if (!devices[device_index].name_complete) {
+        update_device_name(&devices[device_index], report);
+    }
+#if CONFIG_ESP_ADV_DECODERS
+    update_device_beacon(&devices[device_index], report);
+#endif
+}
+
+// DISCOVERY --------------------------------------------------------------------------------------
+
+// Address a device is reachable under, a resolved identity only under its current private address
+static const uint8_t *connect_address(const struct Device *device, uint8_t *addr_type) {
+#if CONFIG_ESP_RPA_RESOLUTION
+    if (device->addr_type == RPA_ADDR_TYPE_PUBLIC_ID || device->addr_type == RPA_ADDR_TYPE_RANDOM_ID) {
+        *addr_type = RPA_ADDR_TYPE_RANDOM;
+        return device->rpa;
+    }
+#endif
+    *addr_type = device->addr_type;
+    return device->bda;
+}
+
+// Start services and characteristics extraction, scanning goes on meanwhile
+static void discover_device(struct DiscoveryTarget *target, int current_device, uint32_t now_ms) {
+    struct Device *device = &devices[current_device];
+
+    target->state = DISCOVERY_CONNECTING;
+    target->device_index = current_device;
+    target->started_ms = now_ms;
+
+    // Results of an earlier discovery are replaced
+    uuid_list_clear(&device->uuids);
+    device->services_count = 0;
+    device->chars_count = 0;
+    device->discovery_failed = false;
+    device_table_pin(current_device, true);
+
+    SCANNER_LOGI(DEBUG_PRINT, "Trying to connect to peripheral %s", device->address);
+
+    // Connecting to device
+    uint8_t addr_type;
+    const uint8_t *bda = connect_address(device, &addr_type);
+
+    hal_gattc_open(bda, addr_type);
+}
+
+// Connection ended, marking discovery as failed when nothing was read
+static void finish_discovery(struct DiscoveryTarget *target, bool failed, uint32_t now_ms) {
+    struct Device *device = &devices[target->device_index];
+
+    if (device->services_count == 0) {
+        failed = true;
+    }
+
+    device->discovery_failed = failed;
+
+#if CONFIG_ESP_METRICS
+    metrics_add(METRIC_DISCOVERY, (now_ms - target->started_ms) * 1000);
+#endif
+
+#if CONFIG_ESP_GATT_CACHE
+    if (!failed) {
+        gatt_cache_store(target->bda, target->adv_hash, now_ms - target->started_ms, now_ms, device);
+    }
+#endif
+
+    discovery_queue_finish(target, failed, now_ms);
+}
+
+#if CONFIG_ESP_GATT_CACHE
+
+// Answering target from the cache without connecting, the cache is asked only once per target
+static bool discover_from_cache(struct DiscoveryTarget *target, int current_device, uint32_t now_ms) {
+    target->cache_checked = true;
+
+    if (!gatt_cache_lookup(target->bda, target->adv_hash, now_ms, &devices[current_device])) {
+        return false;
+    }
+
+    SCANNER_LOGI(DEBUG_PRINT, "Discovery of %s answered from cache", devices[current_device].address);
+
+    target->device_index = current_device;
+    target->started_ms = now_ms;
+    devices[current_device].discovery_failed = false;
+    device_table_pin(current_device, true);
+    discovery_queue_finish(target, false, now_ms);
+
+    return true;
+}
+
+#endif
+
+// Target connection currently open or being opened
+static struct DiscoveryTarget *find_active_target(const uint8_t *bda) {
+    struct DiscoveryTarget *target = discovery_queue_find(bda);
+
+    if (target != NULL && (target->state == DISCOVERY_CONNECTING || target->state == DISCOVERY_CONNECTED)) {
+        return target;
+    }
+    return NULL;
+}
+
+// Storing discovered service or characteristic of the connected device
+static void add_discovered_uuid(const struct Observation *obs) {
+    struct DiscoveryTarget *target = find_active_target(obs->bda);
+
+    if (target == NULL) {
+        return;
+    }
+
+    struct Device *device = &devices[target->device_index];
+    struct Uuid uuid;
+
+    if (!uuid_from_bytes(obs->data, obs->adv_len, &uuid)) {
+        SCANNER_LOGE(DEBUG_PRINT, "Dropping UUID of %s (length %d, %d bases in use)",
+                     device->address, obs->adv_len, uuid_pool_stats.bases_used);
+        return;
+    }
+
+    uuid.role = obs->kind == OBS_SERVICE ? UUID_ROLE_SERVICE : UUID_ROLE_CHAR;
+
+    if (!uuid_list_add(&device->uuids, &uuid)) {
+        SCANNER_LOGE(DEBUG_PRINT, "UUID pool exhausted, dropping UUID of %s", device->address);
+        return;
+    }
+
+    if (uuid.role == UUID_ROLE_SERVICE) {
+        device->services_count++;
+    } else {
+        device->chars_count++;
+    }
+}
+
+#if CONFIG_ESP_GATT_READ_VALUES
+
+// Storing characteristic value read from the connected device
+static void add_discovered_value(const struct Observation *obs) {
+    struct DiscoveryTarget *target = find_active_target(obs->bda);
+
+    if (target == NULL) {
+        return;
+    }
+
+    if (target->values_len + 3 + obs->adv_len > DISCOVERY_VALUES_SIZE) {
+        SCANNER_LOGE(DEBUG_PRINT, "No room for value %02x%02x of %s", obs->data[1], obs->data[0],
+                     devices[target->device_index].address);
+        return;
+    }
+
+    uint8_t *out = target->values + target->values_len;
+
+    out[0] = obs->data[0];
+    out[1] = obs->data[1];
+    out[2] = obs->adv_len;
+    memcpy(out + 3, obs->data + 2, obs->adv_len);
+    target->values_len += 3 + obs->adv_len;
+}
+
+#endif
+
+// Giving up on targets never seen or connections taking too long
+static void expire_discovery_targets(uint32_t now_ms) {
+    for (int i = 0; i < DISCOVERY_QUEUE_SIZE; i++) {
+        struct DiscoveryTarget *target = &discovery_targets[i];
+
+        if (target->state == DISCOVERY_QUEUED && now_ms - target->queued_ms > DISCOVERY_QUEUE_TIMEOUT_MS) {
+            target->failed = true;
+            target->timed_out = true;
+            discovery_queue_release(target);
+
+        } else if ((target->state == DISCOVERY_CONNECTING || target->state == DISCOVERY_CONNECTED)
+                && now_ms - target->started_ms > DISCOVERY_TIMEOUT_MS) {
+            SCANNER_LOGE(DEBUG_PRINT, "Discovery of %s timed out", devices[target->device_index].address);
+
+            uint8_t addr_type;
+
+            target->timed_out = true;
+            hal_gattc_close(connect_address(&devices[target->device_index], &addr_type));
+            finish_discovery(target, true, now_ms);
+        }
+    }
+}
+
+static void log_discovery_stats(uint32_t now_ms) {
+    uint32_t elapsed_ms = now_ms - discovery_counters.first_queued_ms;
+
+    if (discovery_counters.queued == 0) {
+        return;
+    }
+
+    // Devices per minute times ten, one decimal place
+    uint32_t rate = elapsed_ms > 0 ? (uint32_t) ((uint64_t) discovery_counters.completed * 600000 / elapsed_ms) : 0;
+    uint32_t latency = discovery_counters.completed > 0 ? (uint32_t) (discovery_counters.latency_total_ms / discovery_counters.completed) : 0;
+
+    SCANNER_LOGI(DEBUG_PRINT, "Discovery: depth %d (max %d), %d in flight, %u done, %u failed, %u timed out, %u rejected, "
+                 "latency %u ms avg %u ms max, %u.%u devices/min",
+                 discovery_queue_depth(), discovery_counters.max_depth, discovery_queue_in_flight(),
+                 (unsigned) discovery_counters.completed, (unsigned) discovery_counters.failed,
+                 (unsigned) discovery_counters.timed_out, (unsigned) discovery_counters.rejected,
+                 (unsigned) latency, (unsigned) discovery_counters.latency_max_ms, (unsigned) (rate / 10), (unsigned) (rate % 10));
+
+    SCANNER_LOGI(DEBUG_PRINT, "UUID pool: %d/%d chunks (max %d), %d/%d bases, %u dropped for lack of chunks, %u for lack of bases",
+                 uuid_pool_stats.chunks_used, UUID_POOL_CHUNKS, uuid_pool_stats.chunks_high_water,
+                 uuid_pool_stats.bases_used, UUID_BASES, (unsigned) uuid_pool_stats.pool_exhausted,
+                 (unsigned) uuid_pool_stats.bases_exhausted);
+
+#if CONFIG_ESP_GATT_CACHE
+    uint32_t lookups = gatt_cache_counters.hits + gatt_cache_counters.misses;
+
+    SCANNER_LOGI(DEBUG_PRINT, "GATT cache: %d entries, %u hits, %u misses (%u%% hit rate), %u invalidated, %u expired, "
+                 "%u evicted, %u errors, %u ms connection time saved",
+                 gatt_cache_count(), (unsigned) gatt_cache_counters.hits, (unsigned) gatt_cache_counters.misses,
+                 lookups > 0 ? (unsigned) (gatt_cache_counters.hits * 100 / lookups) : 0,
+                 (unsigned) gatt_cache_counters.invalidated, (unsigned) gatt_cache_counters.expired,
+                 (unsigned) gatt_cache_counters.evicted, (unsigned) gatt_cache_counters.errors,
+                 (unsigned) gatt_cache_counters.saved_ms);
+#endif
+}
+
+// END DISCOVERY ----------------------------------------------------------------------------------
+
+void scanner_core_init(void) {
+#if CONFIG_ESP_METRICS
+    metrics_reset();
+    windows_since_metrics = 0;
+#endif
+    device_table_init();
+    discovery_queue_init();
+#if CONFIG_ESP_GATT_CACHE
+    gatt_cache_init();
+#endif
+#if CONFIG_ESP_RPA_RESOLUTION
+    rpa_init();
+#endif
+#if CONFIG_ESP_ADDR_FILTER
+    addr_filter_init(&addr_filter, filter_keys, ADDR_FILTER_MAX_ENTRIES, filter_bloom);
+    if (addr_filter_load(&addr_filter)) {
+        SCANNER_LOGI(DEBUG_PRINT, "Address filter loaded, %d entries, mode %d", addr_filter.count, addr_filter.mode);
+    }
+    addr_filter_dirty = false;
+#endif
+
+    response_address_length = 0;
+#if CONFIG_ESP_SPOOL
+    spool_init(hal_now_ms());
+    drain_tokens = 0;
+    drain_polled_ms = hal_now_ms();
+#endif
+#if CONFIG_ESP_UPLINK_BATCH
+    reset_batch();
+#endif
+
+    memset(&report_counters, 0, sizeof(report_counters));
+#if CONFIG_ESP_DELTA_REPORTING
+    snapshot_done = false;
+    evicted_count = 0;
+    evicted_lost = 0;
+#endif
+#if CONFIG_ESP_SCAN_SCHEDULER
+    memset(&scan_activity, 0, sizeof(scan_activity));
+    scan_activity_since_ms = hal_now_ms();
+#endif
+}
+
+#if CONFIG_ESP_RPA_RESOLUTION
+
+// Observation of a resolved private address continues under the identity address. Advertisements
+// are resolved (once per address, see rpa.h), connection events only find addresses resolved before.
+static const struct Observation *resolve_observation(const struct Observation *obs, struct Observation *resolved) {
+    uint8_t identity[DEVICE_ADDR_LEN];
+    uint8_t identity_type;
+    bool found = obs->kind == OBS_ADV ? rpa_resolve(obs->bda, obs->addr_type, identity, &identity_type)
+            : obs->kind != OBS_WINDOW_END && rpa_lookup(obs->bda, identity, &identity_type);
+
+    if (!found) {
+        return obs;
+    }
+
+    *resolved = *obs;
+    memcpy(resolved->bda, identity, DEVICE_ADDR_LEN);
+    resolved->addr_type = identity_type;
+
+    return resolved;
+}
+
+static void log_rpa_stats(void) {
+    if (rpa_identity_count() == 0) {
+        return;
+    }
+
+    SCANNER_LOGI(DEBUG_PRINT, "Private addresses: %d IRKs, %u lookups, %u cache hits, %u resolved, %u unresolved, "
+                 "%u AES blocks", rpa_identity_count(), (unsigned) rpa_counters.lookups, (unsigned) rpa_counters.cache_hits,
+                 (unsigned) rpa_counters.resolved, (unsigned) rpa_counters.unresolved, (unsigned) rpa_counters.aes_blocks);
+}
+
+#endif
+
+#if CONFIG_ESP_ADDR_FILTER
+
+// Changes of the window reach flash once, the next boot starts from them
+static void save_addr_filter(void) {
+    if (!addr_filter_dirty) {
+        return;
+    }
+
+    addr_filter_dirty = false;
+    if (!addr_filter_save(&addr_filter)) {
+        SCANNER_LOGE(DEBUG_PRINT, "Address filter of %d entries not saved", addr_filter.count);
+    }
+}
+
+static void log_addr_filter_stats(void) {
+    const struct AddrFilterCounters *counters = &addr_filter.counters;
+
+    if (addr_filter.mode == ADDR_FILTER_OFF) {
+        return;
+    }
+
+    SCANNER_LOGI(DEBUG_PRINT, "Address filter: %d entries, %u checked, %u rejected, %u Bloom hits, "
+                 "%u false positives", addr_filter.count, (unsigned) counters->checked, (unsigned) counters->rejected,
+                 (unsigned) counters->bloom_hits, (unsigned) counters->false_positives);
+}
+
+#endif
+
+// Handling one observation on the uplink task
+static void process_observation(const struct Observation *obs) {
+    // Address as received, connections are closed under it
+    const uint8_t *received_bda = obs->bda;
+
+#if CONFIG_ESP_RPA_RESOLUTION
+    struct Observation resolved;
+
+    obs = resolve_observation(obs, &resolved);
+#endif
+
+    switch (obs->kind) {
+
+    // Got inquiry result for device
+    case OBS_ADV: {
+        struct AdvReport report;
+
+#if CONFIG_ESP_ADDR_FILTER
+        // Filtered devices are neither parsed nor kept, nor do they keep the scan duty cycle up
+        if (!addr_filter_accepts(&addr_filter, obs->bda, obs->addr_type)) {
+            break;
+        }
+#endif
+
+#if CONFIG_ESP_SCAN_SCHEDULER
+        scan_activity.advertisements++;
+#endif
+
+        // Single pass over advertisement and scan response
+        adv_parse(obs->data, obs->adv_len, obs->data + obs->adv_len, obs->scan_rsp_len, &report);
+
+        int current_device = device_table_find(obs->bda, obs->addr_type);
+
+        if (current_device >= 0) {
+            update_device_info(current_device, obs, &report);
+        } else {
+            current_device = add_device(obs, &report);
+        }
+
+#if CONFIG_ESP_RPA_RESOLUTION
+        // Private address of the moment is the one to connect to
+        if (obs == &resolved && current_device >= 0) {
+            memcpy(devices[current_device].rpa, received_bda, DEVICE_ADDR_LEN);
+        }
+#endif
+
+        // Start device discovering when a connection is available
+        struct DiscoveryTarget *target = discovery_queue_find(obs->bda);
+
+        if (target != NULL && target->state == DISCOVERY_QUEUED && current_device >= 0) {
+#if CONFIG_ESP_GATT_CACHE
+            target->adv_hash = gatt_cache_adv_hash(&report);
+
+            if (!target->cache_checked && discover_from_cache(target, current_device, obs->timestamp_ms)) {
+                break;
+            }
+#endif
+            if (discovery_queue_in_flight() < DISCOVERY_MAX_CONNECTIONS) {
+                SCANNER_LOGI(DEBUG_PRINT, "Searched device %s", devices[current_device].address);
+                discover_device(target, current_device, obs->timestamp_ms);
+            }
+        }
+        break;
+    }
+
+    // Inquiry window completed
+    case OBS_WINDOW_END:
+        expire_discovery_targets(obs->timestamp_ms);
+        show_found_devices(obs->timestamp_ms);
+        log_discovery_stats(obs->timestamp_ms);
+#if CONFIG_ESP_SPOOL
+        log_spool_stats();
+#endif
+#if CONFIG_ESP_RPA_RESOLUTION
+        log_rpa_stats();
+#endif
+#if CONFIG_ESP_ADDR_FILTER
+        save_addr_filter();
+        log_addr_filter_stats();
+#endif
+
+        // Forgetting devices that have not been seen for a while
+        if (DEVICE_MAX_AGE_MS > 0) {
+            device_table_expire(obs->timestamp_ms, DEVICE_MAX_AGE_MS);
+        }
+
+        hal_log_stats();
+
+#if CONFIG_ESP_METRICS
+        if (CONFIG_ESP_METRICS_INTERVAL > 0 && ++windows_since_metrics >= CONFIG_ESP_METRICS_INTERVAL) {
+            windows_since_metrics = 0;
+            send_metrics(obs->timestamp_ms);
+        }
+#endif
+        break;
+
+    // Connection opened, closing it right away when the target already timed out
+    case OBS_CONNECTED: {
+        struct DiscoveryTarget *target = find_active_target(obs->bda);
+
+        if (target != NULL) {
+            target->state = DISCOVERY_CONNECTED;
+        } else {
+            hal_gattc_close(received_bda);
+        }
+        break;
+    }
+
+    case OBS_SERVICE:
+    case OBS_CHAR:
+        add_discovered_uuid(obs);
+        break;
+
+#if CONFIG_ESP_GATT_READ_VALUES
+    case OBS_VALUE:
+        add_discovered_value(obs);
+        break;
+#endif
+
+    // Marking discovery as failed
+    case OBS_OPEN_FAILED: {
+        struct DiscoveryTarget *target = find_active_target(obs->bda);
+
+        if (target != NULL) {
+            finish_discovery(target, true, obs->timestamp_ms);
+        }
+        break;
+    }
+
+    case OBS_DISCONNECTED: {
+        struct DiscoveryTarget *target = find_active_target(obs->bda);
+
+        if (target != NULL) {
+            finish_discovery(target, false, obs->timestamp_ms);
+        }
+        break;
+    }
+
+#if CONFIG_ESP_GATT_CACHE
+    case OBS_SERVICE_CHANGED:
+        gatt_cache_invalidate(obs->bda);
+        break;
+#endif
+
+    default:
+        break;
+    }
+}
+
+void scanner_core_process(const struct Observation *obs) {
+#if CONFIG_ESP_METRICS
+    // Window end blocks on the uplink, it is timed in microseconds
+    if (obs->kind == OBS_WINDOW_END) {
+        METRICS_START_US(started);
+        process_observation(obs);
+        METRICS_STOP_US(METRIC_REPORT, started);
+        return;
+    }
+
+    METRICS_START_CYCLES(started);
+    process_observation(obs);
+    METRICS_STOP_CYCLES(METRIC_OBSERVATION, started);
+#else
+    process_observation(obs);
+#endif
+}
+
+void scanner_core_poll(uint32_t now_ms) {
+#if CONFIG_ESP_SPOOL
+    drain_spool(now_ms);
+#endif
+}
+
+#if CONFIG_ESP_SCAN_SCHEDULER
+
+void scanner_core_scan_activity(bool active, struct ScanActivity *activity) {
+    uint32_t now_ms = hal_now_ms();
+
+    *activity = scan_activity;
+
+    // Seen since the last call, in_range is cleared by the window report already
+    for (int i = 0; i < DEVICE_TABLE_CAPACITY; i++) {
+        struct Device *device = &devices[i];
+
+        if (!device->used || device->name_complete || device->name_attempts >= CONFIG_ESP_SCAN_NAME_ATTEMPTS
+                || (int32_t) (device->last_seen - scan_activity_since_ms) < 0) {
+            continue;
+        }
+
+        activity->unnamed++;
+        if (active) {
+            device->name_attempts++;
+        }
+    }
+
+    for (int i = 0; i < DISCOVERY_QUEUE_SIZE; i++) {
+        if (discovery_targets[i].state == DISCOVERY_QUEUED) {
+            activity->discoveries++;
+        }
+    }
+
+#if CONFIG_ESP_SPOOL
+    activity->stored = spool_pending();
+#endif
+
+    memset(&scan_activity, 0, sizeof(scan_activity));
+    scan_activity_since_ms = now_ms;
+}
+
+#endif
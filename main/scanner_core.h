@@ -0,0 +1,66 @@
+#pragma once
+
+#include "sdkconfig.h"
+#include "obs_ring.h"
+#include "command.h"
+#include "request_encoder.h"
+
+#define SERVER_ADDR      CONFIG_ESP_IP_ADDRESS
+
+#if CONFIG_ESP_UPLINK_HTTPS
+#define SERVER_SCHEME    "https://"
+#else
+#define SERVER_SCHEME    "http://"
+#endif
+
+#define SERVER_URL       SERVER_SCHEME SERVER_ADDR "/RESTServerScanner-1.0-SNAPSHOT/api/scanner"
+
+#define SCANNING_DURATION 5
+
+// Uplink report counters, totals since boot
+struct ReportCounters {
+    uint32_t sent;          // Devices reported as present
+    uint32_t suppressed;    // Devices seen but unchanged since their last report
+    uint32_t lost;          // Devices reported as out of range
+    uint32_t devices;       // Devices added to the device table
+    uint32_t identified;    // Devices recognised from their advertisements (adv_decoder.h)
+};
+
+extern struct ReportCounters report_counters;
+
+// What the last inquiry window brought, input of the scan scheduler (scan_scheduler.h)
+struct ScanActivity {
+    uint32_t advertisements;    // Advertisement reports processed
+    uint32_t new_devices;       // Devices added to the device table
+    uint32_t unnamed;           // Devices in range still expected to send their name in a scan response
+    uint32_t discoveries;       // Discovery targets waiting for their device to advertise
+    uint32_t stored;            // Batches waiting in the spool
+};
+
+// Scanner core: device tracking, discovery state machine and uplink encoding.
+// Runs on the uplink task, everything platform specific goes through scanner_hal.h.
+
+void scanner_core_init(void);
+
+// Handle one observation drained from the observation ring
+void scanner_core_process(const struct Observation *obs);
+
+// Work done between observations (draining batches stored while offline), called
+// by the uplink task every time it wakes up
+void scanner_core_poll(uint32_t now_ms);
+
+// Response body of an uplink request (address of a device to discover)
+void scanner_core_on_http_data(const char *data, int len);
+
+// Apply a server command handled by the core (discover). Returns false when it
+// could not be applied and the server should send it again.
+bool scanner_core_command(const struct Command *command);
+
+// Activity since the last call, called once per inquiry window after OBS_WINDOW_END. active
+// tells whether the window was scanned actively, an unnamed device stops counting after
+// CONFIG_ESP_SCAN_NAME_ATTEMPTS active windows without a scan response giving its name.
+void scanner_core_scan_activity(bool active, struct ScanActivity *activity);
+
+// Query string of one device as sent in text reports (without leading '?').
+// Also used by the host wire format benchmark.
+void build_device_query(struct RequestEncoder *encoder, int device_index, bool with_discovery, bool lost);
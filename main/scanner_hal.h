@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Thin hardware abstraction used by the scanner core. hal_esp.c implements it on
+// top of ESP-IDF, host/hal_stub.c implements it for the Linux build.
+
+// Logging
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#define SCANNER_LOGE(tag, fmt, ...) ESP_LOGE(tag, fmt, ##__VA_ARGS__)
+#define SCANNER_LOGI(tag, fmt, ...) ESP_LOGI(tag, fmt, ##__VA_ARGS__)
+#else
+#include <stdio.h>
+extern bool hal_log_enabled;
+#define SCANNER_LOGE(tag, fmt, ...) do { if (hal_log_enabled) printf("E %s: " fmt "\n", tag, ##__VA_ARGS__); } while (0)
+#define SCANNER_LOGI(tag, fmt, ...) do { if (hal_log_enabled) printf("I %s: " fmt "\n", tag, ##__VA_ARGS__); } while (0)
+#endif
+
+// Time
+uint32_t hal_now_ms(void);
+
+// Free running counters for measuring durations, they wrap around
+uint32_t hal_cycle_count(void);
+uint32_t hal_cycles_per_us(void);
+uint32_t hal_timer_us(void);
+
+// GAP
+void hal_gap_start_scanning(uint32_t duration_s);
+void hal_gap_stop_scanning(void);
+
+// GATTC, results come back as OBS_CONNECTED / OBS_SERVICE / OBS_CHAR / OBS_VALUE / OBS_OPEN_FAILED / OBS_DISCONNECTED
+// / OBS_SERVICE_CHANGED observations carrying the device address. Several connections may be open at the same time.
+void hal_gattc_open(const uint8_t *bda, uint8_t addr_type);
+
+// Drop connection to the device
+void hal_gattc_close(const uint8_t *bda);
+
+// HTTP, body == NULL sends a GET. Response body is passed to scanner_core_on_http_data.
+// Returns HTTP status or -1 on transport error.
+int hal_http_request(const char *url, const char *content_type, const char *body, int body_len);
+
+// WiFi
+bool hal_wifi_connected(void);
+
+// Persistent key-value storage (NVS on the ESP32), keys are at most 15 characters.
+// len passes the buffer size to hal_store_read and returns the stored length.
+bool hal_store_read(const char *key, void *data, size_t *len);
+bool hal_store_write(const char *key, const void *data, size_t len);
+void hal_store_erase(const char *key);
+
+// Drop every key starting with prefix, other keys of the store are kept
+void hal_store_erase_prefix(const char *prefix);
+
+// Raw flash region of the store-and-forward spool ("spool" partition on the ESP32), 0 bytes when
+// there is none. Offsets are relative to the region, erase works on whole 4 KB sectors and writes
+// can only clear bits of erased flash.
+size_t hal_spool_size(void);
+bool hal_spool_read(size_t offset, void *data, size_t len);
+bool hal_spool_write(size_t offset, const void *data, size_t len);
+bool hal_spool_erase_sector(size_t offset);
+
+// Flash region of the address filter ("filter" partition on the ESP32), 0 bytes when there is none.
+// hal_filter_erase erases the 4 KB sectors covering the first len bytes.
+size_t hal_filter_size(void);
+bool hal_filter_read(size_t offset, void *data, size_t len);
+bool hal_filter_write(size_t offset, const void *data, size_t len);
+bool hal_filter_erase(size_t len);
+
+// AES-128 encryption of one 16 byte block, key and data most significant byte first
+// (the byte order of the Bluetooth security functions). Hardware AES on the ESP32.
+void hal_aes128_encrypt(const uint8_t *key, const uint8_t *in, uint8_t *out);
+
+// Log backend statistics (called once per inquiry window)
+void hal_log_stats(void);
@@ -0,0 +1,368 @@
+#include "spool.h"
+#include "scanner_hal.h"
+
+#include <string.h>
+
+#define SPOOL_PRINT "SPOOL"
+
+#define SPOOL_MAGIC 0x314c5053      // "SPL1"
+
+// Sectors beyond this are left unused, the per sector counters live in RAM
+#define SPOOL_MAX_SECTORS 128
+
+#define STATE_PENDING 0xff
+#define STATE_SENT    0x00
+#define KIND_ERASED   0xff
+
+// Pending records of every sector, to know what is lost when the writer wraps onto it
+struct SpoolSector {
+    uint16_t pending;
+    uint16_t pending_bytes;
+};
+
+struct SpoolCounters spool_counters;
+
+static struct SpoolSector sectors[SPOOL_MAX_SECTORS];
+static int sector_count = 0;
+
+static uint32_t pending_records = 0;
+static uint64_t pending_bytes = 0;
+
+// Writer position, sequence numbers grow by one per sector across boots
+static int write_sector = 0;
+static size_t write_offset = 0;
+static uint32_t write_sequence = 0;
+static uint32_t boot_sequence = 0;
+
+// Reader position, walks from the oldest sector towards the writer
+static int read_sector = 0;
+static size_t read_offset = 0;
+static bool read_sector_current_boot = false;
+
+// Record returned by spool_peek
+static bool peeked = false;
+static size_t peek_offset = 0;
+static size_t peek_length = 0;
+
+static size_t padded(size_t len) {
+    return (len + 3) & ~(size_t) 3;
+}
+
+static size_t sector_base(int sector) {
+    return (size_t) sector * SPOOL_SECTOR_SIZE;
+}
+
+static uint16_t fletcher16(const uint8_t *data, size_t len) {
+    uint16_t sum1 = 0;
+    uint16_t sum2 = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        sum1 = (sum1 + data[i]) % 255;
+        sum2 = (sum2 + sum1) % 255;
+    }
+    return (sum2 << 8) | sum1;
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+static bool flash_write(size_t offset, const void *data, size_t len) {
+    spool_counters.flash_written += len;
+
+    if (!hal_spool_write(offset, data, len)) {
+        spool_counters.errors++;
+        return false;
+    }
+    return true;
+}
+
+// Sequence and boot sequence of a sector, false when it holds no spool data
+static bool read_sector_header(int sector, uint32_t *sequence, uint32_t *boot) {
+    uint8_t header[SPOOL_SECTOR_HEADER_SIZE];
+
+    if (!hal_spool_read(sector_base(sector), header, sizeof(header)) || get_u32(header) != SPOOL_MAGIC) {
+        return false;
+    }
+
+    *sequence = get_u32(header + 4);
+    *boot = get_u32(header + 8);
+    return true;
+}
+
+// Pending records of a sector written by an earlier boot
+static void count_pending(int sector) {
+    size_t offset = SPOOL_SECTOR_HEADER_SIZE;
+    uint8_t header[SPOOL_RECORD_HEADER_SIZE];
+
+    while (offset + SPOOL_RECORD_HEADER_SIZE <= SPOOL_SECTOR_SIZE
+            && hal_spool_read(sector_base(sector) + offset, header, sizeof(header)) && header[1] != KIND_ERASED) {
+        uint16_t len = header[2] | (header[3] << 8);
+
+        if (len > SPOOL_RECORD_MAX) {
+            break;
+        }
+        if (header[0] == STATE_PENDING) {
+            sectors[sector].pending++;
+            sectors[sector].pending_bytes += len;
+        }
+        offset += SPOOL_RECORD_HEADER_SIZE + padded(len);
+    }
+
+    pending_records += sectors[sector].pending;
+    pending_bytes += sectors[sector].pending_bytes;
+}
+
+// Pending records of a sector are gone (overwritten or unreadable)
+static void drop_sector(int sector) {
+    spool_counters.dropped += sectors[sector].pending;
+    pending_records -= sectors[sector].pending;
+    pending_bytes -= sectors[sector].pending_bytes;
+    sectors[sector].pending = 0;
+    sectors[sector].pending_bytes = 0;
+}
+
+static void move_reader(int sector) {
+    uint32_t sequence, boot;
+
+    read_sector = sector;
+    read_offset = SPOOL_SECTOR_HEADER_SIZE;
+    read_sector_current_boot = read_sector_header(sector, &sequence, &boot) && boot == boot_sequence;
+    peeked = false;
+}
+
+// Erase sector and make it the write sector, dropping whatever it still holds
+static void start_sector(int sector) {
+    uint8_t header[SPOOL_SECTOR_HEADER_SIZE];
+
+    if (sectors[sector].pending > 0) {
+        SCANNER_LOGE(SPOOL_PRINT, "Log full, dropping %u batches", (unsigned) sectors[sector].pending);
+        drop_sector(sector);
+    }
+
+    if (read_sector == sector) {
+        move_reader((sector + 1) % sector_count);
+    }
+
+    if (!hal_spool_erase_sector(sector_base(sector))) {
+        spool_counters.errors++;
+    }
+    spool_counters.sectors_erased++;
+
+    memset(header, 0xff, sizeof(header));
+    put_u32(header, SPOOL_MAGIC);
+    put_u32(header + 4, write_sequence);
+    put_u32(header + 8, boot_sequence);
+    flash_write(sector_base(sector), header, sizeof(header));
+
+    write_sector = sector;
+    write_offset = SPOOL_SECTOR_HEADER_SIZE;
+    write_sequence++;
+}
+
+bool spool_init(uint32_t now_ms) {
+    int newest = -1;
+    uint32_t newest_sequence = 0;
+
+    memset(&spool_counters, 0, sizeof(spool_counters));
+    memset(sectors, 0, sizeof(sectors));
+    pending_records = 0;
+    pending_bytes = 0;
+    peeked = false;
+
+    sector_count = hal_spool_size() / SPOOL_SECTOR_SIZE;
+    if (sector_count > SPOOL_MAX_SECTORS) {
+        sector_count = SPOOL_MAX_SECTORS;
+    }
+
+    // Ring needs the write sector and at least one to drain from
+    if (sector_count < 2) {
+        SCANNER_LOGE(SPOOL_PRINT, "No spool region, batches are dropped while offline");
+        sector_count = 0;
+        return false;
+    }
+
+    for (int sector = 0; sector < sector_count; sector++) {
+        uint32_t sequence, boot;
+
+        if (read_sector_header(sector, &sequence, &boot)) {
+            count_pending(sector);
+            if (newest < 0 || sequence > newest_sequence) {
+                newest = sector;
+                newest_sequence = sequence;
+            }
+        }
+    }
+
+    // Fresh sector after the newest one, everything else is older
+    write_sequence = newest < 0 ? 1 : newest_sequence + 1;
+    boot_sequence = write_sequence;
+    read_sector = -1;
+    start_sector(newest < 0 ? 0 : (newest + 1) % sector_count);
+    move_reader((write_sector + 1) % sector_count);
+
+    SCANNER_LOGI(SPOOL_PRINT, "%d sectors, %u batches (%u bytes) pending from earlier boots",
+                 sector_count, (unsigned) pending_records, (unsigned) pending_bytes);
+
+    return true;
+}
+
+bool spool_available(void) {
+    return sector_count > 0;
+}
+
+bool spool_append(uint8_t kind, const void *data, size_t len, uint32_t now_ms) {
+    uint8_t header[SPOOL_RECORD_HEADER_SIZE];
+
+    if (sector_count == 0 || len == 0 || len > SPOOL_RECORD_MAX) {
+        return false;
+    }
+
+    if (write_offset + SPOOL_RECORD_HEADER_SIZE + padded(len) > SPOOL_SECTOR_SIZE) {
+        start_sector((write_sector + 1) % sector_count);
+    }
+
+    header[0] = STATE_PENDING;
+    header[1] = kind;
+    header[2] = len & 0xff;
+    header[3] = len >> 8;
+    put_u32(header + 4, now_ms);
+    uint16_t checksum = fletcher16(data, len);
+    header[8] = checksum & 0xff;
+    header[9] = checksum >> 8;
+    header[10] = 0xff;
+    header[11] = 0xff;
+
+    // Payload first, a header is only ever written for a complete record
+    size_t offset = sector_base(write_sector) + write_offset;
+
+    if (!flash_write(offset + SPOOL_RECORD_HEADER_SIZE, data, len) || !flash_write(offset, header, sizeof(header))) {
+        // Offset is skipped, flash there is no longer erased
+        write_offset = SPOOL_SECTOR_SIZE;
+        return false;
+    }
+
+    write_offset += SPOOL_RECORD_HEADER_SIZE + padded(len);
+    sectors[write_sector].pending++;
+    sectors[write_sector].pending_bytes += len;
+    pending_records++;
+    pending_bytes += len;
+
+    spool_counters.appended++;
+    spool_counters.appended_bytes += len;
+
+    return true;
+}
+
+size_t spool_peek(uint8_t *kind, void *data, size_t size, uint32_t now_ms, uint32_t *age_ms) {
+    uint8_t header[SPOOL_RECORD_HEADER_SIZE];
+
+    while (sector_count > 0 && pending_records > 0) {
+        bool at_writer = read_sector == write_sector;
+
+        // Sector drained, moving on to the next one
+        if (!at_writer && (sectors[read_sector].pending == 0 || read_offset + SPOOL_RECORD_HEADER_SIZE > SPOOL_SECTOR_SIZE)) {
+            move_reader((read_sector + 1) % sector_count);
+            continue;
+        }
+        if (at_writer && read_offset >= write_offset) {
+            return 0;
+        }
+
+        size_t offset = sector_base(read_sector) + read_offset;
+
+        if (!hal_spool_read(offset, header, sizeof(header))) {
+            spool_counters.errors++;
+            return 0;
+        }
+
+        uint16_t len = header[2] | (header[3] << 8);
+
+        // Rest of the sector is unreadable
+        if (header[1] == KIND_ERASED || len > SPOOL_RECORD_MAX) {
+            if (header[1] != KIND_ERASED) {
+                spool_counters.errors++;
+            }
+            drop_sector(read_sector);
+            read_offset = SPOOL_SECTOR_SIZE;
+            if (at_writer) {
+                return 0;
+            }
+            continue;
+        }
+
+        peek_offset = read_offset;
+        peek_length = len;
+        read_offset += SPOOL_RECORD_HEADER_SIZE + padded(len);
+
+        if (header[0] != STATE_PENDING) {
+            continue;
+        }
+
+        peeked = true;
+
+        if (len > size) {
+            SCANNER_LOGE(SPOOL_PRINT, "Dropping stored batch of %u bytes, buffer holds %u", (unsigned) len, (unsigned) size);
+            spool_consume(true);
+            continue;
+        }
+
+        if (!hal_spool_read(offset + SPOOL_RECORD_HEADER_SIZE, data, len)
+                || fletcher16(data, len) != (header[8] | (header[9] << 8))) {
+            spool_counters.errors++;
+            spool_consume(true);
+            continue;
+        }
+
+        // Reader stays on the record until it is consumed
+        read_offset = peek_offset;
+
+        *kind = header[1];
+        *age_ms = read_sector_current_boot ? now_ms - get_u32(header + 4) : SPOOL_AGE_UNKNOWN;
+        return len;
+    }
+
+    return 0;
+}
+
+void spool_consume(bool dropped) {
+    uint8_t state = STATE_SENT;
+
+    if (!peeked) {
+        return;
+    }
+    peeked = false;
+
+    flash_write(sector_base(read_sector) + peek_offset, &state, 1);
+
+    sectors[read_sector].pending--;
+    sectors[read_sector].pending_bytes -= peek_length;
+    pending_records--;
+    pending_bytes -= peek_length;
+    read_offset = peek_offset + SPOOL_RECORD_HEADER_SIZE + padded(peek_length);
+
+    if (dropped) {
+        spool_counters.dropped++;
+    } else {
+        spool_counters.drained++;
+        spool_counters.drained_bytes += peek_length;
+    }
+}
+
+uint32_t spool_pending(void) {
+    return pending_records;
+}
+
+uint64_t spool_pending_bytes(void) {
+    return pending_bytes;
+}
+
+int spool_sectors(void) {
+    return sector_count;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sdkconfig.h"
+
+// Store-and-forward log of uplink batches that could not be sent, kept in the
+// flash region of the hal_spool_* functions.
+//
+// The region is a ring of sectors written strictly in order, so every sector is
+// erased once per pass and wear is spread over the whole region. A sector starts
+// with a 16 byte header (magic, sequence, sequence of the first sector written by
+// the same boot) followed by records:
+//
+//   u8 state      0xff pending, 0x00 sent (cleared in place, no erase needed)
+//   u8 kind       SPOOL_KIND_*, 0xff (erased flash) ends the sector
+//   u16 length    of the payload
+//   u32 time_ms   uptime when the batch was stored
+//   u16 checksum  Fletcher-16 of the payload
+//   u16 reserved
+//   payload, padded to 4 bytes
+//
+// The payload is written before its header, a record cut by a reset reads as
+// the end of the sector. Every boot continues in a fresh sector. When the ring
+// is full the oldest sector is dropped with whatever it still holds.
+
+#define SPOOL_SECTOR_SIZE 4096
+#define SPOOL_SECTOR_HEADER_SIZE 16
+#define SPOOL_RECORD_HEADER_SIZE 12
+
+// Largest payload of one record
+#define SPOOL_RECORD_MAX (SPOOL_SECTOR_SIZE - SPOOL_SECTOR_HEADER_SIZE - SPOOL_RECORD_HEADER_SIZE)
+
+#define SPOOL_KIND_TEXT   1     // Text batch, one query string per line
+#define SPOOL_KIND_BINARY 2     // Binary batch, see wire_format.h
+
+// Age of a record stored before the last reboot
+#define SPOOL_AGE_UNKNOWN UINT32_MAX
+
+struct SpoolCounters {
+    uint32_t appended;
+    uint64_t appended_bytes;    // Payload bytes
+    uint32_t drained;
+    uint64_t drained_bytes;
+    uint32_t dropped;           // Records overwritten before they were drained or rejected
+    uint32_t errors;            // Flash failures and corrupt records
+    uint64_t flash_written;     // Bytes programmed including headers, padding and state marks
+    uint32_t sectors_erased;
+    uint32_t drain_ms;          // Time spent with a backlog while connected
+};
+
+extern struct SpoolCounters spool_counters;
+
+// Scan the region, count records left by earlier boots and open a fresh sector.
+// Returns false when there is no region.
+bool spool_init(uint32_t now_ms);
+
+bool spool_available(void);
+
+// Store a batch, returns false when it is too large or flash failed
+bool spool_append(uint8_t kind, const void *data, size_t len, uint32_t now_ms);
+
+// Copy the oldest pending record into data. Returns its length, 0 when nothing is
+// pending. Records longer than size are dropped. age_ms is SPOOL_AGE_UNKNOWN for
+// records of an earlier boot.
+size_t spool_peek(uint8_t *kind, void *data, size_t size, uint32_t now_ms, uint32_t *age_ms);
+
+// Mark the record returned by spool_peek as sent (or given up on, when dropped)
+void spool_consume(bool dropped);
+
+// Backlog depth
+uint32_t spool_pending(void);
+uint64_t spool_pending_bytes(void);
+
+// Number of sectors in the region
+int spool_sectors(void);
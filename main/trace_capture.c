@@ -0,0 +1,128 @@
+#include "trace_capture.h"
+#include "scan_trace.h"
+
+#include "esp_partition.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include <string.h>
+
+#define TRACE_PRINT "TRACE"
+
+#define TRACE_PARTITION_LABEL "trace"
+#define TRACE_PARTITION_SUBTYPE 0x40
+
+#define TRACE_STAGING_SIZE 256
+
+static const esp_partition_t *trace_partition = NULL;
+static uint32_t trace_sector_count = 0;
+
+static uint32_t current_sector = 0;
+static uint32_t current_sequence = 0;
+static uint32_t sector_offset = 0;
+
+// Records are collected in RAM and written in small chunks
+static uint8_t staging[TRACE_STAGING_SIZE];
+static size_t staging_length = 0;
+
+static struct ScanTraceState trace_state;
+
+// Statistics
+static uint32_t traced_records = 0;
+static uint32_t trace_errors = 0;
+
+// Erase next sector of the ring and write its header
+static void start_sector(uint32_t sector, uint32_t now_ms) {
+    uint8_t header[SCAN_TRACE_HEADER_SIZE];
+
+    current_sector = sector;
+    current_sequence++;
+
+    if (esp_partition_erase_range(trace_partition, sector * SCAN_TRACE_SECTOR_SIZE, SCAN_TRACE_SECTOR_SIZE) != ESP_OK) {
+        trace_errors++;
+    }
+
+    scan_trace_write_header(header, current_sequence, now_ms);
+    if (esp_partition_write(trace_partition, sector * SCAN_TRACE_SECTOR_SIZE, header, sizeof(header)) != ESP_OK) {
+        trace_errors++;
+    }
+
+    sector_offset = SCAN_TRACE_HEADER_SIZE;
+    scan_trace_reset(&trace_state, now_ms);
+}
+
+void trace_capture_init(void) {
+    trace_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, TRACE_PARTITION_SUBTYPE, TRACE_PARTITION_LABEL);
+
+    if (trace_partition == NULL) {
+        ESP_LOGE(TRACE_PRINT, "No \"%s\" partition, capture disabled", TRACE_PARTITION_LABEL);
+        return;
+    }
+
+    trace_sector_count = trace_partition->size / SCAN_TRACE_SECTOR_SIZE;
+
+    // Newest sector written before this boot
+    uint32_t newest_sector = trace_sector_count - 1;
+    uint32_t newest_sequence = 0;
+
+    for (uint32_t sector = 0; sector < trace_sector_count; sector++) {
+        uint8_t header[SCAN_TRACE_HEADER_SIZE];
+        uint32_t sequence, base_ms;
+
+        if (esp_partition_read(trace_partition, sector * SCAN_TRACE_SECTOR_SIZE, header, sizeof(header)) == ESP_OK
+                && scan_trace_read_header(header, &sequence, &base_ms) && sequence > newest_sequence) {
+            newest_sequence = sequence;
+            newest_sector = sector;
+        }
+    }
+
+    // Each boot starts a fresh sector, timestamps restart from zero
+    current_sequence = newest_sequence;
+    start_sector((newest_sector + 1) % trace_sector_count, (uint32_t) (esp_timer_get_time() / 1000));
+
+    ESP_LOGI(TRACE_PRINT, "Capturing into %u sectors, sector %u sequence %u",
+             (unsigned) trace_sector_count, (unsigned) current_sector, (unsigned) current_sequence);
+}
+
+void trace_capture_flush(void) {
+    if (trace_partition == NULL || staging_length == 0) {
+        return;
+    }
+
+    if (esp_partition_write(trace_partition, current_sector * SCAN_TRACE_SECTOR_SIZE + sector_offset, staging, staging_length) != ESP_OK) {
+        trace_errors++;
+    }
+
+    sector_offset += staging_length;
+    staging_length = 0;
+}
+
+void trace_capture_record(const struct Observation *obs) {
+    if (trace_partition == NULL) {
+        return;
+    }
+
+    // Moving to next sector when the largest record might not fit
+    if (sector_offset + staging_length + SCAN_TRACE_MAX_RECORD > SCAN_TRACE_SECTOR_SIZE) {
+        trace_capture_flush();
+        start_sector((current_sector + 1) % trace_sector_count, obs->timestamp_ms);
+    }
+
+    if (staging_length + SCAN_TRACE_MAX_RECORD > sizeof(staging)) {
+        trace_capture_flush();
+    }
+
+    int n = scan_trace_encode(&trace_state, obs, staging + staging_length, sizeof(staging) - staging_length);
+
+    if (n > 0) {
+        staging_length += n;
+        traced_records++;
+    }
+
+    // Keeping at most one window in RAM
+    if (obs->kind == OBS_WINDOW_END) {
+        trace_capture_flush();
+        ESP_LOGI(TRACE_PRINT, "Traced %u records, sector %u, %u errors",
+                 (unsigned) traced_records, (unsigned) current_sector, (unsigned) trace_errors);
+    }
+}
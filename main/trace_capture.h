@@ -0,0 +1,15 @@
+#pragma once
+
+#include "obs_ring.h"
+
+// Optional capture of scan results into the "trace" flash partition, which is
+// used as a ring of scan_trace.h sectors. Runs on the uplink task only.
+
+// Find the partition and continue after the newest sector of the previous boot
+void trace_capture_init(void);
+
+// Append advertisement or window end, other observations are ignored
+void trace_capture_record(const struct Observation *obs);
+
+// Write buffered records to flash
+void trace_capture_flush(void);
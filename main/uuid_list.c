@@ -0,0 +1,234 @@
+#include "uuid_list.h"
+
+#include <string.h>
+
+#define NO_CHUNK -1
+
+// Bytes 12-15 of a 128 bit UUID vary within a vendor base
+#define BASE_VALUE_OFFSET 12
+
+struct UuidPoolStats uuid_pool_stats;
+
+static uint8_t bases[UUID_BASES][16];
+
+// List entries referring to every base, a base nothing refers to is replaced by the next new one
+static uint16_t base_refs[UUID_BASES];
+static int bases_filled = 0;
+
+static struct UuidChunk chunks[UUID_POOL_CHUNKS];
+static int16_t free_chunk = NO_CHUNK;
+
+void uuid_pool_init(void) {
+    memset(&uuid_pool_stats, 0, sizeof(uuid_pool_stats));
+    memset(base_refs, 0, sizeof(base_refs));
+    bases_filled = 0;
+
+    // Chaining every chunk into the free list
+    for (int i = 0; i < UUID_POOL_CHUNKS; i++) {
+        chunks[i].next = (i + 1 < UUID_POOL_CHUNKS) ? i + 1 : NO_CHUNK;
+        chunks[i].count = 0;
+    }
+    free_chunk = 0;
+}
+
+// Index of the base, interning it when new. -1 when every base is referred to.
+static int intern_base(const uint8_t *uuid128) {
+    uint8_t base[16];
+    int unused = -1;
+
+    memcpy(base, uuid128, sizeof(base));
+    memset(base + BASE_VALUE_OFFSET, 0, 4);
+
+    for (int i = 0; i < bases_filled; i++) {
+        if (memcmp(bases[i], base, sizeof(base)) == 0) {
+            return i;
+        }
+        if (unused < 0 && base_refs[i] == 0) {
+            unused = i;
+        }
+    }
+
+    if (bases_filled < UUID_BASES) {
+        unused = bases_filled++;
+    } else if (unused < 0) {
+        uuid_pool_stats.bases_exhausted++;
+        return -1;
+    }
+
+    memcpy(bases[unused], base, sizeof(base));
+
+    return unused;
+}
+
+static void ref_base(const struct Uuid *uuid) {
+    if (uuid->type >= UUID_TYPE_128 && base_refs[uuid->type - UUID_TYPE_128]++ == 0) {
+        uuid_pool_stats.bases_used++;
+    }
+}
+
+static void unref_base(const struct Uuid *uuid) {
+    if (uuid->type >= UUID_TYPE_128 && --base_refs[uuid->type - UUID_TYPE_128] == 0) {
+        uuid_pool_stats.bases_used--;
+    }
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// Two lowercase hex digits of the low byte, returns the position after them
+static char *format_hex(char *str, uint32_t value) {
+    static const char hex_digits[] = "0123456789abcdef";
+
+    str[0] = hex_digits[(value >> 4) & 0x0f];
+    str[1] = hex_digits[value & 0x0f];
+    return str + 2;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+bool uuid_from_bytes(const uint8_t *p, int len, struct Uuid *uuid) {
+    if (len == 2) {
+        uuid->type = UUID_TYPE_16;
+        uuid->value = p[0] | (p[1] << 8);
+    } else if (len == 4) {
+        uuid->type = UUID_TYPE_32;
+        uuid->value = get_u32(p);
+    } else if (len == 16) {
+        int base = intern_base(p);
+
+        if (base < 0) {
+            return false;
+        }
+        uuid->type = UUID_TYPE_128 + base;
+        uuid->value = get_u32(p + BASE_VALUE_OFFSET);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+int uuid_to_bytes(const struct Uuid *uuid, uint8_t *out) {
+    if (uuid->type == UUID_TYPE_16) {
+        out[0] = uuid->value & 0xff;
+        out[1] = (uuid->value >> 8) & 0xff;
+        return 2;
+    }
+
+    if (uuid->type == UUID_TYPE_32) {
+        put_u32(out, uuid->value);
+        return 4;
+    }
+
+    memcpy(out, bases[uuid->type - UUID_TYPE_128], 16);
+    put_u32(out + BASE_VALUE_OFFSET, uuid->value);
+
+    return 16;
+}
+
+void uuid_format(const struct Uuid *uuid, char *str) {
+    uint8_t p[16];
+
+    if (uuid->type == UUID_TYPE_16) {
+        str = format_hex(str, uuid->value >> 8);
+        str = format_hex(str, uuid->value);
+    } else if (uuid->type == UUID_TYPE_32) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            str = format_hex(str, uuid->value >> shift);
+        }
+    } else {
+        uuid_to_bytes(uuid, p);
+
+        // Most significant byte first, dashes before bytes 11, 9, 7 and 5
+        for (int i = 15; i >= 0; i--) {
+            if (i == 11 || i == 9 || i == 7 || i == 5) {
+                *str++ = '-';
+            }
+            str = format_hex(str, p[i]);
+        }
+    }
+    *str = '\0';
+}
+
+bool uuid_list_add(struct UuidList *list, const struct Uuid *uuid) {
+
+    // Last chunk is full, taking a new one from the pool
+    if (list->tail == NO_CHUNK || chunks[list->tail].count == UUID_CHUNK_ENTRIES) {
+        if (free_chunk == NO_CHUNK) {
+            uuid_pool_stats.pool_exhausted++;
+            return false;
+        }
+
+        int16_t chunk = free_chunk;
+        free_chunk = chunks[chunk].next;
+
+        chunks[chunk].next = NO_CHUNK;
+        chunks[chunk].count = 0;
+
+        if (list->tail == NO_CHUNK) {
+            list->head = chunk;
+        } else {
+            chunks[list->tail].next = chunk;
+        }
+        list->tail = chunk;
+
+        uuid_pool_stats.chunks_used++;
+        if (uuid_pool_stats.chunks_used > uuid_pool_stats.chunks_high_water) {
+            uuid_pool_stats.chunks_high_water = uuid_pool_stats.chunks_used;
+        }
+    }
+
+    struct UuidChunk *tail = &chunks[list->tail];
+
+    tail->entries[tail->count++] = *uuid;
+    list->count++;
+    ref_base(uuid);
+
+    return true;
+}
+
+void uuid_list_clear(struct UuidList *list) {
+    if (list->head != NO_CHUNK) {
+        int chunk = list->head;
+
+        while (chunk != NO_CHUNK) {
+            for (int i = 0; i < chunks[chunk].count; i++) {
+                unref_base(&chunks[chunk].entries[i]);
+            }
+            uuid_pool_stats.chunks_used--;
+            chunk = chunks[chunk].next;
+        }
+
+        // Whole chain goes to the front of the free list at once
+        chunks[list->tail].next = free_chunk;
+        free_chunk = list->head;
+    }
+
+    uuid_list_init(list);
+}
+
+const struct Uuid *uuid_list_first(const struct UuidList *list, struct UuidListIterator *it) {
+    it->chunk = list->head;
+    it->index = 0;
+
+    return uuid_list_next(it);
+}
+
+const struct Uuid *uuid_list_next(struct UuidListIterator *it) {
+    while (it->chunk != NO_CHUNK) {
+        struct UuidChunk *chunk = &chunks[it->chunk];
+
+        if (it->index < chunk->count) {
+            return &chunk->entries[it->index++];
+        }
+        it->chunk = chunk->next;
+        it->index = 0;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdkconfig.h"
+
+// Services and characteristics of discovered devices in native form.
+//
+// 16 and 32 bit UUIDs are kept inline. A 128 bit UUID is split into a base (the
+// UUID with bytes 12-15 cleared, shared by every UUID of a vendor) interned in a
+// small table and the 32 bit value found in bytes 12-15. A base is kept while list
+// entries refer to it and replaced by a new one afterwards. Lists of a device are
+// chains of fixed size chunks taken from a shared pool, strings are only built
+// when a report is encoded.
+
+// "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx" and the terminating NUL
+#define UUID_STRING_LENGTH 37
+
+// Interned 128 bit bases and pool chunks, set in Kconfig
+#define UUID_BASES CONFIG_ESP_UUID_BASES
+#define UUID_POOL_CHUNKS CONFIG_ESP_UUID_POOL_CHUNKS
+
+#define UUID_CHUNK_ENTRIES 7
+
+#define UUID_TYPE_16  0
+#define UUID_TYPE_32  1
+#define UUID_TYPE_128 2     // Base index is added to the type
+
+// Role of a list entry
+#define UUID_ROLE_SERVICE 0
+#define UUID_ROLE_CHAR    1
+
+struct Uuid {
+    uint32_t value;
+    uint8_t type;
+    uint8_t role;
+};
+
+// Chain of pool chunks, head is -1 for an empty list
+struct UuidList {
+    int16_t head;
+    int16_t tail;
+    uint16_t count;
+};
+
+struct UuidChunk {
+    int16_t next;
+    uint8_t count;
+    struct Uuid entries[UUID_CHUNK_ENTRIES];
+};
+
+struct UuidPoolStats {
+    int chunks_used;
+    int chunks_high_water;
+    int bases_used;             // Bases list entries refer to
+    uint32_t pool_exhausted;    // Entries dropped because the pool was empty
+    uint32_t bases_exhausted;   // 128 bit UUIDs dropped because every base was referred to
+};
+
+extern struct UuidPoolStats uuid_pool_stats;
+
+// Drop every list and every interned base
+void uuid_pool_init(void);
+
+// Convert UUID bytes (little endian, as sent over the air) interning the base of a 128 bit UUID.
+// The base is only kept once the UUID is added to a list, so add it before converting another one.
+// Returns false for an invalid length or a full base table.
+bool uuid_from_bytes(const uint8_t *p, int len, struct Uuid *uuid);
+
+// Little endian bytes of the UUID, returns their number
+int uuid_to_bytes(const struct Uuid *uuid, uint8_t *out);
+
+// Format as "xxxx", "xxxxxxxx" or "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx", str holds UUID_STRING_LENGTH bytes
+void uuid_format(const struct Uuid *uuid, char *str);
+
+static inline void uuid_list_init(struct UuidList *list) {
+    list->head = -1;
+    list->tail = -1;
+    list->count = 0;
+}
+
+// Append entry, returns false when the pool is exhausted
+bool uuid_list_add(struct UuidList *list, const struct Uuid *uuid);
+
+// Return the chunks of the list to the pool, releasing the bases of its entries
+void uuid_list_clear(struct UuidList *list);
+
+// Walk a list: for (const struct Uuid *u = uuid_list_first(list, &it); u != NULL; u = uuid_list_next(&it))
+struct UuidListIterator {
+    int16_t chunk;
+    uint8_t index;
+};
+
+const struct Uuid *uuid_list_first(const struct UuidList *list, struct UuidListIterator *it);
+const struct Uuid *uuid_list_next(struct UuidListIterator *it);
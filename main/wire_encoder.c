@@ -0,0 +1,288 @@
+#include "wire_encoder.h"
+
+#include <string.h>
+
+// Worst case of one UUID entry: tag, base index and value
+#define UUID_ENTRY_MAX 6
+
+static void put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value & 0xff;
+    out[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (value >> (8 * i)) & 0xff;
+    }
+}
+
+static bool has_room(const struct WireEncoder *encoder, size_t n) {
+    return encoder->length + n <= encoder->size;
+}
+
+void wire_encoder_init(struct WireEncoder *encoder, uint8_t *data, size_t size) {
+    encoder->data = data;
+    encoder->size = size;
+    encoder->length = 0;
+    encoder->records = 0;
+    encoder->bases_sent = 0;
+    memset(encoder->batch_base, -1, sizeof(encoder->batch_base));
+
+    if (size >= WIRE_HEADER_SIZE) {
+        memcpy(data, WIRE_MAGIC, 3);
+        data[3] = WIRE_VERSION;
+        encoder->length = WIRE_HEADER_SIZE;
+    }
+}
+
+// Base item for a base not sent in this batch yet, returns batch index or -1 when out of room
+static int send_base(struct WireEncoder *encoder, const struct Uuid *uuid) {
+    int base = uuid->type - UUID_TYPE_128;
+
+    if (encoder->batch_base[base] >= 0) {
+        return encoder->batch_base[base];
+    }
+
+    if (!has_room(encoder, WIRE_ITEM_HEADER_SIZE + 17)) {
+        return -1;
+    }
+
+    uint8_t *out = encoder->data + encoder->length;
+    uint8_t bytes[16];
+
+    uuid_to_bytes(uuid, bytes);
+    memset(bytes + 12, 0, 4);
+
+    out[0] = WIRE_ITEM_BASE;
+    put_u16(out + 1, 17);
+    out[3] = encoder->bases_sent;
+    memcpy(out + 4, bytes, sizeof(bytes));
+
+    encoder->length += WIRE_ITEM_HEADER_SIZE + 17;
+    encoder->batch_base[base] = encoder->bases_sent;
+
+    return encoder->bases_sent++;
+}
+
+// Bases needed by the device go out before its item
+static bool send_bases(struct WireEncoder *encoder, const struct Device *device) {
+    struct UuidListIterator it;
+
+    for (const struct Uuid *uuid = uuid_list_first(&device->uuids, &it); uuid != NULL; uuid = uuid_list_next(&it)) {
+        if (uuid->type >= UUID_TYPE_128 && send_base(encoder, uuid) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool add_uuids(struct WireEncoder *encoder, const struct Device *device) {
+    struct UuidListIterator it;
+
+    if (!has_room(encoder, 2)) {
+        return false;
+    }
+    put_u16(encoder->data + encoder->length, device->uuids.count);
+    encoder->length += 2;
+
+    for (const struct Uuid *uuid = uuid_list_first(&device->uuids, &it); uuid != NULL; uuid = uuid_list_next(&it)) {
+        uint8_t *out = encoder->data + encoder->length;
+        uint8_t role = uuid->role == UUID_ROLE_CHAR ? WIRE_UUID_CHAR : 0;
+
+        if (!has_room(encoder, UUID_ENTRY_MAX)) {
+            return false;
+        }
+
+        if (uuid->type == UUID_TYPE_16) {
+            out[0] = role | WIRE_UUID_16;
+            put_u16(out + 1, uuid->value);
+            encoder->length += 3;
+        } else if (uuid->type == UUID_TYPE_32) {
+            out[0] = role | WIRE_UUID_32;
+            put_u32(out + 1, uuid->value);
+            encoder->length += 5;
+        } else {
+            out[0] = role | WIRE_UUID_128;
+            out[1] = encoder->batch_base[uuid->type - UUID_TYPE_128];
+            put_u32(out + 2, uuid->value);
+            encoder->length += 6;
+        }
+    }
+    return true;
+}
+
+// Beacon item following the device item
+static bool add_beacon(struct WireEncoder *encoder, const struct Device *device) {
+    if (!has_room(encoder, WIRE_ITEM_HEADER_SIZE + 2 + device->beacon_len)) {
+        return false;
+    }
+
+    uint8_t *out = encoder->data + encoder->length;
+
+    out[0] = WIRE_ITEM_BEACON;
+    put_u16(out + 1, 2 + device->beacon_len);
+    out[3] = device->beacon_kind;
+    out[4] = device->beacon_subtype;
+    memcpy(out + 5, device->beacon, device->beacon_len);
+
+    encoder->length += WIRE_ITEM_HEADER_SIZE + 2 + device->beacon_len;
+    return true;
+}
+
+// Values item following the device and beacon items, entries are sent as they are stored
+static bool add_values(struct WireEncoder *encoder, const uint8_t *values, size_t values_len) {
+    if (values_len > UINT16_MAX || !has_room(encoder, WIRE_ITEM_HEADER_SIZE + values_len)) {
+        return false;
+    }
+
+    uint8_t *out = encoder->data + encoder->length;
+
+    out[0] = WIRE_ITEM_VALUES;
+    put_u16(out + 1, values_len);
+    memcpy(out + 3, values, values_len);
+
+    encoder->length += WIRE_ITEM_HEADER_SIZE + values_len;
+    return true;
+}
+
+bool wire_encoder_add_device(struct WireEncoder *encoder, const struct Device *device, const uint8_t *values,
+                             size_t values_len, bool with_discovery, bool lost) {
+    size_t start = encoder->length;
+    int bases_sent = encoder->bases_sent;
+    size_t name_len = strlen(device->name);
+    bool has_name = name_len > 0 && strcmp(device->name, "-") != 0;
+    uint8_t flags = (device->addr_type & 0x03) << WIRE_DEVICE_ADDR_TYPE_SHIFT;
+
+    if (name_len > 255) {
+        name_len = 255;
+    }
+
+    flags |= lost ? WIRE_DEVICE_LOST : 0;
+    flags |= has_name ? WIRE_DEVICE_NAME : 0;
+    flags |= with_discovery ? WIRE_DEVICE_DISCOVERY : 0;
+    flags |= with_discovery && device->discovery_failed ? WIRE_DEVICE_FAILED : 0;
+
+    bool fits = !with_discovery || send_bases(encoder, device);
+    size_t item = encoder->length;
+
+    if (fits && has_room(encoder, WIRE_ITEM_HEADER_SIZE + 8 + (has_name ? 1 + name_len : 0))) {
+        uint8_t *out = encoder->data + item;
+
+        out[0] = WIRE_ITEM_DEVICE;
+        out[3] = flags;
+        memcpy(out + 4, device->bda, 6);
+        out[10] = (uint8_t) (int8_t) device->rssi;
+        encoder->length += WIRE_ITEM_HEADER_SIZE + 8;
+
+        if (has_name) {
+            out[11] = name_len;
+            memcpy(out + 12, device->name, name_len);
+            encoder->length += 1 + name_len;
+        }
+    } else {
+        fits = false;
+    }
+
+    if (fits && with_discovery) {
+        fits = add_uuids(encoder, device);
+    }
+
+    size_t item_len = encoder->length - item - WIRE_ITEM_HEADER_SIZE;
+
+    if (fits && device->beacon_kind != 0 && !lost) {
+        fits = add_beacon(encoder, device);
+    }
+
+    if (fits && values_len > 0) {
+        fits = add_values(encoder, values, values_len);
+    }
+
+    if (!fits || item_len > UINT16_MAX) {
+        // Forgetting bases sent for this device only
+        for (int i = 0; i < UUID_BASES; i++) {
+            if (encoder->batch_base[i] >= bases_sent) {
+                encoder->batch_base[i] = -1;
+            }
+        }
+        encoder->bases_sent = bases_sent;
+        encoder->length = start;
+        return false;
+    }
+
+    put_u16(encoder->data + item + 1, item_len);
+    encoder->records++;
+
+    return true;
+}
+
+// Buckets from the first to the last non-empty one
+static void bucket_range(const struct MetricHistogram *histogram, int *first, int *count) {
+    int last = METRIC_BUCKETS - 1;
+
+    *first = 0;
+    while (*first < last && histogram->buckets[*first] == 0) {
+        (*first)++;
+    }
+    while (last > *first && histogram->buckets[last] == 0) {
+        last--;
+    }
+    *count = last - *first + 1;
+}
+
+bool wire_encoder_add_metrics(struct WireEncoder *encoder, const struct Metrics *metrics, uint32_t uptime_ms,
+                              uint32_t cycles_per_us) {
+    size_t item_len = WIRE_METRICS_FIXED_SIZE;
+    int first, count;
+
+    for (int stage = 0; stage < METRIC_STAGES; stage++) {
+        if (metrics->stages[stage].count > 0) {
+            bucket_range(&metrics->stages[stage], &first, &count);
+            item_len += WIRE_METRICS_STAGE_SIZE + 4 * count;
+        }
+    }
+
+    if (!has_room(encoder, WIRE_ITEM_HEADER_SIZE + item_len)) {
+        return false;
+    }
+
+    uint8_t *out = encoder->data + encoder->length;
+
+    out[0] = WIRE_ITEM_METRICS;
+    put_u16(out + 1, item_len);
+    out += WIRE_ITEM_HEADER_SIZE;
+
+    put_u32(out, uptime_ms);
+    put_u16(out + 4, cycles_per_us);
+    put_u32(out + 6, metrics->heap_free);
+    put_u32(out + 10, metrics->heap_min_free);
+    put_u32(out + 14, metrics->adv_dropped);
+    out += WIRE_METRICS_FIXED_SIZE;
+
+    for (int stage = 0; stage < METRIC_STAGES; stage++) {
+        const struct MetricHistogram *histogram = &metrics->stages[stage];
+
+        if (histogram->count == 0) {
+            continue;
+        }
+
+        bucket_range(histogram, &first, &count);
+
+        out[0] = stage;
+        out[1] = metrics_stage_unit(stage);
+        put_u32(out + 2, histogram->count);
+        put_u32(out + 6, histogram->max);
+        put_u32(out + 10, (uint32_t) (histogram->total / histogram->count));
+        out[14] = first;
+        out[15] = count;
+        out += WIRE_METRICS_STAGE_SIZE;
+
+        for (int i = 0; i < count; i++) {
+            put_u32(out, histogram->buckets[first + i]);
+            out += 4;
+        }
+    }
+
+    encoder->length += WIRE_ITEM_HEADER_SIZE + item_len;
+
+    return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "wire_format.h"
+#include "device_table.h"
+#include "metrics.h"
+
+// Bounded builder of a binary uplink batch (see wire_format.h) in a caller provided
+// buffer, never allocates. A device that does not fit leaves the batch unchanged.
+struct WireEncoder {
+    uint8_t *data;
+    size_t size;
+    size_t length;
+    int records;
+    int8_t batch_base[UUID_BASES];  // Batch index of every interned base, -1 until sent
+    int bases_sent;
+};
+
+// Start an empty batch (header only)
+void wire_encoder_init(struct WireEncoder *encoder, uint8_t *data, size_t size);
+
+// Append device item, with services and characteristics when with_discovery and a values item
+// when values_len > 0 (entries of u16 UUID, u8 length and value bytes). Returns false when it does not fit.
+bool wire_encoder_add_device(struct WireEncoder *encoder, const struct Device *device, const uint8_t *values,
+                             size_t values_len, bool with_discovery, bool lost);
+
+// Append metrics item, returns false when it does not fit
+bool wire_encoder_add_metrics(struct WireEncoder *encoder, const struct Metrics *metrics, uint32_t uptime_ms,
+                              uint32_t cycles_per_us);
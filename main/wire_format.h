@@ -0,0 +1,67 @@
+#pragma once
+
+// Binary uplink batch format, shared by the scanner encoder (wire_encoder.c) and the
+// reference decoder of the collector side (host/wire_decoder.c).
+//
+// All integers are little endian. A batch starts with a 4 byte header, the magic
+// "SCN" followed by the format version, and continues with TLV items:
+//
+//   type   u8
+//   length u16      length of the value
+//   value
+//
+// Decoders skip item types they do not know, so new items can be added without
+// a version change. The version changes only when an existing item changes.
+//
+// WIRE_ITEM_BASE    u8 batch base index, 16 bytes of a 128-bit UUID base (bytes 12-15 zero).
+//                   Sent before the first device item referencing it, indexes count from 0
+//                   in every batch.
+//
+// WIRE_ITEM_DEVICE  u8 flags (WIRE_DEVICE_*, address type in bits 6-7), bda[6], i8 rssi,
+//                   then when WIRE_DEVICE_NAME is set u8 length and the name bytes,
+//                   then when WIRE_DEVICE_DISCOVERY is set u16 count and count UUID entries:
+//                     u8 tag (WIRE_UUID_CHAR for a characteristic, kind in bits 0-6)
+//                     WIRE_UUID_16   u16 value
+//                     WIRE_UUID_32   u32 value
+//                     WIRE_UUID_128  u8 batch base index, u32 value of bytes 12-15
+//
+// WIRE_ITEM_BEACON  u8 kind, u8 subtype, frame bytes (enum AdvKind and frame layouts of adv_decoder.h).
+//                   Follows the device item it belongs to, never sent with lost devices.
+//
+// WIRE_ITEM_VALUES  Characteristic values read during discovery, for every value u16 UUID, u8 length
+//                   and the value bytes. Follows the device item (and its beacon item), only sent
+//                   with WIRE_DEVICE_DISCOVERY.
+//
+// WIRE_ITEM_METRICS u32 uptime ms, u16 CPU cycles per us, u32 free heap, u32 minimum free heap,
+//                   u32 advertisements dropped, then for every stage with events (metrics.h):
+//                     u8 stage, u8 unit (0 cycles, 1 us), u32 count, u32 max, u32 average,
+//                     u8 first bucket, u8 number of buckets, u32 count of every bucket
+//                   Bucket i counts durations in [2^(i-1), 2^i). Sent alone in a batch
+//                   POSTed to the metrics endpoint.
+
+#define WIRE_CONTENT_TYPE "application/x-ble-scanner-batch"
+
+#define WIRE_MAGIC "SCN"
+#define WIRE_VERSION 1
+#define WIRE_HEADER_SIZE 4
+#define WIRE_ITEM_HEADER_SIZE 3
+
+#define WIRE_ITEM_BASE   0x01
+#define WIRE_ITEM_DEVICE 0x02
+#define WIRE_ITEM_METRICS 0x03
+#define WIRE_ITEM_BEACON 0x04
+#define WIRE_ITEM_VALUES 0x05
+
+#define WIRE_DEVICE_LOST      0x01
+#define WIRE_DEVICE_NAME      0x02
+#define WIRE_DEVICE_DISCOVERY 0x04
+#define WIRE_DEVICE_FAILED    0x08      // Discovery failed, the UUID list may be empty or partial
+#define WIRE_DEVICE_ADDR_TYPE_SHIFT 6
+
+#define WIRE_UUID_CHAR 0x80
+#define WIRE_UUID_16   0
+#define WIRE_UUID_32   1
+#define WIRE_UUID_128  2
+
+#define WIRE_METRICS_FIXED_SIZE 18
+#define WIRE_METRICS_STAGE_SIZE 16      // Without the bucket counts